@@ -7,77 +7,251 @@ See the file COPYING for details.
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
-#include <pthread.h>
 
 #include "allpairs_compare.h"
 
+#include "macros.h"
+#include "xxmalloc.h"
+
 #include "../../sand/src/matrix.h"
 #include "../../sand/src/align.h"
 
-static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
-
 /*
 If you have a custom comparison function, implement it in allpairs_compare_CUSTOM.
 Arguments data1 and data2 point to the objects to be compared.
 Arguments size1 and size2 are the length of each object in bytes.
-When the comparison is complete, output name1, name2, and the result of the comparison.
+When the comparison is complete, print name1, name2, and the result of the comparison to output.
 The result may take any form that you find useful.
-Note that pthread_mutex_lock/unlock is needed around the printf for safety in a multithreaded program.
+Each thread has its own output stream, so no locking is needed around the fprintf.
 */
 
-static void allpairs_compare_CUSTOM( const char *name1, const char *data1, int size1, const char *name2, const char *data2, int size2 )
+static void allpairs_compare_CUSTOM( FILE *output, const char *name1, const char *data1, int size1, const char *name2, const char *data2, int size2 )
 {
 	int result = 5;
 
-	pthread_mutex_lock(&mutex);
-	printf("%s\t%s\t%d\n",name1,name2,result);
-	pthread_mutex_unlock(&mutex);
+	fprintf(output,"%s\t%s\t%d\n",name1,name2,result);
 }
 
 /*
-This is a simple bitwise comparison function that just counts up
-the number of bytes in each object that are different.
+The BITWISE and IRIS functions spend nearly all of their time counting
+the bytes or bits that differ between two objects, so that is done by
+a kernel chosen at runtime for this CPU, in the manner of align.c.
+A kernel provides two operations:
+
+bytes_different counts the bytes that differ in the first length bytes of a and b.
+
+bits_different counts, over words 64-bit words, the bits that are set
+in the masks of both objects and differ in their codes (distance),
+and the bits set in both masks (total).
 */
 
-static void allpairs_compare_BITWISE( const char *name1, const char *data1, int size1, const char *name2, const char *data2, int size2 )
+typedef int  (*bytes_different_t) ( const unsigned char *a, const unsigned char *b, int length );
+typedef void (*bits_different_t) ( const UINT64_T *code1, const UINT64_T *mask1, const UINT64_T *code2, const UINT64_T *mask2, int words, int *distance, int *total );
+
+/*
+The scalar kernel is written plainly, so that the compiler may vectorize
+it as well as it can for any CPU.
+*/
+
+static int bytes_different_scalar( const unsigned char *a, const unsigned char *b, int length )
 {
-	unsigned int i, count = 0;
-	unsigned int minsize;
+	int i, count = 0;
 
-	minsize = size1 - size2 ? size2 : size1;
+	for(i=0;i<length;i++) {
+		if(a[i]!=b[i]) count++;
+	}
+
+	return count;
+}
 
-	count = 0;
-	for(i = 0; i < minsize; i++) {
-		if(data1[i] != data2[i]) {
-			count++;
-		}
+static void bits_different_scalar( const UINT64_T *code1, const UINT64_T *mask1, const UINT64_T *code2, const UINT64_T *mask2, int words, int *distance, int *total )
+{
+	int i, d = 0, t = 0;
+
+	for(i=0;i<words;i++) {
+		UINT64_T m = mask1[i] & mask2[i];
+		d += __builtin_popcountll((code1[i]^code2[i]) & m);
+		t += __builtin_popcountll(m);
 	}
 
-	pthread_mutex_lock(&mutex);
-	printf("%s\t%s\t%d\n",name1,name2,count);
-	pthread_mutex_unlock(&mutex);
+	*distance = d;
+	*total = t;
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define ALLPAIRS_X86
+#include <immintrin.h>
+
+/*
+The popcnt kernel compares sixteen bytes at a time, and counts
+bits with the popcnt instruction rather than in software.
+*/
+
+__attribute__((target("sse2,popcnt")))
+static int bytes_different_popcnt( const unsigned char *a, const unsigned char *b, int length )
+{
+	int i, count = 0;
+
+	for(i=0;i+16<=length;i+=16) {
+		__m128i same = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(a+i)),_mm_loadu_si128((const __m128i *)(b+i)));
+		count += 16 - __builtin_popcount(_mm_movemask_epi8(same));
+	}
+
+	return count + bytes_different_scalar(a+i,b+i,length-i);
+}
+
+__attribute__((target("popcnt")))
+static void bits_different_popcnt( const UINT64_T *code1, const UINT64_T *mask1, const UINT64_T *code2, const UINT64_T *mask2, int words, int *distance, int *total )
+{
+	int i, d = 0, t = 0;
+
+	for(i=0;i<words;i++) {
+		UINT64_T m = mask1[i] & mask2[i];
+		d += __builtin_popcountll((code1[i]^code2[i]) & m);
+		t += __builtin_popcountll(m);
+	}
+
+	*distance = d;
+	*total = t;
+}
+
+/*
+The avx2 kernel compares thirty-two bytes at a time.  It counts the bits of
+each byte by looking up each half of the byte in a table of sixteen counts,
+and sums the counts of the bytes into four 64-bit lanes.
+*/
+
+__attribute__((target("avx2,popcnt")))
+static int bytes_different_avx2( const unsigned char *a, const unsigned char *b, int length )
+{
+	int i, count = 0;
+
+	for(i=0;i+32<=length;i+=32) {
+		__m256i same = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(a+i)),_mm256_loadu_si256((const __m256i *)(b+i)));
+		count += 32 - __builtin_popcount(_mm256_movemask_epi8(same));
+	}
+
+	return count + bytes_different_popcnt(a+i,b+i,length-i);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i popcount_avx2( __m256i x )
+{
+	const __m256i table = _mm256_setr_epi8(0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4,0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4);
+	const __m256i low = _mm256_set1_epi8(0x0f);
+
+	__m256i counts = _mm256_add_epi8(_mm256_shuffle_epi8(table,_mm256_and_si256(x,low)),_mm256_shuffle_epi8(table,_mm256_and_si256(_mm256_srli_epi16(x,4),low)));
+	return _mm256_sad_epu8(counts,_mm256_setzero_si256());
+}
+
+__attribute__((target("avx2,popcnt")))
+static void bits_different_avx2( const UINT64_T *code1, const UINT64_T *mask1, const UINT64_T *code2, const UINT64_T *mask2, int words, int *distance, int *total )
+{
+	__m256i d = _mm256_setzero_si256();
+	__m256i t = _mm256_setzero_si256();
+	UINT64_T lanes[4];
+	int i, tail_distance, tail_total;
+
+	for(i=0;i+4<=words;i+=4) {
+		__m256i m = _mm256_and_si256(_mm256_loadu_si256((const __m256i *)(mask1+i)),_mm256_loadu_si256((const __m256i *)(mask2+i)));
+		__m256i x = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(code1+i)),_mm256_loadu_si256((const __m256i *)(code2+i)));
+		d = _mm256_add_epi64(d,popcount_avx2(_mm256_and_si256(x,m)));
+		t = _mm256_add_epi64(t,popcount_avx2(m));
+	}
+
+	bits_different_popcnt(code1+i,mask1+i,code2+i,mask2+i,words-i,&tail_distance,&tail_total);
+
+	_mm256_storeu_si256((__m256i *)lanes,d);
+	*distance = lanes[0] + lanes[1] + lanes[2] + lanes[3] + tail_distance;
+
+	_mm256_storeu_si256((__m256i *)lanes,t);
+	*total = lanes[0] + lanes[1] + lanes[2] + lanes[3] + tail_total;
+}
+
+#endif
+
+static struct {
+	const char *name;
+	bytes_different_t bytes_different;
+	bits_different_t bits_different;
+} compare_kernels[] = {
+#ifdef ALLPAIRS_X86
+	{ "avx2", bytes_different_avx2, bits_different_avx2 },
+	{ "popcnt", bytes_different_popcnt, bits_different_popcnt },
+#endif
+	{ "scalar", bytes_different_scalar, bits_different_scalar },
+	{ 0, 0, 0 }
+};
+
+static int compare_kernel_index = -1;
+
+static int compare_kernel_supported( int index )
+{
+#ifdef ALLPAIRS_X86
+	__builtin_cpu_init();
+	if(compare_kernels[index].bytes_different==bytes_different_avx2) return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt");
+	if(compare_kernels[index].bytes_different==bytes_different_popcnt) return __builtin_cpu_supports("sse2") && __builtin_cpu_supports("popcnt");
+#endif
+	return 1;
+}
+
+int allpairs_compare_set_kernel( const char *name )
+{
+	int index;
+
+	for(index=0;compare_kernels[index].name;index++) {
+		if(name && strcmp(name,compare_kernels[index].name)) continue;
+		if(!compare_kernel_supported(index)) continue;
+		compare_kernel_index = index;
+		return 1;
+	}
+
+	return 0;
+}
+
+const char * allpairs_compare_kernel_name()
+{
+	if(compare_kernel_index<0) allpairs_compare_set_kernel(0);
+	return compare_kernels[compare_kernel_index].name;
+}
+
+/*
+This is a simple bitwise comparison function that just counts up
+the number of bytes in each object that are different.
+*/
+
+static void allpairs_compare_BITWISE( FILE *output, const char *name1, const char *data1, int size1, const char *name2, const char *data2, int size2 )
+{
+	int count = compare_kernels[compare_kernel_index].bytes_different((const unsigned char *)data1,(const unsigned char *)data2,MIN(size1,size2));
+
+	fprintf(output,"%s\t%s\t%d\n",name1,name2,count);
 }
 
 /*
 This function aligns two DNA sequences using the Smith-Waterman algorithm,
 and if the quality is sufficiently good, displays the alignment.
+Objects are not terminated, so each sequence is copied into a string
+of its own, without the final newline.
 */
 
-static void allpairs_compare_SWALIGN( const char *name1, const char *data1, int size1, const char *name2, const char *data2, int size2 )
+static char * swalign_string( const char *data, int size )
 {
-	char *stra = strdup(data1);
-	char *strb = strdup(data2);
+	char *str = xxmalloc(size+1);
+	memcpy(str,data,size);
+	str[size>0 ? size-1 : 0] = 0;
+	return str;
+}
 
-	stra[size1-1] = 0;
-	strb[size2-1] = 0;
+static void allpairs_compare_SWALIGN( FILE *output, const char *name1, const char *data1, int size1, const char *name2, const char *data2, int size2 )
+{
+	char *stra = swalign_string(data1,size1);
+	char *strb = swalign_string(data2,size2);
 
 	struct matrix *m = matrix_create(size1-1,size2-1);
 	struct alignment *aln = align_smith_waterman(m,stra,strb);
 
-	pthread_mutex_lock(&mutex);
-	printf("> %s %s\n",name1,name2);
-	alignment_print(stdout,stra,strb,aln);
-	pthread_mutex_unlock(&mutex);
+	fprintf(output,"> %s %s\n",name1,name2);
+	alignment_print(output,stra,strb,aln);
 
 	free(stra);
 	free(strb);
@@ -87,121 +261,76 @@ static void allpairs_compare_SWALIGN( const char *name1, const char *data1, int
 
 /*
 This function compares two iris templates in the binary format used by the Computer Vision Research Lab at the University of Notre Dame.
+A template is a line of text giving the number of bits in the code, and then
+the code and its mask, each packed eight bits to a byte.  allpairs_prepare_IRIS
+copies the code and mask of each template, once, into whole 64-bit words
+padded with zeros, so that each comparison is just a count of bits.
 */
 
-static void allpairs_compare_IRIS( const char *name1, const char *data1, int size1, const char *name2, const char *data2, int size2 )
-{
-	int i, j, count = 0;
-	int size, band, inner, outer, quality;
-	const int power2[8] = { 1, 2, 4, 8, 16, 32, 64, 128 };
-
-	// Start processing data in mmap1       
-	sscanf(data1, "%d %d %d %d %d", &size, &band, &inner, &outer, &quality);
-	data1 = strchr(data1, '\n');
+struct iris_template {
+	int words;
+	int padding;
+	UINT64_T bits[1];	/* words of code, then words of mask */
+};
 
-	// Let data1 points to the start of code data
-	data1++;
+static char * allpairs_prepare_IRIS( const char *name, const char *data, int size, int *prepared_size )
+{
+	const char *start = data;
+	char line[256];
+	int bits, band, inner, outer, quality;
+
+	// The object is not terminated, so the header is copied out before it is scanned.
+	data = memchr(data,'\n',MIN(size,(int)sizeof(line)));
+	if(data) {
+		memcpy(line,start,data-start);
+		line[data-start] = 0;
+	}
 
-	if(size1 - (data1 - (char *) data1) != size / 8 * 2) {
-		fprintf(stderr, "allpairs_multicore: Image 1 data size error!\n");
+	if(!data || sscanf(line, "%d %d %d %d %d", &bits, &band, &inner, &outer, &quality)!=5) {
+		fprintf(stderr, "allpairs_multicore: %s is not an iris template!\n", name);
 		exit(1);
 	}
 
-	int code1[size];
-	int mask1[size];
-
-	count = 0;
-	for(i = 0; i < size / 8; i++) {
-		for(j = 0; j < 8; j++) {
-			if(data1[i] & power2[j]) {
-				code1[count] = 1;
-				count++;
-			} else {
-				code1[count] = 0;
-				count++;
-			}
-		}
-	}
+	// Let data point to the start of code data
+	data++;
 
-	// Let data1 now points to the start of mask data
-	data1 += i;
-
-	count = 0;
-	for(i = 0; i < size / 8; i++) {
-		for(j = 0; j < 8; j++) {
-			if(data1[i] & power2[j]) {
-				mask1[count] = 1;
-				count++;
-			} else {
-				mask1[count] = 0;
-				count++;
-			}
-		}
+	int bytes = bits / 8;
+	if(size - (data - start) != bytes * 2) {
+		fprintf(stderr, "allpairs_multicore: %s: image data size error!\n", name);
+		exit(1);
 	}
 
-	sscanf(data2, "%d %d %d %d %d", &size, &band, &inner, &outer, &quality);
-	data2 = strchr(data2, '\n');
-
-	// Let data2 points to the start of code data
-	data2++;
+	int words = (bytes + 7) / 8;
 
-	if(size2 - (data2 - (char *) data2) != size / 8 * 2) {
-		fprintf(stderr, "allpairs_multicore: Image 2 data size error!\n");
+	*prepared_size = sizeof(struct iris_template) + (2*words-1)*sizeof(UINT64_T);
+	struct iris_template *t = calloc(1,*prepared_size);
+	if(!t) {
+		fprintf(stderr, "allpairs_multicore: out of memory!\n");
 		exit(1);
 	}
 
-	int code2[size];
-	int mask2[size];
-
-	count = 0;
-	for(i = 0; i < size / 8; i++) {
-		for(j = 0; j < 8; j++) {
-			if(data2[i] & power2[j]) {
-				code2[count] = 1;
-				count++;
-			} else {
-				code2[count] = 0;
-				count++;
-			}
-		}
-	}
+	t->words = words;
+	memcpy(t->bits,data,bytes);
+	memcpy(t->bits+words,data+bytes,bytes);
 
-	// Let data1 now points to the start of mask data
-	data2 += i;
-
-	count = 0;
-	for(i = 0; i < size / 8; i++) {
-		for(j = 0; j < 8; j++) {
-			if(data2[i] & power2[j]) {
-				mask2[count] = 1;
-				count++;
-			} else {
-				mask2[count] = 0;
-				count++;
-			}
-		}
-	}
+	return (char *) t;
+}
 
-	int codes[size];
-	int masks[size];
-	int results[size];
-	int distance = 0;
-	int total = 0;
-	for(i = 0; i < size; i++) {
-		codes[i] = code1[i] ^ code2[i];
-		masks[i] = mask1[i] & mask2[i];
-		results[i] = codes[i] & masks[i];
-		distance = distance + results[i];
-		total = total + masks[i];
-	}
+static void allpairs_compare_IRIS( FILE *output, const char *name1, const char *data1, int size1, const char *name2, const char *data2, int size2 )
+{
+	const struct iris_template *t1 = (const struct iris_template *) data1;
+	const struct iris_template *t2 = (const struct iris_template *) data2;
+	int distance, total;
+
+	compare_kernels[compare_kernel_index].bits_different(t1->bits,t1->bits+t1->words,t2->bits,t2->bits+t2->words,MIN(t1->words,t2->words),&distance,&total);
 
-	pthread_mutex_lock(&mutex);
-	printf("%s\t%s\t%lf\n",name1,name2,distance/(double)total);
-	pthread_mutex_unlock(&mutex);
+	fprintf(output,"%s\t%s\t%lf\n",name1,name2,distance/(double)total);
 }
 
 allpairs_compare_t allpairs_compare_function_get( const char *name )
 {
+	if(compare_kernel_index<0) allpairs_compare_set_kernel(0);
+
 	if(!strcmp(name,"CUSTOM")) {
 		return allpairs_compare_CUSTOM;
 	} else if(!strcmp(name,"BITWISE")) {
@@ -215,3 +344,12 @@ allpairs_compare_t allpairs_compare_function_get( const char *name )
 	}
 }
 
+
+allpairs_prepare_t allpairs_prepare_function_get( const char *name )
+{
+	if(!strcmp(name,"IRIS")) {
+		return allpairs_prepare_IRIS;
+	} else {
+		return 0;
+	}
+}
@@ -7,8 +7,35 @@ See the file COPYING for details.
 #ifndef ALLPAIRS_COMPARE_H
 #define ALLPAIRS_COMPARE_H
 
-typedef void (*allpairs_compare_t) ( const char *name1, const char *data1, int size1, const char *name2, const char *data2, int size2 );
+#include <stdio.h>
+
+#include "int_sizes.h"
+
+typedef void (*allpairs_compare_t) ( FILE *output, const char *name1, const char *data1, int size1, const char *name2, const char *data2, int size2 );
+
+/*
+Some comparison functions expect each object to be converted first, once,
+into a form that is quicker to compare.  If allpairs_prepare_function_get
+returns a function for name, it must be applied to every object, and
+the comparison function given the converted objects instead.
+The converted object is allocated with malloc, and its length in bytes
+is stored in prepared_size.
+*/
+
+typedef char * (*allpairs_prepare_t) ( const char *name, const char *data, int size, int *prepared_size );
 
 allpairs_compare_t allpairs_compare_function_get( const char *name );
+allpairs_prepare_t allpairs_prepare_function_get( const char *name );
+
+/*
+The built-in comparison functions count differences with a kernel chosen
+at runtime for this CPU.  allpairs_compare_set_kernel selects a kernel
+by name, or the fastest one if name is null, and returns zero if that
+kernel is not available on this CPU.  allpairs_compare_function_get
+selects the fastest kernel if none has been selected yet.
+*/
+
+int          allpairs_compare_set_kernel( const char *name );
+const char * allpairs_compare_kernel_name();
 
 #endif
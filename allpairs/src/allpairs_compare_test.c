@@ -0,0 +1,328 @@
+/*
+Copyright (C) 2013- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+/*
+Checks that the BITWISE and IRIS functions give the same results with
+every kernel available on this CPU as the straightforward comparisons
+that they replace, on random objects and templates of many sizes, and
+optionally measures the speed of each in comparisons per second.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "allpairs_compare.h"
+
+#include "macros.h"
+#include "timestamp.h"
+
+static const char *kernels[] = { "avx2", "popcnt", "scalar", 0 };
+
+static int objects = 200;
+static int benchmark = 0;
+
+struct test_object {
+	char name[32];
+	char *data;
+	int length;
+	char *prepared;
+	int prepared_length;
+};
+
+/*
+The reference BITWISE counts the differing bytes one at a time.
+*/
+
+static void reference_BITWISE( FILE *output, const char *name1, const char *data1, int size1, const char *name2, const char *data2, int size2 )
+{
+	int i, count = 0;
+
+	for(i=0;i<MIN(size1,size2);i++) {
+		if(data1[i]!=data2[i]) count++;
+	}
+
+	fprintf(output,"%s\t%s\t%d\n",name1,name2,count);
+}
+
+/*
+The reference IRIS parses both templates and unpacks them into one
+integer per bit for every comparison, as IRIS once did.
+*/
+
+static void reference_unpack( const char *data, int *bits, int **code, int **mask )
+{
+	int i, j, band, inner, outer, quality;
+
+	sscanf(data,"%d %d %d %d %d",bits,&band,&inner,&outer,&quality);
+	data = strchr(data,'\n') + 1;
+
+	*code = malloc(sizeof(int) * *bits);
+	*mask = malloc(sizeof(int) * *bits);
+
+	for(i=0;i<*bits/8;i++) {
+		for(j=0;j<8;j++) {
+			(*code)[i*8+j] = (data[i] >> j) & 1;
+			(*mask)[i*8+j] = (data[*bits/8+i] >> j) & 1;
+		}
+	}
+}
+
+static void reference_IRIS( FILE *output, const char *name1, const char *data1, int size1, const char *name2, const char *data2, int size2 )
+{
+	int bits1, bits2, *code1, *mask1, *code2, *mask2;
+	int i, distance = 0, total = 0;
+
+	reference_unpack(data1,&bits1,&code1,&mask1);
+	reference_unpack(data2,&bits2,&code2,&mask2);
+
+	for(i=0;i<MIN(bits1,bits2)/8*8;i++) {
+		int m = mask1[i] & mask2[i];
+		distance += (code1[i] ^ code2[i]) & m;
+		total += m;
+	}
+
+	fprintf(output,"%s\t%s\t%lf\n",name1,name2,distance/(double)total);
+
+	free(code1);
+	free(mask1);
+	free(code2);
+	free(mask2);
+}
+
+/*
+Make random objects of many lengths for BITWISE, each a copy of one
+of a few originals with some bytes changed, so that the counts vary.
+*/
+
+static void make_bitwise( struct test_object *o, int count, int max_length )
+{
+	char *original[4];
+	int i, j;
+
+	for(i=0;i<4;i++) {
+		original[i] = malloc(max_length);
+		for(j=0;j<max_length;j++) original[i][j] = lrand48();
+	}
+
+	for(i=0;i<count;i++) {
+		sprintf(o[i].name,"bitwise%d",i);
+		o[i].length = lrand48()%10 ? max_length - lrand48()%64 : lrand48()%max_length;
+		o[i].data = malloc(o[i].length+1);
+		memcpy(o[i].data,original[i%4],o[i].length);
+		for(j=0;j<o[i].length/10;j++) o[i].data[lrand48()%o[i].length] = lrand48();
+		o[i].prepared = 0;
+	}
+
+	for(i=0;i<4;i++) free(original[i]);
+}
+
+/*
+Make random iris templates with the given number of bits,
+or a random number of bits, if that is zero.
+*/
+
+static void make_iris( struct test_object *o, int count, int bits )
+{
+	allpairs_prepare_t prepare = allpairs_prepare_function_get("IRIS");
+	int i, j;
+
+	for(i=0;i<count;i++) {
+		int b = bits ? bits : 8 + lrand48()%4000;
+		char header[64];
+		int header_length = sprintf(header,"%d 20 100 200 90\n",b);
+
+		sprintf(o[i].name,"iris%d",i);
+		o[i].length = header_length + b/8*2;
+		o[i].data = malloc(o[i].length+1);
+		memcpy(o[i].data,header,header_length);
+		for(j=0;j<b/8;j++) {
+			o[i].data[header_length+j] = lrand48();
+			o[i].data[header_length+b/8+j] = lrand48()%4 ? 0xff : lrand48();
+		}
+		o[i].data[o[i].length] = 0;
+
+		o[i].prepared = prepare(o[i].name,o[i].data,o[i].length,&o[i].prepared_length);
+	}
+}
+
+static void free_objects( struct test_object *o, int count )
+{
+	int i;
+	for(i=0;i<count;i++) {
+		free(o[i].data);
+		free(o[i].prepared);
+	}
+}
+
+/*
+Compare every pair of objects with the function and with the reference,
+and count the pairs for which they do not print the same line.
+*/
+
+static int check( const char *function, allpairs_compare_t reference, struct test_object *o, int count )
+{
+	allpairs_compare_t func = allpairs_compare_function_get(function);
+	char *expected, *actual;
+	size_t expected_length, actual_length;
+	int i, j, k;
+	int failures = 0;
+
+	FILE *expected_file = open_memstream(&expected,&expected_length);
+	FILE *actual_file = open_memstream(&actual,&actual_length);
+
+	for(k=0;kernels[k];k++) {
+		if(!allpairs_compare_set_kernel(kernels[k])) {
+			printf("%s: not available on this cpu\n",kernels[k]);
+			continue;
+		}
+
+		for(i=0;i<count;i++) {
+			for(j=0;j<count;j++) {
+				rewind(expected_file);
+				rewind(actual_file);
+
+				reference(expected_file,o[i].name,o[i].data,o[i].length,o[j].name,o[j].data,o[j].length);
+				if(o[i].prepared) {
+					func(actual_file,o[i].name,o[i].prepared,o[i].prepared_length,o[j].name,o[j].prepared,o[j].prepared_length);
+				} else {
+					func(actual_file,o[i].name,o[i].data,o[i].length,o[j].name,o[j].data,o[j].length);
+				}
+
+				fflush(expected_file);
+				fflush(actual_file);
+
+				if(expected_length!=actual_length || memcmp(expected,actual,actual_length)) {
+					printf("%s: %s of %s and %s differs:\n",kernels[k],function,o[i].name,o[j].name);
+					printf("expected %.*s",(int)expected_length,expected);
+					printf("actual   %.*s",(int)actual_length,actual);
+					failures++;
+				}
+			}
+		}
+
+		printf("%s: %d pairs checked with %s\n",kernels[k],count*count,function);
+	}
+
+	fclose(expected_file);
+	fclose(actual_file);
+	free(expected);
+	free(actual);
+
+	return failures;
+}
+
+static double measure_one( allpairs_compare_t func, FILE *output, struct test_object *o, int count, int prepared )
+{
+	int i, j;
+	timestamp_t start = timestamp_get();
+
+	for(i=0;i<count;i++) {
+		for(j=0;j<count;j++) {
+			if(prepared) {
+				func(output,o[i].name,o[i].prepared,o[i].prepared_length,o[j].name,o[j].prepared,o[j].prepared_length);
+			} else {
+				func(output,o[i].name,o[i].data,o[i].length,o[j].name,o[j].data,o[j].length);
+			}
+		}
+	}
+
+	double elapsed = (timestamp_get() - start) / 1000000.0;
+	return count * (double) count / elapsed;
+}
+
+/*
+Measure the comparisons per second of the reference and of each kernel,
+including the printing of each result, as allpairs_multicore does.
+*/
+
+static void measure( const char *function, allpairs_compare_t reference, struct test_object *o, int count, const char *description )
+{
+	allpairs_compare_t func = allpairs_compare_function_get(function);
+	int k;
+
+	FILE *output = fopen("/dev/null","w");
+
+	printf("%-8s %-8s %-24s %12.0lf comparisons/s\n","before",function,description,measure_one(reference,output,o,count,0));
+
+	for(k=0;kernels[k];k++) {
+		if(!allpairs_compare_set_kernel(kernels[k])) continue;
+		printf("%-8s %-8s %-24s %12.0lf comparisons/s\n",kernels[k],function,description,measure_one(func,output,o,count,o[0].prepared!=0));
+	}
+
+	fclose(output);
+}
+
+static void show_help(const char *cmd)
+{
+	printf("Usage: %s [options]\n", cmd);
+	printf(" -n <integer>   Number of random objects of each kind to check. (default: %d)\n",objects);
+	printf(" -s <integer>   Seed for the random objects.\n");
+	printf(" -b             Measure the speed of each kernel instead.\n");
+	printf(" -h             Display this message.\n");
+}
+
+int main(int argc, char **argv)
+{
+	int seed = 1;
+	char c;
+
+	while((c = getopt(argc, argv, "n:s:bh")) != (char) -1) {
+		switch (c) {
+		case 'n':
+			objects = atoi(optarg);
+			break;
+		case 's':
+			seed = atoi(optarg);
+			break;
+		case 'b':
+			benchmark = 1;
+			break;
+		default:
+		case 'h':
+			show_help(argv[0]);
+			exit(0);
+		}
+	}
+
+	srand48(seed);
+
+	struct test_object *o = malloc(sizeof(*o)*MAX(objects,1000));
+
+	if(benchmark) {
+		printf("fastest kernel on this cpu: %s\n",allpairs_compare_kernel_name());
+
+		make_bitwise(o,1000,4096);
+		measure("BITWISE",reference_BITWISE,o,1000,"1000 objects of 4 KB");
+		free_objects(o,1000);
+
+		make_iris(o,300,9600);
+		measure("IRIS",reference_IRIS,o,300,"300 of 9600 bits");
+		free_objects(o,300);
+
+		return 0;
+	}
+
+	int failures = 0;
+
+	make_bitwise(o,objects,5000);
+	failures += check("BITWISE",reference_BITWISE,o,objects);
+	free_objects(o,objects);
+
+	make_iris(o,objects,0);
+	failures += check("IRIS",reference_IRIS,o,objects);
+	free_objects(o,objects);
+
+	free(o);
+
+	if(failures) {
+		printf("%d comparisons differ\n",failures);
+		return 1;
+	}
+
+	return 0;
+}
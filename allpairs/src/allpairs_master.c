@@ -16,6 +16,7 @@ See the file COPYING for details.
 #include "envtools.h"
 #include "text_list.h"
 #include "hash_table.h"
+#include "itable.h"
 #include "stringtools.h"
 #include "xxmalloc.h"
 #include "macros.h"
@@ -39,8 +40,9 @@ static const char * extra_arguments = "";
 static int use_external_program = 0;
 static struct list *extra_files_list = 0;
 
-static int xcurrent = 0;
-static int ycurrent = 0;
+static int ap_scheduler = WORK_QUEUE_SCHEDULE_FILES;
+static FILE *placement_file = 0;
+
 static int xblock = 0;
 static int yblock = 0;
 static int xstop = 0;
@@ -57,6 +59,8 @@ static void show_help(const char *cmd)
 	printf(" -t <seconds>   Estimated time to run one comparison.  (default chosen at runtime)\n");
 	printf(" -x <items>	Width of one work unit, in items to compare.  (default chosen at runtime)\n");
 	printf(" -y <items>	Height of one work unit, in items to compare.  (default chosen at runtime)\n");
+	printf(" -W <mode>      Scheduling algorithm for tasks not tied to a worker: files, time, or fcfs.  (default files)\n");
+	printf(" -l <file>      Record the block, preferred worker, and actual worker of each task in this file.\n");
 	printf(" -a             Advertise the master information to a catalog server.\n");
 	printf(" -N <project>   Set the project name to <project>\n");
 	printf(" -P <integer>   Priority. Higher the value, higher the priority.\n");
@@ -177,28 +181,179 @@ char * text_list_string( struct text_list *t, int a, int b )
 }
 
 /*
-Create the next task in order to be submitted to the work queue.
-Basically, bump the current position in the results matrix by
-xblock, yblock, and then construct a task with a list of files
-on each axis, and attach the necessary files.
+The results matrix is divided into blocks of xblock by yblock items,
+and the blocks into rectangular regions.  Each worker works through one
+region at a time, row by row, so that it keeps the block of set A for
+a row while the blocks of set B stream past, and after the first row
+of the region, already holds those as well.  A new worker, or one that
+has finished its region, takes the region with the most blocks left,
+and if another worker is working on that region, splits it in two along
+its longer side, so that regions stay roughly square.  With W workers,
+each works on about 1/W of the blocks, and so needs only about 1/sqrt(W)
+of each set, rather than nearly all of both.
+
+A task is only submitted when a worker has a slot free for it, and it
+prefers the worker of its region, which holds the most of its files.
+The first task of a new worker is not yet tied to any, and goes to
+whichever worker holds the most of its files.
 */
 
-struct work_queue_task * ap_task_create( struct text_list *seta, struct text_list *setb )
+struct ap_region {
+	int x0, x1;		/* columns of blocks, x1 exclusive */
+	int y0, y1;		/* rows of blocks, y1 exclusive */
+	int x, y;		/* the next block to be done */
+	struct ap_worker *owner;
+};
+
+struct ap_worker {
+	char *host;
+	struct ap_region *region;
+};
+
+static struct list *regions = 0;
+static struct hash_table *workers = 0;
+static struct itable *task_workers = 0;
+
+static int region_blocks_left( struct ap_region *r )
 {
-	int x,y;
-	char *buf, *name;
+	if(r->y>=r->y1) return 0;
+	return (r->y1-r->y)*(r->x1-r->x0) - (r->x-r->x0);
+}
 
-	if(xcurrent>=xstop) {
-		xcurrent=0;
-		ycurrent+=yblock;
+static void region_next_block( struct ap_region *r, int *x, int *y )
+{
+	*x = r->x;
+	*y = r->y;
+
+	r->x++;
+	if(r->x>=r->x1) {
+		r->x = r->x0;
+		r->y++;
 	}
+}
+
+static struct ap_region * region_create( int x0, int x1, int y0, int y1, int x, int y )
+{
+	struct ap_region *r = xxmalloc(sizeof(*r));
+	r->x0 = x0;
+	r->x1 = x1;
+	r->y0 = y0;
+	r->y1 = y1;
+	r->x = x;
+	r->y = y;
+	r->owner = 0;
+	list_push_tail(regions,r);
+	return r;
+}
 
-	if(ycurrent>=ystop) return 0;
+/*
+Split the blocks left in a region in two, and return the new region,
+which holds either its last rows, or the right side of every row left.
+Returns null if there is not enough left to split.
+*/
+
+static struct ap_region * region_split( struct ap_region *r )
+{
+	int rows = r->y1 - r->y;
+	int width = r->x1 - r->x0;
+
+	if(rows>=2 && rows>=width) {
+		int y = r->y + (rows+1)/2;
+		struct ap_region *n = region_create(r->x0,r->x1,y,r->y1,r->x0,y);
+		r->y1 = y;
+		return n;
+	}
+
+	if(width>=2) {
+		int x = r->x0 + width/2;
+		int start_x = MAX(r->x,x);
+		int start_y = r->y;
+
+		/* the right side of the current row may already be done */
+		if(start_x>=r->x1) {
+			start_x = x;
+			start_y++;
+		}
+
+		if(start_y>=r->y1) return 0;
+
+		struct ap_region *n = region_create(x,r->x1,r->y,r->y1,start_x,start_y);
+
+		r->x1 = x;
+		if(r->x>=r->x1) {
+			r->x = r->x0;
+			r->y++;
+		}
+
+		return n;
+	}
+
+	return 0;
+}
+
+/*
+Choose the next block for a worker: the next in its own region, or else
+in the region with the most blocks left, which it takes over if no other
+worker has it, or else splits.  Returns zero if every block has been given out.
+*/
+
+static int ap_next_block( struct ap_worker *w, int *x, int *y )
+{
+	struct ap_region *r, *best = 0;
+
+	if(w->region && region_blocks_left(w->region)) {
+		region_next_block(w->region,x,y);
+		return 1;
+	}
+
+	if(w->region) {
+		list_remove(regions,w->region);
+		free(w->region);
+		w->region = 0;
+	}
+
+	list_first_item(regions);
+	while((r = list_next_item(regions))) {
+		if(!best || region_blocks_left(r) > region_blocks_left(best)) best = r;
+	}
+
+	if(!best || !region_blocks_left(best)) return 0;
+
+	if(!best->owner) {
+		w->region = best;
+		best->owner = w;
+	} else {
+		r = region_split(best);
+		if(r) {
+			w->region = r;
+			r->owner = w;
+		} else {
+			/* too little left to split, so just share it */
+			region_next_block(best,x,y);
+			return 1;
+		}
+	}
+
+	region_next_block(w->region,x,y);
+	return 1;
+}
+
+/*
+Create the task that computes one block of the results matrix,
+with a list of files on each axis, and attach the necessary files.
+*/
+
+struct work_queue_task * ap_task_create( struct text_list *seta, struct text_list *setb, int xcurrent, int ycurrent )
+{
+	int x,y;
+	char *buf, *name;
 
 	char cmd[ALLPAIRS_LINE_MAX];
 	sprintf(cmd,"./%s -e \"%s\" A B %s%s",string_basename(allpairs_multicore_program),extra_arguments,use_external_program ? "./" : "",string_basename(allpairs_compare_program));
 	struct work_queue_task *task = work_queue_task_create(cmd);
 
+	work_queue_task_specify_algorithm(task,ap_scheduler);
+
 	if(use_external_program) {
 		work_queue_task_specify_file(task,allpairs_compare_program,string_basename(allpairs_compare_program),WORK_QUEUE_INPUT,WORK_QUEUE_CACHE);
 	}
@@ -231,12 +386,68 @@ struct work_queue_task * ap_task_create( struct text_list *seta, struct text_lis
 		work_queue_task_specify_file(task,name,string_basename(name),WORK_QUEUE_INPUT,WORK_QUEUE_CACHE);
 	}
 
-	/* advance to the next row/column */
-	xcurrent += xblock;
-
 	return task;
 }
 
+/*
+Submit the next task for a worker, or for a worker not yet known if w is null.
+A task for an unknown worker is recorded with a worker of its own, with no host,
+which is merged with the actual worker when the task completes.
+Returns zero if there was nothing left to submit.
+*/
+
+static int ap_task_submit( struct work_queue *q, struct text_list *seta, struct text_list *setb, struct ap_worker *w )
+{
+	int x, y;
+
+	if(!w) {
+		w = xxmalloc(sizeof(*w));
+		w->host = 0;
+		w->region = 0;
+	}
+
+	if(!ap_next_block(w,&x,&y)) {
+		if(!w->host) free(w);
+		return 0;
+	}
+
+	char tag[32];
+	sprintf(tag,"%d %d",x,y);
+
+	struct work_queue_task *task = ap_task_create(seta,setb,x*xblock,y*yblock);
+	work_queue_task_specify_tag(task,tag);
+	if(w->host) work_queue_task_specify_preferred_host(task,w->host);
+	int taskid = work_queue_submit(q,task);
+	itable_insert(task_workers,taskid,w);
+
+	debug(D_DEBUG,"task %d is block %d,%d for worker %s",taskid,x,y,w->host ? w->host : "(any)");
+
+	return 1;
+}
+
+/*
+Find the worker that ran a completed task.  If the task was submitted for
+any worker, and it ran on a worker that already has a region, the region
+planned for the task is left for another worker to take over.
+*/
+
+static struct ap_worker * ap_task_worker( struct work_queue_task *t )
+{
+	struct ap_worker *w = itable_remove(task_workers,t->taskid);
+	if(!w || w->host) return w;
+
+	struct ap_worker *existing = t->host ? hash_table_lookup(workers,t->host) : 0;
+	if(existing || !t->host) {
+		if(w->region) w->region->owner = 0;
+		free(w);
+		return existing;
+	}
+
+	w->host = xxstrdup(t->host);
+	hash_table_insert(workers,w->host,w);
+	return w;
+}
+
 void task_complete( struct work_queue_task *t )
 {
 	FILE *output = stdout;
@@ -273,7 +484,7 @@ int main(int argc, char **argv)
 
 	extra_files_list = list_create();
 
-	while((c = getopt(argc, argv, "ad:e:f:hN:p:P:t:vx:y:Z:o:")) != (char) -1) {
+	while((c = getopt(argc, argv, "ad:e:f:hl:N:p:P:t:vW:x:y:Z:o:")) != (char) -1) {
 		switch (c) {
 	    case 'a':
 			work_queue_master_mode = WORK_QUEUE_MASTER_MODE_CATALOG;
@@ -295,6 +506,13 @@ int main(int argc, char **argv)
 			show_help(progname);
 			exit(0);
 			break;
+		case 'l':
+			placement_file = fopen(optarg,"w");
+			if(!placement_file) {
+				fprintf(stderr,"%s: couldn't open %s: %s\n",progname,optarg,strerror(errno));
+				return 1;
+			}
+			break;
 		case 'N':
 			free(project);
 			project = xxstrdup(optarg);
@@ -312,6 +530,18 @@ int main(int argc, char **argv)
 			cctools_version_print(stdout, progname);
 			exit(0);
 			break;
+		case 'W':
+			if(!strcmp(optarg, "files")) {
+				ap_scheduler = WORK_QUEUE_SCHEDULE_FILES;
+			} else if(!strcmp(optarg, "time")) {
+				ap_scheduler = WORK_QUEUE_SCHEDULE_TIME;
+			} else if(!strcmp(optarg, "fcfs")) {
+				ap_scheduler = WORK_QUEUE_SCHEDULE_FCFS;
+			} else {
+				fprintf(stderr, "%s: unknown scheduling mode %s\n", progname, optarg);
+				return 1;
+			}
+			break;
 		case 'x':
 			xblock = atoi(optarg);
 			break;
@@ -407,24 +637,64 @@ int main(int argc, char **argv)
 
 	fprintf(stdout, "%s: listening for workers on port %d...\n",progname,work_queue_port(q));
 
+	int xblocks = (xstop+xblock-1)/xblock;
+	int yblocks = (ystop+yblock-1)/yblock;
+
+	regions = list_create();
+	workers = hash_table_create(0,0);
+	task_workers = itable_create(0);
+
+	region_create(0,xblocks,0,yblocks,0,0);
+
 	while(1) {
-		struct work_queue_task *task = NULL;
-		while(work_queue_hungry(q)) {
-			task = ap_task_create(seta,setb);
-			if(task) {
-				work_queue_submit(q, task);
-			} else {
-				break;
+		struct work_queue_stats s;
+		int submitted = 0;
+
+		/*
+		Give a task to each slot not yet busy, or one to wait for the first worker.
+		The slots of tasks complete but not yet returned get theirs just below.
+		*/
+		work_queue_get_stats(q,&s);
+		int idle = MAX(s.total_worker_slots,1) - s.tasks_running - s.tasks_waiting - s.tasks_complete;
+		while(idle-- > 0 && ap_task_submit(q,seta,setb,0)) {
+			submitted++;
+		}
+
+		if(!submitted && work_queue_empty(q)) break;
+
+		struct work_queue_task *task = work_queue_wait(q,5);
+		if(task) {
+			if(placement_file) {
+				fprintf(placement_file,"%s %s %s\n",task->tag,task->preferred_host ? task->preferred_host : "-",task->host ? task->host : "-");
+				fflush(placement_file);
 			}
+			struct ap_worker *w = ap_task_worker(task);
+			task_complete(task);
+			if(w) ap_task_submit(q,seta,setb,w);
 		}
+	}
 
-		if(!task && work_queue_empty(q)) break;
+	struct work_queue_stats s;
+	work_queue_get_stats(q,&s);
+	fprintf(stdout, "%s: sent %lld bytes to %d workers\n",progname,(long long)s.total_bytes_sent,hash_table_size(workers));
 
-		task = work_queue_wait(q,5);
-		if(task) task_complete(task);
+	char *key;
+	struct ap_worker *w;
+	hash_table_firstkey(workers);
+	while(hash_table_nextkey(workers,&key,(void**)&w)) {
+		free(w->host);
+		free(w);
 	}
+	hash_table_delete(workers);
+
+	struct ap_region *r;
+	while((r = list_pop_head(regions))) free(r);
+	list_delete(regions);
+	itable_delete(task_workers);
 
 	work_queue_delete(q);
 
+	if(placement_file) fclose(placement_file);
+
 	return 0;
 }
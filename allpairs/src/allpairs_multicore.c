@@ -12,6 +12,8 @@ See the file COPYING for details.
 #include <time.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h>
 #include <pthread.h>
 
 #include "allpairs_compare.h"
@@ -31,6 +33,7 @@ static const char *progname = "allpairs_multicore";
 static const char *extra_arguments = "";
 static int block_size = 0;
 static int num_cores = 0;
+static int tile_size = 0;
 
 static void show_help(const char *cmd)
 {
@@ -38,6 +41,7 @@ static void show_help(const char *cmd)
 	printf("where options are:\n");
 	printf(" -b <items>     Block size: number of items to hold in memory at once. (default: 50%% of RAM\n");
 	printf(" -c <cores>     Number of cores to be used. (default: # of cores in machine)\n");
+	printf(" -t <items>     Tile size: number of items along each side of a tile. (default: fit to cache)\n");
 	printf(" -e <args>      Extra arguments to pass to the comparison program.\n");
 	printf(" -d <flag>	Enable debugging for this subsystem.\n");
 	printf(" -v         	Show program version.\n");
@@ -87,130 +91,316 @@ int block_size_estimate( struct text_list *seta )
 }
 
 /*
-Load the named file into memory, returning the actual data of
-the file, and filling length with the length of the buffer in bytes.
-The result should be free()d when done.
+An object is the contents of one file, mapped into memory
+rather than read, so that the same file may be used in many blocks
+without being copied each time.  A file smaller than a page would
+waste most of the page, and so is simply read into a buffer.
+If the comparison function has a prepare function, the object is
+converted by it as it is loaded, and only the result is kept.
 */
 
-char * load_one_file( const char *filename, int *length )
+struct object {
+	const char *name;
+	char *data;
+	int length;
+	int mapped;
+};
+
+static void object_unload( struct object *o )
+{
+	if(o->mapped) {
+		munmap(o->data,o->length);
+	} else {
+		free(o->data);
+	}
+}
+
+/*
+Load the named file into memory, filling in the data and length of the object.
+A mapped object is not terminated, so comparison functions must go by the length.
+The object should be released with object_unload when done.
+*/
+
+static void object_load( struct object *o, const char *filename, allpairs_prepare_t prepare )
 {
-	FILE *file = fopen(filename,"r");
-	if(!file) {
+	struct stat info;
+
+	int fd = open(filename,O_RDONLY);
+	if(fd<0 || fstat(fd,&info)<0) {
 		fprintf(stderr,"%s: couldn't open %s: %s\n",progname,filename,strerror(errno));
 		exit(1);
 	}
 
-	fseek(file,0,SEEK_END);
-	*length = ftell(file);
-	fseek(file,0,SEEK_SET);
+	o->name = filename;
+	o->length = info.st_size;
+	o->mapped = o->length >= getpagesize();
 
-	char *data = malloc(*length);
-	if(!data) {
-		fprintf(stderr,"%s: out of memory!\n",progname);
-		exit(1);
+	if(o->mapped) {
+		o->data = mmap(0,o->length,PROT_READ,MAP_PRIVATE,fd,0);
+		if(o->data==MAP_FAILED) {
+			fprintf(stderr,"%s: couldn't map %s: %s\n",progname,filename,strerror(errno));
+			exit(1);
+		}
+	} else {
+		o->data = xxmalloc(o->length+1);
+		if(full_read(fd,o->data,o->length)!=o->length) {
+			fprintf(stderr,"%s: couldn't read %s: %s\n",progname,filename,strerror(errno));
+			exit(1);
+		}
+		o->data[o->length] = 0;
 	}
 
-	full_fread(file,data,*length);
-	fclose(file);
+	close(fd);
 
-	return data;
+	if(prepare) {
+		int length;
+		char *data = prepare(filename,o->data,o->length,&length);
+		object_unload(o);
+		o->data = data;
+		o->length = length;
+		o->mapped = 0;
+	}
 }
 
 /*
-pthreads requires that we pass all arguments through as a single
-pointer, so we are forced to use a little structure to send all
-of the desired arguments.
+tile_size_estimate chooses the number of items along each side of a
+square tile, so that the items of one tile from each set fit within
+half of the cache of one core, measured from the first 100 items of each
+block.  The tiles are made smaller, if need be, to give every core several
+tiles of a block to work on.
 */
 
-struct thread_args {
-	allpairs_compare_t func;
-	char **xname;
-	char **xdata;
-	int   *xdata_length;
-	char  *yname;
-	char  *ydata;
-	int    ydata_length;
-};
+static int tile_size_estimate( struct object *a, int na, struct object *b, int nb )
+{
+	long cache_size = 0;
+	UINT64_T total_data = 0;
+	int count = 0;
+	int i, size;
+
+#ifdef _SC_LEVEL2_CACHE_SIZE
+	cache_size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+#endif
+	if(cache_size<=0) cache_size = 256*1024;
+
+	for(i=0;i<MIN(100,na);i++,count++) total_data += a[i].length;
+	for(i=0;i<MIN(100,nb);i++,count++) total_data += b[i].length;
+
+	UINT64_T average = MAX(1,total_data/MAX(1,count));
+
+	size = MAX(1,cache_size/2/(2*average));
+	size = MIN(size,MAX(na,nb));
+
+	while(size>1 && ((na+size-1)/size)*((nb+size-1)/size) < 4*num_cores) {
+		size /= 2;
+	}
+
+	return size;
+}
 
 /*
-A single thread will loop over a whole block-row of the results,
-calling the comparison function once for each pair of items.
+The threaded main loop is carried out by a pool of num_cores threads,
+started once.  For each pair of blocks, the matrix of comparisons is
+divided into tiles, and each thread takes the next tile not yet done
+until none are left.  The output of each thread goes into its own buffer,
+which is written to the standard output once it holds OUTPUT_FLUSH_SIZE
+bytes, at the end of a row of a tile, so that lines are never interleaved.
 */
 
-static void * row_loop_threaded( void *args )
+#define OUTPUT_FLUSH_SIZE (1024*1024)
+
+struct tile_pool {
+	pthread_mutex_t mutex;
+	pthread_cond_t work_ready;
+	pthread_cond_t work_done;
+
+	allpairs_compare_t func;
+	struct object *a;
+	struct object *b;
+	int na;
+	int nb;
+	int tile_size;
+	int tiles_x;
+	int tiles_total;
+	int tiles_next;
+	int tiles_done;
+	int shutdown;
+};
+
+struct tile_worker {
+	struct tile_pool *pool;
+	pthread_t thread;
+	FILE *output;
+	char *output_data;
+	size_t output_length;
+};
+
+static void tile_worker_flush( struct tile_worker *w )
 {
-	int i;
-	struct thread_args *targs = args;
-	for(i=0;i<block_size;i++) {
-		targs->func(targs->xname[i],targs->xdata[i],targs->xdata_length[i],targs->yname,targs->ydata,targs->ydata_length);
+	fflush(w->output);
+	if(w->output_length>0) {
+		fwrite(w->output_data,1,w->output_length,stdout);
+		rewind(w->output);
+		fflush(w->output);
 	}
-	return 0;
 }
 
-/*
-The threaded main loop loads an entire block of objects into memory,
-then forks threads, one for each row in the block, until done.
-This only applies to functions loaded via dynamic linking.
-Up to num_cores threads will be running simultaneously.
-*/
+static void tile_run( struct tile_worker *w, int tile )
+{
+	struct tile_pool *p = w->pool;
+	int i, j;
+
+	int x = (tile % p->tiles_x) * p->tile_size;
+	int y = (tile / p->tiles_x) * p->tile_size;
+	int xstop = MIN(x+p->tile_size,p->na);
+	int ystop = MIN(y+p->tile_size,p->nb);
+
+	for(j=y;j<ystop;j++) {
+		struct object *b = &p->b[j];
+		for(i=x;i<xstop;i++) {
+			struct object *a = &p->a[i];
+			p->func(w->output,a->name,a->data,a->length,b->name,b->data,b->length);
+		}
+		fflush(w->output);
+		if(w->output_length>=OUTPUT_FLUSH_SIZE) tile_worker_flush(w);
+	}
+}
 
-static int main_loop_threaded( allpairs_compare_t funcptr, struct text_list *seta, struct text_list *setb )
+static void * tile_worker_loop( void *arg )
 {
-	int x,i,j,c;
+	struct tile_worker *w = arg;
+	struct tile_pool *p = w->pool;
 
-	char *xname[block_size];
-	char *xdata[block_size];
-	int xdata_length[block_size];
+	pthread_mutex_lock(&p->mutex);
+	while(1) {
+		if(p->tiles_next<p->tiles_total) {
+			int tile = p->tiles_next++;
+			pthread_mutex_unlock(&p->mutex);
 
-	char *yname[num_cores];
-	char *ydata[num_cores];
-	int ydata_length[num_cores];
+			tile_run(w,tile);
 
-	struct thread_args args[num_cores];
-	pthread_t thread[num_cores];
+			pthread_mutex_lock(&p->mutex);
+			p->tiles_done++;
+			if(p->tiles_done==p->tiles_total) pthread_cond_signal(&p->work_done);
+		} else if(p->shutdown) {
+			break;
+		} else {
+			pthread_cond_wait(&p->work_ready,&p->mutex);
+		}
+	}
+	pthread_mutex_unlock(&p->mutex);
 
-	/* for each block sized vertical stripe... */
-	for(x=0;x<text_list_size(seta);x+=block_size) {
+	tile_worker_flush(w);
 
-		/* load the horizontal members of the stripe */
-		for(i=0;i<block_size;i++) {
-			xname[i] = text_list_get(seta,x+i);
-			xdata[i] = load_one_file(text_list_get(seta,x+i),&xdata_length[i]);
+	return 0;
+}
+
+static void load_block( struct object *o, struct text_list *set, int first, int count, allpairs_prepare_t prepare )
+{
+	int i;
+	for(i=0;i<count;i++) object_load(&o[i],text_list_get(set,first+i),prepare);
+}
+
+static void unload_block( struct object *o, int count )
+{
+	int i;
+	for(i=0;i<count;i++) object_unload(&o[i]);
+}
+
+static int main_loop_threaded( allpairs_compare_t funcptr, allpairs_prepare_t prepare, struct text_list *seta, struct text_list *setb )
+{
+	int x,y,c;
+	int sizea = text_list_size(seta);
+	int sizeb = text_list_size(setb);
+
+	struct object *a = xxmalloc(block_size*sizeof(*a));
+	struct object *b = xxmalloc(block_size*sizeof(*b));
+
+	struct tile_pool pool;
+	struct tile_worker worker[num_cores];
+
+	memset(&pool,0,sizeof(pool));
+	pthread_mutex_init(&pool.mutex,0);
+	pthread_cond_init(&pool.work_ready,0);
+	pthread_cond_init(&pool.work_done,0);
+	pool.func = funcptr;
+	pool.a = a;
+	pool.b = b;
+
+	for(c=0;c<num_cores;c++) {
+		worker[c].pool = &pool;
+		worker[c].output_data = 0;
+		worker[c].output_length = 0;
+		worker[c].output = open_memstream(&worker[c].output_data,&worker[c].output_length);
+		if(!worker[c].output) {
+			fprintf(stderr,"%s: couldn't create output buffer: %s\n",progname,strerror(errno));
+			exit(1);
+		}
+		if(pthread_create(&worker[c].thread,0,tile_worker_loop,&worker[c])!=0) {
+			fprintf(stderr,"%s: couldn't create thread: %s\n",progname,strerror(errno));
+			exit(1);
 		}
+	}
 
-		/* for each row in the stripe ... */
-		for(j=0;j<text_list_size(setb);j+=num_cores) {
-
-			/* don't start more threads than rows remaining. */
-			int n = MIN(num_cores,text_list_size(setb)-j);
-
-			/* start one thread working on a whole row. */
-			for(c=0;c<n;c++) {
-				yname[c] = text_list_get(setb,j+c);
-				ydata[c] = load_one_file(text_list_get(setb,j+c),&ydata_length[c]);
-
-				args[c].func         = funcptr;
-				args[c].xname        = xname;
-				args[c].xdata        = xdata;
-				args[c].xdata_length = xdata_length;
-				args[c].yname	     = yname[c];
-				args[c].ydata        = ydata[c];
-				args[c].ydata_length = ydata_length[c];
-				pthread_create(&thread[c],0,row_loop_threaded,&args[c]);
-			}
+	/*
+	If all of set B fits in one block, it is loaded (and prepared)
+	once and kept for every stripe of set A, rather than once per stripe.
+	*/
+	int b_resident = sizeb<=block_size;
+	if(b_resident) load_block(b,setb,0,sizeb,prepare);
 
-			/* wait for each one to finish */
-			for(c=0;c<n;c++) {
-				pthread_join(thread[c],0);
-				free(ydata[c]);
+	/* for each block sized vertical stripe... */
+	for(x=0;x<sizea;x+=block_size) {
+		int na = MIN(block_size,sizea-x);
+		load_block(a,seta,x,na,prepare);
+
+		/* for each block of the stripe... */
+		for(y=0;y<sizeb;y+=block_size) {
+			int nb = MIN(block_size,sizeb-y);
+			if(!b_resident) load_block(b,setb,y,nb,prepare);
+
+			pthread_mutex_lock(&pool.mutex);
+			pool.na = na;
+			pool.nb = nb;
+			pool.tile_size = tile_size ? tile_size : tile_size_estimate(a,na,b,nb);
+			pool.tiles_x = (na+pool.tile_size-1)/pool.tile_size;
+			pool.tiles_total = pool.tiles_x * ((nb+pool.tile_size-1)/pool.tile_size);
+			pool.tiles_next = 0;
+			pool.tiles_done = 0;
+			debug(D_DEBUG,"block %d,%d: %d tiles of %d items",x,y,pool.tiles_total,pool.tile_size);
+			pthread_cond_broadcast(&pool.work_ready);
+
+			/* wait for every tile of the block to finish */
+			while(pool.tiles_done<pool.tiles_total) {
+				pthread_cond_wait(&pool.work_done,&pool.mutex);
 			}
-		}
+			pthread_mutex_unlock(&pool.mutex);
 
-		for(i=0;i<block_size;i++) {
-			free(xdata[i]);
+			if(!b_resident) unload_block(b,nb);
 		}
+
+		unload_block(a,na);
 	}
 
+	if(b_resident) unload_block(b,sizeb);
+
+	pthread_mutex_lock(&pool.mutex);
+	pool.shutdown = 1;
+	pthread_cond_broadcast(&pool.work_ready);
+	pthread_mutex_unlock(&pool.mutex);
+
+	for(c=0;c<num_cores;c++) {
+		pthread_join(worker[c].thread,0);
+		fclose(worker[c].output);
+		free(worker[c].output_data);
+	}
+
+	pthread_mutex_destroy(&pool.mutex);
+	pthread_cond_destroy(&pool.work_ready);
+	pthread_cond_destroy(&pool.work_done);
+
+	free(a);
+	free(b);
+
 	return 0;
 }
 
@@ -278,7 +468,7 @@ int main(int argc, char *argv[])
 
 	debug_config(progname);
 
-	while((c = getopt(argc, argv, "b:c:e:d:vh")) != (char)-1) {
+	while((c = getopt(argc, argv, "b:c:t:e:d:vh")) != (char)-1) {
 		switch (c) {
 		case 'b':
 			block_size = atoi(optarg);
@@ -286,6 +476,9 @@ int main(int argc, char *argv[])
 		case 'c':
 			num_cores = atoi(optarg);
 			break;
+		case 't':
+			tile_size = atoi(optarg);
+			break;
 		case 'e':
 			extra_arguments = optarg;
 			break;
@@ -335,7 +528,8 @@ int main(int argc, char *argv[])
 
 	allpairs_compare_t funcptr = allpairs_compare_function_get(funcpath);
 	if(funcptr) {
-		result = main_loop_threaded(funcptr,seta,setb);
+		debug(D_DEBUG,"comparing with the %s kernel",allpairs_compare_kernel_name());
+		result = main_loop_threaded(funcptr,allpairs_prepare_function_get(funcpath),seta,setb);
 	} else {
 		if(access(funcpath,X_OK)!=0) {
 			fprintf(stderr, "%s: %s is neither an executable program nor an internal function.\n",progname,funcpath);
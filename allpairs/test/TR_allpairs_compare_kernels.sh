@@ -0,0 +1,21 @@
+#!/bin/sh
+
+. ../../dttools/src/test_runner.common.sh
+
+prepare()
+{
+    cd ../src/; make
+    exit 0
+}
+
+run()
+{
+    cd ../src; exec ./allpairs_compare_test
+}
+
+clean()
+{
+    exit 0
+}
+
+dispatch $@
@@ -0,0 +1,44 @@
+#!/bin/sh
+
+# One of two workers disconnects: the tasks of its region go to the other worker.
+
+. ../../dttools/src/test_runner.common.sh
+. ./workers.common.sh
+
+PREFIX=fallback
+workers_files
+
+prepare()
+{
+	workers_prepare
+	exit 0
+}
+
+run()
+{
+	workers_start
+
+	# Let both workers take a region, then kill one of them.
+	counter=0
+	while [ `workers_preferred` -lt 2 ]; do
+		counter=`expr $counter + 1`
+		[ $counter -gt 30 ] && exit 1
+		sleep 1
+	done
+	kill -9 $WORKER1
+
+	workers_finish || exit 1
+
+	# Some task for the worker that left ran on the other one.
+	[ `awk '$3 != "-" && $3 != $4' $TEST_PLACEMENT | wc -l` -gt 0 ]
+	exit $?
+}
+
+clean()
+{
+	workers_clean
+	rm -f allpairs_multicore
+	exit 0
+}
+
+dispatch $@
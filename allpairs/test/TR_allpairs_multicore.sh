@@ -0,0 +1,67 @@
+#!/bin/sh
+
+. ../../dttools/src/test_runner.common.sh
+
+TEST_INPUT=set.list
+TEST_OUTPUT=multicore.output
+TEST_OUTPUT_TILED=multicore_tiled.output
+TEST_INPUT_SMALL=multicore_small.list
+TEST_OUTPUT_SMALL=multicore_small.output
+TEST_PAGE=multicore_page.seq
+TEST_PAGE_LIST=multicore_page.list
+TEST_OUTPUT_PAGE=multicore_page.output
+
+prepare()
+{
+	rm -f $TEST_OUTPUT
+	rm -f $TEST_OUTPUT_TILED
+	rm -f $TEST_OUTPUT_SMALL
+	head -1 $TEST_INPUT > $TEST_INPUT_SMALL
+
+	# A sequence of exactly one page, which is mapped and not terminated.
+	awk -v n=`getconf PAGESIZE` 'BEGIN { srand(1); for(i=1;i<n;i++) printf "%s", substr("ACGT",int(rand()*4)+1,1); printf "\n" }' > $TEST_PAGE
+	echo $TEST_PAGE > $TEST_PAGE_LIST
+	exit 0
+}
+
+run()
+{
+	../src/allpairs_multicore -c 1 $TEST_INPUT $TEST_INPUT BITWISE | sort > $TEST_OUTPUT || exit 1
+	../src/allpairs_multicore -c 4 -b 2 -t 1 $TEST_INPUT $TEST_INPUT BITWISE | sort > $TEST_OUTPUT_TILED || exit 1
+
+	# Set B fits in one block, and is kept across the stripes of set A.
+	../src/allpairs_multicore -c 2 -b 1 $TEST_INPUT $TEST_INPUT_SMALL BITWISE | sort > $TEST_OUTPUT_SMALL || exit 1
+	awk -v b=`cat $TEST_INPUT_SMALL` '$2==b' $TEST_OUTPUT | diff - $TEST_OUTPUT_SMALL || exit 1
+
+	# SWALIGN goes by the length of each object, not a terminator.
+	../src/allpairs_multicore $TEST_PAGE_LIST $TEST_PAGE_LIST SWALIGN > $TEST_OUTPUT_PAGE || exit 1
+	[ "`sed -n 2p $TEST_OUTPUT_PAGE`" = "`sed -n 3p $TEST_OUTPUT_PAGE`" ] || exit 1
+
+	num_files=`wc -l < $TEST_INPUT`
+	count=`wc -l < $TEST_OUTPUT`
+	if [ $count -ne `expr $num_files \* $num_files` ]; then
+		exit 1
+	fi
+
+	count=`awk '$1==$2 && $3==0' $TEST_OUTPUT | wc -l`
+	if [ $count -ne $num_files ]; then
+		exit 1
+	fi
+
+	diff $TEST_OUTPUT $TEST_OUTPUT_TILED
+	exit $?
+}
+
+clean()
+{
+	rm -f $TEST_OUTPUT
+	rm -f $TEST_OUTPUT_TILED
+	rm -f $TEST_INPUT_SMALL
+	rm -f $TEST_OUTPUT_SMALL
+	rm -f $TEST_PAGE
+	rm -f $TEST_PAGE_LIST
+	rm -f $TEST_OUTPUT_PAGE
+	exit 0
+}
+
+dispatch $@
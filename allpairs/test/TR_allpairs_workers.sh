@@ -0,0 +1,35 @@
+#!/bin/sh
+
+# Two workers share the matrix: each task of a worker's region must run on that worker.
+
+. ../../dttools/src/test_runner.common.sh
+. ./workers.common.sh
+
+PREFIX=workers
+workers_files
+
+prepare()
+{
+	workers_prepare
+	exit 0
+}
+
+run()
+{
+	workers_start
+	workers_finish || exit 1
+
+	# Both workers had a region, and each task for a worker ran on it.
+	[ `workers_preferred` -eq 2 ] || exit 1
+	[ `awk '$3 != "-" && $3 != $4' $TEST_PLACEMENT | wc -l` -eq 0 ]
+	exit $?
+}
+
+clean()
+{
+	workers_clean
+	rm -f allpairs_multicore
+	exit 0
+}
+
+dispatch $@
@@ -0,0 +1,103 @@
+#!/bin/sh
+
+# Shared by the tests that run allpairs_master with several workers.
+# Each test sets PREFIX, which names the files it creates.  The master
+# records where each task ran with -l, one line per task:
+#   <column> <row> <preferred worker, or -> <worker it ran on>
+
+NUM_FILES=6
+
+workers_files()
+{
+	TEST_DIR=$PREFIX.input
+	TEST_INPUT=$PREFIX.list
+	TEST_COMPARE=${PREFIX}_compare.sh
+	TEST_OUTPUT=$PREFIX.output
+	TEST_PLACEMENT=$PREFIX.placement
+	PIDMASTER_FILE=${PREFIX}_master.pid
+	PIDWORKER_FILE=${PREFIX}_worker.pid
+	PORT_FILE=$PREFIX.port
+}
+
+workers_prepare()
+{
+	workers_clean
+
+	mkdir $TEST_DIR
+	i=1
+	while [ $i -le $NUM_FILES ]; do
+		echo $i > $TEST_DIR/item.$i
+		echo $TEST_DIR/item.$i >> $TEST_INPUT
+		i=`expr $i + 1`
+	done
+
+	# Slow enough that both workers connect before the matrix is done.
+	cat > $TEST_COMPARE <<EOF
+#!/bin/sh
+sleep 0.2
+cmp -s "\$1" "\$2"
+echo \$?
+EOF
+	chmod 755 $TEST_COMPARE
+
+	ln -sf ../src/allpairs_multicore .
+}
+
+# Start the master, and then two workers, whose pids are in WORKER1 and WORKER2.
+workers_start()
+{
+	../src/allpairs_master -x 1 -y 1 -l $TEST_PLACEMENT -o $TEST_OUTPUT -Z $PORT_FILE $TEST_INPUT $TEST_INPUT ./$TEST_COMPARE > /dev/null &
+	MASTER=$!
+	echo $MASTER > $PIDMASTER_FILE
+
+	wait_for_file_creation $PORT_FILE 5
+	port=`cat $PORT_FILE`
+
+	../../dttools/src/work_queue_worker -t 30 localhost $port &
+	WORKER1=$!
+	../../dttools/src/work_queue_worker -t 30 localhost $port &
+	WORKER2=$!
+	echo $WORKER1 $WORKER2 > $PIDWORKER_FILE
+}
+
+# The number of distinct workers that tasks preferring a worker were meant for.
+workers_preferred()
+{
+	[ -f $TEST_PLACEMENT ] || { echo 0; return; }
+	awk '$3 != "-" { print $3 }' $TEST_PLACEMENT | sort -u | wc -l
+}
+
+# Wait for the master to finish, and check every result.
+workers_finish()
+{
+	( sleep 60; kill -9 $MASTER ) &
+	watchdog=$!
+	wait $MASTER
+	result=$?
+	kill $watchdog 2> /dev/null
+	[ $result -eq 0 ] || return 1
+
+	cells=`expr $NUM_FILES \* $NUM_FILES`
+	[ `wc -l < $TEST_OUTPUT` -eq $cells ] || return 1
+	[ `awk '$1==$2 && $3==0' $TEST_OUTPUT | wc -l` -eq $NUM_FILES ] || return 1
+	[ `awk '$1!=$2 && $3!=0' $TEST_OUTPUT | wc -l` -eq `expr $cells - $NUM_FILES` ] || return 1
+
+	# Every block ran once.
+	[ `awk '{ print $1, $2 }' $TEST_PLACEMENT | sort -u | wc -l` -eq $cells ] || return 1
+	[ `wc -l < $TEST_PLACEMENT` -eq $cells ] || return 1
+}
+
+workers_clean()
+{
+	[ -f $PIDMASTER_FILE ] && kill -9 `cat $PIDMASTER_FILE` 2> /dev/null
+	[ -f $PIDWORKER_FILE ] && kill -9 `cat $PIDWORKER_FILE` 2> /dev/null
+
+	rm -rf $TEST_DIR
+	rm -f $TEST_INPUT
+	rm -f $TEST_COMPARE
+	rm -f $TEST_OUTPUT
+	rm -f $TEST_PLACEMENT
+	rm -f $PIDMASTER_FILE
+	rm -f $PIDWORKER_FILE
+	rm -f $PORT_FILE
+}
@@ -33,6 +33,8 @@ OPTION_PAIR(-f, file)Extra input file needed by the comparison function. (may be
 OPTION_PAIR(-t, seconds)Estimated time to run one comparison. (default chosen at runtime)
 OPTION_PAIR(-x, item)Width of one work unit, in items to compare. (default chosen at runtime)
 OPTION_PAIR(-y, items)Height of one work unit, in items to compare. (default chosen at runtime)
+OPTION_PAIR(-W, mode)Scheduling algorithm for tasks not yet tied to a worker: PARAM(files), PARAM(time), or PARAM(fcfs). Once a worker has a region of its own, its tasks prefer it regardless. (default is files)
+OPTION_PAIR(-l, file)Record each task in this file as it completes, one line per task: the column and row of its block, the worker it preferred (or - if none), and the worker it ran on.
 OPTION_PAIR(-N, project)Report the master information to a catalog server with the project name - PARAM(project)
 OPTION_PAIR(-E, priority)Priority. Higher the value, higher the priority.
 OPTION_PAIR(-d, flag)Enable debugging for this subsystem. (Try -d all to start.)
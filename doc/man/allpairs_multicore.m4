@@ -28,6 +28,7 @@ SECTION(OPTIONS)
 OPTIONS_BEGIN
 OPTION_PAIR(-b, items)Block size: number of items to hold in memory at once. (default: 50% of RAM)
 OPTION_PAIR(-c, cores)Number of cores to be used. (default: # of cores in machine)
+OPTION_PAIR(-t, items)Tile size: number of items along each side of a tile. (default: fit to cache)
 OPTION_PAIR(-e, args)Extra arguments to pass to the comparison program.
 OPTION_PAIR(-d, flag)Enable debugging for this subsystem.
 OPTION_ITEM(-v)Show program version.
@@ -32,6 +32,8 @@ OPTION_PAIR(-a,sw|ps|banded)Specify the type of alignment: sw (Smith-Waterman),
 OPTION_PAIR(-o,ovl|ovl_new|align|matrix)Specify how each alignment should be output: ovl (Celera V5, V6 OVL format), ovl_new (Celera V7 overlap format), align (display the sequences and alignment graphically) or matrix (display the dynamic programming matrix).  MANPAGE(sand_align_master,1) expects the ovl output format, which is the default.  The other formats are useful for debugging.
 OPTION_PAIR(-m,length)Minimum aligment length (default: 0).
 OPTION_PAIR(-q,quality)Minimum match quality (default: 1.00)
+OPTION_ITEM(-l)Align in memory proportional only to the length of the sequences, which is slower.
+OPTION_PAIR(-t,threads)Number of threads to align with (default: 1).  The output is the same as with one thread.  The matrix output format always uses one thread.
 OPTION_ITEM(-x)Delete input file after completion.
 OPTION_PAIR(-d,subsystem)Enable debugging for this subsystem.  (Try BOLD(-d all) to start.
 OPTION_ITEM(-v)Show program version.
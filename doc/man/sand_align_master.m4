@@ -26,7 +26,8 @@ SECTION(OPTIONS)
 
 OPTIONS_BEGIN
 OPTION_PAIR(-p,port)Port number for work queue master to listen on. (default: 9123)
-OPTION_PAIR(-n,number)Maximum number of candidates per task. (default is 10000)
+OPTION_PAIR(-n,number)Maximum number of candidates per task. (default is 10000 per thread)
+OPTION_PAIR(-t,number)Number of threads that each task aligns with. (default is 1)
 OPTION_PAIR(-e,args)Extra arguments to pass to the alignment program.
 OPTION_PAIR(-d,subsystem)Enable debugging for this subsystem. (Try BOLD(-d all) to start.)
 OPTION_PAIR(-F,mult)Work Queue fast abort multiplier.(default is 10.)
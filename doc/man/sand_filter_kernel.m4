@@ -30,6 +30,7 @@ OPTION_PAIR(-r,file)A meryl file of repeat mers to be ignored.
 OPTION_PAIR(-k,size)The k-mer size to use in candidate selection (default is 22).
 OPTION_PAIR(-w,number)The minimizer window size to use in candidate selection (default is 22).
 OPTION_PAIR(-o,filename)The output file. Default is stdout.
+OPTION_PAIR(-t,number)Number of threads to filter with (default is 1).  The candidates are the same as with one thread.
 OPTION_PAIR(-d,subsystem)Enable debug messages for this subsystem.  Try BOLD(-d all) to start.
 OPTION_ITEM(-v)Show version string.
 OPTION_ITEM(-h)Show help screen.
@@ -30,7 +30,7 @@ OPTION_PAIR(-r,file)A meryl file of repeat mers to be filtered out.
 OPTION_PAIR(-R,n)Automatically retry failed jobs up to n times. (default: 100)
 OPTION_PAIR(-k,size)The k-mer size to use in candidate selection (default is 22).
 OPTION_PAIR(-w,size)The minimizer window size. (default is 22).
-OPTION_ITEM(-u)If set, do not unlink temporary binary output files.
+OPTION_PAIR(-t,number)Number of threads that each task filters with. (default is 1)
 OPTION_PAIR(-c,file)Checkpoint filename; will be created if necessary.
 OPTION_PAIR(-d,flag)Enable debugging for this subsystem.  (Try BOLD(-d all) to start.)
 OPTION_PAIR(-F,number)Work Queue fast abort multiplier.     (default is 10.)
@@ -20,12 +20,21 @@ BOLD(wavefront_master) uses the Work Queue system to distribute tasks among
 processors. After starting BOLD(wavefront_master), you must start a number of
 MANPAGE(work_queue_worker,1) processes on remote machines.  The workers will
 then connect back to the master process and begin executing tasks.  
+PARA
+Each task computes a square tile of the matrix on a worker, by running
+another copy of BOLD(wavefront_master), which is sent along with the
+function.  Only the values just below and just to the left of the tile
+are sent with the task.  BOLD(wavefront_master) measures how long the
+function takes, and how long it takes to dispatch each task, and chooses
+the size of the tiles to finish the whole matrix soonest on the workers
+currently connected.
 
 SECTION(OPTIONS)
 
 OPTIONS_BEGIN
 OPTION_PAIR(-p, port)Port number for queue master to listen on.
 OPTION_PAIR(-Z,file)Select port at random and write it to this file.  (default is disabled)
+OPTION_PAIR(-b,size)Manually set the width and height of the tile computed by each task.  (default is automatic)
 OPTION_PAIR(-d, subsystem)Enable debugging for this subsystem. (Try -d all to start.)
 OPTION_PAIR(-o, file)Send debugging to this file.
 OPTION_ITEM(-v)Show version string
@@ -7,7 +7,9 @@ See the file COPYING for details.
 
 #include "batch_job.h"
 #include "batch_job_internal.h"
+#include "hash_table.h"
 #include "itable.h"
+#include "link.h"
 #include "mpi_queue.h"
 #include "work_queue.h"
 
@@ -122,6 +124,10 @@ struct batch_queue *batch_queue_create(batch_queue_type_t type)
 	q->options_text = 0;
 	q->job_table = itable_create(0);
 	q->output_table = itable_create(0);
+	q->wakeup_link = 0;
+	q->job_names = itable_create(0);
+	q->job_ids = hash_table_create(0, 0);
+	q->next_jobid = 1;
 
 	if(type == BATCH_QUEUE_TYPE_CONDOR)
 		q->logfile = strdup("condor.logfile");
@@ -197,6 +203,18 @@ void batch_queue_delete(struct batch_queue *q)
 			free(q->logfile);
 		if(q->work_queue)
 			work_queue_delete(q->work_queue);
+		if(q->wakeup_link)
+			link_detach(q->wakeup_link);
+		if(q->job_names) {
+			UINT64_T jobid;
+			char *name;
+			itable_firstkey(q->job_names);
+			while(itable_nextkey(q->job_names, &jobid, (void **) &name))
+				free(name);
+			itable_delete(q->job_names);
+		}
+		if(q->job_ids)
+			hash_table_delete(q->job_ids);
 		free(q);
 	}
 }
@@ -296,6 +314,30 @@ batch_job_id_t batch_job_submit_simple(struct batch_queue * q, const char *cmd,
 	}
 }
 
+int batch_job_submit_simple_batch(struct batch_queue *q, struct batch_job_submission *jobs, int count)
+{
+	int i, submitted = 0;
+
+	if(!q->job_table)
+		q->job_table = itable_create(0);
+
+	if(q->type == BATCH_QUEUE_TYPE_CONDOR) {
+		return batch_job_submit_simple_batch_condor(q, jobs, count);
+	} else if(q->type == BATCH_QUEUE_TYPE_SGE) {
+		return batch_job_submit_simple_batch_cluster(q, jobs, count);
+	} else if(q->type == BATCH_QUEUE_TYPE_WORK_QUEUE || q->type == BATCH_QUEUE_TYPE_WORK_QUEUE_SHAREDFS) {
+		return batch_job_submit_simple_batch_work_queue(q, jobs, count);
+	}
+
+	for(i = 0; i < count; i++) {
+		jobs[i].jobid = batch_job_submit_simple(q, jobs[i].cmdline, jobs[i].input_files, jobs[i].output_files);
+		if(jobs[i].jobid >= 0)
+			submitted++;
+	}
+
+	return submitted;
+}
+
 batch_job_id_t batch_job_wait(struct batch_queue * q, struct batch_job_info * info)
 {
 	return batch_job_wait_timeout(q, info, 0);
@@ -363,6 +405,42 @@ int batch_job_remove(struct batch_queue *q, batch_job_id_t jobid)
 	}
 }
 
+void batch_queue_set_wakeup_fd(struct batch_queue *q, int fd)
+{
+	if(q->wakeup_link) {
+		link_detach(q->wakeup_link);
+		q->wakeup_link = 0;
+	}
+
+	if(fd >= 0)
+		q->wakeup_link = link_attach_to_fd(fd);
+}
+
+void batch_job_name_insert(struct batch_queue *q, batch_job_id_t jobid, const char *name)
+{
+	itable_insert(q->job_names, jobid, xxstrdup(name));
+	hash_table_insert(q->job_ids, name, (void *) (PTRINT_T) jobid);
+}
+
+const char *batch_job_name_lookup(struct batch_queue *q, batch_job_id_t jobid)
+{
+	return itable_lookup(q->job_names, jobid);
+}
+
+batch_job_id_t batch_job_name_to_id(struct batch_queue *q, const char *name)
+{
+	return (PTRINT_T) hash_table_lookup(q->job_ids, name);
+}
+
+void batch_job_name_remove(struct batch_queue *q, batch_job_id_t jobid)
+{
+	char *name = itable_remove(q->job_names, jobid);
+	if(name) {
+		hash_table_remove(q->job_ids, name);
+		free(name);
+	}
+}
+
 int batch_queue_port(struct batch_queue *q)
 {
 	if(q->type == BATCH_QUEUE_TYPE_WORK_QUEUE) {
@@ -83,6 +83,40 @@ batch_job_id_t batch_job_submit_simple(struct batch_queue *q, const char *cmdlin
 
 batch_job_id_t batch_job_submit(struct batch_queue *q, const char *cmd, const char *args, const char *infile, const char *outfile, const char *errfile, const char *extra_input_files, const char *extra_output_files);
 
+/** Describes a file of a batch job, by its name where the job is submitted and where it runs. */
+struct batch_job_file {
+	const char *local_name;		/**< The name of the file where the job is submitted. */
+	const char *remote_name;	/**< The name of the file where the job runs, or null if the same. */
+};
+
+/** Describes one of several simple batch jobs submitted together. */
+struct batch_job_submission {
+	const char *cmdline;		/**< The command line to execute, as for @ref batch_job_submit_simple. */
+	const char *input_files;	/**< A comma separated list of input files, or null. */
+	const char *output_files;	/**< A comma separated list of output files, or null. */
+	struct batch_job_file *inputs;	/**< If not null, the input files, used by Work Queue instead of input_files. */
+	int input_count;		/**< The number of entries in inputs. */
+	struct batch_job_file *outputs;	/**< If not null, the output files, used by Work Queue instead of output_files. */
+	int output_count;		/**< The number of entries in outputs. */
+	batch_job_id_t jobid;		/**< Set to the jobid of the submitted job, or to a negative number on failure. */
+};
+
+/** Submit several simple batch jobs at once.
+Condor jobs are described in a single submit file, and SGE jobs as a single array job,
+so that all are submitted with one command, which is much faster than one command per job.
+Work Queue takes the files of each job from the given arrays, if any, rather than
+parsing the strings.
+Other queue types submit the jobs one at a time, as by @ref batch_job_submit_simple.
+All of the jobs are submitted with the current options of the queue.
+Each job is waited for and removed individually by its jobid, as usual.
+@param q The queue to submit to.
+@param jobs An array of jobs to submit.  The jobid of each is filled in.
+@param count The number of jobs in the array.
+@return The number of jobs successfully submitted.
+*/
+
+int batch_job_submit_simple_batch(struct batch_queue *q, struct batch_job_submission *jobs, int count);
+
 /** Wait for any batch job to complete.
 Blocks until a batch job completes.
 @param q The queue to wait on.
@@ -166,6 +200,19 @@ This call returns the type of the batch queue.
 batch_queue_type_t batch_queue_get_type(struct batch_queue *q);
 
 
+/** Return early from waiting when a file descriptor is readable.
+Afterwards, @ref batch_job_wait_timeout returns -1 as soon as <tt>fd</tt>
+becomes readable, even if no job has completed, so that the caller may attend
+to other events, such as the completion of local processes (see @ref process_notify_fd).
+The descriptor is drained each time it causes an early return.
+Work Queue waits on the descriptor together with its workers;
+queue types that poll periodically already return early when a
+local process completes, and are unaffected.
+@param q The batch queue to adjust.
+@param fd The file descriptor to watch, or -1 to stop watching.
+*/
+void batch_queue_set_wakeup_fd(struct batch_queue *q, int fd);
+
 /** Delete a batch queue.
 Note that this function just destroys the internal data structures,
 it does not abort running jobs.  To properly clean up running jobs,
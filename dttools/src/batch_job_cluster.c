@@ -10,6 +10,7 @@
 #include <string.h>
 #include <errno.h>
 
+#include <unistd.h>
 #include <sys/stat.h>
 
 static char * cluster_name = NULL;
@@ -118,11 +119,27 @@ static int setup_batch_wrapper(struct batch_queue *q, const char *sysname)
 }
 
 
-batch_job_id_t batch_job_submit_simple_cluster(struct batch_queue * q, const char *cmd, const char *extra_input_files, const char *extra_output_files)
+/* Record a job known to the cluster by name, under a new jobid. */
+static batch_job_id_t cluster_job_insert(struct batch_queue *q, const char *name)
 {
-	batch_job_id_t jobid;
+	batch_job_id_t jobid = q->next_jobid++;
 	struct batch_job_info *info;
 
+	info = malloc(sizeof(*info));
+	memset(info, 0, sizeof(*info));
+	info->submitted = time(0);
+	itable_insert(q->job_table, jobid, info);
+	batch_job_name_insert(q, jobid, name);
+
+	debug(D_BATCH, "job %d submitted as %s", jobid, name);
+
+	return jobid;
+}
+
+batch_job_id_t batch_job_submit_simple_cluster(struct batch_queue * q, const char *cmd, const char *extra_input_files, const char *extra_output_files)
+{
+	int clusterid;
+
 	if(setup_batch_wrapper(q, cluster_name) < 0)
 		return -1;
 
@@ -159,13 +176,11 @@ batch_job_id_t batch_job_submit_simple_cluster(struct batch_queue * q, const cha
 
 	char line[BATCH_JOB_LINE_MAX] = "";
 	while(fgets(line, sizeof(line), file)) {
-		if(sscanf(line, "Your job %d", &jobid) == 1 || sscanf(line, "%d", &jobid) == 1) {
-			debug(D_BATCH, "job %d submitted", jobid);
+		if(sscanf(line, "Your job %d", &clusterid) == 1 || sscanf(line, "%d", &clusterid) == 1) {
 			pclose(file);
-			info = malloc(sizeof(*info));
-			memset(info, 0, sizeof(*info));
-			info->submitted = time(0);
-			itable_insert(q->job_table, jobid, info);
+			char *name = string_format("%d", clusterid);
+			batch_job_id_t jobid = cluster_job_insert(q, name);
+			free(name);
 			return jobid;
 		}
 	}
@@ -214,7 +229,7 @@ batch_job_id_t batch_job_wait_cluster(struct batch_queue * q, struct batch_job_i
 		itable_firstkey(q->job_table);
 		while(itable_nextkey(q->job_table, &ujobid, (void **) &info)) {
 			jobid = ujobid;
-			char *statusfile = string_format("%s.status.%d", cluster_name, jobid);
+			char *statusfile = string_format("%s.status.%s", cluster_name, batch_job_name_lookup(q, jobid));
 			FILE *file = fopen(statusfile, "r");
 			if(file) {
 				char line[BATCH_JOB_LINE_MAX];
@@ -235,6 +250,7 @@ batch_job_id_t batch_job_wait_cluster(struct batch_queue * q, struct batch_job_i
 				if(info->finished != 0) {
 					unlink(statusfile);
 					info = itable_remove(q->job_table, jobid);
+					batch_job_name_remove(q, jobid);
 					*info_out = *info;
 					free(info);
 					free(statusfile);
@@ -277,10 +293,110 @@ int batch_job_remove_cluster(struct batch_queue *q, batch_job_id_t jobid)
 	info->exited_normally = 0;
 	info->exit_signal = 1;
 
-	char *command = string_format("%s %d", cluster_remove_cmd, jobid);
+	/* A task of an array job is named job.task. */
+	char *name = xxstrdup(batch_job_name_lookup(q, jobid));
+	char *task = strchr(name, '.');
+	char *command;
+	if(task) {
+		*task++ = 0;
+		command = string_format("%s %s -t %s", cluster_remove_cmd, name, task);
+	} else {
+		command = string_format("%s %s", cluster_remove_cmd, name);
+	}
+	free(name);
 	system(command);
 	free(command);
 
 	return 1;
 }
 
+
+/*
+Submit the jobs as one SGE array job.  Rather than a wrapper that takes
+the command as an argument, each array job has its own script, which runs
+the command of its task.  The script is copied by qsub at submission,
+and the status of task T of array job A is written to sge.status.A.T,
+which is also the name that the task is known by here.
+*/
+int batch_job_submit_simple_batch_cluster(struct batch_queue *q, struct batch_job_submission *jobs, int count)
+{
+	char line[BATCH_JOB_LINE_MAX] = "";
+	char *scriptfile;
+	char *command;
+	FILE *file;
+	int arrayid, i;
+
+	for(i = 0; i < count; i++)
+		jobs[i].jobid = -1;
+
+	if(count < 1)
+		return 0;
+
+	scriptfile = string_format("%s.array.%d", cluster_name, (int) getpid());
+	file = fopen(scriptfile, "w");
+	if(!file) {
+		debug(D_BATCH, "could not create %s: %s", scriptfile, strerror(errno));
+		free(scriptfile);
+		return 0;
+	}
+
+	fprintf(file, "#!/bin/sh\n");
+	fprintf(file, "logfile=%s.status.${JOB_ID}.${SGE_TASK_ID}\n", cluster_name);
+	fprintf(file, "starttime=`date +%%s`\n");
+	fprintf(file, "cat > $logfile <<EOF\n");
+	fprintf(file, "start $starttime\n");
+	fprintf(file, "EOF\n\n");
+	fprintf(file, "case ${SGE_TASK_ID} in\n");
+	for(i = 0; i < count; i++)
+		fprintf(file, "%d)\n%s\n;;\n", i + 1, jobs[i].cmdline);
+	fprintf(file, "esac\n\n");
+	fprintf(file, "status=$?\n");
+	fprintf(file, "stoptime=`date +%%s`\n");
+	fprintf(file, "cat >> $logfile <<EOF\n");
+	fprintf(file, "stop $status $stoptime\n");
+	fprintf(file, "EOF\n");
+
+	if(fclose(file) != 0) {
+		debug(D_BATCH, "could not write %s: %s", scriptfile, strerror(errno));
+		unlink(scriptfile);
+		free(scriptfile);
+		return 0;
+	}
+	chmod(scriptfile, 0755);
+
+	command = string_format("%s %s '%s' -t 1-%d %s %s", cluster_submit_cmd, cluster_options, string_basename(scriptfile), count, q->options_text ? q->options_text : "", scriptfile);
+	debug(D_BATCH, "%s", command);
+
+	file = popen(command, "r");
+	free(command);
+	if(!file) {
+		debug(D_BATCH, "couldn't submit job: %s", strerror(errno));
+		unlink(scriptfile);
+		free(scriptfile);
+		return 0;
+	}
+
+	while(fgets(line, sizeof(line), file)) {
+		if(sscanf(line, "Your job-array %d", &arrayid) == 1) {
+			pclose(file);
+			unlink(scriptfile);
+			free(scriptfile);
+			for(i = 0; i < count; i++) {
+				char *name = string_format("%d.%d", arrayid, i + 1);
+				jobs[i].jobid = cluster_job_insert(q, name);
+				free(name);
+			}
+			return count;
+		}
+	}
+
+	if(strlen(line)) {
+		debug(D_NOTICE, "job submission failed: %s", line);
+	} else {
+		debug(D_NOTICE, "job submission failed: no output from %s", cluster_name);
+	}
+	pclose(file);
+	unlink(scriptfile);
+	free(scriptfile);
+	return 0;
+}
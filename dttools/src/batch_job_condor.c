@@ -12,11 +12,118 @@
 #include <signal.h>
 #include <sys/stat.h>
 
+/* Options common to every job in a submit file. */
+static void condor_write_options(struct batch_queue *q, FILE *file)
+{
+	// Note that we do not use transfer_output_files, because that causes the job
+	// to get stuck in a system hold if the files are not created.
+	fprintf(file, "should_transfer_files = yes\n");
+	fprintf(file, "when_to_transfer_output = on_exit\n");
+	fprintf(file, "notification = never\n");
+	fprintf(file, "copy_to_spool = true\n");
+	fprintf(file, "transfer_executable = true\n");
+	fprintf(file, "log = %s\n", q->logfile);
+	if(q->options_text)
+		fprintf(file, "%s\n", q->options_text);
+}
+
+/*
+Read the note that follows a submit event in the log, which gives the
+jobid of the job.  Returns zero if there is none.
+*/
+static batch_job_id_t condor_read_note(FILE *file)
+{
+	char line[BATCH_JOB_LINE_MAX];
+	int id;
+
+	if(fgets(line, sizeof(line), file) && sscanf(line, " BatchJobId %d", &id) == 1)
+		return id;
+
+	return 0;
+}
+
+/*
+A restarted workflow waits again for the jobs of an earlier run that
+shared the log, by the jobids it recorded, so jobids must not repeat
+across runs.  The first jobid of a run is one past the highest in the log.
+*/
+static void condor_init_jobids(struct batch_queue *q)
+{
+	static int done = 0;
+	FILE *file;
+	char line[BATCH_JOB_LINE_MAX];
+	int type, cluster, proc, subproc;
+	batch_job_id_t id;
+
+	if(done)
+		return;
+	done = 1;
+
+	file = fopen(q->logfile, "r");
+	if(!file)
+		return;
+
+	while(fgets(line, sizeof(line), file)) {
+		if(sscanf(line, "%d (%d.%d.%d)", &type, &cluster, &proc, &subproc) == 4 && type == 0) {
+			id = condor_read_note(file);
+			if(id >= q->next_jobid)
+				q->next_jobid = id + 1;
+		}
+	}
+
+	fclose(file);
+	debug(D_BATCH, "jobids of this run start at %d", q->next_jobid);
+}
+
+/*
+Submit condor.submit, in which the jobs have been given consecutive
+jobids from q->next_jobid.  Condor places all of the jobs of a submit
+file in one cluster, in order, so each is known to it as cluster.proc.
+Returns the number of jobs submitted.
+*/
+static int condor_submit(struct batch_queue *q, int count)
+{
+	FILE *file;
+	int njobs, cluster, i;
+	char line[BATCH_JOB_LINE_MAX];
+
+	file = popen("condor_submit condor.submit", "r");
+	if(!file)
+		return 0;
+
+	while(fgets(line, sizeof(line), file)) {
+		if(sscanf(line, "%d job(s) submitted to cluster %d", &njobs, &cluster) == 2) {
+			pclose(file);
+			if(njobs > count)
+				njobs = count;
+			for(i = 0; i < njobs; i++) {
+				batch_job_id_t jobid = q->next_jobid++;
+				char *name = string_format("%d.%d", cluster, i);
+				struct batch_job_info *info;
+				info = malloc(sizeof(*info));
+				memset(info, 0, sizeof(*info));
+				info->submitted = time(0);
+				itable_insert(q->job_table, jobid, info);
+				batch_job_name_insert(q, jobid, name);
+				debug(D_BATCH, "job %d submitted to condor as %s", jobid, name);
+				free(name);
+			}
+			return njobs;
+		}
+	}
+
+	pclose(file);
+	debug(D_BATCH, "failed to submit job to condor!");
+	return 0;
+}
+
 batch_job_id_t batch_job_submit_condor(struct batch_queue *q, const char *cmd, const char *args, const char *infile, const char *outfile, const char *errfile, const char *extra_input_files, const char *extra_output_files)
 {
 	FILE *file;
-	int njobs;
-	int jobid;
+	batch_job_id_t jobid;
+
+	condor_init_jobids(q);
+	jobid = q->next_jobid;
 
 	file = fopen("condor.submit", "w");
 	if(!file) {
@@ -37,40 +144,16 @@ batch_job_id_t batch_job_submit_condor(struct batch_queue *q, const char *cmd, c
 		fprintf(file, "error = %s\n", errfile);
 	if(extra_input_files)
 		fprintf(file, "transfer_input_files = %s\n", extra_input_files);
-	// Note that we do not use transfer_output_files, because that causes the job
-	// to get stuck in a system hold if the files are not created.
-	fprintf(file, "should_transfer_files = yes\n");
-	fprintf(file, "when_to_transfer_output = on_exit\n");
-	fprintf(file, "notification = never\n");
-	fprintf(file, "copy_to_spool = true\n");
-	fprintf(file, "transfer_executable = true\n");
-	fprintf(file, "log = %s\n", q->logfile);
-	if(q->options_text)
-		fprintf(file, "%s\n", q->options_text);
+	condor_write_options(q, file);
+	fprintf(file, "+BatchJobId = %d\n", jobid);
+	fprintf(file, "submit_event_notes = BatchJobId %d\n", jobid);
 	fprintf(file, "queue\n");
 	fclose(file);
 
-	file = popen("condor_submit condor.submit", "r");
-	if(!file)
+	if(condor_submit(q, 1) != 1)
 		return -1;
 
-	char line[BATCH_JOB_LINE_MAX];
-	while(fgets(line, sizeof(line), file)) {
-		if(sscanf(line, "%d job(s) submitted to cluster %d", &njobs, &jobid) == 2) {
-			pclose(file);
-			debug(D_BATCH, "job %d submitted to condor", jobid);
-			struct batch_job_info *info;
-			info = malloc(sizeof(*info));
-			memset(info, 0, sizeof(*info));
-			info->submitted = time(0);
-			itable_insert(q->job_table, jobid, info);
-			return jobid;
-		}
-	}
-
-	pclose(file);
-	debug(D_BATCH, "failed to submit job to condor!");
-	return -1;
+	return jobid;
 }
 
 int setup_condor_wrapper(const char *wrapperfile)
@@ -105,6 +188,57 @@ batch_job_id_t batch_job_submit_simple_condor(struct batch_queue *q, const char
 	return batch_job_submit_condor(q, "condor.sh", cmd, 0, 0, 0, extra_input_files, extra_output_files);
 }
 
+int batch_job_submit_simple_batch_condor(struct batch_queue *q, struct batch_job_submission *jobs, int count)
+{
+	FILE *file;
+	int i, submitted;
+
+	for(i = 0; i < count; i++)
+		jobs[i].jobid = -1;
+
+	if(count < 1)
+		return 0;
+
+	condor_init_jobids(q);
+
+	if(setup_condor_wrapper("condor.sh") < 0) {
+		debug(D_BATCH, "could not create condor.sh: %s", strerror(errno));
+		return 0;
+	}
+
+	file = fopen("condor.submit", "w");
+	if(!file) {
+		debug(D_BATCH, "could not create condor.submit: %s", strerror(errno));
+		return 0;
+	}
+
+	fprintf(file, "universe = vanilla\n");
+	fprintf(file, "executable = condor.sh\n");
+	fprintf(file, "getenv = true\n");
+	condor_write_options(q, file);
+
+	/* Each queue statement takes the values set before it, so the
+	 * per-job values are all restated for each job. */
+	for(i = 0; i < count; i++) {
+		fprintf(file, "arguments = %s\n", jobs[i].cmdline);
+		fprintf(file, "transfer_input_files = %s\n", jobs[i].input_files ? jobs[i].input_files : "");
+		fprintf(file, "+BatchJobId = %d\n", q->next_jobid + i);
+		fprintf(file, "submit_event_notes = BatchJobId %d\n", q->next_jobid + i);
+		fprintf(file, "queue\n");
+	}
+
+	if(fclose(file) != 0) {
+		debug(D_BATCH, "could not write condor.submit: %s", strerror(errno));
+		return 0;
+	}
+
+	submitted = condor_submit(q, count);
+	for(i = 0; i < submitted; i++)
+		jobs[i].jobid = q->next_jobid - submitted + i;
+
+	return submitted;
+}
+
 batch_job_id_t batch_job_wait_condor(struct batch_queue * q, struct batch_job_info * info_out, time_t stoptime)
 {
 	static FILE *logfile = 0;
@@ -128,26 +262,43 @@ batch_job_id_t batch_job_wait_condor(struct batch_queue * q, struct batch_job_in
 
 		char line[BATCH_JOB_LINE_MAX];
 		while(fgets(line, sizeof(line), logfile)) {
-			int type, proc, subproc;
+			int type, cluster, proc, subproc;
 			batch_job_id_t jobid;
+			char name[64];
 			time_t current;
 			struct tm tm;
 
 			struct batch_job_info *info;
 			int logcode, exitcode;
 
-			if(sscanf(line, "%d (%d.%d.%d) %d/%d %d:%d:%d", &type, &jobid, &proc, &subproc, &tm.tm_mon, &tm.tm_mday, &tm.tm_hour, &tm.tm_min, &tm.tm_sec) == 9) {
+			if(sscanf(line, "%d (%d.%d.%d) %d/%d %d:%d:%d", &type, &cluster, &proc, &subproc, &tm.tm_mon, &tm.tm_mday, &tm.tm_hour, &tm.tm_min, &tm.tm_sec) == 9) {
 				tm.tm_year = 2008 - 1900;
 				tm.tm_isdst = 0;
 
 				current = mktime(&tm);
 
-				info = itable_lookup(q->job_table, jobid);
-				if(!info) {
-					info = malloc(sizeof(*info));
-					memset(info, 0, sizeof(*info));
-					itable_insert(q->job_table, jobid, info);
+				/*
+				   The log may be shared with earlier runs.  Their jobs are
+				   taken up again by the jobid in their submit event, so that
+				   a restarted workflow may wait for those still running.
+				   Jobs without one are ignored.
+				 */
+				sprintf(name, "%d.%d", cluster, proc);
+				jobid = batch_job_name_to_id(q, name);
+				if(!jobid && type == 0) {
+					batch_job_id_t id = condor_read_note(logfile);
+					if(id > 0 && !itable_lookup(q->job_table, id)) {
+						info = malloc(sizeof(*info));
+						memset(info, 0, sizeof(*info));
+						itable_insert(q->job_table, id, info);
+						batch_job_name_insert(q, id, name);
+						debug(D_BATCH, "job %d was submitted to condor as %s by an earlier run", id, name);
+						jobid = id;
+					}
 				}
+				info = itable_lookup(q->job_table, jobid);
+				if(!jobid || !info)
+					continue;
 
 				debug(D_BATCH, "line: %s", line);
 
@@ -158,6 +309,7 @@ batch_job_id_t batch_job_wait_condor(struct batch_queue * q, struct batch_job_in
 					debug(D_BATCH, "job %d running now", jobid);
 				} else if(type == 9) {
 					itable_remove(q->job_table, jobid);
+					batch_job_name_remove(q, jobid);
 
 					info->finished = current;
 					info->exited_normally = 0;
@@ -170,6 +322,7 @@ batch_job_id_t batch_job_wait_condor(struct batch_queue * q, struct batch_job_in
 					return jobid;
 				} else if(type == 5) {
 					itable_remove(q->job_table, jobid);
+					batch_job_name_remove(q, jobid);
 
 					info->finished = current;
 
@@ -211,9 +364,52 @@ batch_job_id_t batch_job_wait_condor(struct batch_queue * q, struct batch_job_in
 	return -1;
 }
 
+/*
+A job of an earlier run that has not been seen in the log yet is found
+by the note of its submit event, which names its cluster and process.
+Logs written before jobids were kept apart across runs may hold several
+submissions with the same jobid, so the most recent is taken.
+*/
+static int condor_find_submitted(struct batch_queue *q, batch_job_id_t jobid, int *cluster, int *proc)
+{
+	FILE *file;
+	char line[BATCH_JOB_LINE_MAX];
+	int type, c, p, subproc;
+	int found = 0;
+
+	file = fopen(q->logfile, "r");
+	if(!file)
+		return 0;
+
+	while(fgets(line, sizeof(line), file)) {
+		if(sscanf(line, "%d (%d.%d.%d)", &type, &c, &p, &subproc) == 4 && type == 0) {
+			if(condor_read_note(file) == jobid) {
+				*cluster = c;
+				*proc = p;
+				found = 1;
+			}
+		}
+	}
+
+	fclose(file);
+	return found;
+}
+
 int batch_job_remove_condor(struct batch_queue *q, batch_job_id_t jobid)
 {
-	char *command = string_format("condor_rm %d", jobid);
+	const char *name = batch_job_name_lookup(q, jobid);
+	char *command;
+
+	if(name) {
+		command = string_format("condor_rm %s", name);
+	} else {
+		int cluster, proc;
+		if(!condor_find_submitted(q, jobid, &cluster, &proc)) {
+			debug(D_BATCH, "job %d was not submitted through %s", jobid, q->logfile);
+			return 0;
+		}
+		command = string_format("condor_rm -constraint 'ClusterId == %d && ProcId == %d && BatchJobId == %d'", cluster, proc, jobid);
+	}
 
 	debug(D_BATCH, "%s", command);
 	FILE *file = popen(command, "r");
@@ -2,6 +2,7 @@
 #define BATCH_JOB_INTERNAL_H_
 
 #include "batch_job.h"
+#include "hash_table.h"
 #include "itable.h"
 #include "mpi_queue.h"
 #include "work_queue.h"
@@ -16,8 +17,21 @@ struct batch_queue {
 	struct itable *output_table;
 	struct work_queue *work_queue;
 	struct mpi_queue *mpi_queue;
+	struct link *wakeup_link;
+	struct itable *job_names;	/* Name of each job in the underlying system, by jobid. */
+	struct hash_table *job_ids;	/* Jobid of each job, by name in the underlying system. */
+	batch_job_id_t next_jobid;
 };
 
+/* Queue types that submit several jobs with one command, and so cannot
+ * use the identifier of the underlying system as the jobid, assign their
+ * own jobids, counting up from next_jobid, and map each to and from the
+ * name of the job there. */
+void batch_job_name_insert(struct batch_queue *q, batch_job_id_t jobid, const char *name);
+const char *batch_job_name_lookup(struct batch_queue *q, batch_job_id_t jobid);
+batch_job_id_t batch_job_name_to_id(struct batch_queue *q, const char *name);
+void batch_job_name_remove(struct batch_queue *q, batch_job_id_t jobid);
+
 batch_job_id_t batch_job_submit_simple_local(struct batch_queue * q, const char *cmd, const char *extra_input_files, const char *extra_output_files);
 batch_job_id_t batch_job_submit_local(struct batch_queue * q, const char *cmd, const char *args, const char *infile, const char *outfile, const char *errfile, const char *extra_input_files, const char *extra_output_files);
 batch_job_id_t batch_job_wait_local(struct batch_queue * q, struct batch_job_info * info_out, time_t stoptime);
@@ -27,12 +41,14 @@ batch_job_id_t batch_job_submit_simple_condor(struct batch_queue * q, const char
 batch_job_id_t batch_job_submit_condor(struct batch_queue * q, const char *cmd, const char *args, const char *infile, const char *outfile, const char *errfile, const char *extra_input_files, const char *extra_output_files);
 batch_job_id_t batch_job_wait_condor(struct batch_queue * q, struct batch_job_info * info_out, time_t stoptime);
 int batch_job_remove_condor(struct batch_queue *q, batch_job_id_t jobid);
+int batch_job_submit_simple_batch_condor(struct batch_queue *q, struct batch_job_submission *jobs, int count);
 
 int batch_job_setup_cluster(struct batch_queue *q);
 batch_job_id_t batch_job_submit_simple_cluster(struct batch_queue * q, const char *cmd, const char *extra_input_files, const char *extra_output_files);
 batch_job_id_t batch_job_submit_cluster(struct batch_queue * q, const char *cmd, const char *args, const char *infile, const char *outfile, const char *errfile, const char *extra_input_files, const char *extra_output_files);
 batch_job_id_t batch_job_wait_cluster(struct batch_queue * q, struct batch_job_info * info_out, time_t stoptime);
 int batch_job_remove_cluster(struct batch_queue *q, batch_job_id_t jobid);
+int batch_job_submit_simple_batch_cluster(struct batch_queue *q, struct batch_job_submission *jobs, int count);
 
 batch_job_id_t batch_job_submit_simple_moab(struct batch_queue * q, const char *cmd, const char *extra_input_files, const char *extra_output_files);
 batch_job_id_t batch_job_submit_moab(struct batch_queue * q, const char *cmd, const char *args, const char *infile, const char *outfile, const char *errfile, const char *extra_input_files, const char *extra_output_files);
@@ -40,6 +56,7 @@ batch_job_id_t batch_job_wait_moab(struct batch_queue * q, struct batch_job_info
 int batch_job_remove_moab(struct batch_queue *q, batch_job_id_t jobid);
 
 batch_job_id_t batch_job_submit_simple_work_queue(struct batch_queue * q, const char *cmd, const char *extra_input_files, const char *extra_output_files);
+int batch_job_submit_simple_batch_work_queue(struct batch_queue *q, struct batch_job_submission *jobs, int count);
 batch_job_id_t batch_job_submit_work_queue(struct batch_queue * q, const char *cmd, const char *args, const char *infile, const char *outfile, const char *errfile, const char *extra_input_files, const char *extra_output_files);
 batch_job_id_t batch_job_wait_work_queue(struct batch_queue * q, struct batch_job_info * info_out, time_t stoptime);
 int batch_job_remove_work_queue(struct batch_queue *q, batch_job_id_t jobid);
@@ -10,13 +10,16 @@
 #include <string.h>
 #include <errno.h>
 #include <signal.h>
+#include <unistd.h>
 
 batch_job_id_t batch_job_submit_simple_local(struct batch_queue *q, const char *cmd, const char *extra_input_files, const char *extra_output_files)
 {
 	batch_job_id_t jobid;
 
+	/* The child only runs the shell, so vfork spares a large parent,
+	 * such as Makeflow with a big workflow, from copying its memory map. */
 	fflush(NULL);
-	jobid = fork();
+	jobid = vfork();
 	if(jobid > 0) {
 		debug(D_BATCH, "started process %d: %s", jobid, cmd);
 		struct batch_job_info *info = malloc(sizeof(*info));
@@ -1,6 +1,9 @@
 #include "batch_job.h"
 #include "batch_job_internal.h"
 #include "work_queue.h"
+#include "work_queue_internal.h"
+#include "link.h"
+#include "list.h"
 #include "debug.h"
 #include "stringtools.h"
 #include "macros.h"
@@ -9,6 +12,8 @@
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
+#include <unistd.h>
+#include <sys/wait.h>
 
 
 void specify_work_queue_task_files(struct work_queue_task *t, const char *input_files, const char *output_files)
@@ -172,6 +177,69 @@ batch_job_id_t batch_job_submit_simple_work_queue(struct batch_queue * q, const
 	return t->taskid;
 }
 
+/* Specify files named by an array rather than a string. On a shared
+ * filesystem, the workers see each file by its local name, made absolute
+ * against cwd, so remote names are not used there, as before. */
+static void specify_work_queue_task_file_array(struct work_queue_task *t, struct batch_job_file *files, int count, int type, const char *cwd)
+{
+	const char *local, *remote;
+	char *path = NULL;
+	int i;
+
+	for(i = 0; i < count; i++) {
+		local = files[i].local_name;
+		remote = files[i].remote_name ? files[i].remote_name : local;
+
+		if(cwd) {
+			if(local[0] != '/') {
+				free(path);
+				path = string_format("%s/%s", cwd, local);
+				local = path;
+			}
+			remote = local;
+			if(type == WORK_QUEUE_INPUT) {
+				work_queue_task_specify_file(t, local, remote, WORK_QUEUE_INPUT, WORK_QUEUE_CACHE | WORK_QUEUE_THIRDGET);
+			} else {
+				work_queue_task_specify_file(t, local, remote, WORK_QUEUE_OUTPUT, WORK_QUEUE_THIRDPUT);
+			}
+		} else if(type == WORK_QUEUE_INPUT) {
+			work_queue_task_specify_input_file(t, local, remote);
+		} else {
+			work_queue_task_specify_output_file(t, remote, local);
+		}
+	}
+
+	free(path);
+}
+
+int batch_job_submit_simple_batch_work_queue(struct batch_queue *q, struct batch_job_submission *jobs, int count)
+{
+	struct work_queue_task *t;
+	char *cwd = NULL;
+	int i;
+
+	if(q->type == BATCH_QUEUE_TYPE_WORK_QUEUE_SHAREDFS)
+		cwd = string_getcwd();
+
+	for(i = 0; i < count; i++) {
+		if(!jobs[i].inputs && !jobs[i].outputs) {
+			jobs[i].jobid = batch_job_submit_simple_work_queue(q, jobs[i].cmdline, jobs[i].input_files, jobs[i].output_files);
+			continue;
+		}
+
+		t = work_queue_task_create(jobs[i].cmdline);
+		specify_work_queue_task_file_array(t, jobs[i].inputs, jobs[i].input_count, WORK_QUEUE_INPUT, cwd);
+		specify_work_queue_task_file_array(t, jobs[i].outputs, jobs[i].output_count, WORK_QUEUE_OUTPUT, cwd);
+		work_queue_submit(q->work_queue, t);
+
+		jobs[i].jobid = t->taskid;
+	}
+
+	free(cwd);
+
+	return count;
+}
+
 batch_job_id_t batch_job_wait_work_queue(struct batch_queue * q, struct batch_job_info * info, time_t stoptime)
 {
 	static FILE *logfile = 0;
@@ -193,14 +261,43 @@ batch_job_id_t batch_job_wait_work_queue(struct batch_queue * q, struct batch_jo
 		timeout = MAX(0, stoptime - time(0));
 	}
 
-	struct work_queue_task *t = work_queue_wait(q->work_queue, timeout);
+	struct work_queue_task *t;
+	int woken = 0;
+
+	if(q->wakeup_link) {
+		struct list *aux_links = list_create();
+		struct list *active_links = list_create();
+		char buffer[64];
+
+		list_push_tail(aux_links, q->wakeup_link);
+		t = work_queue_wait_internal(q->work_queue, timeout, aux_links, active_links);
+
+		if(list_size(active_links) > 0) {
+			while(read(link_fd(q->wakeup_link), buffer, sizeof(buffer)) > 0) {
+			}
+			woken = 1;
+		}
+
+		list_delete(aux_links);
+		list_delete(active_links);
+	} else {
+		t = work_queue_wait(q->work_queue, timeout);
+	}
+
 	if(t) {
 		info->submitted = t->time_task_submit / 1000000;
 		info->started = t->time_send_input_start / 1000000;
 		info->finished = t->time_receive_output_finish / 1000000;
-		info->exited_normally = 1;
-		info->exit_code = t->return_status;
-		info->exit_signal = 0;
+		/* The worker reports the status of the command as returned by wait. */
+		if(t->return_status >= 0 && WIFSIGNALED(t->return_status)) {
+			info->exited_normally = 0;
+			info->exit_code = 0;
+			info->exit_signal = WTERMSIG(t->return_status);
+		} else {
+			info->exited_normally = 1;
+			info->exit_code = t->return_status >= 0 ? WEXITSTATUS(t->return_status) : t->return_status;
+			info->exit_signal = 0;
+		}
 
 		/*
 		   If the standard ouput of the job is not empty,
@@ -267,6 +364,10 @@ batch_job_id_t batch_job_wait_work_queue(struct batch_queue * q, struct batch_jo
 		return taskid;
 	}
 
+	if(woken) {
+		return -1;
+	}
+
 	if(work_queue_empty(q->work_queue)) {
 		return 0;
 	} else {
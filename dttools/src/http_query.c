@@ -11,6 +11,9 @@ See the file COPYING for details.
 #include "debug.h"
 #include "domain_name.h"
 #include "url_encode.h"
+#include "hash_table.h"
+#include "list.h"
+#include "macros.h"
 
 #include <errno.h>
 #include <string.h>
@@ -18,10 +21,16 @@ See the file COPYING for details.
 #include <stdio.h>
 #include <stdlib.h>
 #include <ctype.h>
+#include <time.h>
 
 #define HTTP_LINE_MAX 4096
 #define HTTP_PORT 80
 
+#define HTTP_POOL_SIZE 8
+#define HTTP_POOL_TIMEOUT 15
+
+static struct link *http_query_range_common(const char *proxy, const char *urlin, const char *action, INT64_T offset, INT64_T length, INT64_T * size, time_t stoptime, int cache_reload, int *keepalive);
+
 static int http_response_to_errno(int response)
 {
 	if(response <= 299) {
@@ -83,7 +92,148 @@ struct link *http_query_size(const char *url, const char *action, INT64_T * size
 	}
 }
 
-struct link *http_query_size_via_proxy(const char *proxy, const char *urlin, const char *action, INT64_T * size, time_t stoptime, int cache_reload)
+static struct link *http_query_range_proxies(const char *url, const char *action, INT64_T offset, INT64_T length, INT64_T * size, time_t stoptime, int cache_reload, int *keepalive)
+{
+	if(!getenv("HTTP_PROXY")) {
+		return http_query_range_common(0, url, action, offset, length, size, stoptime, cache_reload, keepalive);
+	} else {
+		char proxies[HTTP_LINE_MAX];
+		char *proxy;
+
+		strcpy(proxies, getenv("HTTP_PROXY"));
+		proxy = strtok(proxies, ";");
+
+		while(proxy) {
+			struct link *result;
+			result = http_query_range_common(proxy, url, action, offset, length, size, stoptime, cache_reload, keepalive);
+			if(result)
+				return result;
+			proxy = strtok(0, ";");
+		}
+		return 0;
+	}
+}
+
+struct link *http_query_range(const char *url, const char *action, INT64_T offset, INT64_T length, INT64_T * size, time_t stoptime, int cache_reload)
+{
+	return http_query_range_proxies(url, action, offset, length, size, stoptime, cache_reload, 0);
+}
+
+struct link *http_query_range_keepalive(const char *url, const char *action, INT64_T offset, INT64_T length, INT64_T * size, time_t stoptime, int cache_reload, int *keepalive)
+{
+	*keepalive = 0;
+	return http_query_range_proxies(url, action, offset, length, size, stoptime, cache_reload, keepalive);
+}
+
+/*
+Connections released after a complete keep-alive response are kept
+in a pool for each server address and port, most recently used first.
+A connection that has been idle too long, or that has become readable
+while idle, which means that the server has closed it, is discarded
+rather than reused.
+*/
+
+struct http_idle {
+	struct link *link;
+	time_t last_used;
+};
+
+static struct hash_table *idle_table = 0;
+
+static struct list *pool_lookup(const char *addr, int port)
+{
+	char key[LINK_ADDRESS_MAX + 16];
+	struct list *pool;
+
+	if(!idle_table)
+		idle_table = hash_table_create(0, 0);
+
+	sprintf(key, "%s:%d", addr, port);
+	pool = hash_table_lookup(idle_table, key);
+	if(!pool) {
+		pool = list_create();
+		hash_table_insert(idle_table, key, pool);
+	}
+
+	return pool;
+}
+
+static struct link *pool_get(const char *addr, int port)
+{
+	struct list *pool = pool_lookup(addr, port);
+	struct http_idle *idle;
+	struct link_info info;
+	time_t now = time(0);
+
+	while((idle = list_pop_head(pool))) {
+		struct link *link = idle->link;
+		int expired = (now - idle->last_used) >= HTTP_POOL_TIMEOUT;
+		free(idle);
+
+		info.link = link;
+		info.events = LINK_READ;
+		info.revents = 0;
+
+		if(expired || !link_buffer_empty(link) || link_poll(&info, 1, 0) != 0) {
+			debug(D_HTTP, "discarding idle connection to %s port %d", addr, port);
+			link_close(link);
+			continue;
+		}
+
+		return link;
+	}
+
+	return 0;
+}
+
+void http_query_release(struct link *link)
+{
+	char addr[LINK_ADDRESS_MAX];
+	int port;
+	struct list *pool;
+	struct http_idle *idle;
+
+	if(!link_address_remote(link, addr, &port)) {
+		link_close(link);
+		return;
+	}
+
+	pool = pool_lookup(addr, port);
+	if(list_size(pool) >= HTTP_POOL_SIZE) {
+		link_close(link);
+		return;
+	}
+
+	idle = malloc(sizeof(*idle));
+	if(!idle) {
+		link_close(link);
+		return;
+	}
+
+	idle->link = link;
+	idle->last_used = time(0);
+	list_push_head(pool, idle);
+}
+
+struct link *http_query_size_via_proxy(const char *proxy, const char *url, const char *action, INT64_T * size, time_t stoptime, int cache_reload)
+{
+	return http_query_range_via_proxy(proxy, url, action, 0, -1, size, stoptime, cache_reload);
+}
+
+struct link *http_query_range_via_proxy(const char *proxy, const char *url, const char *action, INT64_T offset, INT64_T length, INT64_T * size, time_t stoptime, int cache_reload)
+{
+	return http_query_range_common(proxy, url, action, offset, length, size, stoptime, cache_reload, 0);
+}
+
+/*
+If keepalive is given, the connection is taken from the idle pool
+when possible, and *keepalive is set if the server has promised to
+leave it open after sending exactly *size bytes of body.  A pooled
+connection that fails before a response arrives is replaced by a
+fresh one, since the server may have closed it at any time.
+*/
+
+static struct link *http_query_range_common(const char *proxy, const char *urlin, const char *action, INT64_T offset, INT64_T length, INT64_T * size, time_t stoptime, int cache_reload, int *keepalive)
 {
 	char url[HTTP_LINE_MAX];
 	char newurl[HTTP_LINE_MAX];
@@ -93,7 +243,16 @@ struct link *http_query_size_via_proxy(const char *proxy, const char *urlin, con
 	int save_errno;
 	int response;
 	char actual_host[HTTP_LINE_MAX];
+	char range[HTTP_LINE_MAX];
 	int actual_port;
+	int ranged = (offset > 0 || length >= 0);
+	int reused = 0;
+	int closing = 0;
+	int have_size = 0;
+	int got_line;
+	int major, minor;
+	char connection_reply[HTTP_LINE_MAX];
+	const char *connection = keepalive ? "keep-alive" : "close";
 	*size = 0;
 
 	url_encode(urlin, url, sizeof(url));
@@ -128,31 +287,67 @@ struct link *http_query_size_via_proxy(const char *proxy, const char *urlin, con
 	if(!domain_name_lookup(actual_host, addr))
 		return 0;
 
-	link = link_connect(addr, actual_port, stoptime);
-	if(!link) {
-		errno = ECONNRESET;
-		return 0;
+	if(keepalive && (link = pool_get(addr, actual_port))) {
+		debug(D_HTTP, "reusing connection to %s port %d", actual_host, actual_port);
+		reused = 1;
+	} else {
+		link = link_connect(addr, actual_port, stoptime);
+		if(!link) {
+			errno = ECONNRESET;
+			return 0;
+		}
+	}
+
+      retry:
+
+	if(!ranged) {
+		range[0] = 0;
+	} else if(length >= 0) {
+		sprintf(range, "Range: bytes=%" PRId64 "-%" PRId64 "\r\n", offset, offset + length - 1);
+	} else {
+		sprintf(range, "Range: bytes=%" PRId64 "-\r\n", offset);
 	}
 
 	if(cache_reload == 0) {
-		debug(D_HTTP, "%s %s HTTP/1.1\r\nHost: %s\r\nConnection: close\r\n\r\n", action, url, actual_host);
-		link_putfstring(link, "%s %s HTTP/1.1\r\nHost: %s\r\nConnection: close\r\n\r\n", stoptime, action, url, actual_host);
+		debug(D_HTTP, "%s %s HTTP/1.1\r\nHost: %s\r\n%sConnection: %s\r\n\r\n", action, url, actual_host, range, connection);
+		link_putfstring(link, "%s %s HTTP/1.1\r\nHost: %s\r\n%sConnection: %s\r\n\r\n", stoptime, action, url, actual_host, range, connection);
 	} else {
 		//  force refresh of cache end-to-end (RFC 2616)
-		debug(D_HTTP, "%s %s HTTP/1.1\r\nHost: %s\r\nCache-Control: max-age=0\r\nConnection: close\r\n\r\n", action, url, actual_host);
-		link_putfstring(link, "%s %s HTTP/1.1\r\nHost: %s\r\nCache-Control: max-age=0\r\nConnection: close\r\n\r\n", stoptime, action, url, actual_host);
+		debug(D_HTTP, "%s %s HTTP/1.1\r\nHost: %s\r\n%sCache-Control: max-age=0\r\nConnection: %s\r\n\r\n", action, url, actual_host, range, connection);
+		link_putfstring(link, "%s %s HTTP/1.1\r\nHost: %s\r\n%sCache-Control: max-age=0\r\nConnection: %s\r\n\r\n", stoptime, action, url, actual_host, range, connection);
+	}
+
+	got_line = link_readline(link, line, HTTP_LINE_MAX, stoptime);
+	if(!got_line && reused) {
+		debug(D_HTTP, "idle connection to %s port %d was closed, reconnecting", actual_host, actual_port);
+		link_close(link);
+		reused = 0;
+		link = link_connect(addr, actual_port, stoptime);
+		if(!link) {
+			errno = ECONNRESET;
+			return 0;
+		}
+		goto retry;
 	}
 
-	if(link_readline(link, line, HTTP_LINE_MAX, stoptime)) {
+	if(got_line) {
 		string_chomp(line);
 		debug(D_HTTP, "%s", line);
-		if(sscanf(line, "HTTP/%*d.%*d %d", &response) == 1) {
+		if(sscanf(line, "HTTP/%d.%d %d", &major, &minor, &response) == 3) {
 			newurl[0] = 0;
+			closing = (major == 1 && minor == 0);
 			while(link_readline(link, line, HTTP_LINE_MAX, stoptime)) {
 				string_chomp(line);
 				debug(D_HTTP, "%s", line);
 				sscanf(line, "Location: %s", newurl);
-				sscanf(line, "Content-Length: %" SCNd64, size);
+				if(sscanf(line, "Content-Length: %" SCNd64, size) == 1)
+					have_size = 1;
+				if(sscanf(line, "Connection: %s", connection_reply) == 1) {
+					if(!strcasecmp(connection_reply, "close"))
+						closing = 1;
+					else if(!strcasecmp(connection_reply, "keep-alive"))
+						closing = 0;
+				}
 				if(strlen(line) <= 2) {
 					break;
 				}
@@ -160,6 +355,27 @@ struct link *http_query_size_via_proxy(const char *proxy, const char *urlin, con
 
 			switch (response) {
 			case 200:
+				/*
+				A server that does not support ranges sends the whole
+				object, so skip over the part that was not wanted.
+				*/
+				if(ranged && strcmp(action, "HEAD")) {
+					if(offset > 0) {
+						if(link_soak(link, offset, stoptime) != offset) {
+							link_close(link);
+							errno = ECONNRESET;
+							return 0;
+						}
+					}
+					*size = MAX(*size - offset, 0);
+					if(length >= 0)
+						*size = MIN(*size, length);
+				}
+				return link;
+				break;
+			case 206:
+				if(keepalive)
+					*keepalive = have_size && !closing;
 				return link;
 				break;
 			case 301:
@@ -172,6 +388,10 @@ struct link *http_query_size_via_proxy(const char *proxy, const char *urlin, con
 						debug(D_HTTP, "error: server gave %d redirect from %s back to the same url!", response, url);
 						errno = EIO;
 						return 0;
+					} else if(keepalive) {
+						return http_query_range_keepalive(newurl, action, offset, length, size, stoptime, cache_reload, keepalive);
+					} else if(ranged) {
+						return http_query_range(newurl, action, offset, length, size, stoptime, cache_reload);
 					} else {
 						return http_query(newurl, action, stoptime);
 					}
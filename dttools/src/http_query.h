@@ -15,6 +15,10 @@ struct link *http_query(const char *url, const char *action, time_t stoptime);
 struct link *http_query_no_cache(const char *url, const char *action, time_t stoptime);
 struct link *http_query_size(const char *url, const char *action, INT64_T * size, time_t stoptime, int cache_reload);
 struct link *http_query_size_via_proxy(const char *proxy, const char *url, const char *action, INT64_T * size, time_t stoptime, int cache_reload);
+struct link *http_query_range(const char *url, const char *action, INT64_T offset, INT64_T length, INT64_T * size, time_t stoptime, int cache_reload);
+struct link *http_query_range_via_proxy(const char *proxy, const char *url, const char *action, INT64_T offset, INT64_T length, INT64_T * size, time_t stoptime, int cache_reload);
+struct link *http_query_range_keepalive(const char *url, const char *action, INT64_T offset, INT64_T length, INT64_T * size, time_t stoptime, int cache_reload, int *keepalive);
+void http_query_release(struct link *link);
 
 INT64_T http_fetch_to_file(const char *url, const char *filename, time_t stoptime);
 
@@ -15,8 +15,11 @@ See the file COPYING for details.
 #include <unistd.h>
 #include <stdlib.h>
 #include <signal.h>
+#include <fcntl.h>
+#include <errno.h>
 
 static struct list *complete_list = 0;
+static int notify_pipe[2] = { -1, -1 };
 
 static void alarm_handler(int sig)
 {
@@ -94,3 +97,40 @@ int process_pending()
 
 	return process_work(0);
 }
+
+static void sigchld_handler(int sig)
+{
+	int saved_errno = errno;
+	char c = 0;
+	ssize_t result;
+
+	/* If the pipe is full, a wakeup is already pending anyway. */
+	result = write(notify_pipe[1], &c, 1);
+	(void) result;
+
+	errno = saved_errno;
+}
+
+int process_notify_fd()
+{
+	struct sigaction action;
+	int i;
+
+	if(notify_pipe[0] >= 0)
+		return notify_pipe[0];
+
+	if(pipe(notify_pipe) < 0)
+		return -1;
+
+	for(i = 0; i < 2; i++) {
+		fcntl(notify_pipe[i], F_SETFL, fcntl(notify_pipe[i], F_GETFL) | O_NONBLOCK);
+		fcntl(notify_pipe[i], F_SETFD, FD_CLOEXEC);
+	}
+
+	action.sa_handler = sigchld_handler;
+	sigemptyset(&action.sa_mask);
+	action.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+	sigaction(SIGCHLD, &action, NULL);
+
+	return notify_pipe[0];
+}
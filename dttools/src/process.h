@@ -59,6 +59,16 @@ int process_pending();
 
 void process_putback(struct process_info *p);
 
+/** Get a file descriptor that becomes readable when a child process completes.
+The first call installs a handler for <tt>SIGCHLD</tt> that writes to a pipe,
+so that a program may wait for child processes and other events at once,
+for example with <tt>poll</tt> or @ref batch_queue_set_wakeup_fd.
+The descriptor only signals that @ref process_wait may have something to return;
+the caller should drain it before calling @ref process_wait with a timeout of zero.
+@return A readable, non-blocking file descriptor, or -1 on failure.
+*/
+int process_notify_fd();
+
 
 
 #endif
@@ -70,6 +70,7 @@ int text_array_set(struct text_array *t, int x, int y, const char *c)
 		value = 0;
 	}
 
+	free(t->data[y * t->width + x]);
 	t->data[y * t->width + x] = value;
 
 	return 1;
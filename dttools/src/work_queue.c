@@ -34,6 +34,8 @@ See the file COPYING for details.
 #include "random_init.h"
 
 #include <unistd.h>
+#include <pthread.h>
+#include <signal.h>
 #include <dirent.h>
 #include <fcntl.h>
 #include <sys/stat.h>
@@ -80,6 +82,9 @@ static const char *work_queue_state_names[] = {"init","ready","busy","full","non
 
 #define MIN_TIME_LIST_SIZE 20
 
+#define STAT_THREADS_MAX 8
+#define STAT_THREAD_FILES_MIN 16	/* Fewer input files are checked without threads. */
+
 #define TIME_SLOT_TASK_TRANSFER 0
 #define TIME_SLOT_TASK_EXECUTE 1
 #define TIME_SLOT_MASTER_IDLE 2
@@ -235,7 +240,7 @@ struct work_queue_file {
 	char *remote_name;	// name on remote machine.
 };
 
-static int start_task_on_worker(struct work_queue *q, struct work_queue_worker *w);
+static int start_task_on_worker(struct work_queue *q, struct work_queue_worker *w, struct work_queue_task *t);
 
 static struct task_statistics *task_statistics_init();
 static void add_time_slot(struct work_queue *q, timestamp_t start, timestamp_t duration, int type, timestamp_t * accumulated_time, struct list *time_list);
@@ -1736,6 +1741,132 @@ static int send_output_files(struct work_queue_task *t, struct work_queue_worker
 
 }
 
+struct stat_job {
+	char **names;
+	int count;
+	int next;
+	int failed;	/* Lowest index of a name that could not be stat'ed, or count. */
+	int error;	/* The errno of that failure. */
+};
+
+/*
+Threads that check input files are started as they are first needed,
+and then wait for the next task with many inputs, rather than being
+started and joined for every task.  The mutex guards the pool and the
+job being worked on.
+*/
+
+static struct {
+	pthread_mutex_t mutex;
+	pthread_cond_t work;	/* Signalled when a job is posted. */
+	pthread_cond_t done;	/* Signalled when a thread leaves a job, or a job is finished. */
+	struct stat_job *job;
+	int generation;		/* Counts jobs posted, so that a thread joins each only once. */
+	int nthreads;
+	int busy;		/* Threads still working on the current job. */
+} stat_pool = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, 0, 0, 0 };
+
+/* Called and returns with the pool mutex held, releasing it during each stat. */
+static void stat_job_run(struct stat_job *j)
+{
+	struct stat info;
+	int i, result, error;
+
+	while((i = j->next++) < j->count) {
+		pthread_mutex_unlock(&stat_pool.mutex);
+		result = stat(j->names[i], &info);
+		error = errno;
+		pthread_mutex_lock(&stat_pool.mutex);
+
+		if(result != 0 && i < j->failed) {
+			j->failed = i;
+			j->error = error;
+		}
+	}
+}
+
+static void *stat_pool_thread(void *arg)
+{
+	int generation = 0;
+
+	pthread_mutex_lock(&stat_pool.mutex);
+	while(1) {
+		while(!stat_pool.job || stat_pool.generation == generation)
+			pthread_cond_wait(&stat_pool.work, &stat_pool.mutex);
+
+		generation = stat_pool.generation;
+		stat_pool.busy++;
+		stat_job_run(stat_pool.job);
+		stat_pool.busy--;
+		pthread_cond_broadcast(&stat_pool.done);
+	}
+
+	return NULL;
+}
+
+/* Called with the pool mutex held. Signals are left to the main thread. */
+static void stat_pool_grow(int nthreads)
+{
+	sigset_t all, old;
+	pthread_t thread;
+
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+
+	while(stat_pool.nthreads < nthreads) {
+		if(pthread_create(&thread, NULL, stat_pool_thread, NULL) != 0)
+			break;
+		pthread_detach(thread);
+		stat_pool.nthreads++;
+	}
+
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+/* Check that the files exist, returning the index of the first that does
+ * not, with the reason in error, or -1 if all do. On a shared filesystem
+ * each stat may wait on the server, so when a task has many inputs the
+ * threads of the pool check them along with this one. */
+static int stat_files(char **names, int count, int *error)
+{
+	struct stat_job j;
+
+	j.names = names;
+	j.count = count;
+	j.next = 0;
+	j.failed = count;
+	j.error = 0;
+
+	pthread_mutex_lock(&stat_pool.mutex);
+
+	if(count >= STAT_THREAD_FILES_MIN) {
+		while(stat_pool.job)
+			pthread_cond_wait(&stat_pool.done, &stat_pool.mutex);
+
+		stat_pool_grow(MIN(STAT_THREADS_MAX, count / STAT_THREAD_FILES_MIN + 1));
+
+		stat_pool.job = &j;
+		stat_pool.generation++;
+		pthread_cond_broadcast(&stat_pool.work);
+	}
+
+	/* This thread checks files as well, and alone if there is no pool. */
+	stat_job_run(&j);
+
+	if(stat_pool.job == &j) {
+		stat_pool.job = NULL;
+		while(stat_pool.busy > 0)
+			pthread_cond_wait(&stat_pool.done, &stat_pool.mutex);
+		pthread_cond_broadcast(&stat_pool.done);
+	}
+
+	pthread_mutex_unlock(&stat_pool.mutex);
+
+	*error = j.error;
+
+	return j.failed < count ? j.failed : -1;
+}
+
 static int send_input_files(struct work_queue_task *t, struct work_queue_worker *w, struct work_queue *q)
 {
 	struct work_queue_file *tf;
@@ -1746,11 +1877,13 @@ static int send_input_files(struct work_queue_task *t, struct work_queue_worker
 	timestamp_t sum_time = 0;
 	int fl;
 	time_t stoptime;
-	struct stat s;
 	char *expanded_payload = NULL;
 
 	// Check input existence
 	if(t->input_files) {
+		char **names = xxmalloc(sizeof(*names) * (list_size(t->input_files) + 1));
+		int count = 0, missing, error, i;
+
 		list_first_item(t->input_files);
 		while((tf = list_next_item(t->input_files))) {
 			if(tf->type == WORK_QUEUE_FILE || tf->type == WORK_QUEUE_FILE_PIECE) {
@@ -1760,14 +1893,20 @@ static int send_input_files(struct work_queue_task *t, struct work_queue_worker
 				} else {
 					expanded_payload = xxstrdup(tf->payload);
 				}
-				if(stat(expanded_payload, &s) != 0) {
-					debug(D_WQ,"Could not stat %s: %s\n", expanded_payload, strerror(errno));
-					free(expanded_payload);
-					goto failure;
-				}
-				free(expanded_payload);
+				names[count++] = expanded_payload;
 			}
 		}
+
+		missing = stat_files(names, count, &error);
+		if(missing >= 0)
+			debug(D_WQ,"Could not stat %s: %s\n", names[missing], strerror(error));
+
+		for(i = 0; i < count; i++)
+			free(names[i]);
+		free(names);
+
+		if(missing >= 0)
+			goto failure;
 	}
 	// Start transfer ...
 	if(t->input_files) {
@@ -2131,11 +2270,35 @@ static struct work_queue_worker *find_worker_by_time(struct work_queue *q)
 	}
 }
 
-// use task-specific algorithm if set, otherwise default to the queue's setting.
+static struct work_queue_worker *find_worker_by_host(struct work_queue *q, const char *host)
+{
+	char *key;
+	struct work_queue_worker *w;
+	hash_table_firstkey(q->worker_table);
+	while(hash_table_nextkey(q->worker_table, &key, (void**)&w)) {
+		if(!strcmp(w->addrport, host)) {
+			return w;
+		}
+	}
+	return NULL;
+}
+
+// use the preferred worker if it is connected, otherwise the task-specific
+// algorithm if set, otherwise default to the queue's setting.
 static struct work_queue_worker *find_best_worker(struct work_queue *q, struct work_queue_task *t)
 {
 	int a = t->worker_selection_algorithm;
 
+	if(t->preferred_host) {
+		struct work_queue_worker *w = find_worker_by_host(q, t->preferred_host);
+		if(w && w->running_tasks < w->nslots) {
+			return w;
+		} else if(w) {
+			debug(D_WQ, "Task %d waits for its preferred worker %s", t->taskid, t->preferred_host);
+			return NULL;
+		}
+	}
+
 	if(a == WORK_QUEUE_SCHEDULE_UNSET) {
 		a = q->worker_selection_algorithm;
 	}
@@ -2157,12 +2320,8 @@ static struct work_queue_worker *find_best_worker(struct work_queue *q, struct w
 	}
 }
 
-static int start_task_on_worker(struct work_queue *q, struct work_queue_worker *w)
+static int start_task_on_worker(struct work_queue *q, struct work_queue_worker *w, struct work_queue_task *t)
 {
-	struct work_queue_task *t = list_pop_head(q->ready_list);
-	if(!t)
-		return 0;
-
 	itable_insert(w->current_tasks, t->taskid, t);
 	itable_insert(q->running_tasks, t->taskid, t); 
 	itable_insert(q->worker_task_map, t->taskid, w); //add worker as execution site for t.
@@ -2188,8 +2347,11 @@ static void start_tasks(struct work_queue *q)
 	struct work_queue_task *t;
 	struct work_queue_worker *w;
 
+	// tasks waiting for a busy preferred worker are set aside, and put back in order.
+	struct list *waiting = list_create();
+
 	while(list_size(q->ready_list) && (q->workers_in_state[WORKER_STATE_READY] || q->workers_in_state[WORKER_STATE_BUSY])) {
-		t = list_peek_head(q->ready_list);
+		t = list_pop_head(q->ready_list);
 		debug(D_WQ, "finding worker for task %d", t->taskid);
 		w = find_best_worker(q, t);
 		if(w) {
@@ -2198,11 +2360,19 @@ static void start_tasks(struct work_queue *q)
 			debug(D_WQ, "No worker found for task %d.", t->taskid);
 		}
 		if(w) {
-			start_task_on_worker(q, w);
+			start_task_on_worker(q, w, t);
+		} else if(t->preferred_host) {
+			list_push_tail(waiting, t);
 		} else {
+			list_push_head(q->ready_list, t);
 			break;
 		}
 	}
+
+	while((t = list_pop_tail(waiting))) {
+		list_push_head(q->ready_list, t);
+	}
+	list_delete(waiting);
 }
 
 static void do_keepalive_checks(struct work_queue *q) {
@@ -2539,6 +2709,13 @@ void work_queue_task_specify_algorithm(struct work_queue_task *t, int alg)
 	t->worker_selection_algorithm = alg;
 }
 
+void work_queue_task_specify_preferred_host(struct work_queue_task *t, const char *host)
+{
+	if(t->preferred_host)
+		free(t->preferred_host);
+	t->preferred_host = xxstrdup(host);
+}
+
 void work_queue_task_delete(struct work_queue_task *t)
 {
 	struct work_queue_file *tf;
@@ -2547,6 +2724,8 @@ void work_queue_task_delete(struct work_queue_task *t)
 			free(t->command_line);
 		if(t->tag)
 			free(t->tag);
+		if(t->preferred_host)
+			free(t->preferred_host);
 		if(t->output)
 			free(t->output);
 		if(t->input_files) {
@@ -2994,6 +3173,12 @@ struct work_queue_task *work_queue_wait_internal(struct work_queue *q, int timeo
 		if( (q->workers_in_state[WORKER_STATE_BUSY] + q->workers_in_state[WORKER_STATE_FULL]) == 0 && list_size(q->ready_list) == 0 && !(aux_links && list_size(aux_links)))
 			break;
 
+		// Start tasks on ready workers, including any submitted since the last call.
+		// This follows the retrieval of the output of finished tasks, so that a worker
+		// removes the uncached files of one task before it receives those of the next,
+		// which may have the same names.
+		start_tasks(q);
+
 		int n = build_poll_table(q, aux_links);
 
 		// Wait no longer than the caller's patience.
@@ -3037,9 +3222,6 @@ struct work_queue_task *work_queue_wait_internal(struct work_queue *q, int timeo
 			}
 		}
 		
-		// Start tasks on ready workers
-		start_tasks(q);
-		
 		// If any worker has sent a results message, retrieve the output files.
 		if(itable_size(q->finished_tasks)) {
 			struct work_queue_worker *w;
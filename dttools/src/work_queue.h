@@ -83,6 +83,7 @@ struct work_queue_task {
 	INT64_T total_bytes_transferred;/**< Number of bytes transferred since task has last started transferring input data. */
 	timestamp_t total_transfer_time;    /**< Time comsumed in microseconds for transferring total_bytes_transferred. */
 	timestamp_t cmd_execution_time;	   /**< Time spent in microseconds for executing the command on the worker. */
+	char *preferred_host;		/**< The address and port of the worker that should run the task, if any. */
 };
 
 /** Statistics describing a work queue. */
@@ -202,6 +203,16 @@ To change the scheduling algorithm for all tasks, use @ref work_queue_specify_al
 */
 void work_queue_task_specify_algorithm(struct work_queue_task *t, int algo );
 
+/** Prefer a particular worker for a single task.
+While the worker at this address and port is connected, the task waits for
+one of its slots, so that it may use the files already cached there, and
+other tasks may start before it.  If the worker is gone, the task is
+assigned by its scheduling algorithm, as usual.
+@param t A task object.
+@param host The address and port of the worker, as in the host field of a task that it ran.
+*/
+void work_queue_task_specify_preferred_host(struct work_queue_task *t, const char *host);
+
 /** Delete a task.
 This may be called on tasks after they are returned from @ref work_queue_wait.
 @param t The task to delete.
@@ -8,6 +8,7 @@ See the file COPYING for details.
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <sys/stat.h>
 
 #include "debug.h"
 #include "xxmalloc.h"
@@ -15,10 +16,73 @@ See the file COPYING for details.
 #include "itable.h"
 #include "hash_table.h"
 #include "list.h"
-#include "set.h"
 
 #include "dag.h"
 
+/* Nodes, files, and filenames are never freed before the dag itself, so
+ * they are carved out of large blocks, which avoids the time and the
+ * per-allocation overhead of a malloc for each, and keeps the rules of
+ * a large workflow close together in memory. */
+
+#define DAG_ARENA_BLOCK_SIZE (1 << 20)
+#define DAG_ARENA_ALIGN 16
+
+struct dag_arena {
+	char *block;
+	size_t used;
+	size_t size;
+};
+
+static struct dag_arena *dag_arena_create()
+{
+	struct dag_arena *a = xxmalloc(sizeof(*a));
+
+	a->block = NULL;
+	a->used = 0;
+	a->size = 0;
+
+	return a;
+}
+
+/* Returns zeroed memory. Requests larger than a block get a block of
+ * their own, so that the rest of the current block is not wasted. */
+static void *dag_arena_alloc(struct dag_arena *a, size_t size)
+{
+	void *p;
+
+	size = (size + DAG_ARENA_ALIGN - 1) & ~((size_t) DAG_ARENA_ALIGN - 1);
+
+	if(size > DAG_ARENA_BLOCK_SIZE / 4) {
+		p = calloc(1, size);
+		if(!p)
+			fatal("makeflow: out of memory");
+		return p;
+	}
+
+	if(a->used + size > a->size) {
+		a->block = calloc(1, DAG_ARENA_BLOCK_SIZE);
+		if(!a->block)
+			fatal("makeflow: out of memory");
+		a->used = 0;
+		a->size = DAG_ARENA_BLOCK_SIZE;
+	}
+
+	p = a->block + a->used;
+	a->used += size;
+
+	return p;
+}
+
+static char *dag_arena_strdup(struct dag_arena *a, const char *s)
+{
+	size_t length = strlen(s) + 1;
+	char *p = dag_arena_alloc(a, length);
+
+	memcpy(p, s, length);
+
+	return p;
+}
+
 struct dag *dag_create()
 {
 	struct dag *d = malloc(sizeof(*d));
@@ -46,10 +110,16 @@ struct dag *dag_create()
 		d->remote_jobs_max = MAX_REMOTE_JOBS_DEFAULT;
 		d->nodeid_counter = 0;
 		d->collect_table = hash_table_create(0, 0);
+		d->collect_queue = list_create();
 		d->export_list = list_create();
 
 		d->task_categories = hash_table_create(0, 0);
 
+		d->local_ready = dag_ready_queue_create();
+		d->remote_ready = dag_ready_queue_create();
+
+		d->arena = dag_arena_create();
+
 		/* Add _MAKEFLOW_COLLECT_LIST to variables table to ensure it is in
 		 * global DAG scope. */
 		hash_table_insert(d->variables, "_MAKEFLOW_COLLECT_LIST", xxstrdup(""));
@@ -59,43 +129,61 @@ struct dag *dag_create()
 	}
 }
 
+/* Fill the ancestor and descendant arrays of every node from the files
+ * they share. The first pass only counts, so that each array is allocated
+ * once at its exact size, and the second fills them. A node that needs
+ * several files made by the same rule lists that rule only once: the
+ * mark on the ancestor records the last node to list it. */
 void dag_compile_ancestors(struct dag *d)
 {
-  struct dag_node *n, *m;
-  struct dag_file *f; 
-  char  *name;
-
-  hash_table_firstkey(d->file_table);
-  while( hash_table_nextkey(d->file_table, &name, (void **) &f) )
-  {
-    m = f->target_of;
-    
-    if(!m)
-      continue;
+	struct dag_node *n, *m;
+	struct dag_file *f;
+	int pass;
+
+	for(pass = 0; pass < 2; pass++) {
+		for(n = d->nodes; n; n = n->next) {
+			list_first_item(n->source_files);
+			while((f = list_next_item(n->source_files))) {
+				m = f->target_of;
+				if(!m || m->ancestor_mark == n)
+					continue;
+				m->ancestor_mark = n;
+
+				if(pass == 0) {
+					n->ancestor_count++;
+					m->descendant_count++;
+				} else {
+					debug(D_DEBUG, "rule %d ancestor of %d\n", m->nodeid, n->nodeid);
+					n->ancestors[n->ancestor_count++] = m;
+					m->descendants[m->descendant_count++] = n;
+				}
+			}
+		}
 
-    list_first_item(f->needed_by);
-    while( (n = list_next_item(f->needed_by)) )
-    {
-      debug(D_DEBUG, "rule %d ancestor of %d\n", m->nodeid, n->nodeid);
-      set_insert(m->descendants, n);
-      set_insert(n->ancestors,   m);
-    }
-  }
+		if(pass == 0) {
+			for(n = d->nodes; n; n = n->next) {
+				n->ancestors = dag_arena_alloc(d->arena, n->ancestor_count * sizeof(*n->ancestors));
+				n->descendants = dag_arena_alloc(d->arena, n->descendant_count * sizeof(*n->descendants));
+				n->ancestor_count = 0;
+				n->descendant_count = 0;
+				n->ancestor_mark = NULL;
+			}
+		}
+	}
 }
 
 int get_ancestor_depth(struct dag_node *n){
 	int group_number = -1;
-	struct dag_node *ancestor = NULL;
+	int i;
 
 	debug(D_DEBUG, "n->ancestor_depth: %d", n->ancestor_depth);
 
 	if(n->ancestor_depth >= 0)
 	{	return n->ancestor_depth;	}
 
-	set_first_element(n->ancestors);
-	while( (ancestor = set_next_element(n->ancestors)) ) {
-		
-		group_number = get_ancestor_depth(ancestor);
+	for(i = 0; i < n->ancestor_count; i++) {
+
+		group_number = get_ancestor_depth(n->ancestors[i]);
 		debug(D_DEBUG, "group: %d, n->ancestor_depth: %d", group_number, n->ancestor_depth);
 		if (group_number > n->ancestor_depth)
 		{	n->ancestor_depth = group_number;	}
@@ -119,28 +207,63 @@ struct dag_node *dag_node_create(struct dag *d, int linenum)
 {
 	struct dag_node *n;
 
-	n = malloc(sizeof(struct dag_node));
-	memset(n, 0, sizeof(struct dag_node));
+	n = dag_arena_alloc(d->arena, sizeof(struct dag_node));
 	n->d = d;
 	n->linenum = linenum;
 	n->state = DAG_NODE_STATE_WAITING;
 	n->nodeid = d->nodeid_counter++;
-	n->variables = hash_table_create(0, 0);
 
+	/* The tables of variables and remote names are created when the
+	 * first entry is added, since most rules have neither. */
 	n->source_files = list_create(0);
 	n->target_files = list_create(0);
 
-	n->remote_names     = itable_create(0);
-	n->remote_names_inv = hash_table_create(0,0);
-
-        n->descendants = set_create(0);
-        n->ancestors   = set_create(0);
-
 	n->ancestor_depth = -1;
 
 	return n;
 }
 
+/* Records the current status of the file, and returns true if it exists. */
+int dag_file_update(struct dag_file *f)
+{
+	struct stat info;
+
+	f->state = DAG_FILE_STATE_CHECKED;
+
+	if(stat(f->filename, &info) != 0) {
+		f->is_dir = 0;
+		f->mtime = 0;
+		f->size = -1;
+		return 0;
+	}
+
+	f->is_dir = S_ISDIR(info.st_mode) ? 1 : 0;
+	f->mtime = info.st_mtime;
+	f->size = info.st_size;
+
+	return 1;
+}
+
+/* Returns true if the file exists, looking at it only the first time
+ * it is asked about. If trust_recorded is set, the status recorded
+ * in a checkpoint is taken as it is, without looking at all. */
+int dag_file_check(struct dag_file *f, int trust_recorded)
+{
+	if(f->state == DAG_FILE_STATE_CHECKED || (f->state == DAG_FILE_STATE_RECORDED && trust_recorded))
+		return f->size >= 0;
+
+	return dag_file_update(f);
+}
+
+/* Records that the file has just been removed by makeflow. */
+void dag_file_set_missing(struct dag_file *f)
+{
+	f->state = DAG_FILE_STATE_CHECKED;
+	f->is_dir = 0;
+	f->mtime = 0;
+	f->size = -1;
+}
+
 /* Returns the struct dag_file for the local filename */
 struct dag_file *dag_file_from_name(struct dag *d, const char *filename)
 {
@@ -150,13 +273,19 @@ struct dag_file *dag_file_from_name(struct dag *d, const char *filename)
 /* Returns the remotename used in rule n for local name filename */
 char *dag_file_remote_name(struct dag_node *n, const char *filename)
 {
-	struct dag_file *f;
-	char *name;
+	if(!n->remote_names)
+		return NULL;
 
-	f = dag_file_from_name(n->d, filename);
-	name = (char *) itable_lookup(n->remote_names, (uintptr_t) f);
+	return dag_node_remote_name(n, dag_file_from_name(n->d, filename));
+}
 
-	return name;
+/* As above, for a file already looked up, without finding it by name. */
+char *dag_node_remote_name(struct dag_node *n, struct dag_file *f)
+{
+	if(!n->remote_names)
+		return NULL;
+
+	return (char *) itable_lookup(n->remote_names, (uintptr_t) f);
 }
 
 /* True if the local file is specified as an absolute path */
@@ -212,7 +341,7 @@ char *dag_node_translate_filename(struct dag_node *n, const char *filename)
 
 	int i = 0;
 	char *newname_org = xxstrdup(newname_ptr);
-	while(hash_table_lookup(n->remote_names_inv, newname_ptr))
+	while(n->remote_names_inv && hash_table_lookup(n->remote_names_inv, newname_ptr))
 	{
 		sprintf(newname_ptr, "%06d-%s", i, newname_org);
 		i++;
@@ -234,11 +363,12 @@ struct dag_file *dag_file_lookup_or_create(struct dag *d, const char *filename)
 	if(f)
 		return f;
 
-	f = malloc(sizeof(struct dag_file));
+	f = dag_arena_alloc(d->arena, sizeof(struct dag_file));
 
-	f->filename  = xxstrdup(filename);
+	f->filename  = dag_arena_strdup(d->arena, filename);
 	f->needed_by = list_create(0);
 	f->target_of = NULL;
+	f->state = DAG_FILE_STATE_UNKNOWN;
 
 	hash_table_insert(d->file_table, f->filename, (void *) f);
 
@@ -282,7 +412,7 @@ char *dag_lookup(const char *name, void *arg)
 	if(s)
 	{
 		/* Try node variables table */
-		if(s->node) {
+		if(s->node && s->node->variables) {
 			value = (const char *)hash_table_lookup(s->node->variables, name);
 			if(value) {
 				s->table = s->node->variables;
@@ -345,6 +475,11 @@ const char *dag_node_add_remote_name(struct dag_node *n, const char *filename, c
 	else
 		remotename = xxstrdup(remotename);
 
+	if(!n->remote_names) {
+		n->remote_names = itable_create(0);
+		n->remote_names_inv = hash_table_create(0, 0);
+	}
+
 	oldname = hash_table_lookup(n->remote_names_inv, remotename);
 
 	if(oldname && strcmp(oldname, filename) == 0)
@@ -417,6 +552,9 @@ void dag_node_state_change(struct dag *d, struct dag_node *n, int newstate)
 	n->state = newstate;
 	d->node_states[n->state]++;
 
+	timestamp_t now = timestamp_get();
+	n->previous_completion = (time_t) (now / 1000000);
+
         /**
 	 * Line format : timestamp node_id new_state job_id nodes_waiting nodes_running nodes_complete nodes_failed nodes_aborted node_id_counter
 	 *
@@ -437,7 +575,7 @@ void dag_node_state_change(struct dag *d, struct dag_node *n, int newstate)
 	 * node_id_counter - total number of nodes in this makeflow.
 	 *
 	 */
-	fprintf(d->logfile, "%" PRIu64 " %d %d %d %d %d %d %d %d %d\n", timestamp_get(), n->nodeid, newstate, n->jobid, d->node_states[0], d->node_states[1], d->node_states[2], d->node_states[3], d->node_states[4], d->nodeid_counter);
+	fprintf(d->logfile, "%" PRIu64 " %d %d %d %d %d %d %d %d %d\n", now, n->nodeid, newstate, n->jobid, d->node_states[0], d->node_states[1], d->node_states[2], d->node_states[3], d->node_states[4], d->nodeid_counter);
 }
 
 struct dag_task_category *dag_task_category_lookup_or_create(struct dag *d, const char *label)
@@ -450,6 +588,8 @@ struct dag_task_category *dag_task_category_lookup_or_create(struct dag *d, cons
 		category = malloc(sizeof(struct dag_task_category)); 
         category->label = xxstrdup(label);
         category->count = 0;
+        category->runtime_count = 0;
+        category->runtime_total = 0;
 
         hash_table_insert(d->task_categories, label, category);
     }
@@ -475,11 +615,96 @@ int dag_file_is_sink(struct dag_file *f)
 
 int dag_node_is_source(struct dag_node *n)
 {
-  return (set_size(n->ancestors) == 0);
+  return (n->ancestor_count == 0);
 }
 
 int dag_node_is_sink(struct dag_node *n)
 {
-  return (set_size(n->descendants) == 0);
+  return (n->descendant_count == 0);
 }
 
+struct dag_ready_queue *dag_ready_queue_create()
+{
+	struct dag_ready_queue *q = xxmalloc(sizeof(*q));
+
+	q->size = 0;
+	q->max = 64;
+	q->sequence = 0;
+	q->entries = xxmalloc(sizeof(*q->entries) * q->max);
+
+	return q;
+}
+
+void dag_ready_queue_delete(struct dag_ready_queue *q)
+{
+	if(!q)
+		return;
+	free(q->entries);
+	free(q);
+}
+
+int dag_ready_queue_size(struct dag_ready_queue *q)
+{
+	return q->size;
+}
+
+/* Returns true if entry a should leave the queue before entry b. */
+static int dag_ready_entry_before(struct dag_ready_entry *a, struct dag_ready_entry *b)
+{
+	if(a->primary != b->primary)
+		return a->primary > b->primary;
+	if(a->secondary != b->secondary)
+		return a->secondary > b->secondary;
+	return a->sequence < b->sequence;
+}
+
+void dag_ready_queue_push(struct dag_ready_queue *q, struct dag_node *n, double primary, double secondary)
+{
+	struct dag_ready_entry e;
+	int i, parent;
+
+	if(q->size == q->max) {
+		q->max *= 2;
+		q->entries = realloc(q->entries, sizeof(*q->entries) * q->max);
+		if(!q->entries)
+			fatal("makeflow: out of memory");
+	}
+
+	e.primary = primary;
+	e.secondary = secondary;
+	e.sequence = q->sequence++;
+	e.node = n;
+
+	for(i = q->size++; i > 0; i = parent) {
+		parent = (i - 1) / 2;
+		if(!dag_ready_entry_before(&e, &q->entries[parent]))
+			break;
+		q->entries[i] = q->entries[parent];
+	}
+	q->entries[i] = e;
+}
+
+struct dag_node *dag_ready_queue_pop(struct dag_ready_queue *q, double *primary)
+{
+	struct dag_ready_entry top, last;
+	int i, child;
+
+	if(q->size == 0)
+		return NULL;
+
+	top = q->entries[0];
+	last = q->entries[--q->size];
+
+	for(i = 0; (child = 2 * i + 1) < q->size; i = child) {
+		if(child + 1 < q->size && dag_ready_entry_before(&q->entries[child + 1], &q->entries[child]))
+			child++;
+		if(!dag_ready_entry_before(&q->entries[child], &last))
+			break;
+		q->entries[i] = q->entries[child];
+	}
+	q->entries[i] = last;
+
+	if(primary)
+		*primary = top.primary;
+	return top.node;
+}
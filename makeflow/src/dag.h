@@ -25,6 +25,13 @@ typedef enum {
 	DAG_NODE_STATE_MAX = 5
 } dag_node_state_t;
 
+typedef enum {
+	DAG_FILE_STATE_UNKNOWN = 0,              /* Not looked at yet. */
+	DAG_FILE_STATE_RECORDED,                 /* As recorded in a checkpoint of the log,
+	                                            not yet checked by this run. */
+	DAG_FILE_STATE_CHECKED                   /* As found, or as left, by this run. */
+} dag_file_state_t;
+
 struct dag {
     char *filename;                          /* Source makeflow file path. */
     struct dag_node *nodes;                  /* Linked list of all production rules, without ordering. */
@@ -44,6 +51,8 @@ struct dag {
                                                 file and their substitution. */
     struct hash_table *collect_table;        /* Keeps the reference counts of filenames of files 
                                                 that are garbage collectable. */
+    struct list *collect_queue;              /* Files of the collect table whose readers have all
+                                                completed, in the order they became collectable. */
     struct list *export_list;                /* List of variables with prefix export. 
                                                 (these are setenv'ed eventually). */
     FILE *logfile;
@@ -58,6 +67,11 @@ struct dag {
     int nodeid_counter;                      /* Keeps a count of production rules read so far 
                                                 (used for the value of dag_node->nodeid). */
     struct hash_table *task_categories;      /* Mapping from labels to category structures. */
+    struct dag_ready_queue *local_ready;     /* Waiting LOCAL nodes whose sources are all complete,
+                                                highest priority first. */
+    struct dag_ready_queue *remote_ready;    /* Likewise, for nodes that run remotely. */
+    struct dag_arena *arena;                 /* Storage for nodes, files, filenames, and the
+                                                ancestor arrays, which live as long as the dag. */
 };
 
 struct lexer_book
@@ -96,13 +110,31 @@ struct lexer_book
 };
 
 
-/* Information of task categories. Right now we only record the
- * name of the category (label), but in the future we can add
- * resource usage statistics. */
+/* Information of task categories. Besides the name of the category
+ * (label), we record the runtimes of its rules observed in makeflow
+ * logs, which are used to estimate the runtime of rules not yet run. */
 struct dag_task_category
 {
     char *label;
     int  count;
+    int  runtime_count;                 /* Number of completed rules with a known runtime. */
+    timestamp_t runtime_total;          /* Sum of those runtimes, in microseconds. */
+};
+
+/* A binary heap of nodes, ordered by a primary and a secondary
+ * priority (highest first), and then by the order of insertion. */
+struct dag_ready_entry {
+    double primary;
+    double secondary;
+    UINT64_T sequence;
+    struct dag_node *node;
+};
+
+struct dag_ready_queue {
+    struct dag_ready_entry *entries;
+    int size;
+    int max;
+    UINT64_T sequence;
 };
 
 /* struct dag_node implements a linked list of nodes. A dag_node
@@ -125,16 +157,30 @@ struct dag_node {
     const char *original_command;       /* The command line as in the makeflow file */
 
     int failure_count;                  /* How many times has this rule failed? (see -R and -r) */
-    time_t previous_completion;
+    time_t previous_completion;         /* Time of the last change of state, as in the log. */
 
     int linenum;                        /* Line number of the node's rule definition */
 
     int local_job;                      /* Flag: does this node runs locally? */
 
-    struct set *descendants;           /* The nodes this node is an immediate ancestor */
-    struct set *ancestors;             /* The nodes this node is an immediate descendant */ 
+    struct dag_node **descendants;     /* The nodes this node is an immediate ancestor, without repeats */
+    int descendant_count;
+    struct dag_node **ancestors;       /* The nodes this node is an immediate descendant, without repeats */
+    int ancestor_count;
+    struct dag_node *ancestor_mark;    /* Last node to list this one as an ancestor, used while compiling. */
     int ancestor_depth;                /* The depth of the ancestor tree for this node */
 
+    int sources_remaining;             /* Entries of source_files not yet in completed_files. */
+    int ready_queued;                  /* Flag: is this node in d->local_ready or d->remote_ready? */
+
+    double runtime_estimate;           /* Expected runtime in seconds, from the category history. */
+    double critical_path;              /* Longest sum of runtime_estimate from this node to a sink. */
+
+    char *cache_key;                   /* Key of this node in the output cache, while it runs. */
+
+    struct dag_node *cluster_next;     /* While this node runs in a composite job with others, the
+                                          next node in the job, in the order they are run. */
+
     /* Support for recursive calls to makeflow. If this node calls makeflow
      * recursively, makeflow_dag is the name of the makeflow file to run, and
      * makeflow_cwd is the working directory. See * dag_parse_node_makeflow_command 
@@ -144,9 +190,10 @@ struct dag_node {
     const char *makeflow_dag;
     const char *makeflow_cwd;           
 
-    struct itable *remote_names;        /* Mapping from struct *dag_files to remotenames (char *) */
+    struct itable *remote_names;        /* Mapping from struct *dag_files to remotenames (char *),
+                                           or NULL if no file of the node has a remote name. */
     struct hash_table *remote_names_inv;/* Mapping from remote filenames to dag_file representing 
-                                           the local file. */
+                                           the local file, or NULL as above. */
 
     struct list   *source_files;        /* list of dag_files of the node's requirements */
     struct list   *target_files;        /* list of dag_files of the node's productions */
@@ -155,7 +202,8 @@ struct dag_node {
                                            file labeled which tasks have comparable resource usage. */ 
 
 
-    struct hash_table *variables;       /* This node settings for environment variables (@ syntax) */
+    struct hash_table *variables;       /* This node settings for environment variables (@ syntax),
+                                           or NULL if the node has none. */
 
     /* Variables used in dag_width, dag_width_uniform_task, and dag_depth
      * functions. Probably we should move them only to those functions, using
@@ -177,10 +225,15 @@ struct dag_node {
  */
 
 struct dag_file {
-    const char *filename;
+    const char *filename;                    /* The only copy of the name, kept in the dag arena. */
 
     struct list     *needed_by;              /* List of nodes that have this file as a source */
     struct dag_node *target_of;              /* The node (if any) that created the file */
+
+    dag_file_state_t state;                  /* Where the status below comes from. */
+    int              is_dir;
+    time_t           mtime;
+    INT64_T          size;                   /* Size in bytes, or -1 if the file does not exist. */
 };
 
 struct dag_lookup_set {
@@ -203,6 +256,11 @@ const char *dag_node_add_remote_name(struct dag_node *n, const char *filename, c
 void dag_compile_ancestors(struct dag *d);
 void dag_find_ancestor_depth(struct dag *d);
 
+struct dag_file *dag_file_from_name(struct dag *d, const char *filename);
+int dag_file_update(struct dag_file *f);
+int dag_file_check(struct dag_file *f, int trust_recorded);
+void dag_file_set_missing(struct dag_file *f);
+
 int dag_file_is_source(struct dag_file *f);
 int dag_file_is_sink(struct dag_file *f);
 int dag_node_is_source(struct dag_node *n);
@@ -214,10 +272,17 @@ void dag_node_state_change(struct dag *d, struct dag_node *n, int newstate);
 char *dag_node_translate_filename(struct dag_node *n, const char *filename);
 
 char *dag_file_remote_name(struct dag_node *n, const char *filename);
+char *dag_node_remote_name(struct dag_node *n, struct dag_file *f);
 int dag_file_isabsolute(const struct dag_file *f);
 
 char *dag_lookup(const char *name, void *arg);
 char *dag_lookup_set(const char *name, void *arg);
 
 struct dag_task_category *dag_task_category_lookup_or_create(struct dag *d, const char *label);
+
+struct dag_ready_queue *dag_ready_queue_create();
+void dag_ready_queue_delete(struct dag_ready_queue *q);
+int dag_ready_queue_size(struct dag_ready_queue *q);
+void dag_ready_queue_push(struct dag_ready_queue *q, struct dag_node *n, double primary, double secondary);
+struct dag_node *dag_ready_queue_pop(struct dag_ready_queue *q, double *primary);
 #endif
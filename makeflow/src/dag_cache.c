@@ -0,0 +1,356 @@
+/*
+Copyright (C) 2013- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <utime.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "debug.h"
+#include "xxmalloc.h"
+#include "hash_table.h"
+#include "list.h"
+#include "stringtools.h"
+#include "sha1.h"
+#include "create_dir.h"
+#include "delete_dir.h"
+#include "copy_stream.h"
+
+#include "dag_cache.h"
+
+struct dag_cache_entry {
+	char *name;
+	time_t mtime;
+	UINT64_T size;
+};
+
+static UINT64_T dag_cache_entry_size(const char *path)
+{
+	char filename[PATH_MAX];
+	struct dirent *e;
+	struct stat info;
+	UINT64_T size = 0;
+	DIR *dir;
+
+	dir = opendir(path);
+	if(!dir)
+		return 0;
+
+	while((e = readdir(dir))) {
+		if(e->d_name[0] == '.')
+			continue;
+		snprintf(filename, sizeof(filename), "%s/%s", path, e->d_name);
+		if(stat(filename, &info) == 0)
+			size += info.st_size;
+	}
+
+	closedir(dir);
+	return size;
+}
+
+static int dag_cache_entry_compare(const void *a, const void *b)
+{
+	const struct dag_cache_entry *x = a;
+	const struct dag_cache_entry *y = b;
+
+	if(x->mtime < y->mtime)
+		return -1;
+	if(x->mtime > y->mtime)
+		return 1;
+	return 0;
+}
+
+/* Count the bytes in every entry, and if they exceed the limit, remove
+ * the least recently used entries until the cache is a tenth below it,
+ * so that the next few stores do not each trigger another scan.
+ * Entries in the middle of being stored begin with a dot and are left
+ * alone. */
+static void dag_cache_evict(struct dag_cache *c)
+{
+	struct dag_cache_entry *entries = NULL;
+	char path[PATH_MAX];
+	struct dirent *e;
+	struct stat info;
+	int count = 0, max = 0, i;
+	UINT64_T target;
+	DIR *dir;
+
+	dir = opendir(c->path);
+	if(!dir) {
+		debug(D_NOTICE, "couldn't open cache %s: %s", c->path, strerror(errno));
+		return;
+	}
+
+	c->size = 0;
+	while((e = readdir(dir))) {
+		if(e->d_name[0] == '.')
+			continue;
+		snprintf(path, sizeof(path), "%s/%s", c->path, e->d_name);
+		if(stat(path, &info) != 0 || !S_ISDIR(info.st_mode))
+			continue;
+		if(count == max) {
+			max = max ? max * 2 : 64;
+			entries = realloc(entries, sizeof(*entries) * max);
+			if(!entries)
+				fatal("makeflow: out of memory");
+		}
+		entries[count].name = xxstrdup(e->d_name);
+		entries[count].mtime = info.st_mtime;
+		entries[count].size = dag_cache_entry_size(path);
+		c->size += entries[count].size;
+		count++;
+	}
+	closedir(dir);
+
+	if(c->size > c->max_size) {
+		target = c->max_size - c->max_size / 10;
+		qsort(entries, count, sizeof(*entries), dag_cache_entry_compare);
+		for(i = 0; i < count && c->size > target; i++) {
+			snprintf(path, sizeof(path), "%s/%s", c->path, entries[i].name);
+			debug(D_DEBUG, "evicting cache entry %s", entries[i].name);
+			if(delete_dir(path) == 0) {
+				c->size -= entries[i].size;
+				c->evicted++;
+			}
+		}
+	}
+
+	for(i = 0; i < count; i++)
+		free(entries[i].name);
+	free(entries);
+}
+
+struct dag_cache *dag_cache_create(const char *path, UINT64_T max_size)
+{
+	struct dag_cache *c;
+
+	if(!create_dir(path, 0777))
+		return NULL;
+
+	c = xxmalloc(sizeof(*c));
+	memset(c, 0, sizeof(*c));
+	c->path = xxstrdup(path);
+	c->max_size = max_size;
+	c->digests = hash_table_create(0, 0);
+
+	dag_cache_evict(c);
+
+	debug(D_DEBUG, "cache %s holds %" PRIu64 " bytes", c->path, c->size);
+
+	return c;
+}
+
+void dag_cache_delete(struct dag_cache *c)
+{
+	char *key;
+	void *value;
+
+	if(!c)
+		return;
+
+	hash_table_firstkey(c->digests);
+	while(hash_table_nextkey(c->digests, &key, &value))
+		free(value);
+	hash_table_delete(c->digests);
+	free(c->path);
+	free(c);
+}
+
+/* Sources are complete before any rule that needs them runs, and are
+ * not changed afterwards, so each is hashed only once per run. */
+static const char *dag_cache_file_digest(struct dag_cache *c, const char *filename)
+{
+	unsigned char digest[SHA1_DIGEST_LENGTH];
+	struct stat info;
+	char *value;
+
+	value = hash_table_lookup(c->digests, filename);
+	if(value)
+		return value;
+
+	if(stat(filename, &info) != 0 || !S_ISREG(info.st_mode))
+		return NULL;
+	if(!sha1_file(filename, digest))
+		return NULL;
+
+	value = xxstrdup(sha1_string(digest));
+	hash_table_insert(c->digests, filename, value);
+
+	return value;
+}
+
+/* Each string is hashed with its terminating null, so that adjacent
+ * fields cannot run together. */
+static void dag_cache_hash_string(sha1_context_t *ctx, const char *s)
+{
+	sha1_update(ctx, (const unsigned char *) s, strlen(s) + 1);
+}
+
+char *dag_cache_key(struct dag_cache *c, struct dag_node *n)
+{
+	struct dag_lookup_set s = { n->d, n, NULL };
+	unsigned char digest[SHA1_DIGEST_LENGTH];
+	sha1_context_t ctx;
+	struct dag_file *f;
+	const char *file_digest;
+	char *name, *value;
+
+	if(list_size(n->target_files) == 0)
+		return NULL;
+
+	sha1_init(&ctx);
+
+	dag_cache_hash_string(&ctx, "command");
+	dag_cache_hash_string(&ctx, n->original_command);
+
+	list_first_item(n->source_files);
+	while((f = list_next_item(n->source_files))) {
+		file_digest = dag_cache_file_digest(c, f->filename);
+		if(!file_digest) {
+			debug(D_DEBUG, "rule %d is not cacheable: %s is not a regular file", n->nodeid, f->filename);
+			return NULL;
+		}
+		dag_cache_hash_string(&ctx, "source");
+		dag_cache_hash_string(&ctx, f->filename);
+		dag_cache_hash_string(&ctx, file_digest);
+	}
+
+	list_first_item(n->target_files);
+	while((f = list_next_item(n->target_files))) {
+		dag_cache_hash_string(&ctx, "target");
+		dag_cache_hash_string(&ctx, f->filename);
+	}
+
+	list_first_item(n->d->export_list);
+	while((name = list_next_item(n->d->export_list))) {
+		value = dag_lookup(name, &s);
+		dag_cache_hash_string(&ctx, "export");
+		dag_cache_hash_string(&ctx, name);
+		dag_cache_hash_string(&ctx, value ? value : "");
+		free(value);
+	}
+
+	sha1_final(digest, &ctx);
+
+	return xxstrdup(sha1_string(digest));
+}
+
+/* Copy a file to a new name. An entry never shares an inode with the
+ * outputs of a workflow, so that changing an output in place cannot
+ * change what later workflows restore. */
+static int dag_cache_copy(const char *from, const char *to)
+{
+	unlink(to);
+	return copy_file_to_file(from, to) >= 0;
+}
+
+int dag_cache_restore(struct dag_cache *c, struct dag_node *n, const char *key)
+{
+	char *entry = string_format("%s/%s", c->path, key);
+	struct dag_file *f;
+	struct stat info;
+	UINT64_T bytes = 0;
+	int i;
+
+	if(stat(entry, &info) != 0 || !S_ISDIR(info.st_mode)) {
+		c->misses++;
+		free(entry);
+		return 0;
+	}
+
+	i = 0;
+	list_first_item(n->target_files);
+	while((f = list_next_item(n->target_files))) {
+		char *cached = string_format("%s/%d", entry, i++);
+		int ok = stat(cached, &info) == 0 && dag_cache_copy(cached, f->filename);
+		free(cached);
+		if(!ok)
+			goto failure;
+		/* A restored output is as new as one just created. */
+		utime(f->filename, NULL);
+		bytes += info.st_size;
+	}
+
+	/* The modification time of an entry records its last use. */
+	utime(entry, NULL);
+
+	c->hits++;
+	c->bytes_restored += bytes;
+	debug(D_DEBUG, "restored rule %d from cache entry %s", n->nodeid, key);
+	free(entry);
+	return 1;
+
+failure:
+	/* The entry may have been evicted under us. Remove anything restored
+	 * so far, so that the rule runs from a clean slate. */
+	debug(D_DEBUG, "couldn't restore rule %d from cache entry %s: %s", n->nodeid, key, strerror(errno));
+	list_first_item(n->target_files);
+	while((f = list_next_item(n->target_files)))
+		unlink(f->filename);
+	c->misses++;
+	free(entry);
+	return 0;
+}
+
+int dag_cache_store(struct dag_cache *c, struct dag_node *n, const char *key)
+{
+	char *entry = string_format("%s/%s", c->path, key);
+	char *tmp = string_format("%s/.tmp.%d.%s", c->path, (int) getpid(), key);
+	struct dag_file *f;
+	struct stat info;
+	UINT64_T bytes = 0;
+	int i;
+
+	/* Another workflow sharing the cache may have stored it already. */
+	if(stat(entry, &info) == 0)
+		goto done;
+
+	if(mkdir(tmp, 0777) != 0) {
+		debug(D_DEBUG, "couldn't create %s: %s", tmp, strerror(errno));
+		goto failure;
+	}
+
+	i = 0;
+	list_first_item(n->target_files);
+	while((f = list_next_item(n->target_files))) {
+		char *cached = string_format("%s/%d", tmp, i++);
+		int ok = stat(f->filename, &info) == 0 && S_ISREG(info.st_mode) && dag_cache_copy(f->filename, cached);
+		free(cached);
+		if(!ok) {
+			debug(D_DEBUG, "couldn't cache %s of rule %d", f->filename, n->nodeid);
+			goto failure;
+		}
+		bytes += info.st_size;
+	}
+
+	if(rename(tmp, entry) != 0)
+		goto failure;
+
+	c->stored++;
+	c->bytes_stored += bytes;
+	c->size += bytes;
+	debug(D_DEBUG, "stored rule %d in cache entry %s", n->nodeid, key);
+
+	if(c->size > c->max_size)
+		dag_cache_evict(c);
+
+done:
+	free(entry);
+	free(tmp);
+	return 1;
+
+failure:
+	delete_dir(tmp);
+	free(entry);
+	free(tmp);
+	return 0;
+}
@@ -0,0 +1,49 @@
+/*
+Copyright (C) 2013- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#ifndef MAKEFLOW_DAG_CACHE_H
+#define MAKEFLOW_DAG_CACHE_H
+
+#include "dag.h"
+
+/* A dag_cache is a directory of rule outputs that may be shared by
+ * many workflows. Each entry is named by a hash of everything that
+ * determines the result of a rule: the command, the names and
+ * contents of its sources, the names of its targets, and the values
+ * of the exported variables. Entries are copied from the outputs of
+ * completed rules, and copied back instead of running the rule again. When the entries
+ * exceed max_size bytes, the least recently used are removed.
+ */
+
+struct dag_cache {
+	char *path;
+	UINT64_T max_size;
+	UINT64_T size;                  /* Bytes in all entries, as last counted. */
+	struct hash_table *digests;     /* Content hash of each source file, by filename. */
+
+	int hits;
+	int misses;
+	int stored;
+	int evicted;
+	UINT64_T bytes_restored;
+	UINT64_T bytes_stored;
+};
+
+struct dag_cache *dag_cache_create(const char *path, UINT64_T max_size);
+void dag_cache_delete(struct dag_cache *c);
+
+/* Returns the key of the node, to be freed by the caller, or NULL
+ * if the node cannot be cached. */
+char *dag_cache_key(struct dag_cache *c, struct dag_node *n);
+
+/* Replaces the targets of the node with the cached entry for key.
+ * Returns true on a hit. */
+int dag_cache_restore(struct dag_cache *c, struct dag_node *n, const char *key);
+
+/* Adds the targets of a completed node to the cache under key. */
+int dag_cache_store(struct dag_cache *c, struct dag_node *n, const char *key);
+
+#endif
@@ -0,0 +1,272 @@
+/*
+Copyright (C) 2013- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "debug.h"
+#include "xxmalloc.h"
+#include "hash_table.h"
+#include "itable.h"
+#include "get_line.h"
+#include "stringtools.h"
+#include "timestamp.h"
+
+#include "dag_checkpoint.h"
+
+#define DAG_CHECKPOINT_MAGIC "MFCHKPT"
+
+#define DAG_CHECKPOINT_VERSION 2
+
+/* Records are written in the native byte order.  A checkpoint written
+ * on a machine of the other order reads this back reversed, and is
+ * ignored in favor of replaying the log. */
+#define DAG_CHECKPOINT_BYTE_ORDER 0x01020304
+
+struct dag_checkpoint_header {
+	char magic[8];
+	UINT32_T version;
+	UINT32_T byte_order;
+	UINT32_T node_count;
+	UINT64_T file_count;
+	UINT64_T log_offset;            /* Offset of the "# CHECKPOINT" line in the log. */
+	UINT64_T timestamp;             /* As written on that line. */
+};
+
+struct dag_checkpoint_node {
+	INT32_T nodeid;
+	INT32_T state;
+	INT64_T jobid;
+	INT64_T previous_completion;
+};
+
+/* Followed by name_length bytes of the filename, without a null. */
+struct dag_checkpoint_file {
+	UINT32_T name_length;
+	INT32_T is_dir;
+	INT64_T mtime;
+	INT64_T size;
+};
+
+int dag_checkpoint_write(struct dag *d, const char *filename)
+{
+	struct dag_checkpoint_header header;
+	struct dag_checkpoint_node record;
+	struct dag_checkpoint_file file_record;
+	struct dag_node *n;
+	struct dag_file *f;
+	char *name;
+	char *tmpname;
+	FILE *file;
+	off_t offset;
+	int failed;
+
+	fflush(d->logfile);
+	offset = lseek(fileno(d->logfile), 0, SEEK_END);
+	if(offset < 0)
+		return 0;
+
+	memset(&header, 0, sizeof(header));
+	strcpy(header.magic, DAG_CHECKPOINT_MAGIC);
+	header.version = DAG_CHECKPOINT_VERSION;
+	header.byte_order = DAG_CHECKPOINT_BYTE_ORDER;
+	header.log_offset = offset;
+	header.timestamp = timestamp_get();
+
+	for(n = d->nodes; n; n = n->next)
+		header.node_count++;
+
+	hash_table_firstkey(d->file_table);
+	while(hash_table_nextkey(d->file_table, &name, (void **) &f)) {
+		if(f->state != DAG_FILE_STATE_UNKNOWN)
+			header.file_count++;
+	}
+
+	tmpname = string_format("%s.%d.tmp", filename, (int) getpid());
+	file = fopen(tmpname, "w");
+	if(!file) {
+		debug(D_NOTICE, "couldn't write checkpoint %s: %s", tmpname, strerror(errno));
+		free(tmpname);
+		return 0;
+	}
+
+	fwrite(&header, sizeof(header), 1, file);
+
+	for(n = d->nodes; n; n = n->next) {
+		record.nodeid = n->nodeid;
+		record.state = n->state;
+		record.jobid = n->jobid;
+		record.previous_completion = n->previous_completion;
+		fwrite(&record, sizeof(record), 1, file);
+	}
+
+	hash_table_firstkey(d->file_table);
+	while(hash_table_nextkey(d->file_table, &name, (void **) &f)) {
+		if(f->state == DAG_FILE_STATE_UNKNOWN)
+			continue;
+		file_record.name_length = strlen(f->filename);
+		file_record.is_dir = f->is_dir;
+		file_record.mtime = f->mtime;
+		file_record.size = f->size;
+		fwrite(&file_record, sizeof(file_record), 1, file);
+		fwrite(f->filename, file_record.name_length, 1, file);
+	}
+
+	failed = ferror(file);
+	if(fclose(file) != 0)
+		failed = 1;
+
+	if(failed || rename(tmpname, filename) != 0) {
+		debug(D_NOTICE, "couldn't write checkpoint %s: %s", filename, strerror(errno));
+		unlink(tmpname);
+		free(tmpname);
+		return 0;
+	}
+	free(tmpname);
+
+	/* Only now that the checkpoint is in place does the log name it. */
+	fprintf(d->logfile, "# CHECKPOINT\t%" PRIu64 "\n", header.timestamp);
+	fflush(d->logfile);
+
+	debug(D_DEBUG, "wrote checkpoint %s of %u rules and %" PRIu64 " files at log offset %" PRIu64, filename, header.node_count, header.file_count, header.log_offset);
+
+	return 1;
+}
+
+/* Returns the offset just past the "# CHECKPOINT" line for the header,
+ * or -1 if the log does not have it at the recorded offset. */
+static INT64_T dag_checkpoint_match_log(struct dag_checkpoint_header *header, const char *logfilename)
+{
+	char *line;
+	char *expected;
+	INT64_T offset = -1;
+	FILE *log;
+
+	log = fopen(logfilename, "r");
+	if(!log)
+		return -1;
+
+	if(fseeko(log, header->log_offset, SEEK_SET) == 0 && (line = get_line(log))) {
+		string_chomp(line);
+		expected = string_format("# CHECKPOINT\t%" PRIu64, header->timestamp);
+		if(!strcmp(line, expected))
+			offset = ftello(log);
+		free(expected);
+		free(line);
+	}
+
+	fclose(log);
+
+	return offset;
+}
+
+INT64_T dag_checkpoint_read(struct dag *d, const char *filename, const char *logfilename)
+{
+	struct dag_checkpoint_header header;
+	struct dag_checkpoint_node *records = NULL;
+	struct dag_checkpoint_file file_record;
+	struct dag_node *n;
+	struct dag_file *f;
+	struct stat info;
+	char *buffer = NULL;
+	char *name;
+	char saved;
+	size_t length, position;
+	INT64_T offset;
+	UINT64_T i;
+	FILE *file;
+
+	file = fopen(filename, "r");
+	if(!file)
+		return -1;
+
+	if(fread(&header, sizeof(header), 1, file) != 1 || strcmp(header.magic, DAG_CHECKPOINT_MAGIC) || header.version != DAG_CHECKPOINT_VERSION || header.byte_order != DAG_CHECKPOINT_BYTE_ORDER) {
+		debug(D_DEBUG, "%s is not a makeflow checkpoint", filename);
+		goto failure;
+	}
+
+	offset = dag_checkpoint_match_log(&header, logfilename);
+	if(offset < 0) {
+		debug(D_DEBUG, "checkpoint %s does not match the log %s", filename, logfilename);
+		goto failure;
+	}
+
+	/* Read and check everything before changing the dag, so that a
+	 * truncated checkpoint leaves it as it was. */
+	if(fstat(fileno(file), &info) != 0)
+		goto failure;
+
+	records = malloc(sizeof(*records) * (header.node_count + 1));
+	if(!records || fread(records, sizeof(*records), header.node_count, file) != header.node_count)
+		goto failure;
+
+	length = info.st_size - sizeof(header) - sizeof(*records) * header.node_count;
+	buffer = malloc(length + 1);
+	if(!buffer || fread(buffer, 1, length, file) != length)
+		goto failure;
+
+	/* The records are not aligned, so each is copied out before use. */
+	position = 0;
+	for(i = 0; i < header.file_count; i++) {
+		if(position + sizeof(file_record) > length)
+			goto failure;
+		memcpy(&file_record, buffer + position, sizeof(file_record));
+		position += sizeof(file_record) + file_record.name_length;
+		if(position > length)
+			goto failure;
+	}
+
+	fclose(file);
+
+	for(i = 0; i < header.node_count; i++) {
+		n = itable_lookup(d->node_table, records[i].nodeid);
+		if(!n)
+			continue;
+		n->state = records[i].state;
+		n->jobid = records[i].jobid;
+		n->previous_completion = records[i].previous_completion;
+	}
+
+	/* Each name is terminated in place, over the first byte of the next
+	 * record, which is put back once the name has been looked up. */
+	position = 0;
+	for(i = 0; i < header.file_count; i++) {
+		memcpy(&file_record, buffer + position, sizeof(file_record));
+		name = buffer + position + sizeof(file_record);
+		position += sizeof(file_record) + file_record.name_length;
+
+		saved = name[file_record.name_length];
+		name[file_record.name_length] = 0;
+
+		f = dag_file_from_name(d, name);
+		if(f) {
+			f->state = DAG_FILE_STATE_RECORDED;
+			f->is_dir = file_record.is_dir;
+			f->mtime = file_record.mtime;
+			f->size = file_record.size;
+		}
+
+		name[file_record.name_length] = saved;
+	}
+
+	debug(D_DEBUG, "read checkpoint %s of %u rules and %" PRIu64 " files, resuming the log at offset %" PRId64, filename, header.node_count, header.file_count, offset);
+
+	free(records);
+	free(buffer);
+
+	return offset;
+
+failure:
+	fclose(file);
+	free(records);
+	free(buffer);
+	return -1;
+}
@@ -0,0 +1,34 @@
+/*
+Copyright (C) 2013- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#ifndef MAKEFLOW_DAG_CHECKPOINT_H
+#define MAKEFLOW_DAG_CHECKPOINT_H
+
+#include "dag.h"
+
+/* A checkpoint is a binary image of the state that the makeflow log
+ * describes at some point in the run: the state, job id and time of last
+ * change of every node, and the last known status of every file. It is
+ * kept beside the log, and records the offset in the log at which it was
+ * taken, where the log has a matching "# CHECKPOINT" line. On restart,
+ * the checkpoint is loaded and only the rest of the log is read.
+ *
+ * The checkpoint is written to a temporary file and renamed into place,
+ * and is ignored unless the log still has the matching line, so a stale,
+ * partial, or foreign checkpoint only costs a full read of the log.
+ */
+
+/* Adds a "# CHECKPOINT" line to the log of the dag, and writes a
+ * checkpoint of the dag as of that line to filename. */
+int dag_checkpoint_write(struct dag *d, const char *filename);
+
+/* Loads the checkpoint in filename into the dag, if it matches the log
+ * in logfilename. Returns the offset in the log just past the matching
+ * "# CHECKPOINT" line, or -1 if no matching checkpoint could be loaded,
+ * in which case the dag is unchanged. */
+INT64_T dag_checkpoint_read(struct dag *d, const char *filename, const char *logfilename);
+
+#endif
@@ -0,0 +1,143 @@
+/*
+Copyright (C) 2013- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+
+#include "debug.h"
+#include "xxmalloc.h"
+#include "list.h"
+
+#include "dag_gc.h"
+
+static int dag_gc_remove(const char *filename)
+{
+	if(unlink(filename) == 0 || errno == ENOENT) {
+		debug(D_DEBUG, "Garbage collected %s", filename);
+		return 1;
+	}
+
+	debug(D_NOTICE, "makeflow: unable to collect %s: %s", filename, strerror(errno));
+	return 0;
+}
+
+/* The lock is released while each file is removed, so that more may be
+ * given in the meantime. */
+static void *dag_gc_worker_main(void *arg)
+{
+	struct dag_gc_worker *w = arg;
+	char *filename;
+	int ok;
+
+	pthread_mutex_lock(&w->mutex);
+	while(1) {
+		filename = list_pop_head(w->pending);
+		if(filename) {
+			w->busy = 1;
+			pthread_mutex_unlock(&w->mutex);
+			ok = dag_gc_remove(filename);
+			free(filename);
+			pthread_mutex_lock(&w->mutex);
+			w->busy = 0;
+			if(ok)
+				w->removed++;
+			else
+				w->failed++;
+		} else if(w->stop) {
+			break;
+		} else {
+			pthread_cond_broadcast(&w->idle);
+			pthread_cond_wait(&w->wakeup, &w->mutex);
+		}
+	}
+	pthread_cond_broadcast(&w->idle);
+	pthread_mutex_unlock(&w->mutex);
+
+	return NULL;
+}
+
+struct dag_gc_worker *dag_gc_worker_create()
+{
+	struct dag_gc_worker *w = xxmalloc(sizeof(*w));
+	sigset_t all, old;
+	int result;
+
+	memset(w, 0, sizeof(*w));
+	w->pending = list_create();
+
+	pthread_mutex_init(&w->mutex, NULL);
+	pthread_cond_init(&w->wakeup, NULL);
+	pthread_cond_init(&w->idle, NULL);
+
+	/* Signals are left to the main thread, which waits for them. */
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+	result = pthread_create(&w->thread, NULL, dag_gc_worker_main, w);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	if(result == 0) {
+		w->threaded = 1;
+	} else {
+		debug(D_NOTICE, "makeflow: couldn't start garbage collection thread, collecting in place: %s", strerror(result));
+	}
+
+	return w;
+}
+
+void dag_gc_worker_delete(struct dag_gc_worker *w)
+{
+
+	if(!w)
+		return;
+
+	if(w->threaded) {
+		pthread_mutex_lock(&w->mutex);
+		w->stop = 1;
+		pthread_cond_signal(&w->wakeup);
+		pthread_mutex_unlock(&w->mutex);
+		pthread_join(w->thread, NULL);
+	}
+
+	pthread_mutex_destroy(&w->mutex);
+	pthread_cond_destroy(&w->wakeup);
+	pthread_cond_destroy(&w->idle);
+	list_delete(w->pending);
+	free(w);
+}
+
+void dag_gc_worker_push(struct dag_gc_worker *w, char *filename)
+{
+
+	if(!w->threaded) {
+		if(dag_gc_remove(filename))
+			w->removed++;
+		else
+			w->failed++;
+		free(filename);
+		return;
+	}
+
+	pthread_mutex_lock(&w->mutex);
+	list_push_tail(w->pending, filename);
+	pthread_cond_signal(&w->wakeup);
+	pthread_mutex_unlock(&w->mutex);
+}
+
+void dag_gc_worker_wait(struct dag_gc_worker *w)
+{
+
+	if(!w->threaded)
+		return;
+
+	pthread_mutex_lock(&w->mutex);
+	while(list_size(w->pending) > 0 || w->busy)
+		pthread_cond_wait(&w->idle, &w->mutex);
+	pthread_mutex_unlock(&w->mutex);
+}
@@ -0,0 +1,43 @@
+/*
+Copyright (C) 2013- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#ifndef MAKEFLOW_DAG_GC_H
+#define MAKEFLOW_DAG_GC_H
+
+#include <pthread.h>
+
+/* A dag_gc_worker removes garbage collected files in a thread of its own,
+ * so that makeflow may go on dispatching rules while the files are
+ * unlinked, which may take a long time on a shared filesystem. Files are
+ * removed in the order they are given. If the thread cannot be started,
+ * each file is removed as soon as it is given.
+ */
+
+struct dag_gc_worker {
+	struct list *pending;           /* Names of the files still to remove. */
+	int busy;                       /* Whether the thread is removing a file. */
+	int stop;
+	int threaded;
+	int removed;                    /* Files removed so far. */
+	int failed;                     /* Files that could not be removed. */
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t wakeup;          /* Signalled when a file is given, or to stop. */
+	pthread_cond_t idle;            /* Signalled when there is nothing left to remove. */
+};
+
+struct dag_gc_worker *dag_gc_worker_create();
+
+/* Stops the thread once every file given has been removed. */
+void dag_gc_worker_delete(struct dag_gc_worker *w);
+
+/* Gives the worker a file to remove. The worker frees the name. */
+void dag_gc_worker_push(struct dag_gc_worker *w, char *filename);
+
+/* Waits until every file given so far has been removed. */
+void dag_gc_worker_wait(struct dag_gc_worker *w);
+
+#endif
@@ -38,12 +38,17 @@ See the file COPYING for details.
 #include "get_line.h"
 #include "int_sizes.h"
 #include "list.h"
+#include "buffer.h"
+#include "process.h"
 #include "xxmalloc.h"
 #include "getopt_aux.h"
 #include "rmonitor_hooks.h"
 #include "random_init.h"
 
 #include "dag.h"
+#include "dag_cache.h"
+#include "dag_checkpoint.h"
+#include "dag_gc.h"
 #include "visitors.h"
 
 #define SHOW_INPUT_FILES 2
@@ -55,6 +60,7 @@ See the file COPYING for details.
 #define MAKEFLOW_AUTO_GROUP 2
 
 #define	MAKEFLOW_MIN_SPACE 10*1024*1024	/* 10 MB */
+#define	MAKEFLOW_GC_TARGET_SPACE (2*MAKEFLOW_MIN_SPACE)	/* Free space restored by on demand collection. */
 #define MAKEFLOW_GC_MIN_THRESHOLD 1
 
 #define MAKEFLOW_TASK_CATEGORY "MAKEFLOW_TASK_CATEGORY"  /* The value of this variable in the Makeflow
@@ -77,6 +83,18 @@ See the file COPYING for details.
 #define LONG_OPT_PPM_FILE         ('z' + 7)
 #define LONG_OPT_PPM_EXE          ('z' + 8)
 #define LONG_OPT_PPM_LEVELS       ('z' + 9)
+#define LONG_OPT_SCHEDULE         ('z' + 10)
+#define LONG_OPT_SCHEDULE_LOG     ('z' + 11)
+#define LONG_OPT_SIMULATE         ('z' + 12)
+#define LONG_OPT_CACHE            ('z' + 13)
+#define LONG_OPT_CACHE_SIZE       ('z' + 14)
+#define LONG_OPT_TRUST_LOG        ('z' + 15)
+#define LONG_OPT_CLUSTER_SIZE     ('z' + 16)
+
+#define MAKEFLOW_CACHE_SIZE_DEFAULT 1024     /* In MB. */
+#define MAKEFLOW_CHECKPOINT_INTERVAL 300     /* In seconds. */
+#define MAKEFLOW_CLUSTER_SIZE_MAX 100        /* Keeps the position of a member within an exit code. */
+#define MAKEFLOW_CLUSTER_RUNTIME 60          /* Estimated seconds of rules per composite job. */
 
 typedef enum {
 	DAG_GC_NONE,
@@ -86,6 +104,15 @@ typedef enum {
 	DAG_GC_ON_DEMAND,
 } dag_gc_method_t;
 
+typedef enum {
+	DAG_SCHEDULE_FIFO,
+	DAG_SCHEDULE_CRITICAL_PATH,
+	DAG_SCHEDULE_GC,
+	DAG_SCHEDULE_MAX
+} dag_schedule_method_t;
+
+static const char *dag_schedule_names[DAG_SCHEDULE_MAX] = { "fifo", "critical", "gc" };
+
 static int dag_abort_flag = 0;
 static int dag_failed_flag = 0;
 static int dag_submit_timeout = 3600;
@@ -95,9 +122,22 @@ static int dag_retry_max = 100;
 static dag_gc_method_t dag_gc_method = DAG_GC_NONE;
 static int dag_gc_param = -1;
 static int dag_gc_collected = 0;
+static INT64_T dag_gc_bytes = 0;		/* By the sizes recorded when the files were created. */
+static int dag_gc_files_present = 0;	/* Estimated files in the working directory, for on_demand. */
+static struct dag_gc_worker *dag_gc_worker = NULL;
 static int dag_gc_barrier = 1;
 static double dag_gc_task_ratio = 0.05;
 
+static dag_schedule_method_t dag_schedule_method = DAG_SCHEDULE_FIFO;
+
+static struct dag_cache *dag_cache = NULL;
+
+static char *dag_checkpoint_filename = NULL;
+static time_t dag_checkpoint_time = 0;
+static int dag_trust_log = 0;
+
+static int dag_cluster_size = 1;
+
 static batch_queue_type_t batch_queue_type = BATCH_QUEUE_TYPE_LOCAL;
 static struct batch_queue *local_queue = 0;
 static struct batch_queue *remote_queue = 0;
@@ -123,11 +163,13 @@ int dag_width_uniform_task(struct dag *d);
 int dag_width_guaranteed_max(struct dag *d);
 int dag_width(struct dag *d, int nested_jobs);
 void dag_node_complete(struct dag *d, struct dag_node *n, struct batch_job_info *info);
+void dag_node_make_ready(struct dag *d, struct dag_node *n);
 int dag_check (struct dag *d);
 int dag_check_dependencies(struct dag *d);
 
 void dag_gc_ref_incr(struct dag *d, const char *file, int increment);
 void dag_gc_ref_count(struct dag *d, const char *file);
+void dag_gc(struct dag *d);
 void dag_export_variables(struct dag *d, struct dag_node *n);
 
 char *dag_parse_readline(struct lexer_book *bk, struct dag_node *n);
@@ -371,10 +413,12 @@ char* bundler_rename(struct dag_node *n, const char *filename){
 
 	if (n) {
 		struct list *input_files = dag_input_files(n->d);
+		/* The files in the list belong to the dag. */
 		if(list_find(input_files, (int (*) (void *, const void *)) string_equal, (void*)filename)){
-			list_free(input_files);
+			list_delete(input_files);
 			return xxstrdup(filename);
 		}
+		list_delete(input_files);
 	}
 	return bundler_translate_name(filename, 0); /* no collisions yet -> 0 */
 }
@@ -495,7 +539,8 @@ void dag_abort_all(struct dag *d)
 	while(itable_nextkey(d->remote_job_table, &jobid, (void **) &n)) {
 		printf("aborting remote job %" PRIu64 "\n", jobid);
 		batch_job_remove(remote_queue, jobid);
-		dag_node_state_change(d, n, DAG_NODE_STATE_ABORTED);
+		for(; n; n = n->cluster_next)
+			dag_node_state_change(d, n, DAG_NODE_STATE_ABORTED);
 	}
 }
 
@@ -531,9 +576,10 @@ void dag_node_clean(struct dag *d, struct dag_node *n)
 	list_first_item(n->target_files);
 	while( (f = list_next_item(n->target_files)) ) {
 		file_clean(f->filename, 0);
+		dag_file_set_missing(f);
 
 		/* Make sure to clobber the original file too if it exists */
-		char *name = (char *) hash_table_lookup(n->remote_names_inv, f->filename);
+		char *name = n->remote_names_inv ? (char *) hash_table_lookup(n->remote_names_inv, f->filename) : NULL;
 
 		if(name)
 			file_clean(name, 0);
@@ -583,7 +629,6 @@ void dag_node_force_rerun(struct itable *rerun_table, struct dag *d, struct dag_
  */
 void dag_node_decide_rerun(struct itable *rerun_table, struct dag *d, struct dag_node *n)
 {
-	struct stat filestat;
 	struct dag_file *f;
 
 	if(itable_lookup(rerun_table, n->nodeid))
@@ -604,13 +649,15 @@ void dag_node_decide_rerun(struct itable *rerun_table, struct dag *d, struct dag
 		goto rerun;
 	}
 	// Rerun if an input file has been updated since the last execution.
+	// Each file is looked at once, however many rules use it, and not
+	// at all if its status in the checkpoint is trusted.
 	list_first_item(n->source_files);
 	while( (f = list_next_item(n->source_files)) )
 	{
-		if(stat(f->filename, &filestat) >= 0) {
-			if(S_ISDIR(filestat.st_mode))
+		if(dag_file_check(f, dag_trust_log)) {
+			if(f->is_dir)
 				continue;
-			if(difftime(filestat.st_mtime, n->previous_completion) > 0) {
+			if(difftime(f->mtime, n->previous_completion) > 0) {
 				goto rerun;	// rerun this node
 			}
 		} else {
@@ -631,7 +678,7 @@ void dag_node_decide_rerun(struct itable *rerun_table, struct dag *d, struct dag
 	// Rerun if an output file is missing.
 	list_first_item(n->target_files);
 	while( (f = list_next_item(n->target_files)) ) {
-		if(stat(f->filename, &filestat) < 0) {
+		if(!dag_file_check(f, dag_trust_log)) {
 			/* If output file is missing, but node completed and file was garbage, then avoid rerunning. */
 			if(n->state == DAG_NODE_STATE_COMPLETE && hash_table_lookup(d->collect_table, f->filename)) {
 				continue;
@@ -647,72 +694,68 @@ void dag_node_decide_rerun(struct itable *rerun_table, struct dag *d, struct dag
 	dag_node_force_rerun(rerun_table, d, n);
 }
 
+/* Rerun the node and every node that depends on it. The nodes are kept
+ * in a list rather than visited recursively, since chains of rules may
+ * be far deeper than the stack. */
 void dag_node_force_rerun(struct itable *rerun_table, struct dag *d, struct dag_node *n)
 {
+	struct list *pending = list_create();
 	struct dag_node *p;
 	struct dag_file *f1;
-	struct dag_file *f2;
-	int child_node_found;
-
-	if(itable_lookup(rerun_table, n->nodeid))
-		return;
+	int i;
 
-	// Mark this node as having been rerun already
-	itable_insert(rerun_table, n->nodeid, n);
+	list_push_tail(pending, n);
 
-	// Remove running batch jobs
-	if(n->state == DAG_NODE_STATE_RUNNING) {
-		if(n->local_job) {
-			batch_job_remove(local_queue, n->jobid);
-			if(itable_remove(d->local_job_table, n->jobid)) {
-				d->local_jobs_running--;
-			}
-		} else {
-			batch_job_remove(remote_queue, n->jobid);
-			if(itable_remove(d->remote_job_table, n->jobid)) {
-				d->remote_jobs_running--;
-			}
-		}
-	}
-	// Clean up things associated with this node
-	dag_node_clean(d, n);
-	dag_node_state_change(d, n, DAG_NODE_STATE_WAITING);
-
-	// For each parent node, rerun it if input file was garbage collected
-	list_first_item(n->source_files);
-	while( (f1 = list_next_item(n->source_files)) ) {
-		if(hash_table_lookup(d->collect_table, f1->filename) == NULL)
+	while((n = list_pop_head(pending))) {
+		if(itable_lookup(rerun_table, n->nodeid))
 			continue;
 
-		p = f1->target_of;
-		if (p) {
-			dag_node_force_rerun(rerun_table, d, p);
-			dag_gc_ref_incr(d, f1->filename, 1);
-		}
-	}
+		// Mark this node as having been rerun already
+		itable_insert(rerun_table, n->nodeid, n);
 
-	// For each child node, rerun it
-	list_first_item(n->target_files);
-	while( (f1 = list_next_item(n->target_files)) ) {
-		for(p = d->nodes; p; p = p->next) {
-			child_node_found = 0;
-
-			list_first_item(p->source_files);
-			while( (f2 = list_next_item(n->source_files)) ) {
-				if(!strcmp(f1->filename, f2->filename)) {
-					child_node_found = 1;
-					break;
+		// Remove running batch jobs
+		if(n->state == DAG_NODE_STATE_RUNNING) {
+			if(n->local_job) {
+				batch_job_remove(local_queue, n->jobid);
+				if(itable_remove(d->local_job_table, n->jobid)) {
+					d->local_jobs_running--;
+				}
+			} else {
+				batch_job_remove(remote_queue, n->jobid);
+				if(itable_remove(d->remote_job_table, n->jobid)) {
+					d->remote_jobs_running--;
 				}
 			}
-			if(child_node_found) {
-				dag_node_force_rerun(rerun_table, d, p);
+		}
+		// Clean up things associated with this node
+		dag_node_clean(d, n);
+		dag_node_state_change(d, n, DAG_NODE_STATE_WAITING);
+
+		// For each parent node, rerun it if input file was garbage collected
+		list_first_item(n->source_files);
+		while( (f1 = list_next_item(n->source_files)) ) {
+			if(hash_table_lookup(d->collect_table, f1->filename) == NULL)
+				continue;
+
+			p = f1->target_of;
+			if (p) {
+				list_push_tail(pending, p);
+				dag_gc_ref_incr(d, f1->filename, 1);
 			}
 		}
+
+		// For each child node, rerun it
+		for(i = 0; i < n->descendant_count; i++)
+			list_push_tail(pending, n->descendants[i]);
 	}
-}
 
+	list_delete(pending);
+}
 
-void dag_log_recover(struct dag *d, const char *filename)
+/* Recover the state of the workflow from its log. If log_offset is not
+ * negative, a checkpoint of the log up to that offset has already been
+ * loaded, and only the rest of the log is read. */
+void dag_log_recover(struct dag *d, const char *filename, INT64_T log_offset)
 {
 	char *line;
 	int nodeid, state, jobid;
@@ -725,6 +768,12 @@ void dag_log_recover(struct dag *d, const char *filename)
 		int linenum = 0;
 		first_run = 0;
 
+		if(log_offset >= 0 && fseeko(d->logfile, log_offset, SEEK_SET) != 0) {
+			fprintf(stderr, "makeflow: couldn't seek in logfile %s: %s\n", filename, strerror(errno));
+			clean_symlinks(d, 1);
+			exit(1);
+		}
+
 		while((line = get_line(d->logfile))) {
 			linenum++;
 
@@ -806,6 +855,28 @@ void dag_log_recover(struct dag *d, const char *filename)
 	// Decide rerun tasks
 	if(!first_run) {
 		struct itable *rerun_table = itable_create(0);
+
+		/* Rules that were left running together in a composite job
+		 * share its jobid. Which rules the job ran, and in what order,
+		 * is not kept, so it is not reconnected: its rules are rerun
+		 * like any other failed rule, and its completion is ignored. */
+		if(batch_queue_type == BATCH_QUEUE_TYPE_CONDOR) {
+			struct itable *running = itable_create(0);
+			struct dag_node *p;
+			for(n = d->nodes; n; n = n->next) {
+				if(n->state != DAG_NODE_STATE_RUNNING || n->local_job)
+					continue;
+				p = itable_lookup(running, n->jobid);
+				if(p) {
+					p->state = DAG_NODE_STATE_FAILED;
+					n->state = DAG_NODE_STATE_FAILED;
+				} else {
+					itable_insert(running, n->jobid, n);
+				}
+			}
+			itable_delete(running);
+		}
+
 		for(n = d->nodes; n; n = n->next) {
 			dag_node_decide_rerun(rerun_table, d, n);
 		}
@@ -813,6 +884,186 @@ void dag_log_recover(struct dag *d, const char *filename)
 	}
 }
 
+/* Read the runtimes of completed rules from a makeflow log, which may
+ * come from an earlier run of this or another workflow, and add them to
+ * the task category of the same label. The runtime of a rule is the time
+ * from when it last started running until it completed. If observed is
+ * given, the runtime of each rule (in microseconds) is also recorded there
+ * by node id. Returns the number of runtimes found. */
+int dag_log_learn_runtimes(struct dag *d, const char *filename, struct itable *observed)
+{
+	FILE *file;
+	char *line;
+	int nodeid, state, jobid, offset;
+	int found = 0;
+	timestamp_t timestamp;
+	struct itable *started = itable_create(0);
+	struct itable *labels = itable_create(0);
+	UINT64_T key;
+	void *value;
+
+	file = fopen(filename, "r");
+	if(!file) {
+		debug(D_DEBUG, "couldn't open %s to read runtimes: %s", filename, strerror(errno));
+		itable_delete(started);
+		itable_delete(labels);
+		return 0;
+	}
+
+	while((line = get_line(file))) {
+		string_chomp(line);
+
+		if(sscanf(line, "# CATEGORY\t%d\t%n", &nodeid, &offset) == 1) {
+			free(itable_remove(labels, nodeid));
+			itable_insert(labels, nodeid, xxstrdup(line + offset));
+		} else if(line[0] != '#' && sscanf(line, "%" SCNu64 " %d %d %d", &timestamp, &nodeid, &state, &jobid) == 4) {
+			if(state == DAG_NODE_STATE_RUNNING) {
+				itable_remove(started, nodeid);
+				itable_insert(started, nodeid, (void *) (PTRINT_T) (timestamp + 1));
+			} else if(state == DAG_NODE_STATE_COMPLETE && (value = itable_remove(started, nodeid))) {
+				timestamp_t runtime = timestamp - ((PTRINT_T) value - 1);
+				const char *label = itable_lookup(labels, nodeid);
+
+				if(label) {
+					struct dag_task_category *category = dag_task_category_lookup_or_create(d, label);
+					category->runtime_count++;
+					category->runtime_total += runtime;
+				}
+
+				if(observed) {
+					itable_remove(observed, nodeid);
+					itable_insert(observed, nodeid, (void *) (PTRINT_T) (runtime + 1));
+				}
+
+				found++;
+			}
+		}
+
+		free(line);
+	}
+
+	fclose(file);
+
+	itable_firstkey(labels);
+	while(itable_nextkey(labels, &key, &value))
+		free(value);
+	itable_delete(labels);
+	itable_delete(started);
+
+	debug(D_DEBUG, "read %d runtimes from %s", found, filename);
+
+	return found;
+}
+
+/* Estimate the runtime of each rule as the mean runtime of its category.
+ * Rules of categories never seen to complete get the mean over all
+ * categories, or one second if nothing is known at all. */
+void dag_estimate_runtimes(struct dag *d)
+{
+	struct dag_task_category *category;
+	struct dag_node *n;
+	char *label;
+	timestamp_t total = 0;
+	int count = 0;
+	double fallback = 1;
+
+	hash_table_firstkey(d->task_categories);
+	while(hash_table_nextkey(d->task_categories, &label, (void **) &category)) {
+		total += category->runtime_total;
+		count += category->runtime_count;
+	}
+
+	if(count > 0)
+		fallback = total / (double) count / 1000000.0;
+
+	for(n = d->nodes; n; n = n->next) {
+		category = n->category;
+		if(category && category->runtime_count > 0) {
+			n->runtime_estimate = category->runtime_total / (double) category->runtime_count / 1000000.0;
+		} else {
+			n->runtime_estimate = fallback;
+		}
+	}
+}
+
+/* The critical path of a node is its own runtime estimate plus the
+ * longest critical path among its descendants. The nodes are visited in
+ * reverse topological order, starting from the sinks, so that deep
+ * chains do not recurse. Nodes in a cycle keep their own estimate. */
+void dag_compute_critical_path(struct dag *d)
+{
+	struct dag_node *n, *m;
+	struct list *sinks = list_create();
+	struct itable *pending = itable_create(0);
+	int count, i;
+
+	for(n = d->nodes; n; n = n->next) {
+		n->critical_path = n->runtime_estimate;
+		count = n->descendant_count;
+		if(count == 0) {
+			list_push_tail(sinks, n);
+		} else {
+			itable_insert(pending, n->nodeid, (void *) (PTRINT_T) count);
+		}
+	}
+
+	while((n = list_pop_head(sinks))) {
+		for(i = 0; i < n->descendant_count; i++) {
+			m = n->descendants[i];
+			n->critical_path = MAX(n->critical_path, n->runtime_estimate + m->critical_path);
+		}
+
+		for(i = 0; i < n->ancestor_count; i++) {
+			m = n->ancestors[i];
+			count = (PTRINT_T) itable_remove(pending, m->nodeid) - 1;
+			if(count > 0) {
+				itable_insert(pending, m->nodeid, (void *) (PTRINT_T) count);
+			} else {
+				list_push_tail(sinks, m);
+			}
+		}
+	}
+
+	if(itable_size(pending) > 0)
+		debug(D_DEBUG, "%d rules are part of a cycle and have no critical path", itable_size(pending));
+
+	itable_delete(pending);
+	list_delete(sinks);
+}
+
+/* The number of bytes that could be garbage collected once this node
+ * completes: the sizes of its sources for which it is the last user. */
+INT64_T dag_node_gc_bytes(struct dag *d, struct dag_node *n)
+{
+	struct dag_file *f;
+	INT64_T bytes = 0;
+
+	list_first_item(n->source_files);
+	while((f = list_next_item(n->source_files))) {
+		PTRINT_T ref_count = (PTRINT_T) hash_table_lookup(d->collect_table, f->filename);
+		if(ref_count && ref_count <= MAKEFLOW_GC_MIN_THRESHOLD + 1 && dag_file_check(f, 1))
+			bytes += f->size;
+	}
+
+	return bytes;
+}
+
+/* Prepare the rule priorities for the given scheduling method, using the
+ * runtimes of the current log (if restarting) and of any extra log given. */
+void dag_prepare_schedule(struct dag *d, const char *logfilename, const char *history)
+{
+	/* Composite jobs are sized by the runtime estimates too. */
+	if(dag_schedule_method == DAG_SCHEDULE_FIFO && dag_cluster_size < 2)
+		return;
+
+	dag_log_learn_runtimes(d, logfilename, NULL);
+	if(history)
+		dag_log_learn_runtimes(d, history, NULL);
+
+	dag_estimate_runtimes(d);
+	dag_compute_critical_path(d);
+}
+
 static char *translate_command(struct dag_node *n, char *old_command, int is_local)
 {
 	char *new_command;
@@ -1023,7 +1274,8 @@ void dag_prepare_nested_jobs(struct dag *d)
 			if(n->nested_job && (n->local_job || batch_queue_type == BATCH_QUEUE_TYPE_LOCAL)) {
 				char *command = xxmalloc(strlen(n->command) + 20);
 				sprintf(command, "%s -j %d", n->command, d->local_jobs_max / dag_nested_width);
-				free((char *)n->command);
+				if(n->command != n->original_command)
+					free((char *)n->command);
 				n->command = command;
 			}
 		}
@@ -1034,7 +1286,8 @@ char *dag_parse_readline(struct lexer_book *bk, struct dag_node *n)
 {
 	struct dag *d = bk->d;
 	struct dag_lookup_set s = {d, n, NULL};
-	char *raw_line = get_line(bk->stream);
+	char *line = get_line(bk->stream);
+	char *raw_line = line;
 
 	if(raw_line) {
 		bk->column_number = 1;
@@ -1060,6 +1313,7 @@ char *dag_parse_readline(struct lexer_book *bk, struct dag_node *n)
 
 		char *subst_line = xxstrdup(raw_line);
 		subst_line = string_subst(subst_line, dag_lookup, &s);
+		free(line);
 
 		free(bk->linetext);
 		bk->linetext = xxstrdup(subst_line);
@@ -1153,6 +1407,8 @@ int dag_parse_variable(struct lexer_book *bk, struct dag_node *n, char *line)
 		value = strcat(new_value, value);
 		hash_table_insert(s.table, name, value);
 	} else {
+		if(n && !n->variables)
+			n->variables = hash_table_create(0, 0);
 		hash_table_insert((n ? n->variables : d->variables), name, xxstrdup(value));
 	}
 
@@ -1367,6 +1623,12 @@ void dag_parse_node_set_command(struct lexer_book *bk, struct dag_node *n, char
 
 	n->original_command = xxstrdup(command);
 	n->command = translate_command(n, command, n->local_job);
+
+	/* Most commands need no translation, and can share one copy. */
+	if(!strcmp(n->command, n->original_command)) {
+		free((char *) n->command);
+		n->command = n->original_command;
+	}
 	debug(D_DEBUG, "node command=%s", n->command);
 }
 
@@ -1516,76 +1778,446 @@ void dag_export_variables(struct dag *d, struct dag_node *n)
 	}
 }
 
-void dag_node_submit(struct dag *d, struct dag_node *n)
+/* The files of a node, or of all the members of a composite job, by local
+ * and remote name, the remote name being null where it is the same. The
+ * remote names were found when the rules were parsed. In a composite job,
+ * each file is listed once, and inputs made by a member are left out. */
+static struct batch_job_file *dag_node_batch_files(struct dag_node *head, int is_input, int *count)
 {
-	char *input_files = NULL;
-	char *output_files = NULL;
+	struct hash_table *listed = NULL;
+	struct batch_job_file *result;
+	struct dag_node *n, *m;
 	struct dag_file *f;
-	const char *remotename;
+	struct list *files;
+	int size = 0;
 
-	struct batch_queue *thequeue;
+	for(n = head; n; n = n->cluster_next)
+		size += list_size(is_input ? n->source_files : n->target_files);
 
-	if(n->local_job) {
-		thequeue = local_queue;
-	} else {
-		thequeue = remote_queue;
+	*count = 0;
+	if(size == 0)
+		return NULL;
+
+	if(head->cluster_next)
+		listed = hash_table_create(0, 0);
+
+	result = xxmalloc(sizeof(*result) * size);
+
+	for(n = head; n; n = n->cluster_next) {
+		files = is_input ? n->source_files : n->target_files;
+		list_first_item(files);
+		while((f = list_next_item(files))) {
+			if(listed) {
+				if(hash_table_lookup(listed, f->filename))
+					continue;
+				if(is_input) {
+					for(m = head; m && m != f->target_of; m = m->cluster_next)
+						;
+					if(m)
+						continue;
+				}
+				hash_table_insert(listed, f->filename, f);
+			}
+			result[*count].local_name = f->filename;
+			result[*count].remote_name = dag_node_remote_name(n, f);
+			(*count)++;
+		}
 	}
 
-	printf("%s\n", n->command);
+	if(listed)
+		hash_table_delete(listed);
 
-	int len = 0, len_temp;
-	char *tmp;
+	return result;
+}
+
+/* The comma separated list of files for a queue that takes them as a
+ * string: for Condor, the remote names, and otherwise the local names.
+ * It is measured first, and allocated once. Work Queue takes the files
+ * themselves. */
+static char *dag_batch_files_string(struct batch_job_file *files, int count, batch_queue_type_t type)
+{
+	const char *name;
+	size_t length = 0, l;
+	char *result, *p;
+	int i;
+
+	if(count == 0)
+		return NULL;
+
+	for(i = 0; i < count; i++) {
+		name = (type == BATCH_QUEUE_TYPE_CONDOR && files[i].remote_name) ? files[i].remote_name : files[i].local_name;
+		length += strlen(name) + 1;
+	}
+
+	result = p = xxmalloc(length + 1);
+
+	for(i = 0; i < count; i++) {
+		name = (type == BATCH_QUEUE_TYPE_CONDOR && files[i].remote_name) ? files[i].remote_name : files[i].local_name;
+		l = strlen(name);
+		memcpy(p, name, l);
+		p += l;
+		*p++ = ',';
+	}
+	*p = 0;
+
+	return result;
+}
+
+/* The batch options and exported variables with which a node is submitted.
+ * Nodes that agree on these can be submitted together. */
+static char *dag_node_submit_context(struct dag *d, struct dag_node *n)
+{
+	struct dag_lookup_set s = {d, n, NULL};
+	char *context, *name, *value, *old;
+
+	value = dag_lookup("BATCH_OPTIONS", &s);
+	context = xxstrdup(value ? value : "");
+	free(value);
+
+	list_first_item(d->export_list);
+	while((name = list_next_item(d->export_list))) {
+		value = dag_lookup(name, &s);
+		old = context;
+		if(value)
+			context = string_format("%s\n%s=%s", old, name, value);
+		else
+			context = string_format("%s\n%s", old, name);
+		free(old);
+		free(value);
+	}
+
+	return context;
+}
+
+/* Composite jobs. When rules are many and short, the overhead of each
+ * batch job dominates. With --cluster-size, rules of the same category
+ * and submit context that are ready together, and chains of rules where
+ * each is the only descendant of the one before, are run as one job of
+ * at most that many rules. The members run one after the other in the
+ * same sandbox, so that the files passed along a chain are not sent in
+ * again. The job stops at the first member that fails, and exits with its
+ * position, from which the state of each rule is recovered. The members
+ * are linked through cluster_next, and the job is known by the first. */
+
+struct dag_cluster {
+	struct dag_node **nodes;
+	int count;
+	const char *context;
+	double runtime;
+	struct hash_table *sandbox_files;   /* From the name in the sandbox to the dag_file. */
+	struct hash_table *sandbox_names;   /* From the filename to the name in the sandbox. */
+};
+
+static const char *dag_file_sandbox_name(struct dag_node *n, struct dag_file *f)
+{
+	const char *remotename = dag_node_remote_name(n, f);
+	return remotename ? remotename : f->filename;
+}
+
+/* The files of a node may share the sandbox if each name in it still
+ * stands for one file, and each file is known by one name. */
+static int dag_cluster_files_fit(struct dag_cluster *c, struct dag_node *n, struct list *files)
+{
+	struct dag_file *f, *g;
+	const char *name, *other;
+
+	list_first_item(files);
+	while((f = list_next_item(files))) {
+		name = dag_file_sandbox_name(n, f);
+		g = hash_table_lookup(c->sandbox_files, name);
+		if(g && g != f)
+			return 0;
+		other = hash_table_lookup(c->sandbox_names, f->filename);
+		if(other && strcmp(other, name))
+			return 0;
+	}
+
+	return 1;
+}
+
+static void dag_cluster_add_files(struct dag_cluster *c, struct dag_node *n, struct list *files)
+{
+	struct dag_file *f;
+	const char *name;
+
+	list_first_item(files);
+	while((f = list_next_item(files))) {
+		name = dag_file_sandbox_name(n, f);
+		if(!hash_table_lookup(c->sandbox_files, name))
+			hash_table_insert(c->sandbox_files, name, f);
+		if(!hash_table_lookup(c->sandbox_names, f->filename))
+			hash_table_insert(c->sandbox_names, f->filename, name);
+	}
+}
+
+static int dag_cluster_accepts(struct dag_cluster *c, struct dag_node *n, const char *context, int limit)
+{
+	if(c->count >= limit)
+		return 0;
+	if(n->local_job || n->nested_job || n->category != c->nodes[0]->category)
+		return 0;
+	if(c->runtime + n->runtime_estimate > MAKEFLOW_CLUSTER_RUNTIME)
+		return 0;
+	if(strcmp(context, c->context))
+		return 0;
+	return dag_cluster_files_fit(c, n, n->source_files) && dag_cluster_files_fit(c, n, n->target_files);
+}
+
+static void dag_cluster_add(struct dag_cluster *c, struct dag_node *n)
+{
+	dag_cluster_add_files(c, n, n->source_files);
+	dag_cluster_add_files(c, n, n->target_files);
+	c->nodes[c->count++] = n;
+	c->runtime += n->runtime_estimate;
+}
+
+static int dag_cluster_member(struct dag_cluster *c, struct dag_node *n)
+{
+	int i;
+
+	for(i = 0; i < c->count; i++) {
+		if(c->nodes[i] == n)
+			return 1;
+	}
+
+	return 0;
+}
+
+/* The only descendant of a member, if it can run after the members in the
+ * same job: each of its sources is complete, or made by a member. Rules
+ * are not chained when caching, as their keys need their sources. */
+static struct dag_node *dag_cluster_chain_next(struct dag *d, struct dag_cluster *c, struct dag_node *p)
+{
+	struct dag_node *n;
+	struct dag_file *f;
+	char *context;
+	int accepted;
+
+	if(dag_cache || p->descendant_count != 1)
+		return NULL;
+
+	n = p->descendants[0];
+	if(n->state != DAG_NODE_STATE_WAITING || n->ready_queued || dag_cluster_member(c, n))
+		return NULL;
 
 	list_first_item(n->source_files);
-	while( (f = list_next_item(n->source_files)) ) {
-		remotename = dag_file_remote_name(n, f->filename);
-		if(!remotename)
-			remotename = f->filename;
+	while((f = list_next_item(n->source_files))) {
+		if(!hash_table_lookup(d->completed_files, f->filename) && !dag_cluster_member(c, f->target_of))
+			return NULL;
+	}
 
-		switch(batch_queue_get_type(thequeue)) {
-		case BATCH_QUEUE_TYPE_WORK_QUEUE:
-			tmp = string_format("%s=%s,", f->filename, remotename);
-			break;
-		case BATCH_QUEUE_TYPE_CONDOR:
-			tmp = string_format("%s,", remotename);
-			break;
-		default:
-			tmp = string_format("%s,", f->filename);
+	context = dag_node_submit_context(d, n);
+	accepted = dag_cluster_accepts(c, n, context, dag_cluster_size);
+	free(context);
+
+	return accepted ? n : NULL;
+}
+
+/* Group the nodes taken from the ready queue into at most slots composite
+ * jobs, and put the first node of each in place of the nodes, returning
+ * how many there are. The ready nodes are spread over as many jobs as
+ * there are slots, so that rules only run together when there are more
+ * than can run apart; chains are followed regardless. Nodes that do not
+ * fit are put back in the ready queue. */
+static int dag_cluster_ready(struct dag *d, struct dag_node **nodes, int count, int slots)
+{
+	struct dag_cluster c;
+	struct dag_node *n;
+	char **contexts;
+	int target, heads = 0, i, j;
+
+	target = MIN(dag_cluster_size, (count + slots - 1) / slots);
+
+	contexts = xxmalloc(sizeof(*contexts) * count);
+	for(i = 0; i < count; i++)
+		contexts[i] = dag_node_submit_context(d, nodes[i]);
+
+	c.nodes = xxmalloc(sizeof(*c.nodes) * dag_cluster_size);
+
+	for(i = 0; i < count; i++) {
+		n = nodes[i];
+		if(!n)
+			continue;
+		nodes[i] = NULL;
+
+		if(heads == slots) {
+			dag_node_make_ready(d, n);
+			continue;
 		}
-		len_temp = strlen(tmp);
-		input_files = realloc(input_files, (len + len_temp + 1) * sizeof(char));
-		memcpy(input_files + len, tmp, len_temp + 1);
-		len += len_temp;
+
+		c.count = 0;
+		c.runtime = 0;
+		c.context = contexts[i];
+		c.sandbox_files = hash_table_create(0, 0);
+		c.sandbox_names = hash_table_create(0, 0);
+		dag_cluster_add(&c, n);
+
+		for(j = i + 1; j < count; j++) {
+			if(nodes[j] && dag_cluster_accepts(&c, nodes[j], contexts[j], target)) {
+				dag_cluster_add(&c, nodes[j]);
+				nodes[j] = NULL;
+			}
+		}
+
+		/* The members added here are themselves followed in turn. */
+		for(j = 0; j < c.count; j++) {
+			while((n = dag_cluster_chain_next(d, &c, c.nodes[j])))
+				dag_cluster_add(&c, n);
+		}
+
+		for(j = 0; j < c.count; j++)
+			c.nodes[j]->cluster_next = j + 1 < c.count ? c.nodes[j + 1] : NULL;
+
+		hash_table_delete(c.sandbox_files);
+		hash_table_delete(c.sandbox_names);
+
+		nodes[heads++] = c.nodes[0];
 	}
 
+	for(i = 0; i < count; i++)
+		free(contexts[i]);
+	free(contexts);
+	free(c.nodes);
 
-	len = 0;
-	list_first_item(n->target_files);
-	while( (f = list_next_item(n->target_files)) ) {
-		remotename = dag_file_remote_name(n, f->filename);
-		if(!remotename)
-			remotename = f->filename;
+	return heads;
+}
 
-		switch(batch_queue_get_type(thequeue)) {
-		case BATCH_QUEUE_TYPE_WORK_QUEUE:
-			tmp = string_format("%s=%s,", remotename, f->filename);
-			break;
-		case BATCH_QUEUE_TYPE_CONDOR:
-			tmp = string_format("%s,", remotename);
-			break;
-		default:
-			tmp = string_format("%s,", f->filename);
+/* The file in which a composite job records the exit code of the member
+ * that failed, or zero. It is an output of the job, so it always exists
+ * when the job ends. */
+static char *dag_cluster_status_file(struct dag_node *head)
+{
+	return string_format(".makeflow.cluster.%d", head->nodeid);
+}
+
+/* The command of a composite job. Each member runs in a subshell, and
+ * the job exits with the position of the first that fails. */
+static char *dag_cluster_command(struct dag_node *n)
+{
+	buffer_t *b = buffer_create();
+	char *status = dag_cluster_status_file(n);
+	char *command;
+	int position;
+
+	for(position = 1; n; n = n->cluster_next, position++)
+		buffer_printf(b, "( %s ) || { echo $? > %s; exit %d; }; ", n->command, status, position);
+	buffer_printf(b, "echo 0 > %s", status);
+
+	command = xxstrdup(buffer_tostring(b, NULL));
+	buffer_delete(b);
+	free(status);
+
+	return command;
+}
+
+/* The exit code of the member of a composite job that failed, as recorded
+ * in its status file, or one if that was not returned. */
+static int dag_cluster_status(struct dag_node *head)
+{
+	char *status = dag_cluster_status_file(head);
+	FILE *file = fopen(status, "r");
+	int code = 0;
+
+	if(file) {
+		if(fscanf(file, "%d", &code) != 1)
+			code = 0;
+		fclose(file);
+	}
+
+	unlink(status);
+	free(status);
+
+	return code ? code : 1;
+}
+
+/* Put a member that was never run back to wait for its sources. */
+static void dag_cluster_requeue(struct dag *d, struct dag_node *n)
+{
+	if(n->local_job) {
+		d->local_jobs_running--;
+	} else {
+		d->remote_jobs_running--;
+	}
+
+	dag_node_state_change(d, n, DAG_NODE_STATE_WAITING);
+	if(n->sources_remaining == 0)
+		dag_node_make_ready(d, n);
+}
+
+/* Split the result of a composite job into the results of its members:
+ * those before the position it exited with completed, the one at that
+ * position failed with its own exit code, and the rest did not run. If
+ * the job as a whole failed, every member shares its result. */
+static void dag_cluster_complete(struct dag *d, struct dag_node *n, struct batch_job_info *info)
+{
+	struct batch_job_info member_info;
+	struct dag_node *next;
+	int count = 0, failed, position, code;
+
+	for(next = n; next; next = next->cluster_next)
+		count++;
+
+	if(info->exited_normally && info->exit_code >= 0 && info->exit_code <= count)
+		failed = info->exit_code;
+	else
+		failed = -1;
+
+	code = dag_cluster_status(n);
+	member_info = *info;
+
+	for(position = 1; n; n = next, position++) {
+		next = n->cluster_next;
+		n->cluster_next = NULL;
+
+		if(failed < 0) {
+			dag_node_complete(d, n, info);
+		} else if(failed == 0 || position < failed) {
+			member_info.exit_code = 0;
+			dag_node_complete(d, n, &member_info);
+		} else if(position == failed) {
+			member_info.exit_code = code;
+			dag_node_complete(d, n, &member_info);
+		} else {
+			dag_cluster_requeue(d, n);
 		}
-		len_temp = strlen(tmp);
-		output_files = realloc(output_files, (len + len_temp + 1) * sizeof(char));
-		memcpy(output_files + len, tmp, len_temp + 1);
-		len += len_temp;
+	}
+}
+
+/* Submit nodes that share a submit context to a queue at once. */
+static void dag_node_submit_batch(struct dag *d, struct batch_queue *thequeue, struct dag_node **nodes, int count)
+{
+	struct batch_job_submission *jobs = xxmalloc(sizeof(*jobs) * count);
+	batch_queue_type_t type = batch_queue_get_type(thequeue);
+	struct dag_node *n, *m, *next;
+	int i, j, done, composite;
+
+	for(i = 0; i < count; i++) {
+		n = nodes[i];
+		for(m = n; m; m = m->cluster_next)
+			printf("%s\n", m->command);
+		jobs[i].cmdline = n->cluster_next ? dag_cluster_command(n) : n->command;
+		jobs[i].inputs = dag_node_batch_files(n, 1, &jobs[i].input_count);
+		jobs[i].outputs = dag_node_batch_files(n, 0, &jobs[i].output_count);
+		if(n->cluster_next) {
+			jobs[i].outputs = xxrealloc(jobs[i].outputs, sizeof(*jobs[i].outputs) * (jobs[i].output_count + 1));
+			jobs[i].outputs[jobs[i].output_count].local_name = dag_cluster_status_file(n);
+			jobs[i].outputs[jobs[i].output_count].remote_name = NULL;
+			jobs[i].output_count++;
+		}
+		if(type == BATCH_QUEUE_TYPE_WORK_QUEUE || type == BATCH_QUEUE_TYPE_WORK_QUEUE_SHAREDFS) {
+			jobs[i].input_files = NULL;
+			jobs[i].output_files = NULL;
+		} else {
+			jobs[i].input_files = dag_batch_files_string(jobs[i].inputs, jobs[i].input_count, type);
+			jobs[i].output_files = dag_batch_files_string(jobs[i].outputs, jobs[i].output_count, type);
+		}
+		jobs[i].jobid = -1;
 	}
 
 	/* Before setting the batch job options (stored in the "BATCH_OPTIONS"
 	 * variable), we must save the previous global queue value, and then
 	 * restore it after we submit. */
-	struct dag_lookup_set s = {d, n, NULL};
+	struct dag_lookup_set s = {d, nodes[0], NULL};
 	char *batch_submit_options = dag_lookup("BATCH_OPTIONS", &s);
 	char *old_batch_submit_options = NULL;
 
@@ -1599,13 +2231,29 @@ void dag_node_submit(struct dag *d, struct dag_node *n)
 	int waittime = 1;
 
 	/* Export variables before each submit. We have to do this before each
-	 * node submission because each node may have local variables
-	 * definitions. */
-	dag_export_variables(d, n);
+	 * submission because each node may have local variables definitions,
+	 * but all of the nodes submitted together have the same values. */
+	dag_export_variables(d, nodes[0]);
 
+	/* The jobs that were submitted are moved ahead of those that were not,
+	 * which are retried. */
+	done = 0;
 	while(1) {
-		n->jobid = batch_job_submit_simple(thequeue, n->command, input_files, output_files);
-		if(n->jobid >= 0)
+		batch_job_submit_simple_batch(thequeue, jobs + done, count - done);
+
+		for(i = j = done; i < count; i++) {
+			if(jobs[i].jobid >= 0) {
+				struct batch_job_submission job = jobs[i];
+				jobs[i] = jobs[j];
+				jobs[j] = job;
+				n = nodes[i];
+				nodes[i] = nodes[j];
+				nodes[j] = n;
+				j++;
+			}
+		}
+		done = j;
+		if(done == count)
 			break;
 
 		fprintf(stderr,"couldn't submit batch job, still trying...\n");
@@ -1627,64 +2275,221 @@ void dag_node_submit(struct dag *d, struct dag_node *n)
 		free(old_batch_submit_options);
 	}
 
-	if(n->jobid >= 0) {
-		dag_node_state_change(d, n, DAG_NODE_STATE_RUNNING);
-		if(n->local_job) {
-			itable_insert(d->local_job_table, n->jobid, n);
-			d->local_jobs_running++;
-		} else {
-			itable_insert(d->remote_job_table, n->jobid, n);
-			d->remote_jobs_running++;
+	/* Every member of a composite job runs, but the job is known by the
+	 * first member alone. */
+	for(i = 0; i < count; i++) {
+		n = nodes[i];
+		composite = n->cluster_next != NULL;
+		if(jobs[i].jobid >= 0) {
+			if(n->local_job) {
+				itable_insert(d->local_job_table, jobs[i].jobid, n);
+			} else {
+				itable_insert(d->remote_job_table, jobs[i].jobid, n);
+			}
 		}
-	} else {
-		dag_node_state_change(d, n, DAG_NODE_STATE_FAILED);
-		dag_failed_flag = 1;
+		for(m = n; m; m = next) {
+			next = m->cluster_next;
+			m->jobid = jobs[i].jobid;
+			if(m->jobid >= 0) {
+				dag_node_state_change(d, m, DAG_NODE_STATE_RUNNING);
+				if(m->local_job) {
+					d->local_jobs_running++;
+				} else {
+					d->remote_jobs_running++;
+				}
+			} else {
+				m->cluster_next = NULL;
+				dag_node_state_change(d, m, DAG_NODE_STATE_FAILED);
+				dag_failed_flag = 1;
+			}
+		}
+		if(composite) {
+			free((char *) jobs[i].cmdline);
+			free((char *) jobs[i].outputs[jobs[i].output_count - 1].local_name);
+		}
+		free((char *) jobs[i].input_files);
+		free((char *) jobs[i].output_files);
+		free(jobs[i].inputs);
+		free(jobs[i].outputs);
 	}
 
-	free(input_files);
-	free(output_files);
+	free(jobs);
 }
 
-int dag_node_ready(struct dag *d, struct dag_node *n)
+/* Rather than scanning every node for readiness, each node counts its
+ * sources that are not yet complete. When a file is completed, the count
+ * of each node that needs it is decremented, and nodes that reach zero
+ * are queued for dispatch. The queues are ordered according to the
+ * scheduling method: in order of readiness (fifo), by longest remaining
+ * critical path (critical), or by the most bytes that become garbage
+ * collectable when the node completes, and then by critical path (gc). */
+
+void dag_node_make_ready(struct dag *d, struct dag_node *n)
 {
-	struct dag_file *f;
+	double primary = 0, secondary = 0;
 
-	if(n->state != DAG_NODE_STATE_WAITING)
-		return 0;
+	if(n->state != DAG_NODE_STATE_WAITING || n->ready_queued)
+		return;
 
+	switch(dag_schedule_method) {
+		case DAG_SCHEDULE_CRITICAL_PATH:
+			primary = n->critical_path;
+			break;
+		case DAG_SCHEDULE_GC:
+			primary = dag_node_gc_bytes(d, n);
+			secondary = n->critical_path;
+			break;
+		default:
+			break;
+	}
+
+	n->ready_queued = 1;
 	if(n->local_job) {
-		if(d->local_jobs_running >= d->local_jobs_max)
-			return 0;
+		dag_ready_queue_push(d->local_ready, n, primary, secondary);
 	} else {
-		if(d->remote_jobs_running >= d->remote_jobs_max)
-			return 0;
+		dag_ready_queue_push(d->remote_ready, n, primary, secondary);
 	}
+}
 
-	list_first_item(n->source_files);
-	while( (f = list_next_item(n->source_files)) ) {
-		if(hash_table_lookup(d->completed_files, f->filename)) {
-			continue;
-		} else {
-			return 0;
+void dag_prepare_ready_queue(struct dag *d)
+{
+	struct dag_node *n;
+	struct dag_file *f;
+
+	for(n = d->nodes; n; n = n->next) {
+		n->sources_remaining = 0;
+		list_first_item(n->source_files);
+		while( (f = list_next_item(n->source_files)) ) {
+			if(!hash_table_lookup(d->completed_files, f->filename))
+				n->sources_remaining++;
+		}
+		if(n->sources_remaining == 0)
+			dag_node_make_ready(d, n);
+	}
+}
+
+void dag_file_complete(struct dag *d, struct dag_file *f)
+{
+	struct dag_node *n;
+
+	if(hash_table_lookup(d->completed_files, f->filename))
+		return;
+
+	hash_table_insert(d->completed_files, f->filename, f->filename);
+
+	list_first_item(f->needed_by);
+	while( (n = list_next_item(f->needed_by)) ) {
+		n->sources_remaining--;
+		if(n->sources_remaining == 0)
+			dag_node_make_ready(d, n);
+	}
+}
+
+/* If the outputs of a node are in the cache, restore them and complete
+ * the node without running it. Otherwise, remember its key so that the
+ * outputs can be stored when it completes. */
+int dag_node_cache_restore(struct dag *d, struct dag_node *n)
+{
+	struct batch_job_info info;
+	struct dag_file *f;
+	struct stat st;
+
+	if(!dag_cache || n->nested_job)
+		return 0;
+
+	free(n->cache_key);
+	n->cache_key = dag_cache_key(dag_cache, n);
+	if(!n->cache_key)
+		return 0;
+
+	if(!dag_cache_restore(dag_cache, n, n->cache_key)) {
+		/* An old output may be a link into the cache: make sure that
+		 * the job replaces it rather than writing through it. */
+		list_first_item(n->target_files);
+		while((f = list_next_item(n->target_files))) {
+			if(lstat(f->filename, &st) == 0 && S_ISREG(st.st_mode) && st.st_nlink > 1)
+				unlink(f->filename);
 		}
+		return 0;
 	}
 
+	printf("%s (cached)\n", n->command);
+
+	free(n->cache_key);
+	n->cache_key = NULL;
+
+	memset(&info, 0, sizeof(info));
+	info.exited_normally = 1;
+	info.exit_code = 0;
+
+	n->jobid = 0;
+	dag_node_state_change(d, n, DAG_NODE_STATE_RUNNING);
+	if(n->local_job) {
+		d->local_jobs_running++;
+	} else {
+		d->remote_jobs_running++;
+	}
+	dag_node_complete(d, n, &info);
+
 	return 1;
 }
 
-void dag_dispatch_ready_jobs(struct dag *d)
+/* Take as many nodes from a ready queue as the queue has room for, and
+ * submit them together, in runs of nodes with the same submit context.
+ * When remote rules are clustered, the room is counted in jobs rather
+ * than rules, and each job may take several rules. */
+static void dag_dispatch_ready_queue(struct dag *d, struct batch_queue *queue, struct dag_ready_queue *ready, int *running, int max)
 {
+	struct dag_node **nodes = NULL;
 	struct dag_node *n;
+	char *context, *next;
+	int count = 0, size = 0, first, i;
+	int limit = max - *running;
+	int slots = 0;
 
-	for(n = d->nodes; n; n = n->next) {
+	if(dag_cluster_size > 1 && queue == remote_queue) {
+		slots = max - itable_size(d->remote_job_table);
+		limit = slots * dag_cluster_size;
+	}
 
-		if(d->remote_jobs_running >= d->remote_jobs_max && d->local_jobs_running >= d->local_jobs_max)
-			break;
+	while(count < limit && (n = dag_ready_queue_pop(ready, NULL))) {
+		n->ready_queued = 0;
+		if(n->state != DAG_NODE_STATE_WAITING || dag_node_cache_restore(d, n))
+			continue;
+		if(count == size) {
+			size = size ? size * 2 : 64;
+			nodes = xxrealloc(nodes, sizeof(*nodes) * size);
+		}
+		nodes[count++] = n;
+	}
+
+	if(count == 0)
+		return;
+
+	if(slots > 0)
+		count = dag_cluster_ready(d, nodes, count, slots);
 
-		if(dag_node_ready(d, n)) {
-			dag_node_submit(d, n);
+	first = 0;
+	context = dag_node_submit_context(d, nodes[0]);
+	for(i = 1; i <= count; i++) {
+		next = i < count ? dag_node_submit_context(d, nodes[i]) : NULL;
+		if(next && !strcmp(next, context)) {
+			free(next);
+			continue;
 		}
+		dag_node_submit_batch(d, queue, nodes + first, i - first);
+		free(context);
+		context = next;
+		first = i;
 	}
+
+	free(nodes);
+}
+
+void dag_dispatch_ready_jobs(struct dag *d)
+{
+	dag_dispatch_ready_queue(d, remote_queue, d->remote_ready, &d->remote_jobs_running, d->remote_jobs_max);
+	dag_dispatch_ready_queue(d, local_queue, d->local_ready, &d->local_jobs_running, d->local_jobs_max);
 }
 
 void dag_node_complete(struct dag *d, struct dag_node *n, struct batch_job_info *info)
@@ -1692,8 +2497,6 @@ void dag_node_complete(struct dag *d, struct dag_node *n, struct batch_job_info
 	struct dag_file *f;
 	int job_failed = 0;
 
-	struct stat stat_info;
-
 	if(n->state != DAG_NODE_STATE_RUNNING)
 		return;
 
@@ -1706,16 +2509,14 @@ void dag_node_complete(struct dag *d, struct dag_node *n, struct batch_job_info
 	if(info->exited_normally && info->exit_code == 0) {
 		list_first_item(n->target_files);
 		while( (f = list_next_item(n->target_files)) ) {
-			if(access(f->filename, R_OK) != 0) {
+			if(!dag_file_update(f)) {
 				fprintf(stderr,"%s did not create file %s\n", n->command, f->filename);
 				job_failed = 1;
 			} else {
 				if(output_len_check) {
-					if(stat(f->filename, &stat_info) == 0) {
-						if(stat_info.st_size <= 0) {
-							debug(D_DEBUG, "%s created a file of length %ld\n", n->command, (long) stat_info.st_size);
-							job_failed = 1;
-						}
+					if(f->size <= 0) {
+						debug(D_DEBUG, "%s created a file of length %ld\n", n->command, (long) f->size);
+						job_failed = 1;
 					}
 				}
 			}
@@ -1739,15 +2540,28 @@ void dag_node_complete(struct dag *d, struct dag_node *n, struct batch_job_info
 			} else {
 				fprintf(stderr,"will retry failed job %s\n", n->command);
 				dag_node_state_change(d, n, DAG_NODE_STATE_WAITING);
+				/* A member of a composite job may still wait for
+				 * sources that the job did not make. */
+				if(n->sources_remaining == 0)
+					dag_node_make_ready(d, n);
 			}
 		} else {
 			dag_failed_flag = 1;
 		}
 	} else {
-		/* Record which target files have been generated by this node. */
+		if(n->cache_key) {
+			dag_cache_store(dag_cache, n, n->cache_key);
+			free(n->cache_key);
+			n->cache_key = NULL;
+		}
+
+		/* Record which target files have been generated by this node,
+		 * and queue those that no rule reads to be collected. */
 		list_first_item(n->target_files);
 		while( (f = list_next_item(n->target_files)) ) {
-			hash_table_insert(d->completed_files, f->filename, f->filename);
+			dag_file_complete(d, f);
+			dag_gc_ref_count(d, f->filename);
+			dag_gc_files_present++;
 		}
 
 		/* Mark source files that have been used by this node and
@@ -1755,9 +2569,9 @@ void dag_node_complete(struct dag *d, struct dag_node *n, struct batch_job_info
 		list_first_item(n->source_files);
 		while( (f = list_next_item(n->source_files)) ) {
 			dag_gc_ref_incr(d, f->filename, -1);
-			if (dag_gc_method == DAG_GC_REF_COUNT) {
-				dag_gc_ref_count(d, f->filename);
-			}
+		}
+		if (dag_gc_method == DAG_GC_REF_COUNT) {
+			dag_gc(d);
 		}
 		dag_node_state_change(d, n, DAG_NODE_STATE_COMPLETE);
 	}
@@ -1778,7 +2592,7 @@ int dag_check(struct dag *d)
 				continue;
 			}
 
-			if(access(f->filename, R_OK) == 0) {
+			if(dag_file_check(f, dag_trust_log)) {
 				hash_table_insert(d->completed_files, f->filename, f->filename);
 				continue;
 			}
@@ -1801,48 +2615,85 @@ int dag_check(struct dag *d)
 	return 1;
 }
 
-int dag_gc_file(struct dag *d, const char *file, int count)
+/* Forget a collectable file, and give it to the worker to remove. */
+static void dag_gc_file(struct dag *d, const char *file)
 {
-	if(access(file, R_OK) == 0 && unlink(file) < 0) {
-		debug(D_NOTICE, "makeflow: unable to collect %s: %s", file, strerror(errno));
-		return 0;
-	} else {
-		debug(D_DEBUG, "Garbage collected %s (%d)", file, count - 1);
-		hash_table_remove(d->collect_table, file);
-		return 1;
+	struct dag_file *f = dag_file_from_name(d, file);
+
+	if(f) {
+		if(f->size > 0)
+			dag_gc_bytes += f->size;
+		dag_file_set_missing(f);
 	}
+
+	dag_gc_worker_push(dag_gc_worker, xxstrdup(file));
+	hash_table_remove(d->collect_table, file);
+	dag_gc_files_present--;
 }
 
-void dag_gc_all(struct dag *d, int threshold, int maxfiles, time_t stoptime)
+/** Line format: # GC timestamp collected time_spent dag_gc_collected
+ *
+ * timestamp - the unix time (in microseconds) when this line is written to the log file.
+ * collected - the number of files were collected in this garbage collection cycle.
+ * time_spent - the length of time this cycle took.
+ * dag_gc_collected - the total number of files has been collected so far since the start this makeflow execution.
+ *
+ */
+static void dag_gc_log(struct dag *d, int collected, timestamp_t start_time)
+{
+	if(collected > 0) {
+		dag_gc_collected += collected;
+		fprintf(d->logfile, "# GC\t%" PRIu64 "\t%d\t%" PRIu64 "\t%d\n", timestamp_get(), collected, timestamp_get() - start_time, dag_gc_collected);
+	}
+}
+
+/* Collect files from the queue of those whose readers have all completed,
+ * oldest first, until maxfiles files or maxbytes bytes (by the sizes
+ * recorded when they were created) are collected, or stoptime passes.
+ * Files that have since gained readers again, by a rerun, are skipped,
+ * and queued again once those complete. */
+void dag_gc_collect(struct dag *d, int maxfiles, INT64_T maxbytes, time_t stoptime)
 {
 	int collected = 0;
+	INT64_T bytes = dag_gc_bytes;
+	timestamp_t start_time = timestamp_get();
+	struct dag_file *f;
+	PTRINT_T ref_count;
+
+	while(collected < maxfiles && dag_gc_bytes - bytes < maxbytes && time(0) < stoptime && (f = list_pop_head(d->collect_queue))) {
+		ref_count = (PTRINT_T) hash_table_lookup(d->collect_table, f->filename);
+		if(!ref_count || ref_count > MAKEFLOW_GC_MIN_THRESHOLD)
+			continue;
+		dag_gc_file(d, f->filename);
+		collected++;
+	}
+
+	dag_gc_log(d, collected, start_time);
+}
+
+/* Collect every file still in the collect table, whether or not it has
+ * readers left, as at the end of a successful run. */
+void dag_gc_all(struct dag *d)
+{
+	struct list *files = list_create();
+	timestamp_t start_time = timestamp_get();
 	char *key;
-	PTRINT_T value;
-	timestamp_t start_time, stop_time;
+	void *value;
+	int collected = 0;
 
-	/* This will walk the table of files to collect and will remove any
-	 * that are below or equal to the threshold. */
-	start_time = timestamp_get();
+	/* The table cannot be changed while it is walked. */
 	hash_table_firstkey(d->collect_table);
-	while(hash_table_nextkey(d->collect_table, &key, (void **)&value) && time(0) < stoptime && collected < maxfiles) {
-		if(value <= threshold && dag_gc_file(d, key, (int)value))
-			collected++;
-	}
-	stop_time = timestamp_get();
+	while(hash_table_nextkey(d->collect_table, &key, &value))
+		list_push_tail(files, xxstrdup(key));
 
-	/* Record total amount of files collected to Makeflowlog. */
-	if(collected > 0) {
-		dag_gc_collected += collected;
-		/** Line format: # GC timestamp collected time_spent dag_gc_collected
-		 *
-		 * timestamp - the unix time (in microseconds) when this line is written to the log file.
-		 * collected - the number of files were collected in this garbage collection cycle.
-		 * time_spent - the length of time this cycle took.
-		 * dag_gc_collected - the total number of files has been collected so far since the start this makeflow execution.
-		 *
-		 */
-		fprintf(d->logfile, "# GC\t%" PRIu64 "\t%d\t%" PRIu64 "\t%d\n", timestamp_get(), collected, stop_time - start_time, dag_gc_collected);
+	while((key = list_pop_head(files))) {
+		dag_gc_file(d, key);
+		free(key);
+		collected++;
 	}
+	list_delete(files);
+
+	dag_gc_log(d, collected, start_time);
 }
 
 void dag_gc_ref_incr(struct dag *d, const char *file, int increment)
@@ -1853,27 +2704,21 @@ void dag_gc_ref_incr(struct dag *d, const char *file, int increment)
 		ref_count = ref_count + increment;
 		hash_table_insert(d->collect_table, file, (void *)ref_count);
 		debug(D_DEBUG, "Marked file %s references (%d)", file, ref_count - 1);
+
+		/* The last reader is done with it. */
+		if(increment < 0 && ref_count == MAKEFLOW_GC_MIN_THRESHOLD)
+			dag_gc_ref_count(d, file);
 	}
 }
 
+/* Queue a file to be collected, if it is collectable and has no readers. */
 void dag_gc_ref_count(struct dag *d, const char *file)
 {
-	PTRINT_T ref_count = (PTRINT_T)hash_table_remove(d->collect_table, file);
-	if(ref_count && ref_count <= MAKEFLOW_GC_MIN_THRESHOLD) {
-		timestamp_t start_time, stop_time;
-		start_time = timestamp_get();
-		dag_gc_file(d, file, ref_count);
-		stop_time = timestamp_get();
-		/** Line format: # GC timestamp collected time_spent dag_gc_collected
-		 *
-		 * timestamp - the unix time (in microseconds) when this line is written to the log file.
-		 * collected - the number of files were collected in this garbage collection cycle.
-		 * time_spent - the length of time this cycle took.
-		 * dag_gc_collected - the total number of files has been collected so far since the start this makeflow execution.
-		 *
-		 */
-		fprintf(d->logfile, "# GC\t%" PRIu64 "\t%d\t%" PRIu64 "\t%d\n", timestamp_get(), 1, stop_time - start_time, ++dag_gc_collected);
-	}
+	PTRINT_T ref_count = (PTRINT_T)hash_table_lookup(d->collect_table, file);
+	struct dag_file *f = dag_file_from_name(d, file);
+
+	if(f && ref_count && ref_count <= MAKEFLOW_GC_MIN_THRESHOLD)
+		list_push_tail(d->collect_queue, f);
 }
 
 /* TODO: move this to a more appropriate location? */
@@ -1894,34 +2739,48 @@ int directory_inode_count(const char *dirname)
 	return inode_count;
 }
 
-int directory_low_disk(const char *path)
+/* Returns the number of bytes to collect to bring the free space of the
+ * disk back to MAKEFLOW_GC_TARGET_SPACE, if it has fallen below
+ * MAKEFLOW_MIN_SPACE, or zero. */
+INT64_T directory_low_disk(const char *path)
 {
 	UINT64_T avail, total;
 
-	if(disk_info_get(path, &avail, &total) >= 0)
-		return avail <= MAKEFLOW_MIN_SPACE;
+	if(disk_info_get(path, &avail, &total) >= 0 && avail <= MAKEFLOW_MIN_SPACE)
+		return MAKEFLOW_GC_TARGET_SPACE - avail;
 
 	return 0;
 }
 
+/* The working directory is counted only once, when the run starts.
+ * Afterwards, the count is kept up to date with the files created by
+ * rules and those collected, so that the directory, which may be large,
+ * is not read again on every pass. */
 void dag_gc(struct dag *d)
 {
 	char cwd[PATH_MAX];
+	INT64_T low_disk;
 
 	switch(dag_gc_method) {
+		case DAG_GC_REF_COUNT:
+			dag_gc_collect(d, INT_MAX, INT64_MAX, INT_MAX);
+			break;
 		case DAG_GC_INCR_FILE:
 			debug(D_DEBUG, "Performing incremental file (%d) garbage collection", dag_gc_param);
-			dag_gc_all(d, MAKEFLOW_GC_MIN_THRESHOLD, dag_gc_param, INT_MAX);
+			dag_gc_collect(d, dag_gc_param, INT64_MAX, INT_MAX);
 			break;
 		case DAG_GC_INCR_TIME:
 			debug(D_DEBUG, "Performing incremental time (%d) garbage collection", dag_gc_param);
-			dag_gc_all(d, MAKEFLOW_GC_MIN_THRESHOLD, INT_MAX, time(0) + dag_gc_param);
+			dag_gc_collect(d, INT_MAX, INT64_MAX, time(0) + dag_gc_param);
 			break;
 		case DAG_GC_ON_DEMAND:
 			getcwd(cwd, PATH_MAX);
-			if(directory_inode_count(cwd) >= dag_gc_param || directory_low_disk(cwd)) {
+			if(dag_gc_files_present >= dag_gc_param) {
 				debug(D_DEBUG, "Performing on demand (%d) garbage collection", dag_gc_param);
-				dag_gc_all(d, MAKEFLOW_GC_MIN_THRESHOLD, INT_MAX, INT_MAX);
+				dag_gc_collect(d, INT_MAX, INT64_MAX, INT_MAX);
+			} else if((low_disk = directory_low_disk(cwd)) > 0) {
+				debug(D_DEBUG, "Performing on demand garbage collection of %" PRId64 " bytes", low_disk);
+				dag_gc_collect(d, INT_MAX, low_disk, INT_MAX);
 			}
 			break;
 		default:
@@ -1929,11 +2788,46 @@ void dag_gc(struct dag *d)
 	}
 }
 
-void dag_run(struct dag *d)
+/* Wait until stoptime for one job in the queue to complete, and if one does,
+ * complete its node.  Returns true if a job was collected. */
+static int dag_wait_job(struct dag *d, struct batch_queue *queue, struct itable *job_table, time_t stoptime)
 {
+	struct batch_job_info info;
 	struct dag_node *n;
 	batch_job_id_t jobid;
-	struct batch_job_info info;
+
+	jobid = batch_job_wait_timeout(queue, &info, stoptime);
+	if(jobid <= 0)
+		return 0;
+
+	debug(D_DEBUG, "Job %d has returned.\n", jobid);
+	n = itable_remove(job_table, jobid);
+	if(n && n->cluster_next)
+		dag_cluster_complete(d, n, &info);
+	else if(n)
+		dag_node_complete(d, n, &info);
+
+	return 1;
+}
+
+void dag_run(struct dag *d)
+{
+	int collected;
+
+	dag_prepare_ready_queue(d);
+
+	if(dag_gc_method != DAG_GC_NONE) {
+		dag_gc_worker = dag_gc_worker_create();
+		if(dag_gc_method == DAG_GC_ON_DEMAND) {
+			char cwd[PATH_MAX];
+			getcwd(cwd, PATH_MAX);
+			dag_gc_files_present = directory_inode_count(cwd);
+		}
+	}
+
+	/* A remote wait returns as soon as a local job exits, so that local
+	 * rules are not left finished and unnoticed behind remote ones. */
+	batch_queue_set_wakeup_fd(remote_queue, process_notify_fd());
 
 	while(!dag_abort_flag) {
 
@@ -1943,34 +2837,20 @@ void dag_run(struct dag *d)
 			break;
 
 		if(d->remote_jobs_running) {
-			int tmp_timeout = 5;
-			jobid = batch_job_wait_timeout(remote_queue, &info, time(0) + tmp_timeout);
-			if(jobid > 0) {
-				debug(D_DEBUG, "Job %d has returned.\n", jobid);
-				n = itable_remove(d->remote_job_table, jobid);
-				if(n)
-					dag_node_complete(d, n, &info);
-			}
+			dag_wait_job(d, remote_queue, d->remote_job_table, time(0) + 5);
+		} else {
+			dag_wait_job(d, local_queue, d->local_job_table, time(0) + 5);
 		}
 
-		if(d->local_jobs_running) {
-			time_t stoptime;
-			int tmp_timeout = 5;
-
-			if(d->remote_jobs_running) {
-				stoptime = time(0);
-			} else {
-				stoptime = time(0) + tmp_timeout;
-			}
-
-			jobid = batch_job_wait_timeout(local_queue, &info, stoptime);
-			if(jobid > 0) {
-				debug(D_DEBUG, "Job %d has returned.\n", jobid);
-				n = itable_remove(d->local_job_table, jobid);
-				if(n)
-					dag_node_complete(d, n, &info);
-			}
-		}
+		/* Collect everything else that has already finished in either
+		 * queue, so that the rules it releases are dispatched together. */
+		do {
+			collected = 0;
+			if(d->local_jobs_running)
+				collected += dag_wait_job(d, local_queue, d->local_job_table, time(0));
+			if(d->remote_jobs_running)
+				collected += dag_wait_job(d, remote_queue, d->remote_job_table, time(0));
+		} while(collected && !dag_abort_flag);
 
 		/* Rather than try to garbage collect after each time in this
 		 * wait loop, perform garbage collection after a proportional
@@ -1980,15 +2860,135 @@ void dag_run(struct dag *d)
 			dag_gc(d);
 			dag_gc_barrier = MAX(d->nodeid_counter*dag_gc_task_ratio, 1);
 		}
+
+		if(time(0) - dag_checkpoint_time >= MAKEFLOW_CHECKPOINT_INTERVAL) {
+			/* The checkpoint should not list files still waiting to be removed. */
+			if(dag_gc_worker)
+				dag_gc_worker_wait(dag_gc_worker);
+			dag_checkpoint_write(d, dag_checkpoint_filename);
+			dag_checkpoint_time = time(0);
+		}
 	}
 
 	if(dag_abort_flag) {
 		dag_abort_all(d);
 	} else {
 		if(!dag_failed_flag && dag_gc_method != DAG_GC_NONE) {
-			dag_gc_all(d, INT_MAX, INT_MAX, INT_MAX);
+			dag_gc_all(d);
 		}
 	}
+
+	/* Let the files given to the worker be removed before returning. */
+	if(dag_gc_worker) {
+		dag_gc_worker_wait(dag_gc_worker);
+		debug(D_DEBUG, "collected %d files of %" PRId64 " bytes", dag_gc_collected, dag_gc_bytes);
+		if(dag_gc_worker->failed > 0)
+			debug(D_NOTICE, "makeflow: %d of %d collected files could not be removed", dag_gc_worker->failed, dag_gc_worker->removed + dag_gc_worker->failed);
+		dag_gc_worker_delete(dag_gc_worker);
+		dag_gc_worker = NULL;
+	}
+}
+
+/* Replay the workflow without running anything: using the runtimes
+ * observed in a makeflow log (or the category estimates for rules the
+ * log does not cover), compute the makespan the workflow would have had
+ * under each scheduling method, with the current limits on local and
+ * remote jobs. Sizes for the gc method are taken from the files on disk. */
+void dag_simulate(struct dag *d, const char *filename)
+{
+	struct itable *observed = itable_create(0);
+	struct dag_ready_queue *running;
+	struct dag_node *n;
+	struct dag_file *f;
+	char *name;
+	void *value;
+	int found, method, local_running, remote_running;
+	double now, busy, finish;
+
+	found = dag_log_learn_runtimes(d, filename, observed);
+	dag_estimate_runtimes(d);
+	for(n = d->nodes; n; n = n->next) {
+		if((value = itable_lookup(observed, n->nodeid)))
+			n->runtime_estimate = ((PTRINT_T) value - 1) / 1000000.0;
+	}
+	dag_compute_critical_path(d);
+
+	printf("simulating %d rules with %d runtimes from %s, %d local and %d remote jobs at once.\n", d->nodeid_counter, itable_size(observed), filename, d->local_jobs_max, d->remote_jobs_max);
+	if(found == 0)
+		printf("no runtimes were found, so every rule is assumed to take one second.\n");
+	printf("%-10s %16s %16s\n", "method", "makespan (s)", "busy (s)");
+
+	for(method = 0; method < DAG_SCHEDULE_MAX; method++) {
+		dag_schedule_method = method;
+
+		/* Start over with only the files that no rule creates. */
+		hash_table_clear(d->completed_files);
+		hash_table_firstkey(d->file_table);
+		while(hash_table_nextkey(d->file_table, &name, (void **) &f)) {
+			if(!f->target_of)
+				hash_table_insert(d->completed_files, f->filename, f->filename);
+		}
+
+		hash_table_clear(d->collect_table);
+		dag_prepare_gc(d);
+
+		for(n = d->nodes; n; n = n->next) {
+			n->state = DAG_NODE_STATE_WAITING;
+			n->ready_queued = 0;
+		}
+
+		dag_prepare_ready_queue(d);
+
+		/* Running nodes are kept in a queue ordered by earliest finish. */
+		running = dag_ready_queue_create();
+		now = busy = 0;
+		local_running = remote_running = 0;
+
+		while(1) {
+			while(remote_running < d->remote_jobs_max && (n = dag_ready_queue_pop(d->remote_ready, NULL))) {
+				n->ready_queued = 0;
+				n->state = DAG_NODE_STATE_RUNNING;
+				dag_ready_queue_push(running, n, -(now + n->runtime_estimate), 0);
+				remote_running++;
+			}
+
+			while(local_running < d->local_jobs_max && (n = dag_ready_queue_pop(d->local_ready, NULL))) {
+				n->ready_queued = 0;
+				n->state = DAG_NODE_STATE_RUNNING;
+				dag_ready_queue_push(running, n, -(now + n->runtime_estimate), 0);
+				local_running++;
+			}
+
+			n = dag_ready_queue_pop(running, &finish);
+			if(!n)
+				break;
+
+			now = -finish;
+			busy += n->runtime_estimate;
+			n->state = DAG_NODE_STATE_COMPLETE;
+			if(n->local_job) {
+				local_running--;
+			} else {
+				remote_running--;
+			}
+
+			list_first_item(n->target_files);
+			while((f = list_next_item(n->target_files))) {
+				dag_file_complete(d, f);
+			}
+
+			list_first_item(n->source_files);
+			while((f = list_next_item(n->source_files))) {
+				dag_gc_ref_incr(d, f->filename, -1);
+			}
+		}
+
+		dag_ready_queue_delete(running);
+
+		printf("%-10s %16.1f %16.1f\n", dag_schedule_names[method], now, busy);
+	}
+
+	itable_delete(observed);
 }
 
 static void handle_abort(int sig)
@@ -2008,6 +3008,10 @@ static void show_help(const char *cmd)
 	fprintf(stdout, " %-30s Disable the check for AFS. (experts only.)\n", "-A,--disable-afs-check");
 	fprintf(stdout, " %-30s Create portable bundle of workflow in <directory>\n", "-b,--bundle-dir=<directory>");            
 	fprintf(stdout, " %-30s Add these options to all batch submit files.\n", "-B,--batch-options=<options>");
+	fprintf(stdout, " %-30s Reuse outputs of identical rules stored in <directory>.\n", "--cache=<directory>");
+	fprintf(stdout, " %-30s Maximum size of the cache in MB.          (default is %d)\n", "--cache-size=<#>", MAKEFLOW_CACHE_SIZE_DEFAULT);
+	fprintf(stdout, " %-30s Run up to <#> short remote rules of the same category\n", "--cluster-size=<#>");
+	fprintf(stdout, " %-30s in one batch job.                      (default is 1, max %d)\n", "", MAKEFLOW_CLUSTER_SIZE_MAX);
 	fprintf(stdout, " %-30s Set catalog server to <catalog>. Format: HOSTNAME:PORT \n", "-C,--catalog-server=<catalog>");
 	fprintf(stdout, " %-30s Enable debugging for this subsystem\n", "-d,--debug=<subsystem>");
 	fprintf(stdout, " %-30s Display the Makefile as a Dot graph or a PPM completion graph.\n", "-D,--dot-graph=<opt>");
@@ -2046,7 +3050,15 @@ static void show_help(const char *cmd)
 	fprintf(stdout, " %-30s Priority. Higher the value, higher the priority.\n", "-P,--priority=<integer>");
 	fprintf(stdout, " %-30s Automatically retry failed batch jobs up to %d times.\n", "-R,--retry", dag_retry_max);
 	fprintf(stdout, " %-30s Automatically retry failed batch jobs up to n times.\n", "-r,--retry-count=<n>");
+	fprintf(stdout, " %-30s Order in which ready rules are submitted:\n", "--schedule=<method>");
+	fprintf(stdout, " %-30s fifo: as they become ready (default); critical: longest\n", "");
+	fprintf(stdout, " %-30s remaining path first; gc: most collectable bytes first.\n", "");
+	fprintf(stdout, " %-30s Also learn rule runtimes from this log for --schedule.\n", "--schedule-log=<logfile>");
+	fprintf(stdout, " %-30s Compare the makespan of each --schedule method,\n", "--simulate=<logfile>");
+	fprintf(stdout, " %-30s replaying the runtimes of this log, and exit.\n", "");
 	fprintf(stdout, " %-30s Time to retry failed batch job submission.  (default is %ds)\n", "-S,--submission-timeout=<#>", dag_submit_timeout);
+	fprintf(stdout, " %-30s On restart, trust the status of files recorded in the\n", "--trust-log");
+	fprintf(stdout, " %-30s log checkpoint, rather than checking each file again.\n", "");
 	fprintf(stdout, " %-30s Work Queue keepalive timeout.               (default is %ds)\n", "-t,--wq-keepalive-timeout=<#>", WORK_QUEUE_DEFAULT_KEEPALIVE_TIMEOUT);
 	fprintf(stdout, " %-30s Work Queue keepalive interval.              (default is %ds)\n", "-u,--wq-keepalive-interval=<#>", WORK_QUEUE_DEFAULT_KEEPALIVE_INTERVAL);
 	fprintf(stdout, " %-30s Show version string\n", "-v,--version");
@@ -2153,6 +3165,13 @@ static void create_summary(struct dag *d, const char *write_summary_to, const ch
 	for (list_first_item(failed_tasks); (fn = list_next_item(failed_tasks)) != NULL;)
 		summarize(summary_file, summary_email, "\t%s\n", fn);
 
+	if (dag_cache) {
+		summarize(summary_file, summary_email, "Cache hits:\t\t %d/%d\n", dag_cache->hits, dag_cache->hits + dag_cache->misses);
+		summarize(summary_file, summary_email, "Cache restored:\t\t %s\n", string_metric(dag_cache->bytes_restored, -1, NULL));
+		summarize(summary_file, summary_email, "Cache stored:\t\t %d tasks, %s\n", dag_cache->stored, string_metric(dag_cache->bytes_stored, -1, NULL));
+		if (dag_cache->evicted != 0) summarize(summary_file, summary_email, "Cache evicted:\t\t %d entries\n", dag_cache->evicted);
+	}
+
 	if (list_size(output_files) > 0){
 		summarize(summary_file, summary_email, "Output files:\n");
 		for (list_first_item(output_files); (fn = list_next_item(output_files)) != NULL;){
@@ -2162,9 +3181,8 @@ static void create_summary(struct dag *d, const char *write_summary_to, const ch
 		}
 	}
 
-	list_free(output_files);
+	/* The names and commands in these lists belong to the dag. */
 	list_delete(output_files);
-	list_free(failed_tasks);
 	list_delete(failed_tasks);
 
 	if(write_summary_to){
@@ -2202,6 +3220,10 @@ int main(int argc, char *argv[])
 	int work_queue_keepalive_interval = WORK_QUEUE_DEFAULT_KEEPALIVE_INTERVAL;
 	int work_queue_keepalive_timeout = WORK_QUEUE_DEFAULT_KEEPALIVE_TIMEOUT;
 	char *write_summary_to = NULL;
+	char *schedule_log = NULL;
+	char *simulate_log = NULL;
+	char *cache_dir = NULL;
+	UINT64_T cache_size = MAKEFLOW_CACHE_SIZE_DEFAULT;
 	char *catalog_host;
 	int catalog_port;
 	int port_set = 0;
@@ -2246,11 +3268,10 @@ int main(int argc, char *argv[])
 		{"disable-afs-check", no_argument, 0, 'A'},
 		{"bundle-dir",        required_argument, 0, 'b'},
 		{"batch-options",     required_argument, 0, 'B'},
+		{"cache",             required_argument, 0, LONG_OPT_CACHE},
+		{"cache-size",        required_argument, 0, LONG_OPT_CACHE_SIZE},
 		{"catalog-server",    required_argument, 0, 'C'},
-<<<<<<< HEAD
-		{"dot-graph",         required_argument, 0, 'D'},
-=======
->>>>>>> f90e346ca22e7f04d7487d24abc6dadfc685c2c4
+		{"cluster-size",      required_argument, 0, LONG_OPT_CLUSTER_SIZE},
 		{"display-mode",	required_argument, 0, 'D'},
 		{"ppm-highlight-row",   required_argument, 0, LONG_OPT_PPM_ROW},
 		{"ppm-highlight-exe",	required_argument, 0, LONG_OPT_PPM_EXE},
@@ -2281,7 +3302,11 @@ int main(int argc, char *argv[])
 		{"priority",         required_argument, 0, 'P'},
 		{"retry",            no_argument, 0, 'R'},
 		{"retry-count",      required_argument, 0, 'r'},
+		{"schedule",         required_argument, 0, LONG_OPT_SCHEDULE},
+		{"schedule-log",     required_argument, 0, LONG_OPT_SCHEDULE_LOG},
+		{"simulate",         required_argument, 0, LONG_OPT_SIMULATE},
 		{"submission-timeout",    required_argument, 0, 'S'},
+		{"trust-log",             no_argument, 0, LONG_OPT_TRUST_LOG},
 		{"wq-keepalive-timeout",  required_argument, 0, 't'},
 		{"wq-keepalive-interval", required_argument, 0, 'u'},
 		{"version", no_argument, 0, 'v'},
@@ -2508,6 +3533,42 @@ int main(int argc, char *argv[])
 				return 1;
 			}
 			break;
+		case LONG_OPT_SCHEDULE:
+			for(dag_schedule_method = 0; dag_schedule_method < DAG_SCHEDULE_MAX; dag_schedule_method++) {
+				if(!strcasecmp(optarg, dag_schedule_names[dag_schedule_method]))
+					break;
+			}
+			if(dag_schedule_method == DAG_SCHEDULE_MAX) {
+				fprintf(stderr, "makeflow: invalid scheduling method: %s\n", optarg);
+				show_help(argv[0]);
+				return 1;
+			}
+			break;
+		case LONG_OPT_SCHEDULE_LOG:
+			free(schedule_log);
+			schedule_log = xxstrdup(optarg);
+			break;
+		case LONG_OPT_SIMULATE:
+			free(simulate_log);
+			simulate_log = xxstrdup(optarg);
+			break;
+		case LONG_OPT_CACHE:
+			free(cache_dir);
+			cache_dir = xxstrdup(optarg);
+			break;
+		case LONG_OPT_CACHE_SIZE:
+			cache_size = strtoull(optarg, NULL, 10);
+			break;
+		case LONG_OPT_TRUST_LOG:
+			dag_trust_log = 1;
+			break;
+		case LONG_OPT_CLUSTER_SIZE:
+			dag_cluster_size = atoi(optarg);
+			if(dag_cluster_size < 1 || dag_cluster_size > MAKEFLOW_CLUSTER_SIZE_MAX) {
+				fprintf(stderr, "makeflow: cluster size must be between 1 and %d.\n", MAKEFLOW_CLUSTER_SIZE_MAX);
+				return 1;
+			}
+			break;
 		default:
 			show_help(argv[0]);
 			return 1;
@@ -2695,22 +3756,40 @@ int main(int argc, char *argv[])
 	dag_prepare_gc(d);
 	dag_prepare_nested_jobs(d);
 
+	dag_checkpoint_filename = string_format("%s.checkpoint", logfilename);
+
 	if(clean_mode) {
 		dag_clean(d);
 		file_clean(logfilename, 0);
+		file_clean(dag_checkpoint_filename, 0);
 		file_clean(batchlogfilename, 0);
 		free(logfilename);
 		free(batchlogfilename);
 		return 0;
 	}
 
+	/* Load the checkpoint first, so that the check of the files may use it. */
+	INT64_T log_offset = dag_checkpoint_read(d, dag_checkpoint_filename, logfilename);
+
 	if(!dag_check(d) && !display_mode) {
 		free(logfilename);
 		free(batchlogfilename);
 		return 1;
 	}
 
-	dag_log_recover(d, logfilename);
+	if(simulate_log) {
+		dag_simulate(d, simulate_log);
+		free(logfilename);
+		free(batchlogfilename);
+		return 0;
+	}
+
+	if(dag_schedule_method == DAG_SCHEDULE_GC && dag_gc_method == DAG_GC_NONE)
+		fprintf(stderr, "makeflow: --schedule=gc has no effect on its own without garbage collection (-g).\n");
+
+	dag_prepare_schedule(d, logfilename, schedule_log);
+
+	dag_log_recover(d, logfilename, log_offset);
 
 	if(display_mode) {
 		free(logfilename);
@@ -2793,7 +3872,16 @@ int main(int argc, char *argv[])
 	signal(SIGQUIT, handle_abort);
 	signal(SIGTERM, handle_abort);
 
+	if(cache_dir) {
+		dag_cache = dag_cache_create(cache_dir, cache_size * 1024 * 1024);
+		if(!dag_cache) {
+			fprintf(stderr, "makeflow: couldn't create cache %s: %s\n", cache_dir, strerror(errno));
+			exit(1);
+		}
+	}
+
 	fprintf(d->logfile, "# STARTED\t%" PRIu64 "\n", timestamp_get());
+	dag_checkpoint_time = time(0);
 	runtime = timestamp_get();
 	dag_run(d);
 	time_completed = timestamp_get();
@@ -2802,6 +3890,8 @@ int main(int argc, char *argv[])
 	batch_queue_delete(local_queue);
 	batch_queue_delete(remote_queue);
 
+	dag_checkpoint_write(d, dag_checkpoint_filename);
+
 	if(!preserve_symlinks && batch_queue_type == BATCH_QUEUE_TYPE_CONDOR) {
 		clean_symlinks(d, 0);
 	}
@@ -2809,9 +3899,16 @@ int main(int argc, char *argv[])
 	if(write_summary_to || email_summary_to) create_summary(d, write_summary_to, email_summary_to, runtime, time_completed, argc, argv, dagfile);
 	free(logfilename);
 	free(batchlogfilename);
+	free(dag_checkpoint_filename);
 	free(write_summary_to);
 	free(email_summary_to);
 
+	if(dag_cache) {
+		debug(D_DEBUG, "cache: %d hits, %d misses, %d stored, %d evicted", dag_cache->hits, dag_cache->misses, dag_cache->stored, dag_cache->evicted);
+		dag_cache_delete(dag_cache);
+		free(cache_dir);
+	}
+
 
 	if(dag_abort_flag) {
 		fprintf(d->logfile, "# ABORTED\t%" PRIu64 "\n", timestamp_get());
@@ -0,0 +1,59 @@
+#!/bin/sh
+
+# Measure the cost of Makeflow itself on a large synthetic workflow.
+#
+# The workflow has <rules> rules in chains <width> wide: rule i depends on
+# rule i-<width>, and only touches its target.  The workflow is run with
+# the local batch system and <jobs> jobs at once.  Reported are the wall
+# time, the CPU time of the makeflow process alone, without its jobs, and
+# its peak resident memory.
+#
+# Use: makeflow_dispatch_benchmark.sh [rules] [width] [jobs] [makeflow]
+
+rules=${1:-1000000}
+width=${2:-100}
+jobs=${3:-16}
+makeflow=${4:-makeflow}
+
+case $makeflow in
+	/*) ;;
+	*/*) makeflow=`pwd`/$makeflow ;;
+esac
+
+dir=`mktemp -d ${TMPDIR:-/tmp}/makeflow_benchmark.XXXXXX` || exit 1
+cd $dir || exit 1
+
+awk -v n=$rules -v w=$width 'BEGIN {
+	for(i=0;i<n;i++) {
+		s = (i<w) ? "" : "out." (i-w)
+		printf "out.%d: %s\n\ttouch out.%d\n\n", i, s, i
+	}
+}' > Makeflow
+
+ticks=`getconf CLK_TCK`
+start=`date +%s`
+
+$makeflow -j $jobs Makeflow > makeflow.stdout 2>&1 &
+pid=$!
+
+# The times of a process are read from /proc until it is reaped.
+cpu=0
+hwm=0
+while [ -f /proc/$pid/stat ]; do
+	now=`awk '{print $14+$15}' /proc/$pid/stat 2> /dev/null` && [ -n "$now" ] && cpu=$now
+	now=`awk '/^VmHWM/ {print $2}' /proc/$pid/status 2> /dev/null` && [ -n "$now" ] && hwm=$now
+	state=`awk '{print $3}' /proc/$pid/stat 2> /dev/null`
+	[ "$state" = "Z" ] && break
+	sleep 1
+done
+
+wait $pid
+result=$?
+stop=`date +%s`
+
+echo "rules $rules width $width jobs $jobs result $result"
+echo "wall `expr $stop - $start` s, makeflow cpu `awk -v c=$cpu -v t=$ticks 'BEGIN {printf "%.2f", c/t}'` s, peak rss `expr $hwm / 1024` MB"
+
+cd /
+rm -rf $dir
+exit $result
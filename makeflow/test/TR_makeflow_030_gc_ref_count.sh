@@ -15,7 +15,7 @@ cat > ../$test_output <<EOF
 7
 5
 6
-7
+5
 EOF
     exit 0
 }
@@ -0,0 +1,72 @@
+#!/bin/sh
+
+. ../../dttools/src/test_runner.common.sh
+
+test_dir=`basename $0 .sh`.dir
+
+# Ten chains of twenty rules each, some of which name their source
+# twice or run as LOCAL, joined by a final rule.  Each rule copies
+# its parent and appends one line, so the final file only has the
+# right length if every rule ran after its parent.
+
+prepare()
+{
+    mkdir $test_dir
+    cd $test_dir
+    ln -s ../../src/makeflow .
+    echo input > input.txt
+
+    i=0
+    finals=""
+    while [ $i -lt 200 ]
+    do
+        if [ $i -lt 10 ]; then
+            src=input.txt
+        else
+            src=out.`expr $i - 10`
+        fi
+
+        if [ `expr $i % 3` -eq 0 ]; then
+            sources="$src $src"
+        else
+            sources="$src"
+        fi
+
+        if [ `expr $i % 7` -eq 0 ]; then
+            local=LOCAL
+        else
+            local=""
+        fi
+
+        printf "out.%d: %s\n\t%s cat %s > out.%d; echo %d >> out.%d\n\n" $i "$sources" "$local" $src $i $i $i >> Makeflow
+
+        if [ $i -ge 190 ]; then
+            finals="$finals out.$i"
+        fi
+
+        i=`expr $i + 1`
+    done
+
+    printf "final:%s\n\tcat%s > final\n" "$finals" "$finals" >> Makeflow
+    exit 0
+}
+
+run()
+{
+    cd $test_dir
+    if ./makeflow -j 4; then
+        lines=`wc -l < final`
+        [ $lines -eq 210 ]
+        exit $?
+    else
+        exit 1
+    fi
+}
+
+clean()
+{
+    rm -fr $test_dir
+    exit 0
+}
+
+dispatch $@
@@ -0,0 +1,61 @@
+#!/bin/sh
+
+. ../../dttools/src/test_runner.common.sh
+
+test_dir=`basename $0 .sh`.dir
+
+# A chain of long rules listed before many short independent ones.
+# Run once in the default order to produce a log of runtimes, then
+# check that the simulation replaying that log finds the critical
+# path order to be faster, and that a real run in that order works.
+
+prepare()
+{
+    mkdir $test_dir
+    cd $test_dir
+    ln -s ../../src/makeflow .
+    echo input > input.txt
+
+    echo "MAKEFLOW_TASK_CATEGORY=long" >> Makeflow
+    src=input.txt
+    for i in 0 1 2 3 4 5
+    do
+        printf "chain.%d: %s\n\tsleep 0.4; cat %s > chain.%d\n\n" $i $src $src $i >> Makeflow
+        src=chain.$i
+    done
+
+    echo "MAKEFLOW_TASK_CATEGORY=short" >> Makeflow
+    for i in 0 1 2 3 4 5 6 7 8 9 10 11
+    do
+        printf "short.%d: input.txt\n\tsleep 0.2; cat input.txt > short.%d\n\n" $i $i >> Makeflow
+    done
+
+    exit 0
+}
+
+run()
+{
+    cd $test_dir
+
+    ./makeflow -J 2 Makeflow || exit 1
+    cp Makeflow.makeflowlog history.log
+
+    ./makeflow -J 2 --simulate=history.log Makeflow > simulation.txt || exit 1
+    cat simulation.txt
+    fifo=`awk '$1 == "fifo" { print $2 }' simulation.txt`
+    critical=`awk '$1 == "critical" { print $2 }' simulation.txt`
+    awk -v f="$fifo" -v c="$critical" 'BEGIN { exit !(c < f) }' || exit 1
+
+    ./makeflow -c Makeflow
+    ./makeflow -J 2 --schedule=critical --schedule-log=history.log Makeflow || exit 1
+    [ -f chain.5 ]
+    exit $?
+}
+
+clean()
+{
+    rm -fr $test_dir
+    exit 0
+}
+
+dispatch $@
@@ -0,0 +1,63 @@
+#!/bin/sh
+
+. ../../dttools/src/test_runner.common.sh
+
+test_dir=`basename $0 .sh`.dir
+
+# Run the same workflow in two directories sharing one cache.  The
+# second run should restore both rules from the cache, and a change
+# to an exported variable should cause both to run again.  Outputs
+# changed in place after a restore must not change the cache.
+
+prepare()
+{
+    mkdir -p $test_dir/first $test_dir/second $test_dir/third
+    cd $test_dir
+    cat > first/Makeflow <<EOM
+GREETING=hello
+export GREETING
+
+mid: input.txt
+	echo \$GREETING > mid; cat input.txt >> mid
+
+out: mid
+	sort mid > out
+EOM
+    echo input > first/input.txt
+    cp first/Makeflow first/input.txt second
+    cp first/Makeflow first/input.txt third
+    exit 0
+}
+
+run()
+{
+    cd $test_dir
+    makeflow=../../../src/makeflow
+
+    (cd first && $makeflow --cache=../cache -f summary Makeflow) || exit 1
+    grep "Cache hits:.*0/2" first/summary || exit 1
+
+    (cd second && $makeflow --cache=../cache -f summary Makeflow) || exit 1
+    grep "Cache hits:.*2/2" second/summary || exit 1
+    cmp first/out second/out || exit 1
+
+    echo changed >> second/mid
+    echo changed >> second/out
+    (cd third && $makeflow --cache=../cache -f summary Makeflow) || exit 1
+    grep "Cache hits:.*2/2" third/summary || exit 1
+    cmp first/mid third/mid || exit 1
+    cmp first/out third/out || exit 1
+
+    (cd second && $makeflow -c Makeflow && sed -i s/hello/goodbye/ Makeflow && $makeflow --cache=../cache -f summary Makeflow) || exit 1
+    grep "Cache hits:.*0/2" second/summary || exit 1
+    grep goodbye second/out
+    exit $?
+}
+
+clean()
+{
+    rm -fr $test_dir
+    exit 0
+}
+
+dispatch $@
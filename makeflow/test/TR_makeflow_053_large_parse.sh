@@ -0,0 +1,47 @@
+#!/bin/sh
+
+. ../../dttools/src/test_runner.common.sh
+
+test_dir=`basename $0 .sh`.dir
+
+# Twenty thousand rules, each naming one of a thousand shared inputs
+# twice and producing two outputs, gathered by a final rule that names
+# each of its parents' outputs twice.  The analysis must count every
+# rule once, and find the final rule one level below the others.
+
+prepare()
+{
+    mkdir $test_dir
+    cd $test_dir
+    ln -s ../../src/makeflow .
+
+    awk 'BEGIN {
+        for(i = 0; i < 20000; i++) {
+            printf("out.%d.dat out.%d.log: sim.exe in.%d.txt in.%d.txt\n", i, i, i % 1000, i % 1000);
+            printf("\t./sim.exe in.%d.txt > out.%d.dat 2> out.%d.log\n\n", i % 1000, i, i);
+        }
+        printf("final:");
+        for(i = 0; i < 20000; i += 100)
+            printf(" out.%d.dat out.%d.log out.%d.dat", i, i, i);
+        printf("\n\tcat out.*.dat > final\n");
+    }' > Makeflow
+    exit 0
+}
+
+run()
+{
+    cd $test_dir
+    ./makeflow -k Makeflow || exit 1
+    ./makeflow -i Makeflow > analysis || exit 1
+    grep "^num_of_tasks	20001$" analysis > /dev/null || exit 1
+    grep "^depth	2$" analysis > /dev/null
+    exit $?
+}
+
+clean()
+{
+    rm -fr $test_dir
+    exit 0
+}
+
+dispatch $@
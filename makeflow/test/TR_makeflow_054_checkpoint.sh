@@ -0,0 +1,66 @@
+#!/bin/sh
+
+. ../../dttools/src/test_runner.common.sh
+
+test_dir=`basename $0 .sh`.dir
+
+# Each rule records its run in runs.  A finished workflow must leave a
+# checkpoint named by its log, and a restart from it must run only the
+# rules that were added or whose inputs changed, and their children.
+
+prepare()
+{
+    mkdir $test_dir
+    cd $test_dir
+    ln -s ../../src/makeflow .
+
+    echo input > in.txt
+    cat > Makeflow <<EOT
+a.txt: in.txt
+	cat in.txt > a.txt; echo a >> runs
+
+b.txt: a.txt
+	cat a.txt > b.txt; echo b >> runs
+
+c.txt:
+	echo c > c.txt; echo c >> runs
+EOT
+    exit 0
+}
+
+run()
+{
+    cd $test_dir
+    ./makeflow Makeflow || exit 1
+    test -f Makeflow.makeflowlog.checkpoint || exit 1
+    grep "^# CHECKPOINT" Makeflow.makeflowlog > /dev/null || exit 1
+    test `wc -l < runs` -eq 3 || exit 1
+
+    cat >> Makeflow <<EOT
+
+d.txt: b.txt
+	cat b.txt > d.txt; echo d >> runs
+EOT
+    rm runs
+    ./makeflow --trust-log Makeflow || exit 1
+    test "`cat runs`" = "d" || exit 1
+
+    rm runs
+    sleep 1
+    echo changed > in.txt
+    ./makeflow Makeflow || exit 1
+    test "`sort runs | tr -d '\n'`" = "abd" || exit 1
+
+    rm runs
+    ./makeflow Makeflow || exit 1
+    test ! -f runs
+    exit $?
+}
+
+clean()
+{
+    rm -fr $test_dir
+    exit 0
+}
+
+dispatch $@
@@ -0,0 +1,100 @@
+#!/bin/sh
+
+. ../../dttools/src/test_runner.common.sh
+
+test_dir=`basename $0 .sh`.dir
+
+# Stand-ins for condor_submit and qsub run each job as it is submitted,
+# and count how often they are called.  Twenty independent rules and a
+# rule that gathers them must be submitted in two calls to each.
+
+prepare()
+{
+    mkdir $test_dir
+    cd $test_dir
+    ln -s ../../src/makeflow .
+    mkdir bin
+
+    cat > bin/condor_submit <<'EOT'
+#!/bin/sh
+set -f
+echo call >> condor_submit.calls
+cluster=$((`cat condor.cluster 2>/dev/null || echo 100` + 1))
+echo $cluster > condor.cluster
+proc=0
+while read -r key eq value; do
+    case "$key" in
+    log) log=$value ;;
+    arguments) args=$value ;;
+    queue)
+        echo "000 ($cluster.$proc.000) 10/19 12:00:00 Job submitted from host" >> $log
+        sh ./condor.sh $args
+        status=$?
+        echo "005 ($cluster.$proc.000) 10/19 12:00:01 Job terminated." >> $log
+        echo "	(1) Normal termination (return value $status)" >> $log
+        proc=$(($proc + 1)) ;;
+    esac
+done < $1
+echo "$proc job(s) submitted to cluster $cluster."
+EOT
+
+    cat > bin/qsub <<'EOT'
+#!/bin/sh
+echo call >> qsub.calls
+JOB_ID=$((`cat sge.job 2>/dev/null || echo 200` + 1))
+echo $JOB_ID > sge.job
+export JOB_ID
+tasks=""
+while [ $# -gt 0 ]; do
+    case "$1" in
+    -cwd|-j|-o|-N) [ "$1" = -cwd ] || shift ;;
+    -t) tasks=${2#1-}; shift ;;
+    *) break ;;
+    esac
+    shift
+done
+if [ -n "$tasks" ]; then
+    for SGE_TASK_ID in `seq 1 $tasks`; do
+        SGE_TASK_ID=$SGE_TASK_ID sh "$@"
+    done
+    echo "Your job-array $JOB_ID.1-$tasks:1 (\"job\") has been submitted"
+else
+    sh "$@"
+    echo "Your job $JOB_ID (\"job\") has been submitted"
+fi
+EOT
+    chmod 755 bin/*
+
+    awk 'BEGIN {
+        for(i = 0; i < 20; i++) {
+            printf("out.%d:\n\techo %d > out.%d\n\n", i, i, i);
+            all = all " out." i;
+        }
+        printf("all:%s\n\tcat%s > all\n", all, all);
+    }' > Makeflow
+    exit 0
+}
+
+run()
+{
+    cd $test_dir
+    PATH=`pwd`/bin:$PATH
+    export PATH
+
+    for type in condor sge; do
+        ./makeflow -c Makeflow > /dev/null
+        rm -f *.calls
+        ./makeflow -T $type Makeflow || exit 1
+        test `wc -l < all` -eq 20 || exit 1
+        test `cat *.calls | wc -l` -eq 2 || exit 1
+    done
+    exit 0
+}
+
+clean()
+{
+    rm -fr $test_dir
+    exit 0
+}
+
+dispatch $@
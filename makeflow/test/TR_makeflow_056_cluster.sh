@@ -0,0 +1,77 @@
+#!/bin/sh
+
+. ../../dttools/src/test_runner.common.sh
+
+test_dir=`basename $0 .sh`.dir
+
+# Twenty independent rules, a chain of four, and a rule that gathers them
+# all, run two jobs at a time in composite jobs of up to five rules.  The
+# rules that ran together share a jobid in the log.  When a rule in a
+# composite job fails, the rules before it are complete, it fails with
+# its own exit code, and the rules after it are run again.  A rule that
+# exits with 101 is retried.
+
+prepare()
+{
+    mkdir $test_dir
+    cd $test_dir
+    ln -s ../../src/makeflow .
+
+    awk 'BEGIN {
+        for(i = 0; i < 20; i++) {
+            printf("out.%d:\n\techo %d > out.%d\n\n", i, i, i);
+            all = all " out." i;
+        }
+        printf("chain.1:\n\techo 1 > chain.1\n\n");
+        for(i = 2; i <= 4; i++)
+            printf("chain.%d: chain.%d\n\tcat chain.%d > chain.%d; echo %d >> chain.%d\n\n", i, i - 1, i - 1, i, i, i);
+        printf("all: chain.4%s\n\tcat chain.4%s > all\n", all, all);
+    }' > Makeflow
+
+    awk 'BEGIN {
+        for(i = 0; i < 10; i++)
+            printf("fail.%d:\n\t%s > fail.%d\n\n", i, i == 3 ? "exit 7" : "echo " i, i);
+    }' > Failing.makeflow
+
+    awk 'BEGIN {
+        for(i = 0; i < 5; i++)
+            printf("retry.%d:\n\t%secho %d > retry.%d\n\n", i, i == 2 ? "test -f tried || { touch tried; exit 101; }; " : "", i, i);
+    }' > Retrying.makeflow
+    exit 0
+}
+
+run()
+{
+    cd $test_dir
+
+    ./makeflow -T local -J 2 --cluster-size=5 Makeflow || exit 1
+    test `wc -l < all` -eq 24 || exit 1
+    test "`cat chain.4 | tr '\n' ' '`" = "1 2 3 4 " || exit 1
+
+    rules=`awk '!/^#/ && $3 == 1 { print $2 }' Makeflow.makeflowlog | sort -u | wc -l`
+    jobs=`awk '!/^#/ && $3 == 1 { print $4 }' Makeflow.makeflowlog | sort -u | wc -l`
+    test $rules -eq 25 || exit 1
+    test $jobs -le 10 || exit 1
+
+    ./makeflow -T local -J 1 --cluster-size=10 Failing.makeflow 2> failing.stderr && exit 1
+    grep "exit 7 > fail.3 failed with exit code 7" failing.stderr || exit 1
+    for i in 0 1 2 4 5 6 7 8 9; do
+        test -f fail.$i || exit 1
+    done
+    test -s fail.3 && exit 1
+
+    ./makeflow -T local -J 1 --cluster-size=5 Retrying.makeflow || exit 1
+    test -f tried || exit 1
+    test `cat retry.* | wc -l` -eq 5 || exit 1
+    ls -a | grep -q makeflow.cluster && exit 1
+
+    exit 0
+}
+
+clean()
+{
+    rm -fr $test_dir
+    exit 0
+}
+
+dispatch $@
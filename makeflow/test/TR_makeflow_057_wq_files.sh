@@ -0,0 +1,63 @@
+#!/bin/sh
+
+. ../../dttools/src/test_runner.common.sh
+
+test_dir=`basename $0 .sh`.dir
+
+# Rules with many inputs, given to Work Queue by their local names, by
+# explicit remote names, and by absolute paths that are given remote names,
+# with and without composite jobs.
+
+prepare()
+{
+    mkdir $test_dir
+    cd $test_dir
+    ln -s ../../src/makeflow .
+
+    mkdir input
+    for i in `seq 1 40`; do
+        echo $i > input/$i
+    done
+    echo absolute > absolute.in
+
+    awk -v dir=`pwd` 'BEGIN {
+        for(r = 0; r < 4; r++) {
+            inputs = "";
+            for(i = 1; i <= 40; i++)
+                inputs = inputs " input/" i;
+            printf("out.%d: %s %s/absolute.in input/1->renamed\n", r, inputs, dir);
+            printf("\tcat%s %s/absolute.in > out.%d\n\n", inputs, dir, r);
+        }
+    }' > Makeflow
+    exit 0
+}
+
+run()
+{
+    cd $test_dir
+
+    for cluster in 1 4; do
+        rm -f makeflow.status makeflow.port
+        (./makeflow -T wq -Z makeflow.port --cluster-size=$cluster Makeflow; echo $? > makeflow.status) &
+
+        wait_for_file_creation makeflow.port 5
+        ../../../dttools/src/work_queue_worker -t60 localhost `cat makeflow.port` &
+        wait_for_file_creation makeflow.status 60
+
+        test `cat makeflow.status` -eq 0 || exit 1
+        for r in 0 1 2 3; do
+            test `wc -l < out.$r` -eq 41 || exit 1
+        done
+        ./makeflow -c Makeflow > /dev/null
+    done
+
+    exit 0
+}
+
+clean()
+{
+    rm -fr $test_dir
+    exit 0
+}
+
+dispatch $@
@@ -0,0 +1,107 @@
+#!/bin/sh
+
+. ../../dttools/src/test_runner.common.sh
+
+test_dir=`basename $0 .sh`.dir
+
+# A stand-in for condor_submit runs each job as it is submitted, except
+# the job that creates "hung", which it leaves queued.  Makeflow is
+# killed while it waits for that job, which then finishes while Makeflow
+# is down.  The restarted Makeflow must take up the job from the log,
+# without running it again, and give its later jobs jobids of their own.
+
+prepare()
+{
+    mkdir $test_dir
+    cd $test_dir
+    ln -s ../../src/makeflow .
+    mkdir bin
+
+    cat > bin/condor_submit <<'EOT'
+#!/bin/sh
+set -f
+cluster=$((`cat condor.cluster 2>/dev/null || echo 100` + 1))
+echo $cluster > condor.cluster
+proc=0
+while read -r key eq value; do
+    case "$key" in
+    log) log=$value ;;
+    arguments) args=$value ;;
+    +BatchJobId) id=$value ;;
+    queue)
+        echo "000 ($cluster.$proc.000) 10/19 12:00:00 Job submitted from host" >> $log
+        echo "    BatchJobId $id" >> $log
+        echo "..." >> $log
+        case "$args" in
+        *"> hung"*)
+            echo "$cluster.$proc" > hung.job ;;
+        *)
+            sh ./condor.sh $args
+            status=$?
+            echo "005 ($cluster.$proc.000) 10/19 12:00:01 Job terminated." >> $log
+            echo "	(1) Normal termination (return value $status)" >> $log ;;
+        esac
+        proc=$(($proc + 1)) ;;
+    esac
+done < $1
+echo "$proc job(s) submitted to cluster $cluster."
+EOT
+    chmod 755 bin/*
+
+    cat > Makeflow <<'EOT'
+first:
+	echo first > first
+
+hung:
+	echo hung > hung
+
+last: first hung
+	cat first hung > last
+EOT
+    exit 0
+}
+
+run()
+{
+    cd $test_dir
+    PATH=`pwd`/bin:$PATH
+    export PATH
+
+    ./makeflow -T condor Makeflow > first.stdout 2>&1 &
+    pid=$!
+    wait_for_file_creation hung.job 10
+    sleep 1
+    kill -9 $pid
+    wait $pid
+
+    # The hung job finishes while Makeflow is down.
+    echo hung > hung
+    echo "005 (`cat hung.job`.000) 10/19 12:00:02 Job terminated." >> Makeflow.condorlog
+    echo "	(1) Normal termination (return value 0)" >> Makeflow.condorlog
+
+    ./makeflow -T condor Makeflow > second.stdout 2>&1 &
+    pid=$!
+    ( sleep 30; kill -9 $pid ) &
+    watchdog=$!
+    wait $pid
+    result=$?
+    kill $watchdog 2> /dev/null
+    [ $result -eq 0 ] || exit 1
+
+    grep "rule still running" second.stdout || exit 1
+    [ "`cat last`" = "first
+hung" ] || exit 1
+
+    # Every job was submitted once, with a jobid of its own.
+    [ `grep -c "^000 " Makeflow.condorlog` -eq 3 ] || exit 1
+    [ `grep BatchJobId Makeflow.condorlog | sort -u | wc -l` -eq 3 ] || exit 1
+    exit 0
+}
+
+clean()
+{
+    rm -fr $test_dir
+    exit 0
+}
+
+dispatch $@
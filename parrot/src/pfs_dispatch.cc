@@ -12,6 +12,7 @@ See the file COPYING for details.
 #include "pfs_poll.h"
 #include "pfs_service.h"
 #include "pfs_dispatch.h"
+#include "pfs_profile.h"
 
 extern "C" {
 #include "tracer.h"
@@ -147,6 +148,7 @@ static void decode_read( struct pfs_process *p, int entering, int syscall, INT64
 		} else if(p->syscall_result>0) {
 			divert_to_channel(p,SYSCALL32_pread,uaddr,p->syscall_result,p->io_channel_offset);
 			pfs_read_count += p->syscall_result;
+			p->profile_bytes += p->syscall_result;
 		} else if( errno==EAGAIN ) {
 			if(p->interrupted) {
 				p->interrupted = 0;
@@ -232,6 +234,7 @@ static void decode_write( struct pfs_process *p, int entering, int syscall, INT6
 				p->state = PFS_PROCESS_STATE_KERNEL;
 				entering = 0;
 				pfs_write_count += p->syscall_result;
+				p->profile_bytes += p->syscall_result;
 			} else {
 				if(errno==EAGAIN && !pfs_is_nonblocking(fd)) {
 					p->state = PFS_PROCESS_STATE_WAITWRITE;
@@ -3299,10 +3302,14 @@ void pfs_dispatch( struct pfs_process *p, INT64_T signum )
 {
 	if(p->state==PFS_PROCESS_STATE_DONE) return;
 
+	if(pfs_profile_enabled) pfs_profile_dispatch_begin(p);
+
 	if(tracer_is_64bit(p->tracer)) {
 		pfs_dispatch64(p,signum);
 	} else {
 		pfs_dispatch32(p,signum);
 	}
+
+	if(pfs_profile_enabled) pfs_profile_dispatch_end(p);
 }
 
@@ -157,6 +157,7 @@ static void decode_read( struct pfs_process *p, INT64_T entering, INT64_T syscal
 		} else if(p->syscall_result>0) {
 			divert_to_channel(p,SYSCALL64_pread,uaddr,p->syscall_result,p->io_channel_offset);
 			pfs_read_count += p->syscall_result;
+			p->profile_bytes += p->syscall_result;
 		} else if( errno==EAGAIN ) {
 			if(p->interrupted) {
 				p->interrupted = 0;
@@ -233,6 +234,7 @@ static void decode_write( struct pfs_process *p, INT64_T entering, INT64_T sysca
 				p->state = PFS_PROCESS_STATE_KERNEL;
 				entering = 0;
 				pfs_write_count += p->syscall_result;
+				p->profile_bytes += p->syscall_result;
 			} else {
 				if(errno==EAGAIN && !pfs_is_nonblocking(fd)) {
 					p->state = PFS_PROCESS_STATE_WAITWRITE;
@@ -8,6 +8,7 @@ See the file COPYING for details.
 #include "pfs_file.h"
 #include "pfs_file_cache.h"
 #include "pfs_service.h"
+#include "pfs_mdcache.h"
 
 extern "C" {
 #include "debug.h"
@@ -193,7 +194,7 @@ pfs_file * pfs_cache_open( pfs_name *name, int flags, mode_t mode )
 			}
 		}
 	} else {
-		if(name->service->stat(name,&buf)!=0) {
+		if(pfs_mdcache_stat(name,&buf)!=0) {
 			if(flags&O_CREAT && errno==ENOENT) {
 				buf.st_mtime = 0;
 				buf.st_size = 0;
@@ -11,6 +11,9 @@ See the file COPYING for details.
 #include "pfs_poll.h"
 #include "pfs_service.h"
 #include "pfs_critical.h"
+#include "pfs_mdcache.h"
+#include "pfs_prefetch.h"
+#include "pfs_profile.h"
 #include "pfs_paranoia.h"
 
 extern "C" {
@@ -87,6 +90,8 @@ const char * pfs_cvmfs_repo_arg = 0;
 
 int pfs_irods_debug_level = 0;
 
+static int pfs_metadata_cache_lifetime = 0;
+
 /*
 This process at the very top of the traced tree
 and its final exit status, which we use to determine
@@ -170,6 +175,7 @@ static void show_use( const char *cmd )
 	printf("  -C         Enable data channel authentication in GridFTP.\n");
 	printf("  -d <name>  Enable debugging for this sub-system.    (PARROT_DEBUG_FLAGS)\n");
 	printf("  -D         Disable small file optimizations.\n");
+	printf("  -e <time>  Cache remote metadata on disk for this long.(PARROT_METADATA_CACHE)\n");
 	printf("  -F         Enable file snapshot caching for all protocols.\n");
 	printf("  -f         Disable following symlinks.\n");
 	printf("  -G <num>   Fake this gid; Real gid stays the same.          (PARROT_GID)\n");
@@ -177,6 +183,7 @@ static void show_use( const char *cmd )
 	printf("  -h         Show this screen.\n");
 	printf("  -i <files> Comma-delimited list of tickets to use for authentication.\n");
 	printf("  -I <num>   Set the debug level output for the iRODS driver.\n");
+	printf("  -j <file>  Write a JSON profile of system call latency.  (PARROT_PROFILE)\n");
 	printf("  -K         Checksum files where available.\n");
 	printf("  -k         Do not checksum files.\n");
 	printf("  -l <path>  Path to ld.so to use.                      (PARROT_LDSO_PATH)\n");
@@ -249,6 +256,11 @@ static void ignore_signal( int sig )
 {
 }
 
+static void request_profile_dump( int sig )
+{
+	pfs_profile_dump_requested = 1;
+}
+
 void pfs_abort()
 {
 	kill(getpid(),SIGTERM);
@@ -419,12 +431,30 @@ int main( int argc, char *argv[] )
 	s = getenv("PARROT_BLOCK_SIZE");
 	if(s) pfs_service_set_block_size(string_metric_parse(s));
 
+	s = getenv("PARROT_CONNECTION_POOL_SIZE");
+	if(s) pfs_service_set_pool_size(atoi(s));
+
+	s = getenv("PARROT_CONNECTION_POOL_TIMEOUT");
+	if(s) pfs_service_set_pool_timeout(string_time_parse(s));
+
+	s = getenv("PARROT_HTTP_STREAMS");
+	if(s) pfs_http_streams = atoi(s);
+
+	s = getenv("PARROT_PROFILE");
+	if(s) pfs_profile_init(s);
+
 	s = getenv("PARROT_MOUNT_FILE");
 	if(s) pfs_resolve_file_config(s);
 
 	s = getenv("PARROT_MOUNT_STRING");
 	if(s) pfs_resolve_manual_config(s);
 
+	s = getenv("PARROT_RESOLVE_CACHE_SIZE");
+	if(s) pfs_resolve_cache_config(atoi(s));
+
+	s = getenv("PARROT_METADATA_CACHE");
+	if(s) pfs_metadata_cache_lifetime = string_time_parse(s);
+
 	s = getenv("PARROT_FORCE_STREAM");
 	if(s) pfs_force_stream = 1;
 
@@ -494,7 +524,7 @@ int main( int argc, char *argv[] )
 
 	sprintf(pfs_temp_dir,"/tmp/parrot.%d",getuid());
 
-	while((c=getopt(argc,argv,"+hA:a:b:B:c:Cd:DFfG:Hi:I:kKl:m:M:N:o:O:p:PQr:R:sSt:T:U:u:vw:WY"))!=(char)-1) {
+	while((c=getopt(argc,argv,"+hA:a:b:B:c:Cd:De:FfG:Hi:I:j:kKl:m:M:N:o:O:p:PQr:R:sSt:T:U:u:vw:WY"))!=(char)-1) {
 		switch(c) {
 		case 'a':
 			if(!auth_register_byname(optarg)) {
@@ -522,6 +552,9 @@ int main( int argc, char *argv[] )
 		case 'D':
 			pfs_enable_small_file_optimizations = 0;
 			break;
+		case 'e':
+			pfs_metadata_cache_lifetime = string_time_parse(optarg);
+			break;
 		case 'F':
 			pfs_force_cache = 1;
 			break;	
@@ -540,6 +573,9 @@ int main( int argc, char *argv[] )
 		case 'i':
 			tickets = strdup(optarg);
 			break;
+		case 'j':
+			pfs_profile_init(optarg);
+			break;
 		case 'k':
 			pfs_checksum_files = 0;
 			break;
@@ -628,6 +664,12 @@ int main( int argc, char *argv[] )
 	if(!pfs_file_cache) fatal("couldn't setup cache in %s: %s\n",pfs_temp_dir,strerror(errno));
 	file_cache_cleanup(pfs_file_cache);
 
+	if(pfs_profile_enabled) install_handler(SIGUSR1,request_profile_dump);
+
+	if(pfs_metadata_cache_lifetime>0) {
+		if(!pfs_mdcache_init(pfs_temp_dir,pfs_metadata_cache_lifetime)) fatal("couldn't setup metadata cache in %s: %s\n",pfs_temp_dir,strerror(errno));
+	}
+
 	if(!chose_auth) auth_register_all();
 
 	if(tickets) {
@@ -735,14 +777,19 @@ int main( int argc, char *argv[] )
 			}
 		}
 		if(pid==-1 && errno==ECHILD) break;
+		if(pfs_profile_dump_requested) pfs_profile_dump();
 		if(pfs_process_count()>0) pfs_poll_sleep();
 	}
 
+	pfs_profile_dump();
+
 	if(pfs_syscall_totals32) {
 		printf("\nParrot System Call Summary:\n");
 		printf("%" PRId64 " syscalls\n",pfs_syscall_count);
 		printf("%" PRId64 " bytes read\n",pfs_read_count);
 		printf("%" PRId64 " bytes written\n",pfs_write_count);
+		pfs_resolve_cache_stats(stdout);
+		pfs_mdcache_stats(stdout);
 
 		printf("\n32-bit System Calls:\n");
 		for(i=0;i<SYSCALL32_MAX;i++) {
@@ -0,0 +1,411 @@
+/*
+Copyright (C) 2005- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include "pfs_mdcache.h"
+
+extern "C" {
+#include "debug.h"
+#include "stringtools.h"
+#include "create_dir.h"
+#include "full_io.h"
+#include "md5.h"
+#include "domain_name_cache.h"
+#include "macros.h"
+}
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/stat.h>
+
+/*
+Each cached result is stored in a small text file named by the
+checksum of its kind and path.  The first line gives the expiration
+time, the result, and the errno of the original call, the second line
+gives the path (to detect collisions), and the remainder gives the
+data returned by the call.  A new record is written under the txn
+directory of the file cache and then renamed into place, so that
+concurrent readers always see a complete record, and the last writer
+wins.  Abandoned transactions are removed by file_cache_cleanup.
+*/
+
+#define MDCACHE_STAT     "stat"
+#define MDCACHE_LSTAT    "lstat"
+#define MDCACHE_READLINK "readlink"
+#define MDCACHE_DIR      "dir"
+
+static char *mdcache_root = 0;
+static int mdcache_lifetime = 0;
+
+static INT64_T mdcache_hits = 0;
+static INT64_T mdcache_misses = 0;
+
+int pfs_mdcache_init( const char *root, int lifetime )
+{
+	char path[PFS_PATH_MAX];
+	struct stat64 info;
+	int i;
+
+	sprintf(path,"%s/md/ff",root);
+	if(stat64(path,&info)!=0) {
+		debug(D_CACHE,"%s does not exist, creating metadata cache directories...",path);
+		for(i=0;i<=0xff;i++) {
+			sprintf(path,"%s/md/%02x",root,i);
+			if(!create_dir(path,0777)) return 0;
+		}
+	}
+
+	mdcache_root = strdup(root);
+	mdcache_lifetime = lifetime;
+
+	debug(D_CACHE,"metadata cache in %s/md with lifetime %d",root,lifetime);
+
+	return 1;
+}
+
+static int mdcache_enabled( pfs_name *name )
+{
+	return mdcache_root && mdcache_lifetime>0 && !name->service->is_local();
+}
+
+/*
+Only failures that say something stable about the namespace
+are worth keeping.  Anything else may be a transient problem
+with the server or the network.
+*/
+
+static int mdcache_errno_ok( int e )
+{
+	return e==ENOENT || e==ENOTDIR || e==EINVAL;
+}
+
+static void mdcache_names( const char *kind, const char *path, char *lpath, char *txn )
+{
+	unsigned char digest[MD5_DIGEST_LENGTH];
+	char shortname[DOMAIN_NAME_MAX];
+	char key[PFS_PATH_MAX*2];
+	const char *checksum;
+
+	sprintf(key,"%s:%s",kind,path);
+	md5_buffer(key,strlen(key),digest);
+	checksum = md5_string(digest);
+
+	sprintf(lpath,"%s/md/%02x/%s",mdcache_root,digest[0],checksum);
+
+	if(txn) {
+		domain_name_cache_guess_short(shortname);
+		sprintf(txn,"%s/txn/%s.%s.%d.XXXXXX",mdcache_root,checksum,shortname,(int)getpid());
+	}
+}
+
+/*
+Load a record into a newly allocated buffer.  On success, returns
+a pointer to the data following the header, which the caller must
+release by freeing *record.  Returns null if there is no valid record.
+*/
+
+static char * mdcache_load( const char *kind, const char *path, int *result, int *error, char **record )
+{
+	char lpath[PFS_PATH_MAX];
+	char *data, *line;
+	struct stat64 info;
+	long long expires;
+	int fd;
+
+	mdcache_names(kind,path,lpath,0);
+
+	fd = ::open64(lpath,O_RDONLY,0);
+	if(fd<0) return 0;
+
+	if(::fstat64(fd,&info)<0) {
+		::close(fd);
+		return 0;
+	}
+
+	data = (char*) malloc(info.st_size+1);
+	if(!data) {
+		::close(fd);
+		return 0;
+	}
+
+	if(full_read(fd,data,info.st_size)!=info.st_size) {
+		::close(fd);
+		free(data);
+		return 0;
+	}
+	::close(fd);
+	data[info.st_size] = 0;
+
+	if(sscanf(data,"%lld %d %d",&expires,result,error)!=3 || expires<time(0)) {
+		debug(D_CACHE,"%s %s expired",kind,path);
+		::unlink(lpath);
+		free(data);
+		return 0;
+	}
+
+	line = strchr(data,'\n');
+	if(!line) {
+		free(data);
+		return 0;
+	}
+	line++;
+
+	int length = strlen(path);
+	if(strncmp(line,path,length) || line[length]!='\n') {
+		free(data);
+		return 0;
+	}
+
+	*record = data;
+	return line+length+1;
+}
+
+static void mdcache_store( const char *kind, const char *path, int result, int error, const char *payload, int length )
+{
+	char lpath[PFS_PATH_MAX];
+	char txn[PFS_PATH_MAX];
+	char header[PFS_PATH_MAX*2];
+	int fd, hlength;
+
+	mdcache_names(kind,path,lpath,txn);
+
+	fd = mkstemp64(txn);
+	if(fd<0) {
+		debug(D_CACHE,"couldn't create %s: %s",txn,strerror(errno));
+		return;
+	}
+
+	hlength = sprintf(header,"%lld %d %d\n%s\n",(long long)(time(0)+mdcache_lifetime),result,error,path);
+
+	if(full_write(fd,header,hlength)!=hlength || (length>0 && full_write(fd,payload,length)!=length)) {
+		debug(D_CACHE,"couldn't write %s: %s",txn,strerror(errno));
+		::close(fd);
+		::unlink(txn);
+		return;
+	}
+
+	::close(fd);
+
+	if(::rename(txn,lpath)<0) {
+		debug(D_CACHE,"couldn't commit %s: %s",lpath,strerror(errno));
+		::unlink(txn);
+	}
+}
+
+static void mdcache_remove( const char *kind, const char *path )
+{
+	char lpath[PFS_PATH_MAX];
+	mdcache_names(kind,path,lpath,0);
+	::unlink(lpath);
+}
+
+static int mdcache_stat_common( const char *kind, pfs_name *name, struct pfs_stat *buf )
+{
+	int result, error;
+	char *record, *payload;
+	long long f[13];
+
+	payload = mdcache_load(kind,name->path,&result,&error,&record);
+	if(payload) {
+		if(result<0) {
+			debug(D_CACHE,"%s %s hit (%s)",kind,name->path,strerror(error));
+			free(record);
+			mdcache_hits++;
+			errno = error;
+			return -1;
+		}
+		if(sscanf(payload,"%lld %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld",
+			&f[0],&f[1],&f[2],&f[3],&f[4],&f[5],&f[6],&f[7],&f[8],&f[9],&f[10],&f[11],&f[12])==13) {
+			debug(D_CACHE,"%s %s hit",kind,name->path);
+			free(record);
+			memset(buf,0,sizeof(*buf));
+			buf->st_dev = f[0];
+			buf->st_ino = f[1];
+			buf->st_mode = f[2];
+			buf->st_nlink = f[3];
+			buf->st_uid = f[4];
+			buf->st_gid = f[5];
+			buf->st_rdev = f[6];
+			buf->st_size = f[7];
+			buf->st_blksize = f[8];
+			buf->st_blocks = f[9];
+			buf->st_atime = f[10];
+			buf->st_mtime = f[11];
+			buf->st_ctime = f[12];
+			mdcache_hits++;
+			return 0;
+		}
+		free(record);
+	}
+
+	mdcache_misses++;
+
+	if(!strcmp(kind,MDCACHE_STAT)) {
+		result = name->service->stat(name,buf);
+	} else {
+		result = name->service->lstat(name,buf);
+	}
+
+	if(result==0) {
+		char data[PFS_LINE_MAX];
+		int length = sprintf(data,"%lld %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld\n",
+			(long long)buf->st_dev,(long long)buf->st_ino,(long long)buf->st_mode,
+			(long long)buf->st_nlink,(long long)buf->st_uid,(long long)buf->st_gid,
+			(long long)buf->st_rdev,(long long)buf->st_size,(long long)buf->st_blksize,
+			(long long)buf->st_blocks,(long long)buf->st_atime,(long long)buf->st_mtime,
+			(long long)buf->st_ctime);
+		mdcache_store(kind,name->path,0,0,data,length);
+	} else if(mdcache_errno_ok(errno)) {
+		error = errno;
+		mdcache_store(kind,name->path,-1,error,0,0);
+		errno = error;
+	}
+
+	return result;
+}
+
+int pfs_mdcache_stat( pfs_name *name, struct pfs_stat *buf )
+{
+	if(!mdcache_enabled(name)) return name->service->stat(name,buf);
+	return mdcache_stat_common(MDCACHE_STAT,name,buf);
+}
+
+int pfs_mdcache_lstat( pfs_name *name, struct pfs_stat *buf )
+{
+	if(!mdcache_enabled(name)) return name->service->lstat(name,buf);
+	return mdcache_stat_common(MDCACHE_LSTAT,name,buf);
+}
+
+int pfs_mdcache_readlink( pfs_name *name, char *buf, pfs_size_t size )
+{
+	int result, error;
+	char *record, *payload;
+
+	if(!mdcache_enabled(name)) return name->service->readlink(name,buf,size);
+
+	payload = mdcache_load(MDCACHE_READLINK,name->path,&result,&error,&record);
+	if(payload) {
+		debug(D_CACHE,"readlink %s hit",name->path);
+		mdcache_hits++;
+		if(result<0) {
+			free(record);
+			errno = error;
+			return -1;
+		}
+		result = MIN(result,(int)size);
+		memcpy(buf,payload,result);
+		free(record);
+		return result;
+	}
+
+	mdcache_misses++;
+
+	result = name->service->readlink(name,buf,size);
+	if(result>=0 && result<size) {
+		mdcache_store(MDCACHE_READLINK,name->path,result,0,buf,result);
+	} else if(result<0 && mdcache_errno_ok(errno)) {
+		error = errno;
+		mdcache_store(MDCACHE_READLINK,name->path,-1,error,0,0);
+		errno = error;
+	}
+
+	return result;
+}
+
+pfs_dir * pfs_mdcache_getdir( pfs_name *name )
+{
+	int result, error;
+	char *record, *payload;
+	pfs_dir *dir;
+
+	if(!mdcache_enabled(name)) return name->service->getdir(name);
+
+	payload = mdcache_load(MDCACHE_DIR,name->path,&result,&error,&record);
+	if(payload) {
+		debug(D_CACHE,"dir %s hit",name->path);
+		mdcache_hits++;
+		if(result<0) {
+			free(record);
+			errno = error;
+			return 0;
+		}
+		dir = new pfs_dir(name);
+		char *entry = payload;
+		char *end;
+		while((end=strchr(entry,'\n'))) {
+			*end = 0;
+			dir->append(entry);
+			entry = end+1;
+		}
+		free(record);
+		return dir;
+	}
+
+	mdcache_misses++;
+
+	dir = name->service->getdir(name);
+	if(dir) {
+		pfs_off_t offset = 0, next_offset;
+		struct dirent *d;
+		char *data = 0;
+		int length = 0;
+
+		while((d=dir->fdreaddir(offset,&next_offset))) {
+			int dlength = strlen(d->d_name);
+			char *newdata = (char*) realloc(data,length+dlength+1);
+			if(!newdata) {
+				free(data);
+				return dir;
+			}
+			data = newdata;
+			memcpy(&data[length],d->d_name,dlength);
+			length += dlength;
+			data[length++] = '\n';
+			offset = next_offset;
+		}
+
+		mdcache_store(MDCACHE_DIR,name->path,0,0,data,length);
+		free(data);
+	} else if(mdcache_errno_ok(errno)) {
+		error = errno;
+		mdcache_store(MDCACHE_DIR,name->path,-1,error,0,0);
+		errno = error;
+	}
+
+	return dir;
+}
+
+/*
+Called whenever this process modifies a name, so that neither
+it nor its directory listing is served stale from the cache.
+Changes made by other clients are only seen after the lifetime
+of the cached record.
+*/
+
+void pfs_mdcache_invalidate( pfs_name *name )
+{
+	char parent[PFS_PATH_MAX];
+
+	if(!mdcache_enabled(name)) return;
+
+	mdcache_remove(MDCACHE_STAT,name->path);
+	mdcache_remove(MDCACHE_LSTAT,name->path);
+	mdcache_remove(MDCACHE_READLINK,name->path);
+	mdcache_remove(MDCACHE_DIR,name->path);
+
+	string_dirname(name->path,parent);
+	mdcache_remove(MDCACHE_DIR,parent);
+}
+
+void pfs_mdcache_stats( FILE *file )
+{
+	fprintf(file,"%" PRId64 " metadata cache hits\n",mdcache_hits);
+	fprintf(file,"%" PRId64 " metadata cache misses\n",mdcache_misses);
+}
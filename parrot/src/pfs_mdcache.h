@@ -0,0 +1,32 @@
+/*
+Copyright (C) 2005- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#ifndef PFS_MDCACHE_H
+#define PFS_MDCACHE_H
+
+#include "pfs_service.h"
+
+#include <stdio.h>
+
+/*
+The metadata cache keeps the results of stat, lstat, readlink,
+and directory listings of remote services on disk, beneath the
+root of the file cache, so that they may be shared by all of the
+Parrot instances on a node.  Failures that indicate a missing
+file are cached as well.  Each result is kept for a fixed lifetime.
+If the cache is not enabled, or the name refers to a local file,
+these calls pass directly through to the service.
+*/
+
+int       pfs_mdcache_init( const char *root, int lifetime );
+int       pfs_mdcache_stat( pfs_name *name, struct pfs_stat *buf );
+int       pfs_mdcache_lstat( pfs_name *name, struct pfs_stat *buf );
+int       pfs_mdcache_readlink( pfs_name *name, char *buf, pfs_size_t size );
+pfs_dir * pfs_mdcache_getdir( pfs_name *name );
+void      pfs_mdcache_invalidate( pfs_name *name );
+void      pfs_mdcache_stats( FILE *file );
+
+#endif
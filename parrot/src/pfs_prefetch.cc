@@ -0,0 +1,295 @@
+/*
+Copyright (C) 2005- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include "pfs_prefetch.h"
+
+extern "C" {
+#include "debug.h"
+#include "http_query.h"
+#include "xxmalloc.h"
+#include "macros.h"
+}
+
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+
+extern int pfs_master_timeout;
+
+int pfs_http_streams = 4;
+
+/*
+A slot holds one chunk of the object.  While the chunk is in
+flight, link is the connection delivering it, and filled counts
+the bytes received so far, starting at offset.  A slot with a
+length of zero is free.  If keepalive is set, the server will
+leave the connection open once the chunk is complete, and it
+goes back to the idle pool in http_query for the next chunk.
+*/
+
+struct pfs_prefetch_slot {
+	struct link *link;
+	int keepalive;
+	INT64_T offset;
+	INT64_T length;
+	INT64_T filled;
+	char *buffer;
+};
+
+pfs_prefetch::pfs_prefetch( const char *u, struct link *first, INT64_T s, int streams, int c )
+{
+	url = xxstrdup(u);
+	size = s;
+	cache_reload = c;
+	link = 0;
+	link_offset = 0;
+	nslots = 0;
+	slots = 0;
+	info = 0;
+	active = 0;
+	next_offset = 0;
+
+	if(streams>1 && size>PFS_PREFETCH_CHUNK_SIZE) {
+		nslots = MIN(streams,(size+PFS_PREFETCH_CHUNK_SIZE-1)/PFS_PREFETCH_CHUNK_SIZE);
+		slots = (struct pfs_prefetch_slot *) xxmalloc(sizeof(*slots)*nslots);
+		memset(slots,0,sizeof(*slots)*nslots);
+
+		/* The initial request becomes the first chunk. */
+		slots[0].link = first;
+		slots[0].offset = 0;
+		slots[0].length = PFS_PREFETCH_CHUNK_SIZE;
+		slots[0].buffer = (char*) xxmalloc(PFS_PREFETCH_CHUNK_SIZE);
+		info = (struct link_info *) xxmalloc(sizeof(*info)*nslots);
+		active = (struct pfs_prefetch_slot **) xxmalloc(sizeof(*active)*nslots);
+		next_offset = PFS_PREFETCH_CHUNK_SIZE;
+
+		debug(D_HTTP,"prefetching %s with %d streams",url,nslots);
+	} else {
+		link = first;
+	}
+}
+
+pfs_prefetch::~pfs_prefetch()
+{
+	int i;
+
+	if(link) link_close(link);
+
+	for(i=0;i<nslots;i++) {
+		slot_drop(&slots[i]);
+		if(slots[i].buffer) free(slots[i].buffer);
+	}
+
+	if(slots) free(slots);
+	if(info) free(info);
+	if(active) free(active);
+	free(url);
+}
+
+struct link * pfs_prefetch::fetch( INT64_T offset, INT64_T length, INT64_T *actual, int *keepalive )
+{
+	time_t stoptime = time(0)+pfs_master_timeout;
+
+	if(!keepalive) return http_query_range(url,"GET",offset,length,actual,stoptime,cache_reload);
+
+	struct link *l = http_query_range_keepalive(url,"GET",offset,length,actual,stoptime,cache_reload,keepalive);
+	if(l && *actual!=length) *keepalive = 0;
+	return l;
+}
+
+pfs_ssize_t pfs_prefetch::read( void *data, pfs_size_t length, pfs_off_t offset )
+{
+	pfs_ssize_t total = 0;
+
+	if(!nslots) return stream_read(data,length,offset);
+
+	while(length>0 && offset<size) {
+		fill_window(offset);
+
+		struct pfs_prefetch_slot *s = slot_find(offset);
+		if(!s) break;
+
+		while(s->filled <= offset-s->offset) {
+			if(!pump() || s->length==0) return total>0 ? total : -1;
+		}
+
+		INT64_T chunk = MIN((INT64_T)length,s->filled-(offset-s->offset));
+		memcpy(data,&s->buffer[offset-s->offset],chunk);
+
+		data = (char*)data + chunk;
+		length -= chunk;
+		offset += chunk;
+		total += chunk;
+	}
+
+	return total;
+}
+
+/*
+Without prefetching, keep one connection open at the current
+offset, and reopen it with a range request if the reader seeks.
+*/
+
+pfs_ssize_t pfs_prefetch::stream_read( void *data, pfs_size_t length, pfs_off_t offset )
+{
+	pfs_ssize_t actual;
+
+	if(size>0 && offset>=size) return 0;
+
+	if(!link || offset!=link_offset) {
+		INT64_T remaining;
+		if(link) link_close(link);
+		debug(D_HTTP,"reopening %s at offset %lld",url,(long long)offset);
+		link = fetch(offset,-1,&remaining,0);
+		if(!link) return -1;
+		link_offset = offset;
+	}
+
+	actual = link_read(link,(char*)data,length,LINK_FOREVER);
+	if(actual>0) link_offset += actual;
+
+	return actual;
+}
+
+int pfs_prefetch::slot_issue( struct pfs_prefetch_slot *s, INT64_T offset )
+{
+	INT64_T actual;
+
+	s->offset = offset;
+	s->length = MIN(PFS_PREFETCH_CHUNK_SIZE,size-offset);
+	s->filled = 0;
+	if(!s->buffer) s->buffer = (char*) xxmalloc(PFS_PREFETCH_CHUNK_SIZE);
+
+	s->link = fetch(offset,s->length,&actual,&s->keepalive);
+	if(!s->link) {
+		s->length = 0;
+		return 0;
+	}
+
+	return 1;
+}
+
+void pfs_prefetch::slot_drop( struct pfs_prefetch_slot *s )
+{
+	if(s->link) {
+		link_close(s->link);
+		s->link = 0;
+	}
+	s->length = 0;
+	s->filled = 0;
+}
+
+struct pfs_prefetch_slot * pfs_prefetch::slot_find( INT64_T offset )
+{
+	int i;
+
+	for(i=0;i<nslots;i++) {
+		struct pfs_prefetch_slot *s = &slots[i];
+		if(s->length>0 && offset>=s->offset && offset<s->offset+s->length) return s;
+	}
+
+	return 0;
+}
+
+/*
+Release the chunks that the reader has passed or that lie outside
+the window ahead of it, then issue requests for the chunks that
+follow, up to one per slot.  If the reader has jumped away from
+all of the chunks in flight, the window starts over at its offset.
+*/
+
+void pfs_prefetch::fill_window( INT64_T offset )
+{
+	INT64_T window = (INT64_T)nslots*PFS_PREFETCH_CHUNK_SIZE;
+	int i;
+
+	if(!slot_find(offset)) {
+		for(i=0;i<nslots;i++) slot_drop(&slots[i]);
+		next_offset = offset;
+		debug(D_HTTP,"prefetch window of %s moved to %lld",url,(long long)offset);
+	}
+
+	for(i=0;i<nslots;i++) {
+		struct pfs_prefetch_slot *s = &slots[i];
+		if(s->length>0 && (s->offset+s->length<=offset || s->offset>=offset+window)) {
+			slot_drop(s);
+		}
+	}
+
+	for(i=0;i<nslots && next_offset<size && next_offset<offset+window;i++) {
+		struct pfs_prefetch_slot *s = &slots[i];
+		if(s->length>0) continue;
+		if(!slot_issue(s,next_offset)) {
+			debug(D_HTTP,"couldn't prefetch %s at %lld: %s",url,(long long)next_offset,strerror(errno));
+			break;
+		}
+		next_offset += s->length;
+	}
+}
+
+/*
+Wait until at least one chunk in flight makes progress, and
+accept whatever data has arrived on every ready connection.
+A connection that ends early is reissued for the remainder of
+its chunk; if that fails, the chunk is dropped.  Returns zero
+and sets errno if nothing could make progress.
+*/
+
+int pfs_prefetch::pump()
+{
+	int i, n = 0, result;
+
+	for(i=0;i<nslots;i++) {
+		if(slots[i].link) {
+			info[n].link = slots[i].link;
+			info[n].events = LINK_READ;
+			info[n].revents = 0;
+			active[n] = &slots[i];
+			n++;
+		}
+	}
+
+	if(n==0) {
+		errno = EIO;
+		return 0;
+	}
+
+	result = link_poll(info,n,pfs_master_timeout*1000);
+	if(result<=0) {
+		if(result==0) errno = ETIMEDOUT;
+		return 0;
+	}
+
+	for(i=0;i<n;i++) {
+		struct pfs_prefetch_slot *s = active[i];
+		if(!info[i].revents) continue;
+
+		int actual = link_read_avail(s->link,&s->buffer[s->filled],s->length-s->filled,time(0)+pfs_master_timeout);
+		if(actual>0) {
+			s->filled += actual;
+			if(s->filled>=s->length) {
+				if(s->keepalive) {
+					http_query_release(s->link);
+				} else {
+					link_close(s->link);
+				}
+				s->link = 0;
+			}
+		} else {
+			INT64_T remaining;
+			debug(D_HTTP,"lost connection to %s at %lld, retrying",url,(long long)(s->offset+s->filled));
+			link_close(s->link);
+			s->link = fetch(s->offset+s->filled,s->length-s->filled,&remaining,&s->keepalive);
+			if(!s->link) {
+				debug(D_HTTP,"couldn't reconnect to %s: %s",url,strerror(errno));
+				slot_drop(s);
+			}
+		}
+	}
+
+	return 1;
+}
@@ -0,0 +1,65 @@
+/*
+Copyright (C) 2005- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#ifndef PFS_PREFETCH_H
+#define PFS_PREFETCH_H
+
+#include "pfs_types.h"
+
+extern "C" {
+#include "link.h"
+}
+
+/*
+A pfs_prefetch reads an object from a web server, using HTTP Range
+requests to read at arbitrary offsets.  If more than one stream is
+allowed and the size of the object is known, the object is divided
+into chunks, and several chunks ahead of the reader are kept in flight
+at once over separate connections, so that the latency of a long
+network path is paid once rather than once per request.  Each chunk
+asks the server to keep its connection open, so that the following
+chunks reuse it instead of paying for a new connection.  Otherwise,
+the object is read through a single connection, which is reopened
+at a new offset whenever the reader seeks.
+*/
+
+#define PFS_PREFETCH_CHUNK_SIZE (1024*1024)
+
+struct pfs_prefetch_slot;
+
+class pfs_prefetch {
+public:
+	pfs_prefetch( const char *url, struct link *first, INT64_T size, int streams, int cache_reload );
+	~pfs_prefetch();
+
+	pfs_ssize_t read( void *data, pfs_size_t length, pfs_off_t offset );
+
+private:
+	struct link * fetch( INT64_T offset, INT64_T length, INT64_T *actual, int *keepalive );
+	pfs_ssize_t stream_read( void *data, pfs_size_t length, pfs_off_t offset );
+	int slot_issue( struct pfs_prefetch_slot *s, INT64_T offset );
+	void slot_drop( struct pfs_prefetch_slot *s );
+	struct pfs_prefetch_slot * slot_find( INT64_T offset );
+	void fill_window( INT64_T offset );
+	int pump();
+
+	char *url;
+	INT64_T size;
+	int cache_reload;
+
+	struct link *link;
+	INT64_T link_offset;
+
+	int nslots;
+	struct pfs_prefetch_slot *slots;
+	struct pfs_prefetch_slot **active;
+	struct link_info *info;
+	INT64_T next_offset;
+};
+
+extern int pfs_http_streams;
+
+#endif
@@ -146,6 +146,11 @@ struct pfs_process * pfs_process_create( pid_t pid, pid_t actual_ppid, pid_t not
 	child->heap_address = 0;
 	child->break_address = 0;
 	child->completing_execve = 0;
+	child->profile_start = 0;
+	child->profile_mark = 0;
+	child->profile_dispatch = 0;
+	child->profile_bytes = 0;
+	child->profile_service = 0;
 
 	actual_parent = pfs_process_lookup(actual_ppid);
 
@@ -73,6 +73,12 @@ struct pfs_process {
 	int 	       exit_signal;
 	int            interrupted;
 	int            nsyscalls;
+
+	UINT64_T       profile_start;
+	UINT64_T       profile_mark;
+	UINT64_T       profile_dispatch;
+	INT64_T        profile_bytes;
+	struct pfs_profile_stats *profile_service;
 };
 
 struct pfs_process * pfs_process_create( pid_t pid, pid_t actual_ppid, pid_t notify_ppid, int share_table, int exit_signal );
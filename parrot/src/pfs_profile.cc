@@ -0,0 +1,262 @@
+/*
+Copyright (C) 2005- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include "pfs_profile.h"
+#include "pfs_sysdeps.h"
+
+extern "C" {
+#include "debug.h"
+#include "hash_table.h"
+#include "timestamp.h"
+#include "xxmalloc.h"
+#include "tracer.h"
+}
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+/*
+Bucket zero counts calls under one microsecond, and bucket i
+counts calls taking from 2^(i-1) up to 2^i microseconds.
+The last bucket collects everything longer.
+*/
+
+#define PFS_PROFILE_BUCKETS 32
+
+struct pfs_profile_stats {
+	INT64_T count;
+	INT64_T usec;
+	INT64_T parrot_usec;
+	INT64_T bytes;
+	INT64_T histogram[PFS_PROFILE_BUCKETS];
+};
+
+extern struct pfs_process *pfs_current;
+
+int pfs_profile_enabled = 0;
+int pfs_profile_dump_requested = 0;
+
+static char *profile_filename = 0;
+static timestamp_t profile_start_time = 0;
+static struct pfs_profile_stats *profile_syscalls32 = 0;
+static struct pfs_profile_stats *profile_syscalls64 = 0;
+static struct hash_table *profile_services = 0;
+static struct pfs_profile_stats profile_unattributed;
+
+void pfs_profile_init( const char *filename )
+{
+	profile_filename = xxstrdup(filename);
+	profile_syscalls32 = (struct pfs_profile_stats *) calloc(SYSCALL32_MAX,sizeof(struct pfs_profile_stats));
+	profile_syscalls64 = (struct pfs_profile_stats *) calloc(SYSCALL64_MAX,sizeof(struct pfs_profile_stats));
+	profile_services = hash_table_create(0,0);
+	memset(&profile_unattributed,0,sizeof(profile_unattributed));
+	profile_start_time = timestamp_get();
+	pfs_profile_enabled = 1;
+}
+
+/*
+Called each time a process stops in the tracer.  A process in the
+user state is entering a new system call, so a new record begins.
+A process in the kernel state is only returning from a call that
+Parrot has already handled, so the clock is not read, and the short
+time taken to collect the result counts as switching overhead.
+This saves one of the three clock readings on most calls.
+*/
+
+void pfs_profile_dispatch_begin( struct pfs_process *p )
+{
+	if(p->state==PFS_PROCESS_STATE_KERNEL) {
+		p->profile_mark = 0;
+		return;
+	}
+
+	timestamp_t now = timestamp_get();
+
+	if(p->state==PFS_PROCESS_STATE_USER) {
+		p->profile_start = now;
+		p->profile_dispatch = 0;
+		p->profile_bytes = 0;
+		p->profile_service = 0;
+	}
+
+	p->profile_mark = now;
+}
+
+static void profile_record( struct pfs_profile_stats *s, INT64_T usec, INT64_T parrot_usec, INT64_T bytes )
+{
+	int b = 0;
+
+	while(usec>>b && b<PFS_PROFILE_BUCKETS-1) b++;
+
+	s->count++;
+	s->usec += usec;
+	s->parrot_usec += parrot_usec;
+	s->bytes += bytes;
+	s->histogram[b]++;
+}
+
+/*
+Called after each dispatch.  If the call has now returned to the
+process (or the process is gone) then the record is complete.
+*/
+
+void pfs_profile_dispatch_end( struct pfs_process *p )
+{
+	timestamp_t now = timestamp_get();
+	struct pfs_profile_stats *s;
+
+	if(p->profile_mark) p->profile_dispatch += now - p->profile_mark;
+
+	if(!p->profile_start) return;
+	if(p->state!=PFS_PROCESS_STATE_USER && p->state!=PFS_PROCESS_STATE_DONE) return;
+
+	INT64_T usec = now - p->profile_start;
+	INT64_T syscall = p->syscall_original;
+
+	if(tracer_is_64bit(p->tracer)) {
+		s = (syscall>=0 && syscall<SYSCALL64_MAX) ? &profile_syscalls64[syscall] : 0;
+	} else {
+		s = (syscall>=0 && syscall<SYSCALL32_MAX) ? &profile_syscalls32[syscall] : 0;
+	}
+
+	if(s) profile_record(s,usec,p->profile_dispatch,p->profile_bytes);
+
+	s = p->profile_service ? p->profile_service : &profile_unattributed;
+	profile_record(s,usec,p->profile_dispatch,p->profile_bytes);
+
+	p->profile_start = 0;
+}
+
+/*
+Charge the system call in progress to the named service.
+If a call touches more than one service, the last one wins.
+*/
+
+void pfs_profile_service( const char *service_name )
+{
+	struct pfs_profile_stats *s;
+
+	if(!pfs_profile_enabled || !pfs_current) return;
+
+	s = (struct pfs_profile_stats *) hash_table_lookup(profile_services,service_name);
+	if(!s) {
+		s = (struct pfs_profile_stats *) xxmalloc(sizeof(*s));
+		memset(s,0,sizeof(*s));
+		hash_table_insert(profile_services,service_name,s);
+	}
+
+	pfs_current->profile_service = s;
+}
+
+static void profile_print( FILE *file, const char *name, struct pfs_profile_stats *s, int *first )
+{
+	int i, last;
+
+	if(!s->count) return;
+
+	for(last=PFS_PROFILE_BUCKETS-1;last>0 && !s->histogram[last];last--) {}
+
+	fprintf(file,"%s\n\t\t\"%s\": { \"count\": %lld, \"usec\": %lld, \"parrot_usec\": %lld, \"other_usec\": %lld, \"bytes\": %lld, \"histogram\": [",
+		*first ? "" : ",",
+		name,
+		(long long)s->count,
+		(long long)s->usec,
+		(long long)s->parrot_usec,
+		(long long)(s->usec-s->parrot_usec),
+		(long long)s->bytes);
+
+	for(i=0;i<=last;i++) {
+		fprintf(file,"%s%lld",i ? ", " : "",(long long)s->histogram[i]);
+	}
+
+	fprintf(file,"] }");
+	*first = 0;
+}
+
+/*
+The profile is written to a temporary file and renamed into
+place, so that a reader never sees a partial dump.
+*/
+
+void pfs_profile_dump()
+{
+	char tmpname[PFS_PATH_MAX];
+	struct pfs_profile_stats total;
+	struct pfs_profile_stats *s;
+	FILE *file;
+	char *key;
+	int i, first;
+
+	pfs_profile_dump_requested = 0;
+	if(!pfs_profile_enabled) return;
+
+	sprintf(tmpname,"%s.%d.tmp",profile_filename,(int)getpid());
+	file = fopen(tmpname,"w");
+	if(!file) {
+		debug(D_NOTICE,"couldn't write profile to %s: %s",tmpname,strerror(errno));
+		return;
+	}
+
+	memset(&total,0,sizeof(total));
+	hash_table_firstkey(profile_services);
+	while(hash_table_nextkey(profile_services,&key,(void**)&s)) {
+		total.count += s->count;
+		total.usec += s->usec;
+		total.parrot_usec += s->parrot_usec;
+		total.bytes += s->bytes;
+	}
+	total.count += profile_unattributed.count;
+	total.usec += profile_unattributed.usec;
+	total.parrot_usec += profile_unattributed.parrot_usec;
+	total.bytes += profile_unattributed.bytes;
+
+	fprintf(file,"{\n");
+	fprintf(file,"\t\"elapsed_usec\": %lld,\n",(long long)(timestamp_get()-profile_start_time));
+	fprintf(file,"\t\"syscalls\": %lld,\n",(long long)total.count);
+	fprintf(file,"\t\"syscall_usec\": %lld,\n",(long long)total.usec);
+	fprintf(file,"\t\"parrot_usec\": %lld,\n",(long long)total.parrot_usec);
+	fprintf(file,"\t\"other_usec\": %lld,\n",(long long)(total.usec-total.parrot_usec));
+	fprintf(file,"\t\"bytes\": %lld,\n",(long long)total.bytes);
+	fprintf(file,"\t\"histogram_units\": \"log2 usec\",\n");
+
+	fprintf(file,"\t\"services\": {");
+	first = 1;
+	hash_table_firstkey(profile_services);
+	while(hash_table_nextkey(profile_services,&key,(void**)&s)) {
+		profile_print(file,key,s,&first);
+	}
+	profile_print(file,"none",&profile_unattributed,&first);
+	fprintf(file,"\n\t},\n");
+
+	fprintf(file,"\t\"syscalls32\": {");
+	first = 1;
+	for(i=0;i<SYSCALL32_MAX;i++) {
+		profile_print(file,tracer_syscall32_name(i),&profile_syscalls32[i],&first);
+	}
+	fprintf(file,"\n\t},\n");
+
+	fprintf(file,"\t\"syscalls64\": {");
+	first = 1;
+#ifdef CCTOOLS_CPU_X86_64
+	for(i=0;i<SYSCALL64_MAX;i++) {
+		profile_print(file,tracer_syscall64_name(i),&profile_syscalls64[i],&first);
+	}
+#endif
+	fprintf(file,"\n\t}\n");
+
+	fprintf(file,"}\n");
+
+	if(fclose(file)!=0 || rename(tmpname,profile_filename)!=0) {
+		debug(D_NOTICE,"couldn't write profile to %s: %s",profile_filename,strerror(errno));
+		unlink(tmpname);
+		return;
+	}
+
+	debug(D_PROCESS,"wrote profile to %s",profile_filename);
+}
@@ -0,0 +1,33 @@
+/*
+Copyright (C) 2005- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#ifndef PFS_PROFILE_H
+#define PFS_PROFILE_H
+
+#include "pfs_process.h"
+
+/*
+The profiler measures each system call from the moment it is
+trapped until the moment it returns to the process.  Of that
+latency, the time spent inside Parrot handling the call (which
+includes all time blocked on a remote service) is separated from
+the remainder (the kernel, scheduling, and tracer overhead).  Calls
+are tallied by system call number and by the service that handled
+them, each with a log-scale histogram of latencies and a count of
+bytes moved.  The results are written as JSON at exit, or upon
+SIGUSR1 if a dump is requested while running.
+*/
+
+extern int pfs_profile_enabled;
+extern int pfs_profile_dump_requested;
+
+void pfs_profile_init( const char *filename );
+void pfs_profile_dispatch_begin( struct pfs_process *p );
+void pfs_profile_dispatch_end( struct pfs_process *p );
+void pfs_profile_service( const char *service_name );
+void pfs_profile_dump();
+
+#endif
@@ -11,6 +11,7 @@ See the file COPYING for details.
 #include "stringtools.h"
 #include "xxmalloc.h"
 #include "hash_table.h"
+#include "int_sizes.h"
 
 #include <stdio.h>
 #include <unistd.h>
@@ -23,22 +24,133 @@ See the file COPYING for details.
 
 extern char pfs_temp_dir[PFS_PATH_MAX];
 
+/*
+Mount entries with a literal prefix are stored in a trie
+indexed by path component, so that only the entries along
+the path of a logical name need to be considered.  Entries
+whose prefix is a shell pattern cannot be placed in the trie,
+and are kept in a separate list that is always checked.
+The most recently added entry takes precedence, as before,
+which is recorded by the priority of each entry.
+*/
+
 struct mount_entry {
 	char prefix[PFS_PATH_MAX];
 	char redirect[PFS_PATH_MAX];
+	int priority;
 	struct mount_entry *next;
 };
 
-static struct mount_entry * mount_list = 0;
+struct mount_node {
+	struct mount_entry *entries;
+	struct hash_table *children;
+};
+
+static struct mount_node *mount_root = 0;
+static struct mount_entry *mount_patterns = 0;
+static int mount_count = 0;
+
+static struct mount_entry **mount_candidates = 0;
+static int mount_candidates_max = 0;
+
+/*
+The resolve cache is bounded in size, and evicts the
+least recently used name when full.  The entries form a
+doubly linked list in order of use, with the most recent
+at the head.
+*/
+
+#define RESOLVE_CACHE_SIZE_DEFAULT 65536
+
+struct resolve_cache_entry {
+	char *logical_name;
+	char *physical_name;
+	struct resolve_cache_entry *prev;
+	struct resolve_cache_entry *next;
+};
+
 static struct hash_table *resolve_cache = 0;
+static struct resolve_cache_entry *resolve_cache_head = 0;
+static struct resolve_cache_entry *resolve_cache_tail = 0;
+static int resolve_cache_size = 0;
+static int resolve_cache_max = RESOLVE_CACHE_SIZE_DEFAULT;
+
+static INT64_T resolve_cache_hits = 0;
+static INT64_T resolve_cache_misses = 0;
+static INT64_T resolve_cache_evictions = 0;
+
+static int is_pattern( const char *prefix )
+{
+	return strpbrk(prefix,"*?[\\")!=0;
+}
+
+static struct mount_node * mount_node_create()
+{
+	struct mount_node *n = xxmalloc(sizeof(*n));
+	n->entries = 0;
+	n->children = 0;
+	return n;
+}
+
+/*
+Find the next component in a path, skipping over any
+leading slashes.  Returns the length of the component
+and sets *start to its beginning, or returns zero at
+the end of the path.
+*/
+
+static int next_component( const char *path, const char **start )
+{
+	int length = 0;
+	while(*path=='/') path++;
+	*start = path;
+	while(path[length] && path[length]!='/') length++;
+	return length;
+}
 
 static void add_mount_entry( const char *prefix, const char *redirect )
 {
 	struct mount_entry * m = xxmalloc(sizeof(*m));
 	strcpy(m->prefix,prefix);
 	strcpy(m->redirect,redirect);
-	m->next = mount_list;
-	mount_list = m;
+	m->priority = mount_count++;
+
+	if(is_pattern(prefix)) {
+		m->next = mount_patterns;
+		mount_patterns = m;
+	} else {
+		char name[PFS_PATH_MAX];
+		const char *p = prefix;
+		const char *start;
+		int length;
+		struct mount_node *n;
+
+		if(!mount_root) mount_root = mount_node_create();
+		n = mount_root;
+
+		while((length=next_component(p,&start))>0) {
+			struct mount_node *child = 0;
+			strncpy(name,start,length);
+			name[length] = 0;
+			if(!n->children) {
+				n->children = hash_table_create(0,0);
+			} else {
+				child = hash_table_lookup(n->children,name);
+			}
+			if(!child) {
+				child = mount_node_create();
+				hash_table_insert(n->children,name,child);
+			}
+			n = child;
+			p = start+length;
+		}
+
+		m->next = n->entries;
+		n->entries = m;
+	}
+
+	mount_candidates_max = mount_count;
+	mount_candidates = xxrealloc(mount_candidates,mount_candidates_max*sizeof(*mount_candidates));
 }
 
 void pfs_resolve_manual_config( const char *str )
@@ -239,20 +351,144 @@ void clean_up_path( char *path )
 	}
 }
 
-pfs_resolve_t pfs_resolve( const char *logical_name, char *physical_name, time_t stoptime )
+/*
+Gather all of the mount entries that could possibly apply
+to this logical name: those along its path in the trie,
+and all of the patterns.  Order them by priority, so that
+the most recently added entry is checked first.
+*/
+
+static int compare_priority( const void *a, const void *b )
 {
-	pfs_resolve_t result = PFS_RESOLVE_UNCHANGED;
+	const struct mount_entry *x = *(const struct mount_entry **)a;
+	const struct mount_entry *y = *(const struct mount_entry **)b;
+	return y->priority - x->priority;
+}
+
+static int mount_candidates_find( const char *logical_name )
+{
+	char name[PFS_PATH_MAX];
+	const char *p = logical_name;
+	const char *start;
+	int length;
+	int count = 0;
+	struct mount_node *n = mount_root;
 	struct mount_entry *e;
-	const char *t;
+
+	while(n) {
+		for(e=n->entries;e;e=e->next) {
+			mount_candidates[count++] = e;
+		}
+		if(!n->children) break;
+		length = next_component(p,&start);
+		if(length<=0) break;
+		strncpy(name,start,length);
+		name[length] = 0;
+		n = hash_table_lookup(n->children,name);
+		p = start+length;
+	}
+
+	for(e=mount_patterns;e;e=e->next) {
+		mount_candidates[count++] = e;
+	}
+
+	if(count>1) qsort(mount_candidates,count,sizeof(*mount_candidates),compare_priority);
+
+	return count;
+}
+
+static void resolve_cache_unlink( struct resolve_cache_entry *c )
+{
+	if(c->prev) c->prev->next = c->next; else resolve_cache_head = c->next;
+	if(c->next) c->next->prev = c->prev; else resolve_cache_tail = c->prev;
+	c->prev = c->next = 0;
+}
+
+static void resolve_cache_push( struct resolve_cache_entry *c )
+{
+	c->prev = 0;
+	c->next = resolve_cache_head;
+	if(resolve_cache_head) resolve_cache_head->prev = c;
+	resolve_cache_head = c;
+	if(!resolve_cache_tail) resolve_cache_tail = c;
+}
+
+static const char * resolve_cache_lookup( const char *logical_name )
+{
+	struct resolve_cache_entry *c;
+
+	if(!resolve_cache) return 0;
+
+	c = hash_table_lookup(resolve_cache,logical_name);
+	if(c) {
+		resolve_cache_hits++;
+		if(c!=resolve_cache_head) {
+			resolve_cache_unlink(c);
+			resolve_cache_push(c);
+		}
+		return c->physical_name;
+	} else {
+		resolve_cache_misses++;
+		return 0;
+	}
+}
+
+static void resolve_cache_insert( const char *logical_name, const char *physical_name )
+{
+	struct resolve_cache_entry *c;
+
+	if(resolve_cache_max<=0) return;
 
 	if(!resolve_cache) resolve_cache = hash_table_create(0,0);
 
-	t = hash_table_lookup(resolve_cache,logical_name);
+	if(hash_table_lookup(resolve_cache,logical_name)) return;
+
+	while(resolve_cache_size>=resolve_cache_max) {
+		c = resolve_cache_tail;
+		resolve_cache_unlink(c);
+		hash_table_remove(resolve_cache,c->logical_name);
+		free(c->logical_name);
+		free(c->physical_name);
+		free(c);
+		resolve_cache_size--;
+		resolve_cache_evictions++;
+	}
+
+	c = xxmalloc(sizeof(*c));
+	c->logical_name = xxstrdup(logical_name);
+	c->physical_name = xxstrdup(physical_name);
+	hash_table_insert(resolve_cache,logical_name,c);
+	resolve_cache_push(c);
+	resolve_cache_size++;
+}
+
+void pfs_resolve_cache_config( int size )
+{
+	resolve_cache_max = size;
+	debug(D_RESOLVE,"resolve cache size is %d",size);
+}
+
+void pfs_resolve_cache_stats( FILE *file )
+{
+	fprintf(file,"%" PRId64 " resolve cache hits\n",resolve_cache_hits);
+	fprintf(file,"%" PRId64 " resolve cache misses\n",resolve_cache_misses);
+	fprintf(file,"%" PRId64 " resolve cache evictions\n",resolve_cache_evictions);
+}
+
+pfs_resolve_t pfs_resolve( const char *logical_name, char *physical_name, time_t stoptime )
+{
+	pfs_resolve_t result = PFS_RESOLVE_UNCHANGED;
+	const char *t;
+	int i, count;
+
+	t = resolve_cache_lookup(logical_name);
 	if(t) {
 		strcpy(physical_name,t);
 		result = PFS_RESOLVE_CHANGED;
-	} else {
-		for(e=mount_list;e;e=e->next) {
+	} else if(mount_count>0) {
+		count = mount_candidates_find(logical_name);
+		for(i=0;i<count;i++) {
+			struct mount_entry *e = mount_candidates[i];
 			result = mount_entry_check(logical_name,e->prefix,e->redirect,physical_name);
 			if(result!=PFS_RESOLVE_UNCHANGED) break;
 		}
@@ -278,12 +514,8 @@ pfs_resolve_t pfs_resolve( const char *logical_name, char *physical_name, time_t
 
 	if(result==PFS_RESOLVE_UNCHANGED || result==PFS_RESOLVE_CHANGED) {
 		debug(D_RESOLVE,"%s = %s",logical_name,physical_name);
-		if(!hash_table_lookup(resolve_cache,logical_name)) {
-			hash_table_insert(resolve_cache,logical_name,xxstrdup(physical_name));
-		}
+		resolve_cache_insert(logical_name,physical_name);
 	}
 
 	return result;
 }
-
-
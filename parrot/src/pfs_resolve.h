@@ -8,6 +8,7 @@ See the file COPYING for details.
 #ifndef PFS_RESOLVE
 #define PFS_RESOLVE
 
+#include <stdio.h>
 #include <time.h>
 
 typedef enum {
@@ -20,6 +21,8 @@ typedef enum {
 
 void pfs_resolve_file_config( const char *mountfile );
 void pfs_resolve_manual_config( const char *string );
+void pfs_resolve_cache_config( int size );
+void pfs_resolve_cache_stats( FILE *file );
 
 pfs_resolve_t pfs_resolve( const char *logical_name, char *physical_name, time_t stoptime );
 
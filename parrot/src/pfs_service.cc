@@ -14,6 +14,8 @@ See the file COPYING for details.
 extern "C" {
 #include "chirp_reli.h"
 #include "hash_table.h"
+#include "list.h"
+#include "debug.h"
 #include "stringtools.h"
 }
 
@@ -485,11 +487,85 @@ void pfs_service_emulate_stat( pfs_name *name, struct pfs_stat *buf )
 	buf->st_blksize = default_block_size;
 }
 
+/*
+Services that use connect and disconnect keep a pool of idle
+connections for each host and port.  A connection is taken from
+the pool while in use, and returned to it afterwards, so that
+several open files on the same server each hold a connection of
+their own, and keep it for later use.  The most recently used
+connection is reused first.  Connections that have been idle for
+too long are discarded, and those idle for a little while are
+checked with the service before being handed out again.
+*/
+
+struct pfs_cxn_idle {
+	void *cxn;
+	time_t last_used;
+};
+
+#define PFS_CXN_POOL_SIZE_DEFAULT 4
+#define PFS_CXN_POOL_TIMEOUT_DEFAULT 300
+#define PFS_CXN_POOL_CHECK_INTERVAL 15
+
 static struct hash_table *table = 0;
+static int pool_size = PFS_CXN_POOL_SIZE_DEFAULT;
+static int pool_timeout = PFS_CXN_POOL_TIMEOUT_DEFAULT;
 
-void * pfs_service_connect_cache( pfs_name *name )
+void pfs_service_set_pool_size( int size )
+{
+	pool_size = size;
+}
+
+void pfs_service_set_pool_timeout( int timeout )
+{
+	pool_timeout = timeout;
+}
+
+int pfs_service::check_connection( pfs_name *name, void *cxn )
+{
+	return 1;
+}
+
+static struct list * pool_lookup( pfs_name *name )
 {
 	char key[PFS_PATH_MAX];
+	struct list *pool;
+
+	if(!table) table = hash_table_create(0,0);
+
+	sprintf(key,"/%s/%s:%d",name->service_name,name->host,name->port);
+	pool = (struct list *) hash_table_lookup(table,key);
+	if(!pool) {
+		pool = list_create();
+		hash_table_insert(table,key,pool);
+	}
+
+	return pool;
+}
+
+/*
+Idle connections are ordered from most to least recently used,
+so the expired ones are always found at the tail of the pool.
+*/
+
+static void pool_expire( pfs_name *name, struct list *pool, time_t now )
+{
+	struct pfs_cxn_idle *idle;
+
+	while((idle = (struct pfs_cxn_idle *) list_peek_tail(pool))) {
+		if((now-idle->last_used)<pool_timeout) break;
+		list_pop_tail(pool);
+		debug(D_DEBUG,"closing idle connection to %s:%d",name->host,name->port);
+		name->service->disconnect(name,idle->cxn);
+		free(idle);
+	}
+}
+
+void * pfs_service_connect_cache( pfs_name *name )
+{
+	struct list *pool;
+	struct pfs_cxn_idle *idle;
+	time_t now;
 	void *cxn;
 
 	if(!name->host[0]) {
@@ -497,12 +573,21 @@ void * pfs_service_connect_cache( pfs_name *name )
 		return 0;
 	}
 
-	if(!table) table = hash_table_create(0,0);
+	pool = pool_lookup(name);
+	now = time(0);
+
+	pool_expire(name,pool,now);
 
-	if(table) {
-		sprintf(key,"/%s/%s:%d",name->service_name,name->host,name->port);
-		cxn = hash_table_remove(table,key);
-		if(cxn) return cxn;
+	while((idle = (struct pfs_cxn_idle *) list_pop_head(pool))) {
+		cxn = idle->cxn;
+		if((now-idle->last_used)>=PFS_CXN_POOL_CHECK_INTERVAL && !name->service->check_connection(name,cxn)) {
+			debug(D_DEBUG,"idle connection to %s:%d failed check",name->host,name->port);
+			name->service->disconnect(name,cxn);
+			free(idle);
+			continue;
+		}
+		free(idle);
+		return cxn;
 	}
 
 	return name->service->connect(name);
@@ -510,22 +595,26 @@ void * pfs_service_connect_cache( pfs_name *name )
 
 void pfs_service_disconnect_cache( pfs_name *name, void *cxn, int invalidate )
 {
-	char key[PFS_PATH_MAX];
+	struct list *pool;
+	struct pfs_cxn_idle *idle;
 	int save_errno = errno;
 
-	if(!table) table = hash_table_create(0,0);
+	pool = pool_lookup(name);
 
-	if(table && !invalidate) {
-		sprintf(key,"/%s/%s:%d",name->service_name,name->host,name->port);
-		if(hash_table_lookup(table,key)) {
-			name->service->disconnect(name,cxn);
+	if(!invalidate && list_size(pool)<pool_size) {
+		idle = (struct pfs_cxn_idle *) malloc(sizeof(*idle));
+		if(idle) {
+			idle->cxn = cxn;
+			idle->last_used = time(0);
+			list_push_head(pool,idle);
 		} else {
-			hash_table_insert(table,key,cxn);
+			name->service->disconnect(name,cxn);
 		}
 	} else {
 		name->service->disconnect(name,cxn);
 	}
 
+	pool_expire(name,pool,time(0));
+
 	errno = save_errno;
 }
-
@@ -21,6 +21,7 @@ public:
 
 	virtual void * connect( pfs_name *name );
 	virtual void disconnect( pfs_name *name, void *cxn );
+	virtual int check_connection( pfs_name *name, void *cxn );
 	virtual int get_default_port();
 	virtual int get_block_size();
 	virtual int tilde_is_special();
@@ -86,6 +87,9 @@ void pfs_service_emulate_stat( pfs_name *name, struct pfs_stat *buf );
 void pfs_service_set_block_size( int bs );
 int  pfs_service_get_block_size();
 
+void pfs_service_set_pool_size( int size );
+void pfs_service_set_pool_timeout( int timeout );
+
 void * pfs_service_connect_cache( pfs_name *name );
 void pfs_service_disconnect_cache( pfs_name *name, void *cxn, int invalidate );
 
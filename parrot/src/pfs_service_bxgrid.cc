@@ -542,6 +542,10 @@ public:
 		mysql_close((MYSQL *)cxn);
 	}
 
+	virtual int check_connection( pfs_name *name, void *cxn ) {
+		return mysql_ping((MYSQL *)cxn)==0;
+	}
+
 	virtual pfs_dir *getdir( pfs_name *name ) {
 		pfs_dir *result = 0;
 		MYSQL *mysql_cxn = (MYSQL *)pfs_service_connect_cache(name);
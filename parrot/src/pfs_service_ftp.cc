@@ -127,6 +127,10 @@ public:
 		ftp_lite_close((struct ftp_lite_server*)cxn);
 	}
 
+	virtual int check_connection( pfs_name *name, void *cxn ) {
+		return ftp_lite_nop((struct ftp_lite_server*)cxn);
+	}
+
 	virtual int get_default_port() {
 		if(type==GLOBUS_GSS) {
 			return FTP_LITE_GSS_DEFAULT_PORT;
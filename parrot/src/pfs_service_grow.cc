@@ -24,8 +24,10 @@ All metadata requests and directory lookups are handled using this
 data structure.
 
 To access a file, GROW issues an HTTP request and reads the data
-sequentially into the pfs_file_cache.  A checksum is computed
-incrementally.  If the checksum does not match that in the directory
+sequentially into the pfs_file_cache.  Large files are fetched as
+several ranges in parallel by a pfs_prefetch, but are still delivered
+in order, so the checksum is computed incrementally as each range
+is consumed.  If the checksum does not match that in the directory
 listing, the directory cache is discarded, and the close() fails
 with EAGAIN, causing the pfs_file_cache to re-issue the open.
 This procedure is repeated with an exponentially repeating backoff
@@ -47,6 +49,7 @@ filesystem, which placed a listing in every single directory.)
 */
 
 #include "pfs_service.h"
+#include "pfs_prefetch.h"
 
 extern "C" {
 #include "debug.h"
@@ -568,21 +571,21 @@ struct grow_dirent * grow_dirent_lookup( pfs_name *name, int follow_links )
 class pfs_file_grow : public pfs_file
 {
 private:
-	struct link *link;
+	pfs_prefetch *prefetch;
 	pfs_stat info;
 	sha1_context_t context;
 
 public:
-	pfs_file_grow( pfs_name *n, struct link *l, struct grow_dirent *d ) : pfs_file(n) {
-		link = l;
+	pfs_file_grow( pfs_name *n, const char *url, struct link *l, struct grow_dirent *d ) : pfs_file(n) {
 		grow_dirent_to_stat(d,&info);
+		prefetch = new pfs_prefetch(url,l,info.st_size,pfs_http_streams,1);
 		if(pfs_checksum_files) {
 			sha1_init(&context);
 		}
 	}
 
 	virtual int close() {
-		link_close(link);
+		delete prefetch;
 
 		struct grow_dirent *d;
 		d = grow_dirent_lookup(&name,1);
@@ -612,7 +615,7 @@ public:
 
 	virtual pfs_ssize_t read( void *d, pfs_size_t length, pfs_off_t offset ) {
 		pfs_ssize_t actual;
-		actual = link_read(link,(char*)d,length,LINK_FOREVER);
+		actual = prefetch->read(d,length,offset);
 		if(pfs_checksum_files && actual>0) sha1_update(&context,(unsigned char *)d,actual);
 		return actual;
 	}
@@ -660,7 +663,7 @@ public:
 		struct link *link = http_query_no_cache(url,"GET",time(0)+pfs_master_timeout);
 		if(link) {
 			debug(D_GROW,"open %s",url);
-			return new pfs_file_grow(name,link,d);
+			return new pfs_file_grow(name,url,link,d);
 		} else {
 			debug(D_GROW,"failed to open %s",url);
 			return 0;
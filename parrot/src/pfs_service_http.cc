@@ -6,6 +6,7 @@ See the file COPYING for details.
 */
 
 #include "pfs_service.h"
+#include "pfs_prefetch.h"
 
 extern "C" {
 #include "debug.h"
@@ -32,10 +33,8 @@ extern "C" {
 
 extern int pfs_master_timeout;
 
-static struct link * http_fetch( pfs_name *name, const char *action, INT64_T *size )
+static struct link * http_fetch( pfs_name *name, const char *action, INT64_T *size, char *url )
 {
-	char url[HTTP_LINE_MAX];
-
 	if(!name->host[0]) {
 		errno = ENOENT;
 		return 0;
@@ -45,25 +44,36 @@ static struct link * http_fetch( pfs_name *name, const char *action, INT64_T *si
 	return http_query_size(url,action,size,time(0)+pfs_master_timeout,0);
 }
 
+/*
+Reads are served through a pfs_prefetch, which fetches ranges of
+the object on demand, so an open http file may be read at any
+offset.  The service itself is still reported as non-seekable,
+so that by default whole objects are copied into the file cache.
+*/
+
 class pfs_file_http : public pfs_file
 {
 private:
-	struct link *link;
+	pfs_prefetch *prefetch;
 	INT64_T size;
 
 public:
-	pfs_file_http( pfs_name *n, struct link *l, INT64_T s ) : pfs_file(n) {
-		link = l;
+	pfs_file_http( pfs_name *n, const char *url, struct link *l, INT64_T s ) : pfs_file(n) {
+		prefetch = new pfs_prefetch(url,l,s,pfs_http_streams,0);
 		size = s;
 	}
 
 	virtual int close() {
-		link_close(link);
+		delete prefetch;
 		return 0;
 	}
 
 	virtual pfs_ssize_t read( void *d, pfs_size_t length, pfs_off_t offset ) {
-		return link_read(link,(char*)d,length,LINK_FOREVER);
+		return prefetch->read(d,length,offset);
+	}
+
+	virtual int is_seekable() {
+		return 1;
 	}
 
 	virtual int fstat( struct pfs_stat *buf ) {
@@ -88,15 +98,16 @@ public:
 	virtual pfs_file * open( pfs_name *name, int flags, mode_t mode ) {
 		struct link *link;
 		INT64_T size;
+		char url[HTTP_LINE_MAX];
 
 		if((flags&O_ACCMODE)!=O_RDONLY) {
 			errno = EROFS;
 			return 0;
 		}
  
-		link = http_fetch(name,"GET",&size);
+		link = http_fetch(name,"GET",&size,url);
 		if(link) {
-			return new pfs_file_http(name,link,size);
+			return new pfs_file_http(name,url,link,size);
 		} else {
 			return 0;
 		}
@@ -105,8 +116,9 @@ public:
 	virtual int stat( pfs_name *name, struct pfs_stat *buf ) {
 		struct link *link;
 		INT64_T size;
+		char url[HTTP_LINE_MAX];
 
-		link = http_fetch(name,"HEAD",&size);
+		link = http_fetch(name,"HEAD",&size,url);
 		if(link) {
 			link_close(link);
 			pfs_service_emulate_stat(name,buf);
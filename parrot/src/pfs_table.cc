@@ -17,6 +17,8 @@ See the file COPYING for details.
 #include "pfs_mmap.h"
 #include "pfs_process.h"
 #include "pfs_file_cache.h"
+#include "pfs_mdcache.h"
+#include "pfs_profile.h"
 
 extern "C" {
 #include "debug.h"
@@ -222,7 +224,7 @@ void pfs_table::follow_symlink( struct pfs_name *pname, int depth )
 	char *name_to_resolve = link_target;
 	struct pfs_name new_pname = *pname;
 
-	int rlres = new_pname.service->readlink(pname,link_target,PFS_PATH_MAX-1);
+	int rlres = pfs_mdcache_readlink(pname,link_target,PFS_PATH_MAX-1);
 	if (rlres > 0) {
 		/* readlink does not NULL-terminate */
 		link_target[rlres] = '\000';
@@ -290,7 +292,9 @@ int pfs_table::resolve_name( const char *cname, struct pfs_name *pname, bool do_
 			strcpy(pname->hostport,"localhost");
 			strcpy(pname->rest,pname->path);
 			pname->is_local = 1;
+			pfs_profile_service(pname->service_name);
 		} else {
+			pfs_profile_service(pname->service_name);
 			if(!strcmp(pname->service_name,"multi")) {// if we're dealing with a multivolume, split off at the @
 				string_split_multipath(tmp,pname->host,pname->rest);
 			} else {
@@ -355,8 +359,12 @@ pfs_file * pfs_table::open_object( const char *lname, int flags, mode_t mode, in
 	}
 
 	if(resolve_name(lname,&pname)) {
+		if(flags&O_ACCMODE || flags&(O_CREAT|O_TRUNC)) {
+			pfs_mdcache_invalidate(&pname);
+		}
+
 		if(flags&O_DIRECTORY) {
-			file = pname.service->getdir(&pname);
+			file = pfs_mdcache_getdir(&pname);
 		} else if(pname.service->is_local()) {
 			file = pname.service->open(&pname,flags,mode);
 		} else if(pname.service->is_seekable()) {
@@ -679,6 +687,9 @@ int pfs_table::close( int fd )
 
 		if(f->refs()==1) {
 			result = f->close();
+			// A stat taken while the file was being written
+			// may have cached a size that is now out of date.
+			if(p->flags&O_ACCMODE) pfs_mdcache_invalidate(f->get_name());
 			delete f;
 		} else {
 			f->delref();
@@ -751,6 +762,7 @@ pfs_ssize_t pfs_table::pread( int fd, void *data, pfs_size_t nbyte, pfs_off_t of
 		result = 0;
 	} else {
 		pfs_file *f = pointers[fd]->file;
+		pfs_profile_service(f->get_name()->service_name);
 		if(!f->is_seekable() && f->get_last_offset()!=offset) {
 			stream_warning(f);
 			errno = ESPIPE;
@@ -778,6 +790,7 @@ pfs_ssize_t pfs_table::pwrite( int fd, const void *data, pfs_size_t nbyte, pfs_o
 		result = 0;
 	} else {
 		pfs_file *f = pointers[fd]->file;
+		pfs_profile_service(f->get_name()->service_name);
 		if(!f->is_seekable() && f->get_last_offset()!=offset) {
 			stream_warning(f);
 			errno = ESPIPE;
@@ -1214,6 +1227,7 @@ int pfs_table::chmod( const char *n, mode_t mode )
 
 	if(resolve_name(n,&pname)) {
 		result = pname.service->chmod(&pname,mode);
+		if(result==0) pfs_mdcache_invalidate(&pname);
 	}
 
 	return result;
@@ -1226,6 +1240,7 @@ int pfs_table::chown( const char *n, uid_t uid, gid_t gid )
 
 	if(resolve_name(n,&pname)) {
 		result = pname.service->chown(&pname,uid,gid);
+		if(result==0) pfs_mdcache_invalidate(&pname);
 	}
 
 	/*
@@ -1247,6 +1262,7 @@ int pfs_table::lchown( const char *n, uid_t uid, gid_t gid )
 
 	if(resolve_name(n,&pname,false)) {
 		result = pname.service->lchown(&pname,uid,gid);
+		if(result==0) pfs_mdcache_invalidate(&pname);
 	}
 
 	return result;
@@ -1259,6 +1275,7 @@ int pfs_table::truncate( const char *n, pfs_off_t offset )
 
 	if(resolve_name(n,&pname)) {
 		result = pname.service->truncate(&pname,offset);
+		if(result==0) pfs_mdcache_invalidate(&pname);
 	}
 
 	return result;
@@ -1423,6 +1440,7 @@ int pfs_table::utime( const char *n, struct utimbuf *buf )
 
 	if(resolve_name(n,&pname)) {
 		result = pname.service->utime(&pname,buf);
+		if(result==0) pfs_mdcache_invalidate(&pname);
 	}
 
 	return result;
@@ -1435,7 +1453,10 @@ int pfs_table::unlink( const char *n )
 
 	if(resolve_name(n,&pname,false)) {
 		result = pname.service->unlink(&pname);
-		if(result==0) pfs_cache_invalidate(&pname);
+		if(result==0) {
+			pfs_cache_invalidate(&pname);
+			pfs_mdcache_invalidate(&pname);
+		}
 	}
 
 	return result;
@@ -1447,7 +1468,7 @@ int pfs_table::stat( const char *n, struct pfs_stat *b )
 	int result = -1;
 
 	if(resolve_name(n,&pname)) {
-		result = pname.service->stat(&pname,b);
+		result = pfs_mdcache_stat(&pname,b);
 		if(result>=0) {
 			b->st_blksize = pname.service->get_block_size();
 		} else if(errno==ENOENT && !pname.hostport[0]) {
@@ -1478,7 +1499,7 @@ int pfs_table::lstat( const char *n, struct pfs_stat *b )
 	int result=-1;
 
 	if(resolve_name(n,&pname,false)) {
-		result = pname.service->lstat(&pname,b);
+		result = pfs_mdcache_lstat(&pname,b);
 		if(result>=0) {
 			b->st_blksize = pname.service->get_block_size();
 		} else if(errno==ENOENT && !pname.hostport[0]) {
@@ -1502,6 +1523,8 @@ int pfs_table::rename( const char *n1, const char *n2 )
 			if(result==0) {
 				pfs_cache_invalidate(&p1);
 				pfs_cache_invalidate(&p2);
+				pfs_mdcache_invalidate(&p1);
+				pfs_mdcache_invalidate(&p2);
 			}
 		} else {
 			errno = EXDEV;
@@ -1519,6 +1542,7 @@ int pfs_table::link( const char *n1, const char *n2 )
 	if(resolve_name(n1,&p1,false) && resolve_name(n2,&p2,false)) {
 		if(p1.service==p2.service) {
 			result = p1.service->link(&p1,&p2);
+			if(result==0) pfs_mdcache_invalidate(&p2);
 		} else {
 			errno = EXDEV;
 		}
@@ -1543,6 +1567,7 @@ int pfs_table::symlink( const char *n1, const char *n2 )
 
 	if(resolve_name(n2,&pname,false)) {
 		result = pname.service->symlink(n1,&pname);
+		if(result==0) pfs_mdcache_invalidate(&pname);
 	}
 
 	return result;
@@ -1586,11 +1611,11 @@ int pfs_table::readlink( const char *n, char *buf, pfs_size_t size )
 				strncpy(buf,target->name,size);
 				result = MIN(size,(pfs_size_t)strlen(target->name));
 			} else {
-				result = pname.service->readlink(&pname,buf,size);
+				result = pfs_mdcache_readlink(&pname,buf,size);
 			}
 
 		} else {
-			result = pname.service->readlink(&pname,buf,size);
+			result = pfs_mdcache_readlink(&pname,buf,size);
 		}
 	} else {
 		result = -1;
@@ -1607,6 +1632,7 @@ int pfs_table::mknod( const char *n, mode_t mode, dev_t dev )
 
 	if(resolve_name(n,&pname)) {
 		result = pname.service->mknod(&pname,mode,dev);
+		if(result==0) pfs_mdcache_invalidate(&pname);
 	}
 
 	return result;
@@ -1619,6 +1645,7 @@ int pfs_table::mkdir( const char *n, mode_t mode )
 
 	if(resolve_name(n,&pname)) {
 		result = pname.service->mkdir(&pname,mode);
+		if(result==0) pfs_mdcache_invalidate(&pname);
 	}
 
 	return result;
@@ -1631,6 +1658,7 @@ int pfs_table::rmdir( const char *n )
 
 	if(resolve_name(n,&pname,false)) {
 		result = pname.service->rmdir(&pname);
+		if(result==0) pfs_mdcache_invalidate(&pname);
 	}
 
 	return result;
@@ -15,18 +15,29 @@ See the file COPYING for details.
 #include "macros.h"
 #include "matrix.h"
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define ALIGN_X86
+#include <immintrin.h>
+#endif
+
 #define TRACEBACK_LEFT '-'
 #define TRACEBACK_UP   '|'
 #define TRACEBACK_DIAG '\\'
 #define TRACEBACK_END  'X'
 
+// A score low enough that no alignment ever passes through it.
+#define SCORE_OUTSIDE (SHRT_MIN + 100)
+
 // XXX need to pass these in all the way from the beginning
 static const int score_match = 2;
 static const int score_mismatch = -1;
 static const int score_gap = -1;
 
-static void choose_best(struct matrix *m, int * i, int * j, int istart, int iend, int jstart, int jend );
-static struct alignment * alignment_traceback(struct matrix *m, int i, int j, const char *a, const char *b );
+static const char traceback_names[4] = { TRACEBACK_DIAG, TRACEBACK_LEFT, TRACEBACK_UP, TRACEBACK_END };
+
+static int choose_best(struct matrix *m, int * i, int * j, int istart, int iend, int jstart, int jend, const int *start, int *best );
+static struct alignment * alignment_summary(struct matrix *m, int i, int j, const int *carry );
+static struct alignment * alignment_traceback(struct matrix *m, int i, int j, int score, const char *a, const char *b );
 
 /*
 CAREFUL HERE:
@@ -34,187 +45,607 @@ The matrix indexes are [0:width] and [0:height], inclusive.
 The 0th row and column of the matrix are used for initialization values.
 BUT, the string indexes are [0:length), and are set one off from the matrix.
 So, note that the value of matrix[i][j] evaluates string values a[i-1] and b[j-1].
+
+The matrix is swept out one anti-diagonal at a time: every cell (i,j)
+with i+j=d depends only on cells of the diagonals d-1 and d-2, so all
+the cells of a diagonal can be computed at once, in the lanes of a
+vector register.  The scores of a diagonal are kept in an array indexed
+by i+1, so that the cell (i-1,j) to the left and the cell (i,j-1) above
+are consecutive in the previous diagonal, and the cell (i-1,j-1) is at
+the same place in the one before it.  The second sequence is copied
+backwards, so that b[j-1] for consecutive cells is also consecutive.
+
+A kernel computes n consecutive cells of a diagonal d, starting at cell i,
+from the scores of the two previous diagonals (prev and prev2) and the
+bases of both sequences, stores their scores in h and their directions in
+traceback, and returns the highest score if it is a Smith-Waterman alignment.
+The kernels may read and write up to MATRIX_LANES cells past the end.
+
+For a score only matrix, traceback is null, and the other planes of the
+diagonals, stride shorts apart, carry the start of the path into each
+cell and its count of gaps along with the score.
+
+Every kernel breaks ties exactly as the scalar one does: the diagonal
+first, then the left, then above.
+*/
+
+typedef int (*align_kernel_t)( short *h, const short *prev, const short *prev2, const char *a, const char *b, int n, int is_smith_waterman, unsigned char *traceback, int stride, int i, int d );
+
+static int align_kernel_scalar( short *h, const short *prev, const short *prev2, const char *a, const char *b, int n, int is_smith_waterman, unsigned char *traceback, int stride, int i, int d )
+{
+	int best = SHRT_MIN;
+	int c, p;
+
+	if(traceback) memset(traceback,0,(n+3)/4);
+
+	for(c=0;c<n;c++) {
+
+		// Compute the score from the diagonal.
+		int score = prev2[c] + ((a[c]==b[c]) ? score_match : score_mismatch);
+		int dir = MATRIX_TRACEBACK_DIAG;
+
+		// Compute the score from the left, and accept if greater.
+		int leftscore = prev[c] + score_gap;
+		if(leftscore>score) {
+			score = leftscore;
+			dir = MATRIX_TRACEBACK_LEFT;
+		}
+
+		// Compute the score from above, and accept if greater.
+		int upscore = prev[c+1] + score_gap;
+		if(upscore>score) {
+			score = upscore;
+			dir = MATRIX_TRACEBACK_UP;
+		}
+
+		// Smith-Waterman alignments can never go below zero.
+		// A zero will stop the traceback at that spot.
+
+		if(is_smith_waterman) {
+			if(score<0) {
+				score = 0;
+				dir = MATRIX_TRACEBACK_END;
+			}
+		}
+
+		h[c] = score;
+		if(score>best) best = score;
+
+		if(traceback) traceback[c/4] |= dir << (2*(c%4));
+
+		if(stride) {
+			const short *from;
+
+			if(dir==MATRIX_TRACEBACK_DIAG) {
+				from = prev2 + c;
+			} else if(dir==MATRIX_TRACEBACK_LEFT) {
+				from = prev + c;
+			} else if(dir==MATRIX_TRACEBACK_UP) {
+				from = prev + c + 1;
+			} else {
+				from = 0;
+			}
+
+			for(p=MATRIX_PLANE_START_I;p<MATRIX_PLANES;p++) {
+				h[c+p*stride] = from ? from[p*stride] : 0;
+			}
+
+			if(!from) {
+				h[c+MATRIX_PLANE_START_I*stride] = i + c;
+				h[c+MATRIX_PLANE_START_J*stride] = d - i - c;
+			} else if(dir!=MATRIX_TRACEBACK_DIAG) {
+				h[c+MATRIX_PLANE_GAPS*stride]++;
+			}
+		}
+	}
+
+	return best;
+}
+
+#ifdef ALIGN_X86
+
+/*
+spread[x] has the eight bits of x at the even bit positions, so that
+the low and high bits of eight directions, gathered from the lanes
+with movemask, can be interleaved into two bits per cell.
 */
 
-static inline struct cell score_cell( struct matrix *m, int i, int j, const char *a, const char *b, int is_smith_waterman )
+static unsigned short spread[256];
+
+static void spread_init()
 {
-	struct cell result;
-
-	// Compute the score from the diagonal.
-	int diagscore = matrix(m,i-1,j-1).score + ((a[i-1]==b[j-1]) ? score_match : score_mismatch);
-	result.score = diagscore;
-	result.traceback = TRACEBACK_DIAG;
-
-	// Compute the score from the left, and accept if greater.
-	int leftscore = matrix(m,i-1,j).score + score_gap;
-	if(leftscore>result.score) {
-		result.score = leftscore;
-		result.traceback = TRACEBACK_LEFT;
+	int x, k;
+	for(x=0;x<256;x++) {
+		spread[x] = 0;
+		for(k=0;k<8;k++) {
+			if(x & (1<<k)) spread[x] |= 1 << (2*k);
+		}
 	}
+}
+
+/*
+Choose each lane from the diagonal, the left, or above, as the score did.
+Where a Smith-Waterman path ends, the kernels replace the choice with
+the values of the cell itself.
+*/
+
+__attribute__((target("sse2")))
+static inline __m128i carry_sse2( const short *prev, const short *prev2, __m128i isleft, __m128i isup )
+{
+	__m128i x = _mm_loadu_si128((const __m128i *)prev2);
+	x = _mm_or_si128(_mm_andnot_si128(isleft,x),_mm_and_si128(isleft,_mm_loadu_si128((const __m128i *)prev)));
+	return _mm_or_si128(_mm_andnot_si128(isup,x),_mm_and_si128(isup,_mm_loadu_si128((const __m128i *)(prev+1))));
+}
+
+__attribute__((target("sse2")))
+static int align_kernel_sse2( short *h, const short *prev, const short *prev2, const char *a, const char *b, int n, int is_smith_waterman, unsigned char *traceback, int stride, int i, int d )
+{
+	const __m128i match = _mm_set1_epi16(score_match);
+	const __m128i mismatch = _mm_set1_epi16(score_mismatch);
+	const __m128i gap = _mm_set1_epi16(score_gap);
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i one = _mm_set1_epi16(1);
+	const __m128i left = _mm_set1_epi16(MATRIX_TRACEBACK_LEFT);
+	const __m128i up = _mm_set1_epi16(MATRIX_TRACEBACK_UP);
+	const __m128i end = _mm_set1_epi16(MATRIX_TRACEBACK_END);
+	const __m128i lanes = _mm_setr_epi16(0,1,2,3,4,5,6,7);
+	__m128i best = _mm_set1_epi16(SHRT_MIN);
+	int c;
+
+	for(c=0;c<n;c+=8) {
+		__m128i same = _mm_cmpeq_epi8(_mm_loadl_epi64((const __m128i *)(a+c)),_mm_loadl_epi64((const __m128i *)(b+c)));
+		same = _mm_unpacklo_epi8(same,same);
+
+		__m128i score = _mm_adds_epi16(_mm_loadu_si128((const __m128i *)(prev2+c)),_mm_or_si128(_mm_and_si128(same,match),_mm_andnot_si128(same,mismatch)));
+		__m128i leftscore = _mm_adds_epi16(_mm_loadu_si128((const __m128i *)(prev+c)),gap);
+		__m128i upscore = _mm_adds_epi16(_mm_loadu_si128((const __m128i *)(prev+c+1)),gap);
+
+		__m128i isleft = _mm_cmpgt_epi16(leftscore,score);
+		score = _mm_max_epi16(score,leftscore);
+
+		__m128i isup = _mm_cmpgt_epi16(upscore,score);
+		score = _mm_max_epi16(score,upscore);
+		isleft = _mm_andnot_si128(isup,isleft);
+
+		__m128i isend = zero;
+		if(is_smith_waterman) {
+			isend = _mm_cmpgt_epi16(zero,score);
+			score = _mm_max_epi16(score,zero);
+
+			// Lanes past the end hold garbage, so they count as zero, which is never better.
+			__m128i valid = _mm_cmpgt_epi16(_mm_set1_epi16(n-c),lanes);
+			best = _mm_max_epi16(best,_mm_and_si128(score,valid));
+		}
+
+		_mm_storeu_si128((__m128i *)(h+c),score);
 
-	// Compute the score from above, and accept if greater.
-	int upscore = matrix(m,i,j-1).score + score_gap;
-	if(upscore>result.score) {
-		result.score = upscore;
-		result.traceback = TRACEBACK_UP;
+		if(traceback) {
+			__m128i dir = _mm_or_si128(_mm_or_si128(_mm_and_si128(isleft,left),_mm_and_si128(isup,up)),_mm_and_si128(isend,end));
+			int bits = _mm_movemask_epi8(_mm_packs_epi16(_mm_slli_epi16(dir,15),_mm_slli_epi16(dir,14)));
+			unsigned short packed = spread[bits&0xff] | (spread[(bits>>8)&0xff]<<1);
+			memcpy(traceback+c/4,&packed,sizeof(packed));
+		}
+
+		if(stride) {
+			__m128i isgap = _mm_or_si128(isleft,isup);
+			__m128i cells = _mm_add_epi16(_mm_set1_epi16(i+c),lanes);
+			__m128i x;
+
+			x = carry_sse2(prev+c+MATRIX_PLANE_START_I*stride,prev2+c+MATRIX_PLANE_START_I*stride,isleft,isup);
+			if(is_smith_waterman) x = _mm_or_si128(_mm_andnot_si128(isend,x),_mm_and_si128(isend,cells));
+			_mm_storeu_si128((__m128i *)(h+c+MATRIX_PLANE_START_I*stride),x);
+
+			x = carry_sse2(prev+c+MATRIX_PLANE_START_J*stride,prev2+c+MATRIX_PLANE_START_J*stride,isleft,isup);
+			if(is_smith_waterman) x = _mm_or_si128(_mm_andnot_si128(isend,x),_mm_and_si128(isend,_mm_sub_epi16(_mm_set1_epi16(d),cells)));
+			_mm_storeu_si128((__m128i *)(h+c+MATRIX_PLANE_START_J*stride),x);
+
+			x = carry_sse2(prev+c+MATRIX_PLANE_GAPS*stride,prev2+c+MATRIX_PLANE_GAPS*stride,isleft,isup);
+			x = _mm_andnot_si128(isend,_mm_add_epi16(x,_mm_and_si128(isgap,one)));
+			_mm_storeu_si128((__m128i *)(h+c+MATRIX_PLANE_GAPS*stride),x);
+
+		}
 	}
 
-	// Smith-Waterman alignments can never go below zero.
-	// A zero will stop the traceback at that spot.
+	best = _mm_max_epi16(best,_mm_srli_si128(best,8));
+	best = _mm_max_epi16(best,_mm_srli_si128(best,4));
+	best = _mm_max_epi16(best,_mm_srli_si128(best,2));
+
+	return (short) _mm_cvtsi128_si32(best);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i carry_avx2( const short *prev, const short *prev2, __m256i isleft, __m256i isup )
+{
+	__m256i x = _mm256_loadu_si256((const __m256i *)prev2);
+	x = _mm256_blendv_epi8(x,_mm256_loadu_si256((const __m256i *)prev),isleft);
+	return _mm256_blendv_epi8(x,_mm256_loadu_si256((const __m256i *)(prev+1)),isup);
+}
+
+__attribute__((target("avx2")))
+static int align_kernel_avx2( short *h, const short *prev, const short *prev2, const char *a, const char *b, int n, int is_smith_waterman, unsigned char *traceback, int stride, int i, int d )
+{
+	const __m256i match = _mm256_set1_epi16(score_match);
+	const __m256i mismatch = _mm256_set1_epi16(score_mismatch);
+	const __m256i gap = _mm256_set1_epi16(score_gap);
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i one = _mm256_set1_epi16(1);
+	const __m256i left = _mm256_set1_epi16(MATRIX_TRACEBACK_LEFT);
+	const __m256i up = _mm256_set1_epi16(MATRIX_TRACEBACK_UP);
+	const __m256i end = _mm256_set1_epi16(MATRIX_TRACEBACK_END);
+	const __m256i lanes = _mm256_setr_epi16(0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15);
+	__m256i best = _mm256_set1_epi16(SHRT_MIN);
+	int c;
+
+	for(c=0;c<n;c+=16) {
+		__m256i same = _mm256_cvtepi8_epi16(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(a+c)),_mm_loadu_si128((const __m128i *)(b+c))));
+
+		__m256i score = _mm256_adds_epi16(_mm256_loadu_si256((const __m256i *)(prev2+c)),_mm256_blendv_epi8(mismatch,match,same));
+		__m256i leftscore = _mm256_adds_epi16(_mm256_loadu_si256((const __m256i *)(prev+c)),gap);
+		__m256i upscore = _mm256_adds_epi16(_mm256_loadu_si256((const __m256i *)(prev+c+1)),gap);
+
+		__m256i isleft = _mm256_cmpgt_epi16(leftscore,score);
+		score = _mm256_max_epi16(score,leftscore);
+
+		__m256i isup = _mm256_cmpgt_epi16(upscore,score);
+		score = _mm256_max_epi16(score,upscore);
+		isleft = _mm256_andnot_si256(isup,isleft);
+
+		__m256i isend = zero;
+		if(is_smith_waterman) {
+			isend = _mm256_cmpgt_epi16(zero,score);
+			score = _mm256_max_epi16(score,zero);
+
+			__m256i valid = _mm256_cmpgt_epi16(_mm256_set1_epi16(n-c),lanes);
+			best = _mm256_max_epi16(best,_mm256_and_si256(score,valid));
+		}
+
+		_mm256_storeu_si256((__m256i *)(h+c),score);
+
+		if(traceback) {
+			__m256i dir = _mm256_or_si256(_mm256_or_si256(_mm256_and_si256(isleft,left),_mm256_and_si256(isup,up)),_mm256_and_si256(isend,end));
+
+			// The pack works within each half, so each half gives the low bits of eight lanes, then their high bits.
+			unsigned bits = _mm256_movemask_epi8(_mm256_packs_epi16(_mm256_slli_epi16(dir,15),_mm256_slli_epi16(dir,14)));
+			unsigned packed = spread[bits&0xff] | (spread[(bits>>8)&0xff]<<1) | ((unsigned)(spread[(bits>>16)&0xff] | (spread[(bits>>24)&0xff]<<1)) << 16);
+			memcpy(traceback+c/4,&packed,sizeof(packed));
+		}
+
+		if(stride) {
+			__m256i isgap = _mm256_or_si256(isleft,isup);
+			__m256i cells = _mm256_add_epi16(_mm256_set1_epi16(i+c),lanes);
+			__m256i x;
+
+			x = carry_avx2(prev+c+MATRIX_PLANE_START_I*stride,prev2+c+MATRIX_PLANE_START_I*stride,isleft,isup);
+			if(is_smith_waterman) x = _mm256_blendv_epi8(x,cells,isend);
+			_mm256_storeu_si256((__m256i *)(h+c+MATRIX_PLANE_START_I*stride),x);
+
+			x = carry_avx2(prev+c+MATRIX_PLANE_START_J*stride,prev2+c+MATRIX_PLANE_START_J*stride,isleft,isup);
+			if(is_smith_waterman) x = _mm256_blendv_epi8(x,_mm256_sub_epi16(_mm256_set1_epi16(d),cells),isend);
+			_mm256_storeu_si256((__m256i *)(h+c+MATRIX_PLANE_START_J*stride),x);
+
+			x = carry_avx2(prev+c+MATRIX_PLANE_GAPS*stride,prev2+c+MATRIX_PLANE_GAPS*stride,isleft,isup);
+			x = _mm256_andnot_si256(isend,_mm256_add_epi16(x,_mm256_and_si256(isgap,one)));
+			_mm256_storeu_si256((__m256i *)(h+c+MATRIX_PLANE_GAPS*stride),x);
 
-	if(is_smith_waterman) {
-		if(result.score<0) {
-			result.score = 0;
-			result.traceback = TRACEBACK_END;
 		}
 	}
 
-	return result;
+	__m128i half = _mm_max_epi16(_mm256_castsi256_si128(best),_mm256_extracti128_si256(best,1));
+	half = _mm_max_epi16(half,_mm_srli_si128(half,8));
+	half = _mm_max_epi16(half,_mm_srli_si128(half,4));
+	half = _mm_max_epi16(half,_mm_srli_si128(half,2));
+
+	return (short) _mm_cvtsi128_si32(half);
+}
+
+#endif
+
+static struct {
+	const char *name;
+	align_kernel_t kernel;
+} align_kernels[] = {
+#ifdef ALIGN_X86
+	{ "avx2", align_kernel_avx2 },
+	{ "sse2", align_kernel_sse2 },
+#endif
+	{ "scalar", align_kernel_scalar },
+	{ 0, 0 }
+};
+
+static int align_kernel_index = -1;
+
+static int align_kernel_supported( int index )
+{
+#ifdef ALIGN_X86
+	__builtin_cpu_init();
+	if(align_kernels[index].kernel==align_kernel_avx2) return __builtin_cpu_supports("avx2");
+	if(align_kernels[index].kernel==align_kernel_sse2) return __builtin_cpu_supports("sse2");
+#endif
+	return 1;
+}
+
+int align_set_kernel( const char *name )
+{
+	int index;
+
+#ifdef ALIGN_X86
+	if(!spread[1]) spread_init();
+#endif
+
+	for(index=0;align_kernels[index].name;index++) {
+		if(name && strcmp(name,align_kernels[index].name)) continue;
+		if(!align_kernel_supported(index)) continue;
+		align_kernel_index = index;
+		return 1;
+	}
+
+	return 0;
 }
 
-struct alignment * align_smith_waterman( struct matrix *m, const char * a, const char * b )
+const char * align_kernel_name()
+{
+	if(align_kernel_index<0) align_set_kernel(0);
+	return align_kernels[align_kernel_index].name;
+}
+
+static int floor_half( int x )
+{
+	return x>=0 ? x/2 : -((1-x)/2);
+}
+
+static int ceil_half( int x )
+{
+	return -floor_half(-x);
+}
+
+struct sweep {
+	int is_smith_waterman;
+	int is_banded;
+	int band_low;			// When banded, the lowest and highest i-j of the band.
+	int band_high;
+	int watch_i;			// A cell whose score is wanted afterwards,
+	int watch_j;
+	int watch_known;		// and whether the path into it is known without a traceback.
+	int watch[MATRIX_PLANES];
+	int best_i;			// For Smith-Waterman, the last cell with the best score, in row order.
+	int best_j;
+	int best[MATRIX_PLANES];
+};
+
+/*
+Find the cell of a diagonal with the score best that comes last in
+row order, and keep it if it comes after the best so far.
+*/
+
+static void sweep_best( struct sweep *s, struct matrix *m, const short *h, int d, int istart, int istop, int best )
+{
+	int i, p;
+
+	for(i=istart;i<istop;i++) {
+		if(h[i+1]==best) break;
+	}
+
+	int j = d - i;
+
+	if(best>s->best[MATRIX_PLANE_SCORE] || j>s->best_j || (j==s->best_j && i>s->best_i)) {
+		s->best_i = i;
+		s->best_j = j;
+		for(p=0;p<m->planes;p++) s->best[p] = h[i+1+p*m->stride];
+	}
+}
+
+/*
+The borders are zero, except where they are next to the band,
+so that no alignment ever enters the band from the side.
+A path that reaches a border starts there.
+*/
+
+static int sweep_border( struct sweep *s, int i, int j )
+{
+	if(s->is_banded && (i-j==s->band_low-1 || i-j==s->band_high+1)) return SCORE_OUTSIDE;
+	return 0;
+}
+
+static void sweep_border_cell( struct sweep *s, struct matrix *m, short *h, int i, int j )
+{
+	h[i+1] = sweep_border(s,i,j);
+
+	if(m->planes>1) {
+		h[i+1+MATRIX_PLANE_START_I*m->stride] = i;
+		h[i+1+MATRIX_PLANE_START_J*m->stride] = j;
+		h[i+1+MATRIX_PLANE_GAPS*m->stride] = 0;
+	}
+}
+
+static void sweep( struct matrix *m, const char *a, const char *b, struct sweep *s )
 {
 	int width = m->width;
 	int height = m->height;
-	int i,j;
+	int stride = m->traceback ? 0 : m->stride;
+	int offset = 0;
+	int d, i, j, p;
 
-	int best_i = 0;
-	int best_j = 0;
-	int best_score = 0;
+	if(align_kernel_index<0) align_set_kernel(0);
+	align_kernel_t kernel = align_kernels[align_kernel_index].kernel;
 
-	// Zero out the first row.
-	for(i=0; i<=width; i++) {
-		matrix(m,i,0).score = 0;
-		matrix(m,i,0).traceback = TRACEBACK_LEFT;
+	memcpy(m->a,a,width);
+	for(j=0;j<height;j++) m->b[j] = b[height-j-1];
+
+	for(i=0;i<=width;i++) m->row[i] = SCORE_OUTSIDE;
+	for(j=0;j<=height;j++) m->column[j] = SCORE_OUTSIDE;
+	if(m->scores) {
+		for(i=0;i<(width+1)*(height+1);i++) m->scores[i] = SCORE_OUTSIDE;
 	}
 
-	// Zero out the first column.
-	for(j=0; j<=height; j++) {
-		matrix(m,0,j).score = 0;
-		matrix(m,0,j).traceback = TRACEBACK_UP;
+	memset(s->watch,0,sizeof(s->watch));
+	s->watch[MATRIX_PLANE_SCORE] = SCORE_OUTSIDE;
+	s->watch_known = 0;
+	if(s->watch_i==0 || s->watch_j==0) {
+		s->watch[MATRIX_PLANE_SCORE] = sweep_border(s,s->watch_i,s->watch_j);
+		s->watch[MATRIX_PLANE_START_I] = s->watch_i;
+		s->watch[MATRIX_PLANE_START_J] = s->watch_j;
+		s->watch_known = 1;
 	}
 
-	// Sweep out the rest of the matrix.
-	for (j=1; j<=height; j++) {
-		for (i=1; i<=width; i++) {
+	s->best_i = 0;
+	s->best_j = 0;
+	memset(s->best,0,sizeof(s->best));
+
+	for(d=0;d<=width+height;d++) {
+		short *h = m->diagonal[d%3];
+		const short *prev = m->diagonal[(d+2)%3];
+		const short *prev2 = m->diagonal[(d+1)%3];
+
+		// The cells of this diagonal within the matrix and the band, including the borders.
+		int lo = MAX(0,d-height);
+		int hi = MIN(width,d);
+		if(s->is_banded) {
+			lo = MAX(lo,ceil_half(d+s->band_low));
+			hi = MIN(hi,floor_half(d+s->band_high));
+
+			// Where the band has not yet reached the first column, the first column is computed anyway.
+			if(hi<1) hi = MIN(width,MIN(d,1));
+		}
+
+		// The cells to compute, leaving out the borders.
+		int istart = MAX(lo,1);
+		int istop = MIN(hi,d-1);
 
-			struct cell s = score_cell(m, i, j, a, b, 1 );
-			matrix(m,i,j) = s;
+		m->first[d] = istart;
+		m->last[d] = istop;
+		m->offset[d] = offset;
+
+		if(istart<=istop) {
+			int n = istop - istart + 1;
+			int best = kernel(h+istart+1,prev+istart,prev2+istart,m->a+istart-1,m->b+height-d+istart,n,s->is_smith_waterman,m->traceback ? m->traceback+offset : 0,stride,istart,d);
+			offset += (n+MATRIX_LANES-1)/MATRIX_LANES*MATRIX_LANES/4;
 
 			// Keep track of the cell with the best score.
-			if(s.score>=best_score) {
-				best_score = s.score;
-				best_i = i;
-				best_j = j;
+			if(s->is_smith_waterman && best>=s->best[MATRIX_PLANE_SCORE]) {
+				sweep_best(s,m,h,d,istart,istop,best);
 			}
 		}
+
+		// Zero out the borders, and mark the cells on either side of the
+		// diagonal as outside, so that the next diagonals never use them.
+		if(lo==0) sweep_border_cell(s,m,h,0,d);
+		if(hi==d) sweep_border_cell(s,m,h,d,0);
+		if(lo<=width+2) h[lo] = SCORE_OUTSIDE;
+		if(hi>=-2) h[hi+2] = SCORE_OUTSIDE;
+
+		if(d-height>=lo && d-height<=hi) {
+			for(p=0;p<m->planes;p++) matrix_row(m,p)[d-height] = h[d-height+1+p*m->stride];
+		}
+
+		if(width>=lo && width<=hi) {
+			for(p=0;p<m->planes;p++) matrix_column(m,p)[d-width] = h[width+1+p*m->stride];
+		}
+
+		if(d==s->watch_i+s->watch_j && s->watch_i>=lo && s->watch_i<=hi) {
+			for(p=0;p<m->planes;p++) s->watch[p] = h[s->watch_i+1+p*m->stride];
+			s->watch_known = 1;
+		}
+
+		if(m->scores) {
+			for(i=lo;i<=hi;i++) matrix_score(m,i,d-i) = h[i+1];
+		}
 	}
+}
+
+struct alignment * align_smith_waterman( struct matrix *m, const char * a, const char * b )
+{
+	struct sweep s;
+
+	memset(&s,0,sizeof(s));
+	s.is_smith_waterman = 1;
+	s.watch_i = s.watch_j = -1;
+
+	sweep(m,a,b,&s);
+
+	if(!m->traceback) return alignment_summary(m, s.best_i, s.best_j, s.best);
 
 	// Start the traceback from the cell with the highest score.
-	return alignment_traceback(m, best_i, best_j, a, b );
+	return alignment_traceback(m, s.best_i, s.best_j, s.best[MATRIX_PLANE_SCORE], a, b );
 }
 
 struct alignment * align_prefix_suffix( struct matrix *m, const char * a, const char * b, int min_align )
 {
 	int width = m->width;
 	int height = m->height;
-	int i,j;
 	int best_i = 0;
 	int best_j = 0;
+	int best[MATRIX_PLANES];
+	struct sweep s;
 
 	min_align = MIN(min_align,MIN(width,height));
 
-	// Zero out the top row.
-	for(i=0; i<=width; i++) {
-		matrix(m,i,0).score = 0;
-		matrix(m,i,0).traceback = TRACEBACK_LEFT;
-	}
-
-	// Zero out the left column.
-	for(j=1; j<=height; j++) {
-		matrix(m,0,j).score = 0;
-		matrix(m,0,j).traceback = TRACEBACK_UP;
-	}
+	memset(&s,0,sizeof(s));
+	s.watch_i = s.watch_j = min_align;
 
-	// Sweep out the entire matrix.
-	for (i=1; i<=width; i++) {
-		for (j=1; j<=height; j++) {
-			matrix(m,i,j) = score_cell(m, i, j, a, b, 0 );
-		}
-	}
+	sweep(m,a,b,&s);
 
 	// Find the maximum of the last row and last column.
-	choose_best(m, &best_i, &best_j, min_align, width, min_align, height);
+	int found = choose_best(m, &best_i, &best_j, min_align, width, min_align, height, s.watch, best);
+
+	if(!m->traceback) {
+		if(!found && !s.watch_known) return 0;
+		return alignment_summary(m, best_i, best_j, best);
+	}
 
 	// Start traceback from best position and go until we hit the top or left edge.
-	return alignment_traceback(m, best_i, best_j, a, b );
+	return alignment_traceback(m, best_i, best_j, best[MATRIX_PLANE_SCORE], a, b );
 }
 
 struct alignment * align_banded( struct matrix *m, const char *a, const char *b, int astart, int bstart, int k )
 {
 	int width = m->width;
 	int height = m->height;
-	int i,j;
 	int best_i = 0;
 	int best_j = 0;
+	int best[MATRIX_PLANES];
+	struct sweep s;
 
 	int offset = astart - bstart;
 
-	// Zero out the top border.
-	for(i=0;i<=width;i++) {
-		matrix(m,i,0).score = 0;
-		matrix(m,i,0).traceback = TRACEBACK_LEFT;
-	}
-
-	// Zero out the left border.
-	for(j=0;j<=height;j++) {
-		matrix(m,0,j).score = 0;
-		matrix(m,0,j).traceback = TRACEBACK_UP;
-	}
-
-	// Set the diagonals to a large small number so that the
-	// traceback never wanders off the band.
-	for(j=0;j<=height;j++) {
-		i = offset + k + j + 1;
-		if(i>=0 && i<=width) {
-			matrix(m,i,j).score = SHRT_MIN + 100;
-			matrix(m,i,j).traceback = TRACEBACK_LEFT;
-		}
-		i = offset - k + j - 1;
-		if(i>=0 && i<=width) {
-			matrix(m,i,j).score = SHRT_MIN + 100;
-			matrix(m,i,j).traceback = TRACEBACK_UP;
-		}
-	}
-
 	#define BRACKET( a, x, b ) MIN(MAX((a),(x)),(b))
 
-	// For each row, sweep out the valid range of columns.
-	for(j=1;j<=MIN(height,width-offset+k);j++) {
+	int istart = BRACKET(0,height+offset-k,width);
+	int iend   = BRACKET(0,height+offset+k,width);
+	int jstart = BRACKET(0,width-offset-k,height);
+	int jend   = BRACKET(0,width-offset+k,height);
 
-		int istart = BRACKET(1,offset+j-k,width);
-		int istop  = BRACKET(1,offset+j+k,width);
+	// Only the cells within k of the diagonal through the start positions are computed.
+	memset(&s,0,sizeof(s));
+	s.is_banded = 1;
+	s.band_low = offset - k;
+	s.band_high = offset + k;
+	s.watch_i = istart;
+	s.watch_j = jstart;
 
-		for(i=istart;i<=istop;i++) {
-			matrix(m,i,j) = score_cell(m,i,j,a,b,0);
-		}
-	}
+	sweep(m,a,b,&s);
 
 	// Choose the best value on the valid ranges of the alignment.
-	choose_best(m, &best_i, &best_j,
-		       BRACKET(0,height+offset-k,width),
-		       BRACKET(0,height+offset+k,width),
-		       BRACKET(0,width-offset-k,height),
-		       BRACKET(0,width-offset+k,height) );
+	int found = choose_best(m, &best_i, &best_j, istart, iend, jstart, jend, s.watch, best);
+
+	if(!m->traceback) {
+		if(!found && !s.watch_known) return 0;
+		return alignment_summary(m, best_i, best_j, best);
+	}
 
 	// Run the traceback back to the edges of the matrix.
-	return alignment_traceback(m, best_i, best_j, a, b );
+	return alignment_traceback(m, best_i, best_j, best[MATRIX_PLANE_SCORE], a, b );
 }
 
-static void choose_best(struct matrix *m, int * best_i, int * best_j, int istart, int iend, int jstart, int jend )
+/*
+Returns true if a cell above zero was found, and fills in best
+with the values of the cell, from the first that start holds.
+*/
+
+static int choose_best(struct matrix *m, int * best_i, int * best_j, int istart, int iend, int jstart, int jend, const int *start, int *best )
 {
-	int i, j;
+	int i, j, p;
 	double best_score = 0;
+	int found = 0;
 
 	// QUESTION: do we want to use % identity like Celera? May require changing the score parameters.
 
@@ -224,31 +655,58 @@ static void choose_best(struct matrix *m, int * best_i, int * best_j, int istart
 
 	*best_i = istart;
 	*best_j = jstart;
+	memcpy(best,start,sizeof(*best)*MATRIX_PLANES);
 
 	// Find the best in the last column
 	if(jstart!=jend) {
-		for (i=m->width, j=jstart; j <= jend; j++) {
-			if ( matrix(m,i,j).score > best_score) {
-	      			best_score =  matrix(m,i,j).score;
-	      			*best_i = i;
+		for (j=jstart; j <= jend; j++) {
+			if ( m->column[j] > best_score) {
+	      			best_score =  m->column[j];
+	      			*best_i = m->width;
 	      			*best_j = j;
+				found = 1;
 			}
 		}
 	}
 
 	// Find the best in the last row
 	if(istart!=iend) {
-		for (i=istart, j=m->height; i <= iend; i++) {
-			if ( matrix(m,i,j).score > best_score) {
-				best_score =  matrix(m,i,j).score;
+		for (i=istart; i <= iend; i++) {
+			if ( m->row[i] > best_score) {
+				best_score =  m->row[i];
 				*best_i = i;
-				*best_j = j;
+				*best_j = m->height;
+				found = 2;
 			}
 		}
 	}
+
+	if(found==1) {
+		for(p=0;p<m->planes;p++) best[p] = matrix_column(m,p)[*best_j];
+	} else if(found==2) {
+		for(p=0;p<m->planes;p++) best[p] = matrix_row(m,p)[*best_i];
+	}
+
+	return found;
 }
 
-static struct alignment * alignment_traceback(struct matrix *m, int istart, int jstart, const char *a, const char *b )
+/*
+A traceback that starts outside of the band, which happens only
+when no cell of the last row or column scores above zero, is
+led back into the band, to the left or from above.
+*/
+
+static int alignment_direction( struct matrix *m, int i, int j )
+{
+	int d = i + j;
+
+	if(i<m->first[d]) return TRACEBACK_UP;
+	if(i>m->last[d]) return TRACEBACK_LEFT;
+
+	return traceback_names[matrix_traceback(m,i,j)];
+}
+
+static struct alignment * alignment_traceback(struct matrix *m, int istart, int jstart, int score, const char *a, const char *b )
 {
 	struct alignment * aln = malloc(sizeof(*aln));
 	memset(aln,0,sizeof(*aln));
@@ -263,7 +721,7 @@ static struct alignment * alignment_traceback(struct matrix *m, int istart, int
 
 	while ( (i>0) && (j>0) ) {
 
-		dir = matrix(m,i,j).traceback;
+		dir = alignment_direction(m,i,j);
 		aln->traceback[length++] = dir;
 
 		if(dir==TRACEBACK_DIAG) {
@@ -309,12 +767,44 @@ static struct alignment * alignment_traceback(struct matrix *m, int istart, int
 	aln->end2 = jstart-1;
 	aln->length1 = m->width;
 	aln->length2 = m->height;
-	aln->score = matrix(m,istart,jstart).score;
+	aln->score = score;
 	aln->quality = (double)(aln->gap_count + aln->mismatch_count) / MIN(aln->end1-aln->start1,aln->end2-aln->start2);
 	
 	return aln;
 }
 
+/*
+For a score only matrix, the alignment is described from the values
+carried into its last cell, just as the traceback would find it,
+but without the traceback itself.  Every path starts from a score of
+zero, so the mismatches follow from the score, the gaps, and the
+length of the path: the steps along each sequence add up to twice
+the matches and mismatches, plus the gaps.
+*/
+
+static struct alignment * alignment_summary(struct matrix *m, int iend, int jend, const int *carry )
+{
+	struct alignment * aln = malloc(sizeof(*aln));
+	memset(aln,0,sizeof(*aln));
+
+	aln->start1 = carry[MATRIX_PLANE_START_I];
+	aln->start2 = carry[MATRIX_PLANE_START_J];
+	aln->end1 = iend-1;
+	aln->end2 = jend-1;
+	aln->length1 = m->width;
+	aln->length2 = m->height;
+	aln->gap_count = carry[MATRIX_PLANE_GAPS];
+	aln->score = carry[MATRIX_PLANE_SCORE];
+
+	// A path of no steps may be a single cell outside of the band, which has no score of zero.
+	int steps = (iend - aln->start1) + (jend - aln->start2) - aln->gap_count;
+	if(steps>0) aln->mismatch_count = (score_match*steps/2 + score_gap*aln->gap_count - aln->score) / (score_match - score_mismatch);
+
+	aln->quality = (double)(aln->gap_count + aln->mismatch_count) / MIN(aln->end1-aln->start1,aln->end2-aln->start2);
+
+	return aln;
+}
+
 #define LINE_WIDTH 80
 
 static void print_rows( FILE * file, char a, char b )
@@ -26,10 +26,28 @@ struct alignment {
 	char ori;
 };
 
+/*
+With a matrix from matrix_create_score_only, the alignment functions find the
+same alignment as they would with a full matrix, using far less memory, but
+leave its traceback null.  In the rare case that the alignment starts from a
+cell that only a traceback could have followed, they return null instead,
+and the caller should align again with a full matrix.
+*/
+
 struct alignment * align_prefix_suffix( struct matrix *m, const char *a, const char *b, int min_align );
 struct alignment * align_smith_waterman( struct matrix *m, const char *a, const char *b );
 struct alignment * align_banded( struct matrix *m, const char *a, const char *b, int astart, int bstart, int k );
 
+/*
+The alignments are computed by a vectorized kernel chosen at runtime for the
+CPU (avx2 or sse2), or by a scalar one, all of which give the same results.
+align_set_kernel selects a kernel by name, or the fastest one if name is null,
+and returns zero if that kernel is not available on this CPU.
+*/
+
+int          align_set_kernel( const char *name );
+const char * align_kernel_name();
+
 void alignment_print( FILE * file, const char * str1, const char * str2, struct alignment *a );
 void alignment_delete( struct alignment *a );
 
@@ -10,27 +10,151 @@ See the file COPYING for details.
 
 #include "matrix.h"
 
+static void matrix_free( struct matrix *m )
+{
+	free(m->first);
+	free(m->last);
+	free(m->offset);
+	free(m->traceback);
+	free(m->row);
+	free(m->column);
+	free(m->scores);
+	free(m->diagonal[0]);
+	free(m->diagonal[1]);
+	free(m->diagonal[2]);
+	free(m->a);
+	free(m->b);
+}
+
+/*
+Allocate space for sequences of up to max_width and max_height bases,
+with directions unless the matrix is score only, and with every score
+if the matrix had them.
+*/
+
+static int matrix_allocate( struct matrix *m, int with_traceback, int with_scores )
+{
+	int width = m->max_width;
+	int height = m->max_height;
+	int diagonals = width + height + 1;
+
+	// The kernels read and write up to a full set of lanes past the end of a diagonal.
+	m->stride = width + 2 + 2*MATRIX_LANES;
+
+	m->first = malloc(sizeof(int) * diagonals);
+	m->last = malloc(sizeof(int) * diagonals);
+	m->offset = malloc(sizeof(int) * diagonals);
+	m->row = malloc(sizeof(short) * (width+1) * m->planes);
+	m->column = malloc(sizeof(short) * (height+1) * m->planes);
+	m->diagonal[0] = calloc(m->stride * m->planes, sizeof(short));
+	m->diagonal[1] = calloc(m->stride * m->planes, sizeof(short));
+	m->diagonal[2] = calloc(m->stride * m->planes, sizeof(short));
+	m->a = calloc(width + 2*MATRIX_LANES, 1);
+	m->b = calloc(height + 2*MATRIX_LANES, 1);
+
+	// Each diagonal has at most MIN(width,height) cells, plus less than a full set of lanes of padding.
+	if(with_traceback) {
+		m->traceback = malloc((size_t) width * height / 4 + (size_t) diagonals * MATRIX_LANES / 4 + MATRIX_LANES);
+	}
+
+	if(with_scores) {
+		m->scores = malloc(sizeof(short) * (width+1) * (height+1));
+	}
+
+	return m->first && m->last && m->offset && m->row && m->column && m->diagonal[0] && m->diagonal[1] && m->diagonal[2] && m->a && m->b
+		&& (m->traceback || !with_traceback) && (m->scores || !with_scores);
+}
+
+static struct matrix * matrix_create_kind( int width, int height, int with_traceback, int with_scores )
+{
+	struct matrix *m = calloc(1,sizeof(*m));
+	if(!m) return 0;
+
+	m->width = m->max_width = width;
+	m->height = m->max_height = height;
+	m->planes = with_traceback ? 1 : MATRIX_PLANES;
+
+	if(!matrix_allocate(m,with_traceback,with_scores)) {
+		matrix_delete(m);
+		return 0;
+	}
+
+	return m;
+}
+
 struct matrix * matrix_create( int width, int height )
 {
-	struct matrix *m = malloc(sizeof(*m));
+	return matrix_create_kind(width,height,1,0);
+}
+
+struct matrix * matrix_create_with_scores( int width, int height )
+{
+	return matrix_create_kind(width,height,1,1);
+}
+
+struct matrix * matrix_create_score_only( int width, int height )
+{
+	return matrix_create_kind(width,height,0,0);
+}
+
+int matrix_resize( struct matrix *m, int width, int height )
+{
+	if(width>m->max_width || height>m->max_height) {
+		int with_traceback = m->traceback!=0;
+		int with_scores = m->scores!=0;
+
+		matrix_free(m);
+		memset(m->diagonal,0,sizeof(m->diagonal));
+		m->first = m->last = m->offset = 0;
+		m->traceback = 0;
+		m->row = m->column = m->scores = 0;
+		m->a = m->b = 0;
+
+		if(width>m->max_width) m->max_width = width;
+		if(height>m->max_height) m->max_height = height;
+
+		if(!matrix_allocate(m,with_traceback,with_scores)) return 0;
+	}
 
 	m->width = width;
 	m->height = height;
-	m->data = malloc(sizeof(struct cell) * (m->width+1) * (height+1) );
 
-	return m;
+	return 1;
 }
 
 void matrix_delete( struct matrix *m )
 {
-	free(m->data);
+	matrix_free(m);
 	free(m);
 }
 
+/*
+Cells that were not computed, such as those outside of a band,
+are shown without a direction.  The borders keep the directions
+that they had when every cell was stored.
+*/
+
+static char matrix_direction( struct matrix *m, int i, int j )
+{
+	static const char names[4] = { '\\', '-', '|', 'X' };
+	int d = i + j;
+
+	if(j==0) return '-';
+	if(i==0) return '|';
+	if(i<m->first[d] || i>m->last[d]) return ' ';
+
+	return names[matrix_traceback(m,i,j)];
+}
+
 void matrix_print( struct matrix *m, const char *a, const char *b )
 {
 	int i,j;
 
+	if(!m->scores) {
+		printf("(the scores of this matrix were not kept)\n");
+		return;
+	}
+
 	if(b) printf("     ");
 
 	if(a) for(i=0;i<m->width;i++) printf("    %c",a[i]);
@@ -47,9 +171,7 @@ void matrix_print( struct matrix *m, const char *a, const char *b )
 		}
 
 		for(i=0;i<=m->width;i++) {
-			char t = matrix(m,i,j).traceback;
-			if(t==0) t=' ';
-			printf("%3d%c ",matrix(m,i,j).score,t);
+			printf("%3d%c ",matrix_score(m,i,j),matrix_direction(m,i,j));
 		}
 		printf("\n");
 	}
@@ -7,23 +7,75 @@ See the file COPYING for details.
 #ifndef MATRIX_H
 #define MATRIX_H
 
-struct cell
-{
-	short score;
-	short traceback;
-};
+/*
+The matrix keeps what an alignment needs once the sweep is done:
+the direction taken into each computed cell, packed two bits to a
+cell, and the scores of the last row and the last column.
+The score of every cell is only kept by a matrix created with
+matrix_create_with_scores, which is slower, for printing.
+
+The directions are stored by anti-diagonal (the cells with the same i+j),
+because that is the order in which the vectorized kernels compute them.
+Diagonal d holds the cells from i=first[d] to i=last[d], starting at byte
+offset[d] of traceback, and is padded to a multiple of MATRIX_LANES cells.
+
+A matrix created with matrix_create_score_only has no directions at all,
+and needs memory only in proportion to the lengths of the sequences.
+Instead, every cell of the diagonals, and of the last row and column,
+carries MATRIX_PLANES values: the score, and, for the path that reaches
+the cell, the cell where it begins and its count of gaps.
+Each value is kept in its own plane, stride shorts after the one before.
+
+A matrix may be reused for sequences of other lengths with matrix_resize,
+which only allocates more memory for sequences longer than any before.
+*/
+
+#define MATRIX_TRACEBACK_DIAG 0
+#define MATRIX_TRACEBACK_LEFT 1
+#define MATRIX_TRACEBACK_UP   2
+#define MATRIX_TRACEBACK_END  3
+
+#define MATRIX_PLANE_SCORE      0
+#define MATRIX_PLANE_START_I    1
+#define MATRIX_PLANE_START_J    2
+#define MATRIX_PLANE_GAPS       3
+#define MATRIX_PLANES           4
+
+#define MATRIX_LANES 16
 
 struct matrix {
 	int width;
 	int height;
-	struct cell *data;
+	int max_width;
+	int max_height;
+	int planes;
+	int stride;
+	int *first;
+	int *last;
+	int *offset;
+	unsigned char *traceback;
+	short *row;
+	short *column;
+	short *scores;
+
+	/* Scratch space for the sweep: three diagonals of scores, and padded copies of the sequences. */
+	short *diagonal[3];
+	char *a;
+	char *b;
 };
 
 struct matrix * matrix_create( int width, int height );
+struct matrix * matrix_create_with_scores( int width, int height );
+struct matrix * matrix_create_score_only( int width, int height );
+int             matrix_resize( struct matrix *m, int width, int height );
 void            matrix_delete( struct matrix *m );
 void            matrix_print( struct matrix *m, const char *a, const char *b );
 
-#define matrix(m,i,j) ( (m)->data[(m->width*(j) + i)] )
+#define matrix_traceback(m,i,j) ( ( (m)->traceback[(m)->offset[(i)+(j)] + ((i)-(m)->first[(i)+(j)])/4] >> (2*(((i)-(m)->first[(i)+(j)])%4)) ) & 3 )
 
-#endif
+#define matrix_row(m,plane) ( (m)->row + (plane)*((m)->max_width+1) )
+#define matrix_column(m,plane) ( (m)->column + (plane)*((m)->max_height+1) )
+
+#define matrix_score(m,i,j) ( (m)->scores[((m)->width+1)*(j) + (i)] )
 
+#endif
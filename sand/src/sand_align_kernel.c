@@ -11,6 +11,7 @@ See the file COPYING for details.
 #include <errno.h>
 #include <string.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <sys/types.h>
 
 #include "cctools.h"
@@ -25,6 +26,9 @@ See the file COPYING for details.
 static int min_align = 0;
 static double min_qual = 1.0;
 
+static int linear_memory = 0;
+static int threads = 1;
+
 static const char *output_format = "ovl";
 static const char *align_type = "banded";
 
@@ -36,22 +40,400 @@ static void show_help(const char *cmd)
 	printf(" -o <format>    Output format: ovl, ovl_new, align, or matrix. (default: %s)\n",output_format);
 	printf(" -m <integer>	Minimum aligment length (default: %d).\n", min_align);
 	printf(" -q <integer>	Minimum match quality (default: %.2lf)\n",min_qual);
+	printf(" -l         	Use memory only in proportion to the sequence lengths, which is slower.\n");
+	printf(" -t <integer>	Number of threads aligning pairs. (default: %d)\n",threads);
 	printf(" -x         	Delete input file after completion.\n");
 	printf(" -d <flag>	Enable debugging for this subsystem.\n");
 	printf(" -v         	Show program version.\n");
 	printf(" -h         	Display this message.\n");
 }
 
+/*
+A pair to align: the second sequence, where the first sequence starts
+and ends against it, and once aligned, the alignment.  The first
+sequence is shared by all of the pairs read after it, and is freed
+once the last of them is written.
+*/
+
+struct shared_seq {
+	struct seq *seq;
+	int refcount;
+};
+
+struct pair {
+	struct shared_seq *s1;
+	struct seq *s2;
+	int start1;
+	int start2;
+	int metadata_valid;
+	char ori;
+	struct alignment *aln;
+};
+
+/*
+Each aligning thread keeps its own matrices from one pair to the next.
+*/
+
+struct workspace {
+	struct matrix *m;
+	struct matrix *score_only;
+};
+
+/*
+Use the same matrix for every pair, only growing it when a pair is
+longer than any before, rather than allocating one for each pair.
+*/
+
+static struct matrix * matrix_reuse( struct matrix *m, int width, int height, struct matrix * (*create)( int width, int height ) )
+{
+	if(m && matrix_resize(m,width,height)) return m;
+	if(m) matrix_delete(m);
+
+	m = create(width,height);
+	if(!m) {
+		fprintf(stderr,"sand_align_kernel: out of memory when creating alignment matrix.\n");
+		exit(1);
+	}
+
+	return m;
+}
+
+static struct alignment * align_sequences( struct matrix *m, struct pair *p )
+{
+	struct seq *s1 = p->s1->seq;
+	struct seq *s2 = p->s2;
+
+	if(!strcmp(align_type,"sw")) {
+
+		return align_smith_waterman(m,s1->data,s2->data);
+
+	} else if(!strcmp(align_type,"ps")) {
+
+		return align_prefix_suffix(m,s1->data,s2->data, min_align);
+
+	} else if(!strcmp(align_type,"banded")) {
+		if(p->metadata_valid<3) {
+			fprintf(stderr,"sand_align_kernel: sequence %s did not indicate start positions for the banded alignment.\n",s2->name);
+			exit(1);
+		}
+
+		/* The width of the band is proportional to the desired quality of the match. */
+
+		int k = 2 + min_qual * MIN(s1->num_bases,s2->num_bases) / 2.0;
+		if(k<5) k = 5;
+
+		return align_banded(m,s1->data, s2->data, p->start1, p->start2, k);
+	} else {
+		fprintf(stderr,"unknown alignment type: %s\n",align_type);
+		exit(1);
+	}
+}
+
+static struct alignment * pair_align( struct pair *p, struct workspace *w )
+{
+	struct seq *s1 = p->s1->seq;
+	struct seq *s2 = p->s2;
+	struct alignment *aln = 0;
+
+	// In linear memory, first align with only the scores, which is enough
+	// to reject most pairs, and is all that an overlap needs.  Then make
+	// a full alignment with a traceback only for the pairs to be shown.
+
+	if(linear_memory && strcmp(output_format,"matrix")) {
+		w->score_only = matrix_reuse(w->score_only,s1->num_bases,s2->num_bases,matrix_create_score_only);
+		aln = align_sequences(w->score_only,p);
+	}
+
+	if(!aln || (aln->quality <= min_qual && !strcmp(output_format,"align"))) {
+		alignment_delete(aln);
+		if(!strcmp(output_format,"matrix")) {
+			w->m = matrix_reuse(w->m,s1->num_bases,s2->num_bases,matrix_create_with_scores);
+		} else {
+			w->m = matrix_reuse(w->m,s1->num_bases,s2->num_bases,matrix_create);
+		}
+		aln = align_sequences(w->m,p);
+	}
+
+	aln->ori = p->ori;
+	return aln;
+}
+
+/*
+The matrix format prints the matrix that the pair was just aligned in,
+so it is only used when aligning in a single thread.
+*/
+
+static void pair_write( struct pair *p, struct workspace *w )
+{
+	struct seq *s1 = p->s1->seq;
+	struct seq *s2 = p->s2;
+	struct alignment *aln = p->aln;
+
+	if(aln->quality <= min_qual) {
+		if(!strcmp(output_format,"ovl")) {
+			overlap_write_v5(stdout, aln, s1->name, s2->name);
+		} else if(!strcmp(output_format, "ovl_new")) { 
+			overlap_write_v7(stdout, aln, s1->name, s2->name); 
+		} else if(!strcmp(output_format,"matrix")) {
+			printf("*** %s alignment of sequences %s and %s (quality %lf):\n\n",align_type,s1->name,s2->name,aln->quality);
+			matrix_print(w->m,s1->data,s2->data);
+		} else if(!strcmp(output_format,"align")) {
+			printf("*** %s alignment of sequences %s and %s (quality %lf):\n\n",align_type,s1->name,s2->name,aln->quality);
+			alignment_print(stdout,s1->data,s2->data,aln);
+		} else {
+			printf("unknown output format '%s'\n",output_format);
+			exit(1);
+		}
+	}
+}
+
+static void shared_seq_release( struct shared_seq *s )
+{
+	if(--s->refcount==0) {
+		seq_free(s->seq);
+		free(s);
+	}
+}
+
+/*
+Read each first sequence, and then the sequences to be aligned against it,
+until an empty list, (two nulls to halt) and pass every pair to handle.
+The pairs hold a reference to the first sequence, and so does the reader
+while it reads them.
+*/
+
+static void read_pairs( FILE *input, void (*handle)( struct pair *p ), void (*release)( struct shared_seq *s ) )
+{
+	struct cseq *c1, *c2;
+
+	// outer loop: read first sequence in comparison list
+
+	while((c1=cseq_read(input))) {
+	  struct shared_seq *s1 = malloc(sizeof(*s1));
+	  s1->seq = cseq_uncompress(c1);
+	  s1->refcount = 1;
+	  cseq_free(c1);
+
+	  // inner loop: read sequences until null (indicating end of list)
+	  // then continue again with outer loop.  (two nulls to halt.)
+
+	  while((c2=cseq_read(input))) {
+		struct pair *p = malloc(sizeof(*p));
+		memset(p,0,sizeof(*p));
+
+		p->s2 = cseq_uncompress(c2);
+		cseq_free(c2);
+
+		int dir = 0;
+		char* tmp = strdup(p->s2->metadata);
+		
+		char* token = strtok(tmp, "	 ");
+		p->start2 = atoi(token);
+		p->metadata_valid++;
+		while((token = strtok(NULL, "	 "))) 
+		{
+			dir = p->start1;
+			p->start1 = p->start2;
+			p->start2 = atoi(token);
+			p->metadata_valid++;
+		}
+		free(tmp);
+
+		if(p->metadata_valid>=1 && dir==-1) {
+			seq_reverse_complement(p->s2);
+			p->ori = 'I';
+		} else {
+			p->ori = 'N';
+		}
+
+		p->s1 = s1;
+		s1->refcount++;
+
+		handle(p);
+	  }
+	  release(s1);
+	}
+}
+
+static void pair_delete( struct pair *p )
+{
+	seq_free(p->s2);
+	alignment_delete(p->aln);
+	free(p);
+}
+
+static struct workspace serial_workspace;
+
+static void pair_handle_serial( struct pair *p )
+{
+	p->aln = pair_align(p,&serial_workspace);
+	pair_write(p,&serial_workspace);
+	shared_seq_release(p->s1);
+	pair_delete(p);
+}
+
+/*
+With more than one thread, the main thread reads the pairs into a
+bounded ring of slots, the aligning threads take the oldest pairs not
+yet taken, and a writer thread writes the aligned pairs in the order
+that they were read, so that the output is the same as with one thread.
+Each slot is numbered by the count of pairs read before it, and a pair
+is only read into a slot once the pair before it there was written.
+*/
+
+#define QUEUE_SIZE_PER_THREAD 64
+
+struct pair_queue {
+	struct pair **slots;
+	int size;
+	int reading;			// Number of pairs read so far,
+	int aligning;			// taken by aligning threads,
+	int writing;			// and written.
+	int done_reading;
+	pthread_mutex_t mutex;
+	pthread_cond_t ready;		// Signaled when a pair is read, or reading is done.
+	pthread_cond_t aligned;		// Signaled when a pair is aligned.
+	pthread_cond_t written;		// Signaled when a pair is written.
+};
+
+static struct pair_queue queue;
+
+static void pair_handle_threaded( struct pair *p )
+{
+	pthread_mutex_lock(&queue.mutex);
+	while(queue.reading - queue.writing >= queue.size) {
+		pthread_cond_wait(&queue.written,&queue.mutex);
+	}
+	queue.slots[queue.reading % queue.size] = p;
+	queue.reading++;
+	pthread_cond_signal(&queue.ready);
+	pthread_mutex_unlock(&queue.mutex);
+}
+
+static void shared_seq_release_threaded( struct shared_seq *s )
+{
+	pthread_mutex_lock(&queue.mutex);
+	shared_seq_release(s);
+	pthread_mutex_unlock(&queue.mutex);
+}
+
+static void * align_thread( void *arg )
+{
+	struct workspace w;
+	memset(&w,0,sizeof(w));
+
+	pthread_mutex_lock(&queue.mutex);
+	while(1) {
+		if(queue.aligning < queue.reading) {
+			struct pair *p = queue.slots[queue.aligning % queue.size];
+			queue.aligning++;
+			pthread_mutex_unlock(&queue.mutex);
+
+			struct alignment *aln = pair_align(p,&w);
+
+			pthread_mutex_lock(&queue.mutex);
+			p->aln = aln;
+			pthread_cond_signal(&queue.aligned);
+		} else if(queue.done_reading) {
+			break;
+		} else {
+			pthread_cond_wait(&queue.ready,&queue.mutex);
+		}
+	}
+	pthread_mutex_unlock(&queue.mutex);
+
+	if(w.m) matrix_delete(w.m);
+	if(w.score_only) matrix_delete(w.score_only);
+
+	return 0;
+}
+
+/*
+A pair in the slot being written is aligned once it has an alignment,
+which is only set or read while holding the mutex.
+*/
+
+static void * write_thread( void *arg )
+{
+	pthread_mutex_lock(&queue.mutex);
+	while(1) {
+		struct pair *p = 0;
+
+		if(queue.writing < queue.aligning) {
+			p = queue.slots[queue.writing % queue.size];
+		}
+
+		if(p && p->aln) {
+			pthread_mutex_unlock(&queue.mutex);
+			pair_write(p,0);
+			pthread_mutex_lock(&queue.mutex);
+
+			queue.slots[queue.writing % queue.size] = 0;
+			queue.writing++;
+			shared_seq_release(p->s1);
+			pthread_cond_signal(&queue.written);
+
+			pthread_mutex_unlock(&queue.mutex);
+			pair_delete(p);
+			pthread_mutex_lock(&queue.mutex);
+		} else if(queue.done_reading && queue.writing==queue.reading) {
+			break;
+		} else {
+			pthread_cond_wait(&queue.aligned,&queue.mutex);
+		}
+	}
+	pthread_mutex_unlock(&queue.mutex);
+
+	return 0;
+}
+
+static void read_pairs_threaded( FILE *input )
+{
+	pthread_t aligners[threads];
+	pthread_t writer;
+	int i;
+
+	queue.size = threads * QUEUE_SIZE_PER_THREAD;
+	queue.slots = calloc(queue.size,sizeof(*queue.slots));
+	pthread_mutex_init(&queue.mutex,0);
+	pthread_cond_init(&queue.ready,0);
+	pthread_cond_init(&queue.aligned,0);
+	pthread_cond_init(&queue.written,0);
+
+	for(i=0;i<threads;i++) {
+		if(pthread_create(&aligners[i],0,align_thread,0)) {
+			fprintf(stderr,"sand_align_kernel: couldn't create thread: %s\n",strerror(errno));
+			exit(1);
+		}
+	}
+
+	if(pthread_create(&writer,0,write_thread,0)) {
+		fprintf(stderr,"sand_align_kernel: couldn't create thread: %s\n",strerror(errno));
+		exit(1);
+	}
+
+	read_pairs(input,pair_handle_threaded,shared_seq_release_threaded);
+
+	pthread_mutex_lock(&queue.mutex);
+	queue.done_reading = 1;
+	pthread_cond_broadcast(&queue.ready);
+	pthread_cond_broadcast(&queue.aligned);
+	pthread_mutex_unlock(&queue.mutex);
+
+	for(i=0;i<threads;i++) pthread_join(aligners[i],0);
+	pthread_join(writer,0);
+
+	free(queue.slots);
+}
+
 int main(int argc, char ** argv)
 {
 	FILE * input;
-	struct seq *s1=0, *s2=0;
-	char ori;
 	char c;
 	int fileindex;
 	int del_input=0;
 
-	while((c = getopt(argc, argv, "a:o:k:m:q:xd:vh")) != (char) -1) {
+	while((c = getopt(argc, argv, "a:o:k:m:q:lt:xd:vh")) != (char) -1) {
 		switch (c) {
 		case 'a':
 			align_type = optarg;
@@ -65,6 +447,12 @@ int main(int argc, char ** argv)
 		case 'q':
 			min_qual = atof(optarg);
 			break;
+		case 'l':
+			linear_memory = 1;
+			break;
+		case 't':
+			threads = atoi(optarg);
+			break;
 		case 'x':
 			del_input = 1;
 			break;
@@ -85,6 +473,9 @@ int main(int argc, char ** argv)
 
 	cctools_version_debug(D_DEBUG, argv[0]);
 
+	if(threads<1) threads = 1;
+	if(!strcmp(output_format,"matrix")) threads = 1;
+
 	fileindex = optind;
 	if ((argc - optind) == 1) {
 		input = fopen(argv[fileindex], "r");
@@ -96,106 +487,19 @@ int main(int argc, char ** argv)
 		input = stdin;
 	}
 
-	struct cseq *c1, *c2;
-
 	if(!strcmp(output_format,"ovl") || !strcmp(output_format, "ovl_new")) {
 		overlap_write_begin(stdout);
 	}
 
-	// outer loop: read first sequence in comparison list
-
-	while((c1=cseq_read(input))) {
-	  s1 = cseq_uncompress(c1);
-	  cseq_free(c1);
-
-	  // inner loop: read sequences until null (indicating end of list)
-	  // then continue again with outer loop.  (two nulls to halt.)
-
-	  while((c2=cseq_read(input))) {
-		s2 = cseq_uncompress(c2);
-		cseq_free(c2);
-
-		int dir = 0;
-		int start1 = 0;
-		int start2 = 0;
-		char* tmp = strdup(s2->metadata);
-		int metadata_valid = 0;
-		
-		char* token = strtok(tmp, "	 ");
-		start2 = atoi(token);
-		metadata_valid++;
-		while((token = strtok(NULL, "	 "))) 
-		{
-			dir = start1;
-			start1 = start2;
-			start2 = atoi(token);
-			metadata_valid++;
-		}
-
-		if(metadata_valid>=1 && dir==-1) {
-			seq_reverse_complement(s2);
-			ori = 'I';
-		} else {
-			ori = 'N';
-		}
-
-		struct matrix *m = matrix_create(s1->num_bases,s2->num_bases);
-		if(!m) {
-			fprintf(stderr,"sand_align_kernel: out of memory when creating alignment matrix.\n");
-			exit(1);
-		}
-
-		struct alignment *aln;
-
-		if(!strcmp(align_type,"sw")) {
-
-			aln = align_smith_waterman(m,s1->data,s2->data);
-
-		} else if(!strcmp(align_type,"ps")) {
-
-			aln = align_prefix_suffix(m,s1->data,s2->data, min_align);
-
-		} else if(!strcmp(align_type,"banded")) {
-			if(metadata_valid<3) {
-				fprintf(stderr,"sand_align_kernel: sequence %s did not indicate start positions for the banded alignment.\n",s2->name);
-				exit(1);
-			}
-
-			/* The width of the band is proportional to the desired quality of the match. */
-
-			int k = 2 + min_qual * MIN(s1->num_bases,s2->num_bases) / 2.0;
-			if(k<5) k = 5;
+	// Choose the alignment kernel before any thread uses it.
+	debug(D_DEBUG,"aligning with the %s kernel in %d threads",align_kernel_name(),threads);
 
-			aln = align_banded(m,s1->data, s2->data, start1, start2, k);
-		} else {
-			fprintf(stderr,"unknown alignment type: %s\n",align_type);
-			exit(1);
-		}
-
-		aln->ori = ori;
-
-		if(aln->quality <= min_qual) {
-			if(!strcmp(output_format,"ovl")) {
-				overlap_write_v5(stdout, aln, s1->name, s2->name);
-			} else if(!strcmp(output_format, "ovl_new")) { 
-				overlap_write_v7(stdout, aln, s1->name, s2->name); 
-			} else if(!strcmp(output_format,"matrix")) {
-				printf("*** %s alignment of sequences %s and %s (quality %lf):\n\n",align_type,s1->name,s2->name,aln->quality);
-				matrix_print(m,s1->data,s2->data);
-			} else if(!strcmp(output_format,"align")) {
-				printf("*** %s alignment of sequences %s and %s (quality %lf):\n\n",align_type,s1->name,s2->name,aln->quality);
-				alignment_print(stdout,s1->data,s2->data,aln);
-			} else {
-				printf("unknown output format '%s'\n",output_format);
-				exit(1);
-			}
-		}
-		
-		matrix_delete(m);
-		seq_free(s2);
-		alignment_delete(aln);
-	  }
-	  seq_free(s1);
+	if(threads>1) {
+		read_pairs_threaded(input);
+	} else {
+		read_pairs(input,pair_handle_serial,shared_seq_release);
+		if(serial_workspace.m) matrix_delete(serial_workspace.m);
+		if(serial_workspace.score_only) matrix_delete(serial_workspace.score_only);
 	}
 
 	fclose(input);
@@ -210,6 +514,3 @@ int main(int argc, char ** argv)
 	}
 	return 0;
 }
-
-
-
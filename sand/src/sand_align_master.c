@@ -19,16 +19,16 @@ See the file COPYING for details.
 #include "debug.h"
 #include "work_queue.h"
 #include "work_queue_catalog.h"
-#include "hash_table.h"
 #include "stringtools.h"
 #include "macros.h"
 #include "envtools.h"
 
 #include "sequence.h"
 #include "compressed_sequence.h"
+#include "sequence_store.h"
 
 static struct work_queue *queue = 0;
-static struct hash_table *sequence_table = 0;
+static struct sequence_store *sequence_store = 0;
 static int port = WORK_QUEUE_DEFAULT_PORT;
 static char *project = NULL;
 static int work_queue_master_mode = WORK_QUEUE_MASTER_MODE_STANDALONE;
@@ -39,7 +39,6 @@ static const char *candidate_file_name;
 static const char *sequence_file_name;
 static const char *output_file_name;
 
-static FILE *sequence_file;
 static FILE *candidate_file;
 static FILE *output_file;
 
@@ -54,7 +53,10 @@ static timestamp_t tasks_filetime = 0;
 static int candidates_loaded = 0;
 static int sequences_loaded = 0;
 
-static int max_pairs_per_task = 10000;
+static int max_pairs_per_task = 0;
+static int threads_per_task = 1;
+
+#define MAX_PAIRS_PER_THREAD_DEFAULT 10000
 
 #define CANDIDATE_SUCCESS 0
 #define CANDIDATE_EOF 1
@@ -70,7 +72,8 @@ static void show_help(const char *cmd)
 	printf("Use: %s [options] <sand_align_kernel> <candidates.cand> <sequences.cfa> <overlaps.ovl>\n", cmd);
 	printf("where options are:\n");
 	printf(" -p <port>      Port number for work queue master to listen on. (default: %d)\n", port);
-	printf(" -n <number>    Maximum number of candidates per task. (default is %d)\n", max_pairs_per_task);
+	printf(" -n <number>    Maximum number of candidates per task. (default is %d per thread)\n", MAX_PAIRS_PER_THREAD_DEFAULT);
+	printf(" -t <number>    Number of threads that each task aligns with. (default is %d)\n", threads_per_task);
 	printf(" -e <args>      Extra arguments to pass to the alignment program.\n");
 	printf(" -d <subsystem> Enable debugging for this subsystem.  (Try -d all to start.)\n");
 	printf(" -F <#>         Work Queue fast abort multiplier.     (default is 10.)\n");
@@ -206,30 +209,18 @@ static int candidate_read(FILE * fp, char *name1, char *name2, char *extra_data)
 	return CANDIDATE_SUCCESS;
 }
 
-struct cseq *sequence_lookup(struct hash_table *h, const char *name)
-{
-	struct cseq *c = hash_table_lookup(h, name);
-	if(c)
-		return c;
-
-	while(1) {
-		c = cseq_read(sequence_file);
-		if(!c)
-			break;
-
-		sequences_loaded++;
-
-		hash_table_insert(h, c->name, c);
-		if(!strcmp(name, c->name))
-			return c;
+/*
+The sequences are read from the store as the candidates name them,
+and freed as soon as they have been written into a task.
+*/
 
-		int size = hash_table_size(h);
-		if(size % 100000 == 0)
-			debug(D_DEBUG, "loaded %d sequences", size);
-	}
+struct cseq *sequence_lookup(struct sequence_store *s, const char *name)
+{
+	int i = sequence_store_lookup(s, name);
+	if(i < 0)
+		fatal("candidate file contains invalid sequence name: %s\n", name);
 
-	fatal("candidate file contains invalid sequence name: %s\n", name);
-	return 0;
+	return sequence_store_read(s, i);
 }
 
 static void buffer_ensure(char **buffer, int *buffer_size, int buffer_used, int buffer_delta)
@@ -245,7 +236,7 @@ static void buffer_ensure(char **buffer, int *buffer_size, int buffer_used, int
 	}
 }
 
-static struct work_queue_task *task_create(struct hash_table *sequence_table)
+static struct work_queue_task *task_create(struct sequence_store *sequence_store)
 {
 	char aname1[CAND_FILE_LINE_MAX];
 	char aname2[CAND_FILE_LINE_MAX];
@@ -261,8 +252,8 @@ static struct work_queue_task *task_create(struct hash_table *sequence_table)
 	if(result != CANDIDATE_SUCCESS)
 		return 0;
 
-	s1 = sequence_lookup(sequence_table, aname1);
-	s2 = sequence_lookup(sequence_table, aname2);
+	s1 = sequence_lookup(sequence_store, aname1);
+	s2 = sequence_lookup(sequence_store, aname2);
 
 	static int buffer_size = 1024;
 	char *buffer = malloc(buffer_size);
@@ -273,6 +264,9 @@ static struct work_queue_task *task_create(struct hash_table *sequence_table)
 	buffer_pos += cseq_sprint(&buffer[buffer_pos], s1, "");
 	buffer_pos += cseq_sprint(&buffer[buffer_pos], s2, aextra);
 
+	cseq_free(s1);
+	cseq_free(s2);
+
 	int npairs = 1;
 	int nseqs = 2;
 
@@ -281,13 +275,14 @@ static struct work_queue_task *task_create(struct hash_table *sequence_table)
 		if(result != CANDIDATE_SUCCESS)
 			break;
 
-		s1 = sequence_lookup(sequence_table, bname1);
-		s2 = sequence_lookup(sequence_table, bname2);
+		s2 = sequence_lookup(sequence_store, bname2);
 
 		if(strcmp(aname1, bname1) != 0) {
+			s1 = sequence_lookup(sequence_store, bname1);
 			buffer_ensure(&buffer, &buffer_size, buffer_pos, cseq_size(s1) + cseq_size(s2) + 10);
 			buffer_pos += cseq_sprint(&buffer[buffer_pos], 0, "");
 			buffer_pos += cseq_sprint(&buffer[buffer_pos], s1, "");
+			cseq_free(s1);
 			strcpy(aname1, bname1);
 			strcpy(aname2, bname2);
 			strcpy(aextra, bextra);
@@ -296,6 +291,7 @@ static struct work_queue_task *task_create(struct hash_table *sequence_table)
 
 		buffer_ensure(&buffer, &buffer_size, buffer_pos, cseq_size(s2) + 10);
 		buffer_pos += cseq_sprint(&buffer[buffer_pos], s2, bextra);
+		cseq_free(s2);
 
 		nseqs++;
 		npairs++;
@@ -306,7 +302,11 @@ static struct work_queue_task *task_create(struct hash_table *sequence_table)
 
 	char cmd[strlen(align_prog) + strlen(align_prog_args) + 100];
 
-	sprintf(cmd, "./%s %s aligndata", "align", align_prog_args);
+	if(threads_per_task > 1) {
+		sprintf(cmd, "./%s -t %d %s aligndata", "align", threads_per_task, align_prog_args);
+	} else {
+		sprintf(cmd, "./%s %s aligndata", "align", align_prog_args);
+	}
 
 	struct work_queue_task *t = work_queue_task_create(cmd);
 	work_queue_task_specify_input_file(t, align_prog, "align");
@@ -332,7 +332,7 @@ int main(int argc, char *argv[])
 	// One can also set the fast_abort_multiplier by the '-f' option.
 	wq_option_fast_abort_multiplier = 10;
 
-	while((c = getopt(argc, argv, "e:F:N:C:p:P:n:d:o:vha")) != (char) -1) {
+	while((c = getopt(argc, argv, "e:F:N:C:p:P:n:t:d:o:vha")) != (char) -1) {
 		switch (c) {
 		case 'p':
 			port = atoi(optarg);
@@ -340,6 +340,9 @@ int main(int argc, char *argv[])
 		case 'n':
 			max_pairs_per_task = atoi(optarg);
 			break;
+		case 't':
+			threads_per_task = atoi(optarg);
+			break;
 		case 'e':
 			align_prog_args = strdup(optarg);
 			break;
@@ -389,6 +392,12 @@ int main(int argc, char *argv[])
 
 	cctools_version_debug(D_DEBUG, argv[0]);
 
+	// A task that aligns with more threads finishes as soon with more pairs.
+	if(threads_per_task < 1)
+		threads_per_task = 1;
+	if(max_pairs_per_task < 1)
+		max_pairs_per_task = MAX_PAIRS_PER_THREAD_DEFAULT * threads_per_task;
+
 
 	if((argc - optind) != 4) {
 		show_help(progname);
@@ -405,8 +414,8 @@ int main(int argc, char *argv[])
 	sequence_file_name = argv[optind + 2];
 	output_file_name = argv[optind + 3];
 
-	sequence_file = fopen(sequence_file_name, "r");
-	if(!sequence_file) {
+	sequence_store = sequence_store_open(sequence_file_name);
+	if(!sequence_store) {
 		fprintf(stderr, "%s: couldn't open sequence file %s: %s\n", progname, sequence_file_name, strerror(errno));
 		return 1;
 	}
@@ -440,7 +449,7 @@ int main(int argc, char *argv[])
 	work_queue_specify_name(queue, project);
 	work_queue_specify_priority(queue, priority);
 
-	sequence_table = hash_table_create(20000001, 0);
+	sequences_loaded = sequence_store_count(sequence_store);
 
 	start_time = time(0);
 
@@ -452,7 +461,7 @@ int main(int argc, char *argv[])
 			display_progress(queue);
 
 		while(more_candidates && work_queue_hungry(queue)) {
-			t = task_create(sequence_table);
+			t = task_create(sequence_store);
 			if(t) {
 				work_queue_submit(queue, t);
 				tasks_submitted++;
@@ -481,6 +490,7 @@ int main(int argc, char *argv[])
 
 	fclose(output_file);
 	fclose(candidate_file);
+	sequence_store_close(sequence_store);
 
 	work_queue_delete(queue);
 
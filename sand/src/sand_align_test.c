@@ -0,0 +1,330 @@
+/*
+Copyright (C) 2013- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+/*
+Checks that every alignment kernel available on this CPU gives the
+same alignments as the scalar kernel, on random pairs of sequences
+that overlap with mutations, and optionally measures the speed of
+each kernel in billions of cell updates per second (GCUPS).
+It also checks that a score only matrix describes the same alignments,
+apart from the traceback itself.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "align.h"
+#include "matrix.h"
+
+#include "macros.h"
+#include "timestamp.h"
+
+static const char *kernels[] = { "avx2", "sse2", "scalar", 0 };
+
+static int pairs = 2000;
+static int max_length = 600;
+static int benchmark = 0;
+
+struct test_pair {
+	char *a;
+	char *b;
+	int min_align;
+	int astart;
+	int bstart;
+	int k;
+};
+
+static void random_bases( char *s, int n )
+{
+	int i;
+	for(i=0;i<n;i++) s[i] = "ACGT"[lrand48()%4];
+	s[n] = 0;
+}
+
+/*
+Make a pair of sequences that overlap by a random amount, the second
+a mutated copy of the first, with random bases on either side.
+One pair in five is unrelated, and one in ten is very short.
+*/
+
+static void make_pair( struct test_pair *p, int max_length )
+{
+	int alength = 1 + lrand48() % (lrand48()%10 ? max_length : 20);
+	int offset = 0;
+	int i, n = 0;
+
+	p->a = malloc(alength+1);
+	p->b = malloc(3*max_length+64);
+	random_bases(p->a,alength);
+
+	if(lrand48()%5==0) {
+		random_bases(p->b,1+lrand48()%max_length);
+		offset = lrand48()%max_length - max_length/2;
+	} else {
+		offset = lrand48()%alength - alength/3;
+		if(offset<0) {
+			random_bases(p->b,-offset);
+			n = -offset;
+		}
+		for(i=MAX(offset,0);i<alength;i++) {
+			double r = drand48();
+			if(r<0.05) continue;
+			if(r<0.10) p->b[n++] = "ACGT"[lrand48()%4];
+			p->b[n++] = r<0.15 ? "ACGT"[lrand48()%4] : p->a[i];
+		}
+		random_bases(p->b+n,lrand48()%50);
+		if(!p->b[0]) random_bases(p->b,1);
+	}
+
+	p->min_align = lrand48()%50;
+	p->k = 5 + lrand48()%30;
+	offset += lrand48()%7 - 3;
+	p->astart = MAX(offset,0);
+	p->bstart = MAX(-offset,0);
+}
+
+static struct alignment * align_pair( struct matrix *m, struct test_pair *p, const char *type )
+{
+	if(!strcmp(type,"sw")) {
+		return align_smith_waterman(m,p->a,p->b);
+	} else if(!strcmp(type,"ps")) {
+		return align_prefix_suffix(m,p->a,p->b,p->min_align);
+	} else {
+		return align_banded(m,p->a,p->b,p->astart,p->bstart,p->k);
+	}
+}
+
+static int alignment_compare( struct alignment *x, struct alignment *y )
+{
+	return x->score==y->score
+		&& x->start1==y->start1 && x->end1==y->end1
+		&& x->start2==y->start2 && x->end2==y->end2
+		&& x->gap_count==y->gap_count && x->mismatch_count==y->mismatch_count
+		&& !strcmp(x->traceback,y->traceback);
+}
+
+static int check( struct test_pair *p, int count )
+{
+	static const char *types[] = { "sw", "ps", "banded" };
+	int i, t, k;
+	int failures = 0;
+
+	for(k=0;kernels[k];k++) {
+		if(!strcmp(kernels[k],"scalar")) continue;
+		if(!align_set_kernel(kernels[k])) {
+			printf("%s: not available on this cpu\n",kernels[k]);
+			continue;
+		}
+
+		for(i=0;i<count;i++) {
+			struct matrix *m = matrix_create(strlen(p[i].a),strlen(p[i].b));
+
+			for(t=0;t<3;t++) {
+				align_set_kernel("scalar");
+				struct alignment *expected = align_pair(m,&p[i],types[t]);
+				align_set_kernel(kernels[k]);
+				struct alignment *actual = align_pair(m,&p[i],types[t]);
+
+				if(!alignment_compare(expected,actual)) {
+					printf("%s: %s alignment of pair %d differs from scalar:\n",kernels[k],types[t],i);
+					printf("a: %s\nb: %s\n",p[i].a,p[i].b);
+					printf("scalar score %d traceback %s\n",expected->score,expected->traceback);
+					printf("%s score %d traceback %s\n",kernels[k],actual->score,actual->traceback);
+					failures++;
+				}
+
+				alignment_delete(expected);
+				alignment_delete(actual);
+			}
+
+			matrix_delete(m);
+		}
+
+		printf("%s: %d alignments of each type checked against scalar\n",kernels[k],count);
+	}
+
+	return failures;
+}
+
+/*
+The quality of an alignment of a single cell is not a number,
+and is not equal even to itself.
+*/
+
+static int summary_compare( struct alignment *x, struct alignment *y )
+{
+	return x->score==y->score
+		&& x->start1==y->start1 && x->end1==y->end1
+		&& x->start2==y->start2 && x->end2==y->end2
+		&& x->gap_count==y->gap_count && x->mismatch_count==y->mismatch_count
+		&& (x->quality==y->quality || (x->quality!=x->quality && y->quality!=y->quality));
+}
+
+/*
+A score only alignment may decline to describe an alignment that
+only a traceback can find, but otherwise must agree with the traceback.
+*/
+
+static int check_score_only( struct test_pair *p, int count )
+{
+	static const char *types[] = { "sw", "ps", "banded" };
+	int i, t, k;
+	int failures = 0;
+	int declined = 0;
+
+	struct matrix *m = matrix_create(1,1);
+	struct matrix *s = matrix_create_score_only(1,1);
+
+	for(k=0;kernels[k];k++) {
+		if(!align_set_kernel(kernels[k])) continue;
+
+		for(i=0;i<count;i++) {
+			matrix_resize(m,strlen(p[i].a),strlen(p[i].b));
+			matrix_resize(s,strlen(p[i].a),strlen(p[i].b));
+
+			for(t=0;t<3;t++) {
+				struct alignment *expected = align_pair(m,&p[i],types[t]);
+				struct alignment *actual = align_pair(s,&p[i],types[t]);
+
+				if(!actual) {
+					declined++;
+				} else if(!summary_compare(expected,actual)) {
+					printf("%s: score only %s alignment of pair %d differs:\n",kernels[k],types[t],i);
+					printf("a: %s\nb: %s\n",p[i].a,p[i].b);
+					printf("expected score %d at %d,%d to %d,%d with %d gaps and %d mismatches\n",expected->score,expected->start1,expected->start2,expected->end1,expected->end2,expected->gap_count,expected->mismatch_count);
+					printf("actual score %d at %d,%d to %d,%d with %d gaps and %d mismatches\n",actual->score,actual->start1,actual->start2,actual->end1,actual->end2,actual->gap_count,actual->mismatch_count);
+					failures++;
+				}
+
+				alignment_delete(expected);
+				alignment_delete(actual);
+			}
+		}
+
+		printf("%s: %d score only alignments of each type checked, %d left to the traceback\n",kernels[k],count,declined);
+		declined = 0;
+	}
+
+	matrix_delete(m);
+	matrix_delete(s);
+
+	return failures;
+}
+
+/*
+Align pairs of sequences of the same length, and count the cells
+that were actually computed, which for a banded alignment are
+only those within the band.
+*/
+
+static void measure( int length, int count )
+{
+	static const char *types[] = { "sw", "ps", "banded" };
+	struct test_pair p;
+	int i, t, k, d;
+
+	p.a = malloc(length+1);
+	p.b = malloc(length+1);
+	random_bases(p.a,length);
+	memcpy(p.b,p.a,length+1);
+	for(i=0;i<length/20;i++) p.b[lrand48()%length] = "ACGT"[lrand48()%4];
+	p.min_align = 0;
+	p.astart = p.bstart = 0;
+	p.k = 2 + 0.04 * length / 2.0;
+
+	struct matrix *m = matrix_create(length,length);
+
+	for(k=0;kernels[k];k++) {
+		if(!align_set_kernel(kernels[k])) continue;
+
+		for(t=0;t<3;t++) {
+			double cells = 0;
+			timestamp_t start = timestamp_get();
+
+			for(i=0;i<count;i++) {
+				alignment_delete(align_pair(m,&p,types[t]));
+				for(d=0;d<=2*length;d++) {
+					if(m->last[d]>=m->first[d]) cells += m->last[d] - m->first[d] + 1;
+				}
+			}
+
+			double elapsed = (timestamp_get() - start) / 1000000.0;
+			printf("%-8s %-8s %6d x %-6d %8.3lf GCUPS %10.1lf alignments/s\n",kernels[k],types[t],length,length,cells/elapsed/1e9,count/elapsed);
+		}
+	}
+
+	matrix_delete(m);
+	free(p.a);
+	free(p.b);
+}
+
+static void show_help(const char *cmd)
+{
+	printf("Usage: %s [options]\n", cmd);
+	printf(" -n <integer>   Number of random pairs to check. (default: %d)\n",pairs);
+	printf(" -l <integer>   Maximum length of the sequences. (default: %d)\n",max_length);
+	printf(" -s <integer>   Seed for the random pairs.\n");
+	printf(" -b             Measure the speed of each kernel instead.\n");
+	printf(" -h             Display this message.\n");
+}
+
+int main(int argc, char **argv)
+{
+	int seed = 1;
+	int i;
+	char c;
+
+	while((c = getopt(argc, argv, "n:l:s:bh")) != (char) -1) {
+		switch (c) {
+		case 'n':
+			pairs = atoi(optarg);
+			break;
+		case 'l':
+			max_length = atoi(optarg);
+			break;
+		case 's':
+			seed = atoi(optarg);
+			break;
+		case 'b':
+			benchmark = 1;
+			break;
+		default:
+		case 'h':
+			show_help(argv[0]);
+			exit(0);
+		}
+	}
+
+	srand48(seed);
+
+	if(benchmark) {
+		printf("fastest kernel on this cpu: %s\n",align_kernel_name());
+		measure(1000,20);
+		measure(5000,1);
+		return 0;
+	}
+
+	struct test_pair *p = malloc(sizeof(*p)*pairs);
+	for(i=0;i<pairs;i++) make_pair(&p[i],max_length);
+
+	int failures = check(p,pairs);
+	failures += check_score_only(p,pairs);
+
+	for(i=0;i<pairs;i++) {
+		free(p[i].a);
+		free(p[i].b);
+	}
+	free(p);
+
+	if(failures) {
+		printf("%d alignments differ\n",failures);
+		return 1;
+	}
+
+	return 0;
+}
@@ -24,6 +24,7 @@ static char *progname = "sand_filter_kernel";
 static int num_seqs;
 static int kmer_size = 22;
 static int window_size = 22;
+static int threads = 1;
 static unsigned long max_mem_kb = ULONG_MAX;
 
 static char *repeat_filename = 0;
@@ -58,6 +59,7 @@ static void show_help(const char *cmd)
 	printf(" -k <number>    The k-mer size to use in candidate selection (default is 22).\n");
 	printf(" -w <number>    The minimizer window size to use in candidate selection (default is 22).\n");
 	printf(" -o <filename>  The output file. Default is stdout.\n");
+	printf(" -t <number>    Number of threads to filter with (default is 1).\n");
 	printf("                output file to indicate it has ended (default is nothing)\n");
 	printf(" -d <subsys>    Enable debug messages for this subsystem.  Try 'd -all' to start .\n");
 	printf(" -v             Show version string\n");
@@ -68,7 +70,7 @@ static void get_options(int argc, char **argv, const char *progname)
 {
 	char c;
 
-	while((c = getopt(argc, argv, "d:r:s:k:w:f:o:vh")) != (char) -1) {
+	while((c = getopt(argc, argv, "d:r:s:k:w:f:o:t:vh")) != (char) -1) {
 		switch (c) {
 		case 'r':
 			repeat_filename = optarg;
@@ -95,6 +97,13 @@ static void get_options(int argc, char **argv, const char *progname)
 		case 'o':
 			output_filename = optarg;
 			break;
+		case 't':
+			threads = atoi(optarg);
+			if(threads < 1) {
+				fprintf(stderr, "Invalid number of threads %s\n", optarg);
+				exit(1);
+			}
+			break;
 		case 'd':
 			debug_flags_set(optarg);
 			break;
@@ -125,6 +134,7 @@ int main(int argc, char **argv)
 	FILE *input;
 	FILE *repeats = 0;
 	FILE *output;
+	struct sequence_filter *filter;
 
 	int start_x, end_x, start_y, end_y;
 
@@ -157,13 +167,12 @@ int main(int argc, char **argv)
 	// >>
 	// ...
 
-	set_k(kmer_size);
-	set_window_size(window_size);
+	filter = sequence_filter_create(kmer_size, window_size, threads);
 
 	// If we only give one file, do an all vs. all
 	// on them.
 	if(!second_sequence_filename) {
-		num_seqs = load_seqs(input);
+		num_seqs = load_seqs(filter, input);
 		start_x = 0;
 		end_x = num_seqs;
 		start_y = 0;
@@ -177,7 +186,7 @@ int main(int argc, char **argv)
 			fprintf(stderr, "Could not open file %s for reading.\n", second_sequence_filename);
 			exit(1);
 		}
-		num_seqs = load_seqs_two_files(input, &end_x, input2, &end_y);
+		num_seqs = load_seqs_two_files(filter, input, &end_x, input2, &end_y);
 		start_x = 0;
 		start_y = end_x;
 		debug(D_DEBUG,"First file contains %d sequences, stored from (%d,%d].\n", end_x, start_x, end_x);
@@ -187,11 +196,11 @@ int main(int argc, char **argv)
 
 	debug(D_DEBUG,"Loaded %d sequences\n",num_seqs);
 
-	init_cand_table(num_seqs * 5);
-	init_mer_table(num_seqs * 5);
+	init_cand_table(filter, num_seqs * 5);
+	init_mer_table(filter, num_seqs * 5);
 
 	if(repeats) {
-		int repeat_count = init_repeat_mer_table(repeats, 2000000, 0);
+		int repeat_count = init_repeat_mer_table(filter, repeats, 2000000, 0);
 		fclose(repeats);
 		debug(D_DEBUG,"Loaded %d repeated mers\n", repeat_count);
 	}
@@ -218,28 +227,28 @@ int main(int argc, char **argv)
 
 			start_mem = get_mem_usage();
 
-			load_mer_table_subset(curr_start_x, MIN(curr_start_x + rectangle_size, end_x), curr_start_y, MIN(curr_start_y + rectangle_size, end_y), (curr_start_x == curr_start_y));
+			load_mer_table_subset(filter, curr_start_x, MIN(curr_start_x + rectangle_size, end_x), curr_start_y, MIN(curr_start_y + rectangle_size, end_y), (curr_start_x == curr_start_y));
 
 			table_mem = get_mem_usage();
 
 			debug(D_DEBUG,"Finished loading, now generating candidates\n");
 			debug(D_DEBUG,"Memory used: %lu\n", table_mem - start_mem);
 
-			generate_candidates();
+			generate_candidates(filter);
 			cand_mem = get_mem_usage();
 
-			debug(D_DEBUG,"Total candidates generated: %llu\n", (long long unsigned int) total_cand);
 			debug(D_DEBUG,"Candidate memory used: %lu\n", cand_mem - table_mem);
 
-			output_list = retrieve_candidates(&num_in_list);
-			output_candidate_list(output, output_list, num_in_list);
+			output_list = retrieve_candidates(filter, &num_in_list);
+			debug(D_DEBUG,"Candidates generated: %d\n", num_in_list);
+			output_candidate_list(filter, output, output_list, num_in_list);
 			free(output_list);
 			fflush(output);
 
 			debug(D_DEBUG,"Now freeing\n");
 
-			free_cand_table();
-			free_mer_table();
+			free_cand_table(filter);
+			free_mer_table(filter);
 
 			debug(D_DEBUG,"Successfully output and freed!\n");
 
@@ -257,6 +266,7 @@ int main(int argc, char **argv)
 	}
 
 	fclose(output);
+	sequence_filter_delete(filter);
 
 	return 0;
 }
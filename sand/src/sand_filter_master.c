@@ -21,12 +21,12 @@ See the file COPYING for details.
 #include "work_queue_catalog.h"
 #include "memory_info.h"
 #include "macros.h"
-#include "delete_dir.h"
 #include "envtools.h"
 #include "stringtools.h"
 
 #include "compressed_sequence.h"
 #include "sequence_filter.h"
+#include "sequence_store.h"
 
 #include <sys/resource.h>
 
@@ -44,7 +44,6 @@ enum filter_master_task_result {
 static void get_options(int argc, char **argv, const char *progname);
 static void show_help(const char *cmd);
 static void load_sequences(const char *file);
-static size_t load_rectangle_to_file(int rect_id, struct cseq **sequences, int cseq_count);
 static void task_submit(struct work_queue *q, int curr_rect_x, int curr_rect_y);
 static void task_complete(struct work_queue_task *t);
 static void display_progress();
@@ -56,15 +55,14 @@ static int priority = 0;
 
 static int kmer_size = 22;
 static int window_size = 22;
-static int do_not_unlink = 0;
+static int threads_per_task = 1;
 static int retry_max = 100;
 
 static unsigned long int cand_count = 0;
 
-static struct cseq **sequences = 0;
+static struct sequence_store *sequences = 0;
 static int num_seqs = 0;
 static int num_rectangles = 0;
-static size_t *rectangle_sizes = 0;
 
 static struct work_queue *q = 0;
 
@@ -76,7 +74,6 @@ static const char *filter_program_name = "sand_filter_kernel";
 static char filter_program_args[255];
 static char filter_program_path[255];
 static const char *outfilename;
-static char *outdirname = 0;
 static FILE *outfile;
 static FILE *checkpoint_file = 0;
 
@@ -99,7 +96,7 @@ static void show_help(const char *cmd)
 	printf(" -R <n>         Automatically retry failed jobs up to n times. (default: %d)\n", retry_max);
 	printf(" -k <number>    The k-mer size to use in candidate selection (default is %d).\n", kmer_size);
 	printf(" -w <number>    The minimizer window size. (default is %d).\n", window_size);
-	printf(" -u             If set, do not unlink temporary binary output files.\n");
+	printf(" -t <number>    Number of threads that each task filters with. (default is %d)\n", threads_per_task);
 	printf(" -c <file>      Checkpoint filename; will be created if necessary.\n");
 	printf(" -d <subsystem> Enable debugging for this subsystem.  (Try -d all to start.)\n");
 	printf(" -F <#>         Work Queue fast abort multiplier.     (default is 10.)\n");
@@ -112,92 +109,30 @@ static void show_help(const char *cmd)
 	printf(" -h             Show this help screen\n");
 }
 
+/*
+Each rectangle is a run of consecutive sequences, and so a piece of the
+sequence file, which is sent to the tasks as it is.
+*/
+
 void load_sequences(const char *filename)
 {
-	FILE *file;
-	int i, count, rect_id, rectangle_count;
-	struct cseq *c;
-	size_t size;
-
-	rectangle_count = 256;
-	rectangle_sizes = malloc(rectangle_count * sizeof(size_t));
-
-	file = fopen(filename, "r");
-	if(!file)
-		fatal("couldn't open %s: %s\n", filename, strerror(errno));
-
-	debug(D_DEBUG, "rectangle size: %d\n", rectangle_size);
-	sequences = malloc(rectangle_size * sizeof(struct cseq *));
+	sequences = sequence_store_open(filename);
 	if(!sequences)
-		fatal("No enough memory to hold %d sequences. (%s) \n", rectangle_size, strerror(errno));
-
-
-	count = 0;
-	rect_id = 0;
-	while(1) {
-		c = cseq_read(file);
-		if(!c) {
-			if(count != rectangle_size && count > 0) {	// write the last rectangle to file
-				size = load_rectangle_to_file(rect_id, sequences, count);
-				if(!size)
-					fatal("Failed to write rectangle %d to file. (%s)\n", rect_id, strerror(errno));
-				rectangle_sizes[rect_id] = size;
-				rect_id++;
-				for(i = 0; i < count; i++)
-					cseq_free(sequences[i]);
-				debug(D_DEBUG, "Rectangle %d has been created.\n", rect_id - 1);
-			}
+		fatal("couldn't open %s: %s\n", filename, strerror(errno));
 
-			num_rectangles = rect_id;
-			break;
-		}
-		sequences[count] = c;
-		count++;
-		num_seqs++;
-
-		if(count == rectangle_size) {
-			size = load_rectangle_to_file(rect_id, sequences, count);
-			if(!size)
-				fatal("Failed to write rectangle %d to file. (%s)\n", rect_id, strerror(errno));
-			rectangle_sizes[rect_id] = size;
-			rect_id++;
-			if(rect_id == rectangle_count) {
-				rectangle_count = rectangle_count * 2;
-				rectangle_sizes = realloc(rectangle_sizes, rectangle_count * sizeof(size_t));
-				if(!rectangle_sizes)
-					fatal("Failed to allocate memory for holding rectangle sizes. Number of rectangles: %d. (%s)\n", rectangle_count, strerror(errno));
-			}
-			for(i = 0; i < count; i++)
-				cseq_free(sequences[i]);
-			count = 0;
-			debug(D_DEBUG, "Rectangle %d has been created.\n", rect_id - 1);
-		}
-	}
+	num_seqs = sequence_store_count(sequences);
+	num_rectangles = (num_seqs + rectangle_size - 1) / rectangle_size;
 
-	fclose(file);
-	free(sequences);
+	debug(D_DEBUG, "rectangle size: %d\n", rectangle_size);
+	debug(D_DEBUG, "%d sequences in %d rectangles\n", num_seqs, num_rectangles);
 }
 
-size_t load_rectangle_to_file(int rect_id, struct cseq **sequences, int cseq_count)
+static void specify_rectangle(struct work_queue_task *t, int rect_id, const char *remote_name)
 {
-	int i;
-	size_t size;
-	char tmpfilename[255];
-	FILE *tmpfile;
-
-	size = 0;
-	sprintf(tmpfilename, "%s/rect%03d.cfa", outdirname, rect_id);
-	tmpfile = fopen(tmpfilename, "w");
-	if(!tmpfile)
-		return 0;
-
-	for(i = 0; i < cseq_count; i++) {
-		cseq_write(tmpfile, sequences[i]);
-		size += cseq_size(sequences[i]);
-	}
-	fclose(tmpfile);
+	int first = rect_id * rectangle_size;
+	int last = MIN(first + rectangle_size, num_seqs);
 
-	return size;
+	work_queue_task_specify_file_piece(t, sequence_filename, remote_name, sequence_store_offset(sequences, first), sequence_store_offset(sequences, last) - 1, WORK_QUEUE_INPUT, WORK_QUEUE_CACHE);
 }
 
 static void init_checkpoint()
@@ -255,8 +190,6 @@ static void task_submit(struct work_queue *q, int curr_rect_x, int curr_rect_y)
 	char rname_x[32];
 	char rname_y[32];
 	char cmd[255];
-	char fname_x[255];
-	char fname_y[255];
 	char tag[32];
 
 	sprintf(tag, "%03d-%03d", curr_rect_y, curr_rect_x);
@@ -287,11 +220,9 @@ static void task_submit(struct work_queue *q, int curr_rect_x, int curr_rect_y)
 
 	// Add the rectangle. Add it as staged, so if the worker
 	// already has these sequences, there's no need to send them again.
-	sprintf(fname_x, "%s/%s", outdirname, rname_x);
-	work_queue_task_specify_file(t, fname_x, rname_x, WORK_QUEUE_INPUT, WORK_QUEUE_CACHE);
+	specify_rectangle(t, curr_rect_x, rname_x);
 	if(curr_rect_x != curr_rect_y) {
-		sprintf(fname_y, "%s/%s", outdirname, rname_y);
-		work_queue_task_specify_file(t, fname_y, rname_y, WORK_QUEUE_INPUT, WORK_QUEUE_CACHE);
+		specify_rectangle(t, curr_rect_y, rname_y);
 	}
 
 	work_queue_submit(q, t);
@@ -464,8 +395,7 @@ int main(int argc, char **argv)
 
 	work_queue_delete(q);
 
-	if(!do_not_unlink)
-		delete_dir(outdirname);
+	sequence_store_close(sequences);
 
 	return 0;
 }
@@ -477,7 +407,7 @@ static void get_options(int argc, char **argv, const char *progname)
 	char *catalog_host = NULL;
 	int catalog_port = 0;
 
-	while((c = getopt(argc, argv, "p:P:n:d:F:N:C:s:r:R:k:w:c:o:uxvha")) != (char) -1) {
+	while((c = getopt(argc, argv, "p:P:n:d:F:N:C:s:r:R:k:w:t:c:o:uxvha")) != (char) -1) {
 		switch (c) {
 		case 'p':
 			port = atoi(optarg);
@@ -497,6 +427,9 @@ static void get_options(int argc, char **argv, const char *progname)
 		case 'w':
 			window_size = atoi(optarg);
 			break;
+		case 't':
+			threads_per_task = atoi(optarg);
+			break;
 		case 'c':
 			checkpoint_filename = optarg;
 			break;
@@ -531,7 +464,7 @@ static void get_options(int argc, char **argv, const char *progname)
 			work_queue_master_mode = WORK_QUEUE_MASTER_MODE_CATALOG;
 			break;
 		case 'u':
-			do_not_unlink = 1;
+			fprintf(stderr, "%s: -u has no effect, since there are no longer any temporary files to keep.\n", progname);
 			break;
 		case 'o':
 			debug_config_file(optarg);
@@ -556,22 +489,15 @@ static void get_options(int argc, char **argv, const char *progname)
 	sequence_filename = argv[optind++];
 	outfilename = argv[optind++];
 
-	outdirname = malloc(strlen(outfilename) + 15);
-	sprintf(outdirname, "%s.filter.tmp", outfilename);
-
-	if(mkdir(outdirname, S_IRWXU) != 0) {
-		if(errno == EEXIST) {
-			fprintf(stderr, "%s: directory %s already exists, you may want to delete or rename before running.\n", progname, outdirname);
-		} else {
-			fprintf(stderr, "%s: couldn't create %s: %s\n", progname, outdirname, strerror(errno));
-			exit(1);
-		}
-	}
-
 	sprintf(filter_program_args, "-k %d -w %d -s d", kmer_size, window_size);
 
 	if(repeat_filename) {
 		sprintf(tmp, " -r %s", string_basename(repeat_filename));
 		strcat(filter_program_args, tmp);
 	}
+
+	if(threads_per_task > 1) {
+		sprintf(tmp, " -t %d", threads_per_task);
+		strcat(filter_program_args, tmp);
+	}
 }
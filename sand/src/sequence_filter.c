@@ -10,9 +10,13 @@ See the file COPYING for details.
 #include <limits.h>
 #include <stdarg.h>
 #include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <errno.h>
 
 #include "sequence_filter.h"
 #include "itable.h"
+#include "macros.h"
 
 #define EVEN_MASK 0xCCCCCCCCCCCCCCCCULL
 #define ODD_MASK  0x3333333333333333ULL
@@ -28,19 +32,27 @@ unsigned short short_masks[8] = { 65535, 16383, 4095, 1023, 255, 63, 15, 3 };
 #define SHORT_MASK_2 15
 #define SHORT_MASK_1 3
 
-static int k = 22;
-static mer_t k_mask = 0;
-static int WINDOW_SIZE = 22;
-static mer_t repeat_mask = 0;
+#define MER_VALUE(f,mer) ( (mer & (EVEN_MASK & (f)->k_mask)) | ((~mer) & (ODD_MASK & (f)->k_mask)) )
 
-#define MER_VALUE(mer) ( (mer & (EVEN_MASK & k_mask)) | ((~mer) & (ODD_MASK & k_mask)) )
+// The number of sequences whose minimizers are found before they are added to the mer table.
+#define SEQUENCES_PER_BATCH 4096
+
+/*
+The mer table and the candidate table are open addressed: each is a flat
+array of slots, a power of two in size, holding the index of an entry in
+an array of entries kept in the order that they were created.  A mer entry
+keeps the list of sequences in which the mer was found as a chain of
+indexes into a single array of list elements, the newest first.
+Nothing is allocated per mer or per candidate, and clearing the tables
+for the next rectangle keeps their memory for reuse.
+*/
 
 struct mer_list_elem_s
 {
 	int seq_num;
 	short loc;
 	char dir;
-	struct mer_list_elem_s * next;
+	int next;
 };
 
 typedef struct mer_list_elem_s mer_list_element;
@@ -48,9 +60,8 @@ typedef struct mer_list_elem_s mer_list_element;
 struct mer_hash_element_s
 {
 	mer_t mer;
-	mer_list_element * mle;
+	int mle;
 	unsigned char count;
-	struct mer_hash_element_s * next;
 };
 typedef struct mer_hash_element_s mer_hash_element;
 
@@ -59,128 +70,350 @@ struct cand_list_element_s
 	int cand1;
 	int cand2;
 	char dir;
-	int count;
 	short loc1;
 	short loc2;
-	struct cand_list_element_s * next;
 };
 typedef struct cand_list_element_s cand_list_element;
 
+struct slot_table
+{
+	int *slots;
+	int size;
+	int count;
+};
+
+// A minimizer of a sequence, and the mer table bucket where it belongs.
+struct found_mer
+{
+	mer_t mer;
+	int bucket;
+	short loc;
+	char dir;
+};
+
+/*
+The work of a rectangle is split among as many parts as there are threads.
+Each part finds the minimizers of its share of the sequences, and owns
+the mers whose buckets (the remainder of the mer over mer_table_buckets)
+fall between first_bucket and last_bucket, along with the candidates
+that those mers generate.  Because the parts together visit the buckets
+in order, the candidates are the same for any number of threads.
+*/
+
+struct filter_part
+{
+	struct sequence_filter *f;
+	int first_bucket;
+	int last_bucket;
+
+	struct found_mer *found;
+	int found_count;
+	int found_max;
+
+	struct slot_table mer_slots;
+	mer_hash_element *mers;
+	int mers_max;
+	mer_list_element *mer_lists;
+	int mer_lists_count;
+	int mer_lists_max;
+
+	struct slot_table cand_slots;
+	cand_list_element *candidates;
+	int candidates_max;
+};
+
+struct sequence_filter
+{
+	int k;
+	mer_t k_mask;
+	int window_size;
+	int threads;
+
+	struct cseq **seqs;
+	int num_seqs;
+	struct itable *repeat_mer_table;
+	int mer_table_buckets;
+	int cand_table_buckets;
+
+	int start_x;
+	int end_x;
+	int start_y;
+	int end_y;
+	int same_rect;
+
+	struct filter_part *parts;
+
+	// The sequences of the current batch, which part found the minimizers of each, and where.
+	int batch_count;
+	int batch_seqs[SEQUENCES_PER_BATCH];
+	int batch_part[SEQUENCES_PER_BATCH];
+	int batch_start[SEQUENCES_PER_BATCH];
+	int batch_end[SEQUENCES_PER_BATCH];
+};
+
 /* These are globals referenced directly by sand_filter_mer_seq. */
 /* This needs to be cleaned up. */
 
 int curr_rect_x = 0;
 int curr_rect_y = 0;
 int rectangle_size = 1000;
-unsigned long total_cand = 0;
-
-static int MER_TABLE_BUCKETS = 5000011; //20000003;
-static int CAND_TABLE_BUCKETS= 5000011; //20000003;
-static struct cseq ** all_seqs = 0;
-static cand_list_element ** candidates;
-static mer_hash_element ** mer_table;
-static struct itable * repeat_mer_table = 0;
-static int num_seqs = 0;
-
-static int start_x = 0;
-static int end_x = 0;
-static int start_y = 0;
-static int end_y = 0;
-static int same_rect;
 
 #define in_range(x, s, e) (  ((s) <= (x)) && ((x) < (e))   )
 
-void add_sequence_to_mer(mer_t mer, int i, char dir, short loc);
-mer_hash_element * find_mer(mer_t mer);
-void free_mer_table();
-void free_mer_hash_element(mer_hash_element * mhe);
-void free_mer_table();
-void free_cand_table();
-mer_list_element * create_mer_list_element(int seq_num, char dir, short loc);
-mer_hash_element * get_mer_hash_element(mer_t mer);
-void free_mer_list_element(mer_list_element * mle);
-void mer_generate_cands(mer_hash_element * mhe);
-void print_8mer(unsigned short mer);
-void set_k_mask();
-mer_t make_mer(const char * str);
-
-void add_candidate(int seq, int cand, char dir, mer_t mer, short loc1, short loc2);
-void free_cand_list_element(cand_list_element * cle);
-
-void find_all_kmers(int seq_num);
-void find_minimizers(int seq_num);
-minimizer get_minimizer(int seq_num, int window_start);
-mer_t get_kmer(struct cseq *c, int i);
-void print_16mer(mer_t mer16);
-mer_t rev_comp_mer(mer_t mer);
-
-void print_mhe(FILE * file, mer_hash_element * mhe);
-
-void init_cand_table( int buckets )
+static void add_sequence_to_mer(struct filter_part *p, mer_t mer, int i, char dir, short loc);
+static mer_hash_element * find_mer(struct filter_part *p, mer_t mer);
+static int create_mer_list_element(struct filter_part *p, int seq_num, char dir, short loc);
+static mer_hash_element * get_mer_hash_element(struct filter_part *p, mer_t mer);
+static void mer_generate_cands(struct filter_part *p, mer_hash_element * mhe);
+static mer_t make_mer(const char * str);
+
+static void add_candidate(struct filter_part *p, int seq, int cand, char dir, mer_t mer, short loc1, short loc2);
+
+static void find_minimizers(struct filter_part *p, int seq_num);
+static mer_t get_kmer(struct sequence_filter *f, struct cseq *c, int i);
+static mer_t rev_comp_mer(struct sequence_filter *f, mer_t mer);
+
+static void print_mhe(struct sequence_filter *f, FILE * file, struct filter_part *p, mer_hash_element * mhe);
+
+/*
+Fibonacci hashing spreads the keys over the high bits of the product,
+which choose the first slot to probe.
+*/
+
+static unsigned slot_hash( UINT64_T key, int size )
+{
+	return (unsigned) ((key * 0x9E3779B97F4A7C15ULL) >> 32) & (size - 1);
+}
+
+// Allocate t->size empty slots.
+static void slot_table_alloc( struct slot_table *t )
+{
+	t->slots = malloc(t->size * sizeof(int));
+	if (!t->slots)
+	{
+		fprintf(stderr, "sequence_filter: out of memory\n");
+		exit(1);
+	}
+	memset(t->slots, -1, t->size * sizeof(int));
+}
+
+static void slot_table_init( struct slot_table *t, int entries )
+{
+	free(t->slots);
+	t->size = 1024;
+	while (t->size < 2 * entries) t->size *= 2;
+	slot_table_alloc(t);
+	t->count = 0;
+}
+
+static void slot_table_clear( struct slot_table *t )
+{
+	if (t->count > 0) memset(t->slots, -1, t->size * sizeof(int));
+	t->count = 0;
+}
+
+// Find the empty slot where key belongs.
+static unsigned slot_table_free_slot( struct slot_table *t, UINT64_T key )
+{
+	unsigned slot = slot_hash(key, t->size);
+	while (t->slots[slot] >= 0) slot = (slot + 1) & (t->size - 1);
+	return slot;
+}
+
+// Make room for one more entry, doubling the table once it is half full.
+static void slot_table_grow( struct slot_table *t, struct filter_part *p, UINT64_T (*key)( struct filter_part *p, int entry ) )
 {
+	if (2 * (t->count + 1) <= t->size) return;
+
 	int i;
-	CAND_TABLE_BUCKETS = buckets;
-	candidates = malloc(CAND_TABLE_BUCKETS * sizeof(cand_list_element *));
-	for (i=0; i < CAND_TABLE_BUCKETS; i++)
+	int *old = t->slots;
+	int old_size = t->size;
+
+	t->size *= 2;
+	slot_table_alloc(t);
+
+	for (i = 0; i < old_size; i++)
 	{
-		candidates[i] = 0;
+		if (old[i] >= 0) t->slots[slot_table_free_slot(t, key(p, old[i]))] = old[i];
 	}
+
+	free(old);
 }
 
-void init_mer_table( int buckets )
+static void * array_grow( void *array, int *max, int needed, size_t size )
+{
+	if (needed <= *max) return array;
+
+	int new_max = *max ? *max : 1024;
+	while (new_max < needed) new_max *= 2;
+
+	array = realloc(array, new_max * size);
+	if (!array)
+	{
+		fprintf(stderr, "sequence_filter: out of memory\n");
+		exit(1);
+	}
+
+	*max = new_max;
+	return array;
+}
+
+/*
+Run func on every part, each in a thread of its own,
+and wait for all of them to finish.
+*/
+
+static void run_parts( struct sequence_filter *f, void *(*func)( void *arg ) )
 {
 	int i;
-	MER_TABLE_BUCKETS = buckets;
-	mer_table = malloc(MER_TABLE_BUCKETS * sizeof(mer_hash_element *));
-	for (i=0; i < MER_TABLE_BUCKETS; i++)
+
+	if (f->threads == 1)
 	{
-		mer_table[i] = 0;
+		func(&f->parts[0]);
+		return;
 	}
+
+	pthread_t *threads = malloc(f->threads * sizeof(pthread_t));
+
+	for (i = 0; i < f->threads; i++)
+	{
+		if (pthread_create(&threads[i], 0, func, &f->parts[i]) != 0)
+		{
+			fprintf(stderr, "sequence_filter: couldn't create thread: %s\n", strerror(errno));
+			exit(1);
+		}
+	}
+
+	for (i = 0; i < f->threads; i++)
+	{
+		pthread_join(threads[i], 0);
+	}
+
+	free(threads);
+}
+
+struct sequence_filter * sequence_filter_create( int k, int window_size, int threads )
+{
+	int i;
+	struct sequence_filter *f = calloc(1, sizeof(*f));
+
+	f->k = k;
+	f->window_size = window_size;
+	f->threads = MAX(threads, 1);
+
+	f->k_mask = 0;
+	for (i=0; i<k; i++)
+	{
+		// Push it over two bits and or by binary 11
+		// This amounts to pushing two 1's onto the right side.
+		f->k_mask = (f->k_mask << 2) | 3;
+	}
+
+	f->parts = calloc(f->threads, sizeof(struct filter_part));
+	for (i = 0; i < f->threads; i++) f->parts[i].f = f;
+
+	return f;
 }
 
-int load_seqs(FILE * input )
+void sequence_filter_delete( struct sequence_filter *f )
+{
+	int i;
+
+	if (!f) return;
+
+	for (i = 0; i < f->threads; i++)
+	{
+		struct filter_part *p = &f->parts[i];
+		free(p->found);
+		free(p->mer_slots.slots);
+		free(p->mers);
+		free(p->mer_lists);
+		free(p->cand_slots.slots);
+		free(p->candidates);
+	}
+	free(f->parts);
+
+	for (i = 0; i < f->num_seqs; i++) cseq_free(f->seqs[i]);
+	free(f->seqs);
+
+	if (f->repeat_mer_table)
+	{
+		UINT64_T key;
+		void *value;
+		itable_firstkey(f->repeat_mer_table);
+		while (itable_nextkey(f->repeat_mer_table, &key, &value)) free(value);
+		itable_delete(f->repeat_mer_table);
+	}
+
+	free(f);
+}
+
+void init_cand_table( struct sequence_filter *f, int buckets )
+{
+	int i;
+	f->cand_table_buckets = buckets;
+	for (i = 0; i < f->threads; i++)
+	{
+		slot_table_init(&f->parts[i].cand_slots, buckets / f->threads);
+	}
+}
+
+void init_mer_table( struct sequence_filter *f, int buckets )
+{
+	int i;
+	f->mer_table_buckets = buckets;
+	for (i = 0; i < f->threads; i++)
+	{
+		f->parts[i].first_bucket = (INT64_T) buckets * i / f->threads;
+		f->parts[i].last_bucket = (INT64_T) buckets * (i+1) / f->threads;
+		slot_table_init(&f->parts[i].mer_slots, buckets / f->threads);
+	}
+}
+
+int load_seqs(struct sequence_filter *f, FILE * input )
 {
 	int seq_count = sequence_count(input);
 
-	all_seqs = malloc(seq_count*sizeof(struct cseq *));
+	f->num_seqs = 0;
+	f->seqs = malloc(seq_count*sizeof(struct cseq *));
 	struct cseq *c;
 
 	while ((c=cseq_read(input))) {
-		all_seqs[num_seqs++] = c;
+		f->seqs[f->num_seqs++] = c;
 	}
 
-	return num_seqs;
+	return f->num_seqs;
 
 }
 
-int load_seqs_two_files(FILE * f1, int * end1, FILE * f2, int * end2)
+int load_seqs_two_files(struct sequence_filter *f, FILE * f1, int * end1, FILE * f2, int * end2)
 {
-	num_seqs = 0;
+	f->num_seqs = 0;
 	int count1 = sequence_count(f1);
 	int count2 = sequence_count(f2);
 
-	all_seqs = malloc((count1+count2)*sizeof(struct cseq *));
+	f->seqs = malloc((count1+count2)*sizeof(struct cseq *));
 	struct cseq *c;
 
 	while((c = cseq_read(f1))) {
-		all_seqs[num_seqs++] = c;
+		f->seqs[f->num_seqs++] = c;
 	}
 
-	*end1 = num_seqs;
+	*end1 = f->num_seqs;
 
 	while((c = cseq_read(f2))) {
-		all_seqs[num_seqs++] = c;
+		f->seqs[f->num_seqs++] = c;
 	}
 
-	*end2 = num_seqs;
+	*end2 = f->num_seqs;
 
-	return num_seqs;
+	return f->num_seqs;
 
 }
 
 // Loads up a set of mers from a file and stores them.
 // These mers cannot be treated as minimizers.
-int init_repeat_mer_table(FILE * repeats, unsigned long buckets, int max_mer_repeat)
+int init_repeat_mer_table(struct sequence_filter *f, FILE * repeats, unsigned long buckets, int max_mer_repeat)
 {
 	// Estimate the number of buckets here by dividing the file
 	// size by 25.
@@ -196,27 +429,27 @@ int init_repeat_mer_table(FILE * repeats, unsigned long buckets, int max_mer_rep
 	char str[1024];
 	int *count = malloc(sizeof(int));;
 	mer_t mer, rev;
-	repeat_mer_table = itable_create(buckets);
-	if (k_mask == 0) set_k_mask();
+	f->repeat_mer_table = itable_create(buckets);
 
 	while (fscanf(repeats, ">%d %s\n", count, str) == 2)
 	{
 		if (*count >= max_mer_repeat)
 		{
 			mer = make_mer(str);
-			rev = rev_comp_mer(mer);
-			if (MER_VALUE(mer) < MER_VALUE(rev))
-				itable_insert(repeat_mer_table, mer, count);
+			rev = rev_comp_mer(f, mer);
+			if (MER_VALUE(f, mer) < MER_VALUE(f, rev))
+				itable_insert(f->repeat_mer_table, mer, count);
 			else
-				itable_insert(repeat_mer_table, rev, count);
+				itable_insert(f->repeat_mer_table, rev, count);
+			count = malloc(sizeof(int));
 		}
-		count = malloc(sizeof(int));
 	}
+	free(count);
 
-	return itable_size(repeat_mer_table);
+	return itable_size(f->repeat_mer_table);
 }
 
-mer_t make_mer(const char * str)
+static mer_t make_mer(const char * str)
 {
 	mer_t mer = 0;
 	int i;
@@ -228,39 +461,7 @@ mer_t make_mer(const char * str)
 	return mer;
 }
 
-void rearrange_seqs_for_dist_framework()
-{
-	int i;
-
-	struct cseq ** top = malloc(rectangle_size*(sizeof(struct cseq *)));
-	struct cseq ** bottom = malloc(rectangle_size*(sizeof(struct cseq*)));
-
-	for (i=0; i < num_seqs; i+=2)
-	{
-		top[i/2] = all_seqs[i];
-		bottom[i/2] = all_seqs[i+1];
-	}
-	for (i=0; i<rectangle_size; i++)
-	{
-		all_seqs[i] = top[i];
-		all_seqs[i+rectangle_size] = bottom[i];
-	}
-
-	free(top);
-	free(bottom);
-}
-
-int compare_cand(const void * pair1, const void * pair2)
-{
-
-	// If c1.cand1 < c2.cand1, return a negative number, meaning less than.
-	// If c1.cand1 and c2.cand1 are equal, check the second one.
-	int diff = ((candidate_t *) pair1)->cand1 - ((candidate_t *) pair2)->cand1;
-	if (!diff) return ((candidate_t *) pair1)->cand2 - ((candidate_t *) pair2)->cand2;
-	return diff;
-}
-
-int output_candidate_list( FILE * file, candidate_t * list, int total_output )
+int output_candidate_list( struct sequence_filter *f, FILE * file, candidate_t * list, int total_output )
 {
 	if (!list) return 0;
 
@@ -270,131 +471,205 @@ int output_candidate_list( FILE * file, candidate_t * list, int total_output )
 	for (i=0; i<total_output; i++)
 	{
 		candidate_t pair = list[i];
-		fprintf(file, "%s\t%s\t%d\t%d\t%d\n", all_seqs[pair.cand1]->name, all_seqs[pair.cand2]->name, pair.dir, pair.loc1, (pair.dir == 1) ? pair.loc2 : all_seqs[pair.cand2]->num_bases - pair.loc2 - k);
+		fprintf(file, "%s\t%s\t%d\t%d\t%d\n", f->seqs[pair.cand1]->name, f->seqs[pair.cand2]->name, pair.dir, pair.loc1, (pair.dir == 1) ? pair.loc2 : f->seqs[pair.cand2]->num_bases - pair.loc2 - f->k);
 		total_printed++;
 	}
 	return total_printed;
 }
 
-candidate_t * retrieve_candidates(int * total_cand_ret)
+/*
+A candidate found by more than one part is kept as the part that visited
+it first found it.  Candidates are then listed by their sequences, and
+then newest first, which is the order that they had when the candidate
+table was chained.
+*/
+
+struct cand_ref
 {
-	int curr_index;
+	cand_list_element cand;
+	int order;
+};
+
+static int compare_cand_refs(const void * ref1, const void * ref2)
+{
+	const struct cand_ref * r1 = ref1;
+	const struct cand_ref * r2 = ref2;
+
+	if (r1->cand.cand1 != r2->cand.cand1) return r1->cand.cand1 - r2->cand.cand1;
+	if (r1->cand.cand2 != r2->cand.cand2) return r1->cand.cand2 - r2->cand.cand2;
+	if (r1->cand.dir != r2->cand.dir) return r1->cand.dir - r2->cand.dir;
+	return r1->order - r2->order;
+}
+
+candidate_t * retrieve_candidates(struct sequence_filter *f, int * total_cand_ret)
+{
+	int i, j;
+	int total_refs = 0;
 	int total_output = 0;
 
-	cand_list_element * cle;
+	for (i = 0; i < f->threads; i++) total_refs += f->parts[i].cand_slots.count;
 
-	candidate_t * candidate_list = malloc(total_cand*sizeof(struct candidate_s));
+	struct cand_ref * refs = malloc(total_refs*sizeof(struct cand_ref));
 
-	for (curr_index = 0; curr_index < CAND_TABLE_BUCKETS; curr_index++)
+	total_refs = 0;
+	for (i = 0; i < f->threads; i++)
 	{
-		cle = candidates[curr_index];	
-		while (cle)
+		struct filter_part *p = &f->parts[i];
+		for (j = 0; j < p->cand_slots.count; j++)
 		{
-			if (cle->count >= 1) 
-			{
-				candidate_list[total_output].cand1 = cle->cand1;
-				candidate_list[total_output].cand2 = cle->cand2;
-				candidate_list[total_output].dir = cle->dir;
-				candidate_list[total_output].loc1 = cle->loc1;
-				candidate_list[total_output].loc2 = cle->loc2;
-				total_output++;
-			}
-			cle = cle->next;
+			refs[total_refs].cand = p->candidates[j];
+			refs[total_refs].order = total_refs;
+			total_refs++;
+		}
+	}
+
+	qsort(refs, total_refs, sizeof(struct cand_ref), compare_cand_refs);
+
+	for (i = 0; i < total_refs; i++)
+	{
+		if (total_output > 0)
+		{
+			cand_list_element * prev = &refs[total_output-1].cand;
+			cand_list_element * c = &refs[i].cand;
+			if (prev->cand1 == c->cand1 && prev->cand2 == c->cand2 && prev->dir == c->dir) continue;
+		}
+		refs[total_output++] = refs[i];
+	}
+
+	// The same pair in both directions: the newer one goes first.
+	for (i = 1; i < total_output; i++)
+	{
+		if (refs[i].cand.cand1 == refs[i-1].cand.cand1 && refs[i].cand.cand2 == refs[i-1].cand.cand2 && refs[i].order > refs[i-1].order)
+		{
+			struct cand_ref r = refs[i];
+			refs[i] = refs[i-1];
+			refs[i-1] = r;
 		}
-		free_cand_list_element(candidates[curr_index]);
-		candidates[curr_index] = 0;
 	}
 
+	candidate_t * candidate_list = malloc(total_output*sizeof(struct candidate_s));
+
+	for (i = 0; i < total_output; i++)
+	{
+		cand_list_element * cle = &refs[i].cand;
+		candidate_list[i].cand1 = cle->cand1;
+		candidate_list[i].cand2 = cle->cand2;
+		candidate_list[i].dir = cle->dir;
+		candidate_list[i].loc1 = cle->loc1;
+		candidate_list[i].loc2 = cle->loc2;
+	}
+
+	free(refs);
+	free_cand_table(f);
+
 	*total_cand_ret = total_output;
-	qsort(candidate_list, total_output, sizeof(struct candidate_s), compare_cand);
 	return candidate_list;
 
 }
 
-void generate_candidates()
+/*
+The mers of a part are visited in the order that they had when the mer
+table was chained: by bucket, and then newest first.  A pair of sequences
+that share several mers keeps the locations of the first one visited,
+so this keeps the candidates the same.
+*/
+
+static int * mers_in_bucket_order(struct filter_part *p)
 {
-	int curr_bucket;
+	int i;
+	int buckets = p->last_bucket - p->first_bucket;
+	int * order = malloc(p->mer_slots.count * sizeof(int));
+	int * start = calloc(buckets + 1, sizeof(int));
+
+	for (i = 0; i < p->mer_slots.count; i++) start[p->mers[i].mer % p->f->mer_table_buckets - p->first_bucket + 1]++;
+	for (i = 0; i < buckets; i++) start[i+1] += start[i];
+	for (i = p->mer_slots.count - 1; i >= 0; i--) order[start[p->mers[i].mer % p->f->mer_table_buckets - p->first_bucket]++] = i;
 
-	mer_hash_element * mhe, *old_mhe;
+	free(start);
+	return order;
+}
 
-	for(curr_bucket = 0; curr_bucket < MER_TABLE_BUCKETS; curr_bucket++)
+static void * generate_part_candidates( void *arg )
+{
+	struct filter_part *p = arg;
+	int i;
+	int * order = mers_in_bucket_order(p);
+
+	for (i = 0; i < p->mer_slots.count; i++)
 	{
-		mhe = mer_table[curr_bucket];
-		while (mhe)
-		{
-			mer_generate_cands(mhe);
-			old_mhe = mhe;
-			mhe = mhe->next;
-			free(old_mhe);
-		}
-		mer_table[curr_bucket] = 0;
+		mer_generate_cands(p, &p->mers[order[i]]);
 	}
+
+	free(order);
+
+	slot_table_clear(&p->mer_slots);
+	p->mer_lists_count = 0;
+
+	return 0;
 }
 
-void mer_generate_cands(mer_hash_element * mhe)
+void generate_candidates(struct sequence_filter *f)
 {
-	if (!mhe) return;
+	run_parts(f, generate_part_candidates);
+}
 
-	mer_list_element *head, *curr;
+static void mer_generate_cands(struct filter_part *p, mer_hash_element * mhe)
+{
+	if (!mhe) return;
 
-	head = mhe->mle;
+	int head, curr;
 
-	while (head)
+	for (head = mhe->mle; head >= 0; head = p->mer_lists[head].next)
 	{
-		curr = head->next;
-		while (curr)
+		mer_list_element * h = &p->mer_lists[head];
+		for (curr = h->next; curr >= 0; curr = p->mer_lists[curr].next)
 		{
-			add_candidate(head->seq_num, curr->seq_num, head->dir * curr->dir, mhe->mer, head->loc, curr->loc);
-			curr = curr->next;
+			mer_list_element * c = &p->mer_lists[curr];
+			add_candidate(p, h->seq_num, c->seq_num, h->dir * c->dir, mhe->mer, h->loc, c->loc);
 		}
-		head = head->next;
 	}
-
-	free_mer_list_element(mhe->mle);
-	mhe->mle = 0;
 }
 
-void print_mer_table(FILE * file)
+void print_mer_table(struct sequence_filter *f, FILE * file)
 {
-	int curr_bucket;
-	mer_hash_element * mhe;
-	for (curr_bucket = 0; curr_bucket < MER_TABLE_BUCKETS; curr_bucket++)
+	int i, j;
+
+	for (i = 0; i < f->threads; i++)
 	{
-		mhe = mer_table[curr_bucket];
-		while (mhe)
+		struct filter_part *p = &f->parts[i];
+		int * order = mers_in_bucket_order(p);
+
+		for (j = 0; j < p->mer_slots.count; j++)
 		{
-			print_mhe(file, mhe);
-			mhe = mhe->next;
+			print_mhe(f, file, p, &p->mers[order[j]]);
 		}
+
+		free(order);
 	}
 }
 
-void print_mhe(FILE * file, mer_hash_element * mhe)
+static void print_mhe(struct sequence_filter *f, FILE * file, struct filter_part *p, mer_hash_element * mhe)
 {
 	if (!mhe) return;
 
-	mer_list_element *head, *curr;
-	head = mhe->mle;
-	char mer_str[k+1];
+	int head, curr;
+	char mer_str[f->k+1];
 
-	while(head)
+	for (head = mhe->mle; head >= 0; head = p->mer_lists[head].next)
 	{
-		curr = head->next;
-		while (curr)
+		for (curr = p->mer_lists[head].next; curr >= 0; curr = p->mer_lists[curr].next)
 		{
-			translate_kmer(mhe->mer, mer_str, k);
-			fprintf(file, "%s\t%d\t%s\t%s\t%d\n", mer_str, mhe->count, all_seqs[head->seq_num]->name, all_seqs[curr->seq_num]->name, (int) (head->dir * curr->dir));
-			curr = curr->next;
+			translate_kmer(mhe->mer, mer_str, f->k);
+			fprintf(file, "%s\t%d\t%s\t%s\t%d\n", mer_str, mhe->count, f->seqs[p->mer_lists[head].seq_num]->name, f->seqs[p->mer_lists[curr].seq_num]->name, (int) (p->mer_lists[head].dir * p->mer_lists[curr].dir));
 		}
-		head = head->next;
 	}
 }
 
-mer_t rev_comp_mer(mer_t mer)
+static mer_t rev_comp_mer(struct sequence_filter *f, mer_t mer)
 {
 	mer_t new_mer = 0;
 	int i;
-	for (i = 0; i < k; i++)
+	for (i = 0; i < f->k; i++)
 	{
 		// Build new_mer by basically popping off the LSB of mer (mer >> 2)
 		// and pushing to the LSB of new_mer.
@@ -403,21 +678,23 @@ mer_t rev_comp_mer(mer_t mer)
 		mer = mer >> 2;
 	}
 	// Now it's reversed, so complement it, but mask it by k_mask so only the important bits get complemented.
-	return (~new_mer) & k_mask;
+	return (~new_mer) & f->k_mask;
 }
 
-
-void find_all_kmers(int seq_num)
+// Keep a minimizer of a sequence for the mer table, unless it is a repeat.
+static void add_found_mer(struct filter_part *p, minimizer *m)
 {
-	mer_t mer16;
-	int i;
-	int end = all_seqs[seq_num]->num_bases - 15;
+	struct sequence_filter *f = p->f;
 
-	for (i = 0; i<end; i+=8)
-	{
-		mer16 = get_kmer(all_seqs[seq_num], i);
-		add_sequence_to_mer(mer16, seq_num, (char) 1, (short) i);
-	}
+	if (f->repeat_mer_table && itable_lookup(f->repeat_mer_table, m->mer)) return;
+
+	p->found = array_grow(p->found, &p->found_max, p->found_count + 1, sizeof(*p->found));
+
+	struct found_mer *fm = &p->found[p->found_count++];
+	fm->mer = m->mer;
+	fm->bucket = m->mer % f->mer_table_buckets;
+	fm->loc = m->loc;
+	fm->dir = m->dir;
 }
 
 // Each time you move the window, you add a new kmer.
@@ -426,13 +703,15 @@ void find_all_kmers(int seq_num)
 //    If so, set it as the new one.
 // 2. Is the current absolute minimizer now outside the window?
 //    If so, check the window to find a NEW absolute minimizer, and add it.
-void find_minimizers(int seq_num)
+static void find_minimizers(struct filter_part *p, int seq_num)
 {
+	struct sequence_filter *f = p->f;
+	struct cseq *c = f->seqs[seq_num];
 	int i;
-	int end = all_seqs[seq_num]->num_bases - k + 1;
+	int end = c->num_bases - f->k + 1;
 	mer_t mer, rev, mer_val, rev_val;
 
-	minimizer window[WINDOW_SIZE];
+	minimizer window[f->window_size];
 	minimizer abs_min;
 	int abs_min_index = 0;
 	int index;
@@ -443,12 +722,12 @@ void find_minimizers(int seq_num)
 	abs_min.dir = 0;
 
 	// First, just populate the first window and get the first minimizer.
-	for (i = 0; i < WINDOW_SIZE; i++)
+	for (i = 0; i < f->window_size; i++)
 	{
-		mer = get_kmer(all_seqs[seq_num], i);
-		rev = rev_comp_mer(mer);
-		mer_val = MER_VALUE(mer);
-		rev_val = MER_VALUE(rev);
+		mer = get_kmer(f, c, i);
+		rev = rev_comp_mer(f, mer);
+		mer_val = MER_VALUE(f, mer);
+		rev_val = MER_VALUE(f, rev);
 
 		if (mer_val < rev_val)
 		{
@@ -472,18 +751,18 @@ void find_minimizers(int seq_num)
 	}
 
 	// Add the absolute minimizer for the first window.
-	add_sequence_to_mer(abs_min.mer, seq_num, abs_min.dir, abs_min.loc);
+	add_found_mer(p, &abs_min);
 
-	for (i = WINDOW_SIZE; i < end; i++)
+	for (i = f->window_size; i < end; i++)
 	{
-		index = i%WINDOW_SIZE;
+		index = i%f->window_size;
 
 		// First, add the new k-mer to the window, evicting the k-mer that is
 		// no longer in the window
-		mer = get_kmer(all_seqs[seq_num], i);
-		rev = rev_comp_mer(mer);
-		mer_val = MER_VALUE(mer);
-		rev_val = MER_VALUE(rev);
+		mer = get_kmer(f, c, i);
+		rev = rev_comp_mer(f, mer);
+		mer_val = MER_VALUE(f, mer);
+		rev_val = MER_VALUE(f, rev);
 
 		if (mer_val < rev_val)
 		{
@@ -501,13 +780,12 @@ void find_minimizers(int seq_num)
 		}
 
 		// Now, check if the new k-mer is better than the current absolute minimizer.
-		//if (window[index].value < abs_min.value)
 		if (window[index].value < abs_min.value)
 		{
 			// If so, set it as the new absolute minimizer and add this sequence to the mer table
 			abs_min = window[index];
 			abs_min_index = index;
-			add_sequence_to_mer(abs_min.mer, seq_num, abs_min.dir, abs_min.loc);
+			add_found_mer(p, &abs_min);
 		}
 		// Now, check if the current absolute minimizer is out of the window
 		// We just replaced index, so if abs_min_index == index, we just evicted
@@ -516,10 +794,10 @@ void find_minimizers(int seq_num)
 		{
 			// Find the new minimizer
 			// If runtime starts to suffer I can implement something better than a linear search,
-			// but because WINDOW_SIZE is a small constant (around 20) it should be OK.
+			// but because the window size is a small constant (around 20) it should be OK.
 			abs_min.value = MINIMIZER_MAX;
 			abs_min.dir = 0;
-			for (j = 0; j < WINDOW_SIZE; j++)
+			for (j = 0; j < f->window_size; j++)
 			{
 				if (window[j].value < abs_min.value)
 				{
@@ -528,156 +806,20 @@ void find_minimizers(int seq_num)
 				}
 			}
 			// Add the new current minimizer to the mer table.
-			add_sequence_to_mer(abs_min.mer, seq_num, abs_min.dir, abs_min.loc);
+			add_found_mer(p, &abs_min);
 		}
 	}
 }
 
-// Gets the next minimizer for this sequence.  Returns 1 if it worked, 0 if we're at the end of the sequence.
-int get_next_minimizer(int seq_num, minimizer * next_minimizer )
+static mer_t get_kmer(struct sequence_filter *f, struct cseq *c, int curr)
 {
-	static int i = 0;
-	static int index = 0;
-	static minimizer * window = 0;
-	static minimizer abs_min = {0, ULONG_MAX, -1, 0};
-	static int abs_min_index = 0;
-	static int prev_seq_num = -1;
-	static int end;
-
-	mer_t mer, rev, mer_val, rev_val;
-
-	// Re-initialize everything if the sequence we are using changes.
-	if (seq_num != prev_seq_num)
-	{
-		if (!window) window = malloc(WINDOW_SIZE*sizeof(minimizer));
-		i = 0;
-		index = 0;
-		abs_min.mer = 0;
-		abs_min.value = ULONG_MAX;
-		abs_min.dir = 0;
-		abs_min.loc = -1;
-		abs_min_index = 0;
-		end = all_seqs[seq_num]->num_bases - k + 1;
-		prev_seq_num = seq_num;
-	}
-
-	// If we haven't populated the whole window yet, do so now.
-	if (i == 0)
-	{
-		index = i;
-		for (i = 0; i < WINDOW_SIZE; i++)
-		{
-			// Get the current mer, its reverse complement, and its minimizer values.
-			mer = get_kmer(all_seqs[seq_num], i);
-			rev = rev_comp_mer(mer);
-			mer_val = MER_VALUE(mer);
-			rev_val = MER_VALUE(rev);
-
-			// Add them to the window.
-
-			if (mer_val < rev_val)
-			{
-				window[index].mer = mer;
-				window[index].value = mer_val;
-				window[index].dir = 1;
-				window[index].loc = i;
-			}
-			else
-			{
-				window[index].mer = rev;
-				window[index].value = rev_val;
-				window[index].dir = -1;
-				window[index].loc = i;
-			}
-			if (window[index].value < abs_min.value)
-			{
-				abs_min = window[index];
-				abs_min_index = index;
-			}
-		}
-
-		// Now, return the minimizer we found (it will be the first minimizer for the list)
-		*next_minimizer = abs_min;
-
-		return 1;
-	}
-
-	// Otherwise, we can just continue on from the current position of i.
-	for ( ; i < end; i++)
-	{
-		index = i%WINDOW_SIZE;
-
-		// First, add the new k-mer to the window, evicting the k-mer that is
-		// no longer in the window
-		mer = get_kmer(all_seqs[seq_num], i);
-		rev = rev_comp_mer(mer);
-		mer_val = MER_VALUE(mer);
-		rev_val = MER_VALUE(rev);
-
-		if (mer_val < rev_val)
-		{
-			window[index].mer = mer;
-			window[index].value = mer_val;
-			window[index].dir = 1;
-			window[index].loc = i;
-		}
-		else
-		{
-			window[index].mer = rev;
-			window[index].value = rev_val;
-			window[index].dir = -1;
-			window[index].loc = i;
-		}
-
-		// Now, check if the new k-mer is better than the current absolute minimizer.
-		if (window[index].value < abs_min.value)
-		{
-			// If so, set it as the new absolute minimizer and add this sequence to the mer table
-			abs_min = window[index];
-			abs_min_index = index;
-			*next_minimizer = abs_min;
-			i++;  // Increment i so we won't process this k-mer again.
-			return 1;
-		}
-		// Now, check if the current absolute minimizer is out of the window
-		// We just replaced index, so if abs_min_index == index, we just evicted
-		// the current minimizer.
-		else if (abs_min_index == index)
-		{
-			// Find the new minimizer
-			// If runtime starts to suffer I can implement something better than a linear search,
-			// but because WINDOW_SIZE is a small constant (around 20) it should be OK.
-			int j;
-			abs_min.value = ULONG_MAX;
-			abs_min.dir = 0;
-			for (j = 0; j < WINDOW_SIZE; j++)
-			{
-				if (window[j].value < abs_min.value)
-				{
-					abs_min = window[j];
-					abs_min_index = j;
-				}
-			}
-			// Add the new current minimizer to the mer table.
-			*next_minimizer = abs_min;
-			i++;   // Increment i so we won't process this k-mer again.
-			return 1;
-		}
-	}
-
-	// We made it to the end of the sequence without finding a new minimizer, so we are done.
-	return 0;
-}
-
-mer_t get_kmer(struct cseq *c, int curr)
-{
-	// Which mer does this kmer start in? 
+	// Which mer does this kmer start in?
 	int which_mer = curr/8;
 	int which_base = curr%8;
 	unsigned short curr_mer = 0;
 	mer_t mer = 0;
 
-	int bases_left = k;
+	int bases_left = f->k;
 
 	// Start from the first base and push k bases.
 	while (bases_left > 0)
@@ -724,19 +866,6 @@ mer_t get_kmer(struct cseq *c, int curr)
 	return mer;
 }
 
-void print_8mer(unsigned short mer)
-{
-	char str[9];
-	int i;
-	for (i=0; i<8; i++)
-	{
-		str[i] = num_to_base((mer >> ((8-1)-i)*2) & 3);
-	}
-	str[8] = '\0';
-
-	printf("%s\n", str);
-}
-
 void translate_kmer(mer_t mer, char * str, int length)
 {
 	//print_mer(stderr, mer);
@@ -759,305 +888,256 @@ void translate_kmer(mer_t mer, char * str, int length)
 }
 
 
-void add_sequence_to_mer(mer_t mer, int seq_num, char dir, short loc)
+static void add_sequence_to_mer(struct filter_part *p, mer_t mer, int seq_num, char dir, short loc)
 {
-	// Store the sequence and its reverse complement as the same key.
-
-	if (repeat_mer_table && itable_lookup(repeat_mer_table, mer)) return;
-
-	mer_list_element * mle, * new_mle;
-
 	// This will create it if it doesn't exist.
-	mer_hash_element * mhe = get_mer_hash_element(mer);
-
-	// Check that the list exists.
-	if (!mhe->mle)
-	{
-		// If not, create it, increment the count and we're done.
-		new_mle = create_mer_list_element(seq_num, dir, loc);
-		mhe->mle = new_mle;
-		mhe->count++;
-		return;
-	}
-
-	// If a list does exist, add this sequence it.
-
-	mle = mhe->mle;
+	mer_hash_element * mhe = get_mer_hash_element(p, mer);
 
 	// Because we add one sequence at a time, this will be at the front
 	// if it has ever had this mer before, so we don't add it twice.
-	if (mle->seq_num == seq_num) return;
+	if (mhe->mle >= 0 && p->mer_lists[mhe->mle].seq_num == seq_num) return;
 
-	new_mle = create_mer_list_element(seq_num, dir, loc);
-	new_mle->next = mle;
+	// Creating the element may move the lists, but not the mer.
+	int new_mle = create_mer_list_element(p, seq_num, dir, loc);
+	p->mer_lists[new_mle].next = mhe->mle;
 	mhe->mle = new_mle;
 	mhe->count++;
-	
+
 }
 
-mer_list_element * create_mer_list_element(int seq_num, char dir, short loc)
+static int create_mer_list_element(struct filter_part *p, int seq_num, char dir, short loc)
 {
-	mer_list_element * new_mle = malloc(sizeof(*new_mle));
+	p->mer_lists = array_grow(p->mer_lists, &p->mer_lists_max, p->mer_lists_count + 1, sizeof(*p->mer_lists));
+
+	mer_list_element * new_mle = &p->mer_lists[p->mer_lists_count];
 	new_mle->seq_num = seq_num;
 	new_mle->dir = dir;
 	new_mle->loc = loc;
-	new_mle->next = 0;
+	new_mle->next = -1;
 
-	return new_mle;
+	return p->mer_lists_count++;
 }
 
-mer_hash_element * get_mer_hash_element(mer_t mer)
+static UINT64_T mer_key( struct filter_part *p, int entry )
 {
-	int bucket = mer % MER_TABLE_BUCKETS;
-	mer_hash_element * mhe;
+	return p->mers[entry].mer;
+}
 
-	// If there are no hash elements in this bucket
-	// Add a new one.
-	if (!mer_table[bucket])
-	{
-		mhe = malloc(sizeof(*mhe));
-		mhe->mer = mer;
-		mhe->count = 0;
-		mhe->mle = 0;
-		mhe->next = 0;
-		mer_table[bucket] = mhe;
-		return mhe;
-	}
+static mer_hash_element * get_mer_hash_element(struct filter_part *p, mer_t mer)
+{
+	mer_hash_element * mhe = find_mer(p, mer);
+	if (mhe) return mhe;
 
-	mhe = find_mer(mer);
-
-	// If this bucket is not empty, but does not contain this mer, add it.
-	if (!mhe) {
-		mer_hash_element * new_mhe = malloc(sizeof(*new_mhe));
-		new_mhe->mer = mer;
-		new_mhe->count = 0;
-		new_mhe->mle = 0;
-		new_mhe->next = mer_table[bucket];
-		mer_table[bucket] = new_mhe;
-		return new_mhe;
-	} else {
-		return mhe;
-	}
+	// This mer is not in the table, so add it.
+	slot_table_grow(&p->mer_slots, p, mer_key);
+	p->mers = array_grow(p->mers, &p->mers_max, p->mer_slots.count + 1, sizeof(*p->mers));
+
+	mhe = &p->mers[p->mer_slots.count];
+	mhe->mer = mer;
+	mhe->count = 0;
+	mhe->mle = -1;
+	p->mer_slots.slots[slot_table_free_slot(&p->mer_slots, mer)] = p->mer_slots.count++;
+
+	return mhe;
 }
 
-mer_hash_element * find_mer(mer_t mer)
+static mer_hash_element * find_mer(struct filter_part *p, mer_t mer)
 {
-	int bucket = mer % MER_TABLE_BUCKETS;
-
-	mer_hash_element * mhe = mer_table[bucket];
+	unsigned slot = slot_hash(mer, p->mer_slots.size);
 
-	while (mhe)
+	while (p->mer_slots.slots[slot] >= 0)
 	{
+		mer_hash_element * mhe = &p->mers[p->mer_slots.slots[slot]];
 		if (mhe->mer == mer) { return mhe; }
-		mhe = mhe->next;
+		slot = (slot + 1) & (p->mer_slots.size - 1);
 	}
 
 	return 0;
 }
 
-void free_mer_table()
+void free_mer_table(struct sequence_filter *f)
 {
-	int curr_mhe = 0;
+	int i;
 
-	for (; curr_mhe < MER_TABLE_BUCKETS; curr_mhe++)
+	for (i = 0; i < f->threads; i++)
 	{
-		free_mer_hash_element(mer_table[curr_mhe]);
+		slot_table_clear(&f->parts[i].mer_slots);
+		f->parts[i].mer_lists_count = 0;
 	}
 }
 
-void free_mer_hash_element(mer_hash_element * mhe)
+// Find the minimizers of this part's share of the batch.
+static void * find_part_minimizers( void *arg )
 {
-	if (!mhe) return;
-
-	free_mer_list_element(mhe->mle);
-	mer_hash_element * n = mhe->next;
-	free(mhe);
-	free_mer_hash_element(n);
-}
+	struct filter_part *p = arg;
+	struct sequence_filter *f = p->f;
+	int part = p - f->parts;
+	int first = (INT64_T) f->batch_count * part / f->threads;
+	int last = (INT64_T) f->batch_count * (part+1) / f->threads;
+	int i;
 
-void free_mer_list_element(mer_list_element * mle)
-{
-	if (!mle) return;
+	p->found_count = 0;
 
-	mer_list_element * n = mle->next;
-	free(mle);
-	free_mer_list_element(n);
-}
-
-void set_k(int new_k)
-{
-	k = new_k;
-	set_k_mask();
-}
+	for (i = first; i < last; i++)
+	{
+		f->batch_part[i] = part;
+		f->batch_start[i] = p->found_count;
+		find_minimizers(p, f->batch_seqs[i]);
+		f->batch_end[i] = p->found_count;
+	}
 
-void set_window_size(int new_size)
-{
-	WINDOW_SIZE = new_size;
+	return 0;
 }
 
-void set_k_mask()
+// Add the minimizers of the batch that belong in this part's buckets, in the order of the sequences.
+static void * add_part_minimizers( void *arg )
 {
-	int i;
+	struct filter_part *p = arg;
+	struct sequence_filter *f = p->f;
+	int i, j;
 
-	k_mask = 0;
-	for (i=0; i<k; i++)
+	for (i = 0; i < f->batch_count; i++)
 	{
-		// Push it over two bits and or by binary 11
-		// This amounts to pushing two 1's onto the right side.
-		k_mask = (k_mask << 2) | 3;
+		struct found_mer *found = f->parts[f->batch_part[i]].found;
+		for (j = f->batch_start[i]; j < f->batch_end[i]; j++)
+		{
+			struct found_mer *fm = &found[j];
+			if (fm->bucket < p->first_bucket || fm->bucket >= p->last_bucket) continue;
+			add_sequence_to_mer(p, fm->mer, f->batch_seqs[i], fm->dir, fm->loc);
+		}
 	}
+
+	return 0;
 }
 
-void load_mer_table()
+static void load_batch(struct sequence_filter *f)
 {
-	int curr_col, end_col, curr_row, end_row;
-	curr_col = curr_rect_x*rectangle_size;
-	end_col = curr_col+rectangle_size;
-	if (end_col > num_seqs) { end_col = num_seqs; }
+	if (f->batch_count == 0) return;
 
-	curr_row = curr_rect_y*rectangle_size;
-	end_row = curr_row+rectangle_size;
-	if (end_row > num_seqs) { end_row = num_seqs; }
+	run_parts(f, find_part_minimizers);
+	run_parts(f, add_part_minimizers);
 
-	load_mer_table_subset(curr_col, end_col, curr_row, end_row, (curr_rect_x == curr_rect_y));
+	f->batch_count = 0;
 }
 
-void load_mer_table_subset(int curr_col, int end_col, int curr_row, int end_row, int is_same_rect)
+static void add_to_batch(struct sequence_filter *f, int seq_num)
 {
+	f->batch_seqs[f->batch_count++] = seq_num;
+	if (f->batch_count == SEQUENCES_PER_BATCH) load_batch(f);
+}
 
-	mer_t repeat_mask_rev;
-
-	if (k_mask == 0) { set_k_mask(); }
-	repeat_mask_rev = rev_comp_mer(repeat_mask);
-	if (MER_VALUE(repeat_mask_rev) < MER_VALUE(repeat_mask)) repeat_mask = repeat_mask_rev;
-
-	start_x = curr_col;
-	end_x = end_col;
-	start_y = curr_row;
-	end_y = end_row;
-	same_rect = is_same_rect;
+void load_mer_table_subset(struct sequence_filter *f, int curr_col, int end_col, int curr_row, int end_row, int is_same_rect)
+{
+	f->start_x = curr_col;
+	f->end_x = end_col;
+	f->start_y = curr_row;
+	f->end_y = end_row;
+	f->same_rect = is_same_rect;
 
 	// This is an imaginary matrix, but we're loading all the sequences
 	// on a given rectangle, defined by curr_rect_x, curr_rect_y and rectangle_size.
 	// Load the mers in each of these sequences, then we'll output any matches.
+	// The sequences are loaded in batches, so that the minimizers of a batch
+	// may be found in parallel before they are added to the mer table.
 
 	for ( ;	curr_col < end_col; curr_col++ )
 	{
-		find_minimizers(curr_col);
+		add_to_batch(f, curr_col);
 	}
 
 	// If we are on the diagonal, don't need to add both, because they are the same.
-	if (is_same_rect) { return; }
-
-	for ( ;	curr_row < end_row; curr_row++ )
+	if (!is_same_rect)
 	{
-		find_minimizers(curr_row);
-	}
-}
-
-cand_list_element * create_new_cle(int seq1, int seq2, int dir, int loc1, int loc2)
-{
-	cand_list_element * new_cle = malloc(sizeof(*new_cle));
-	if (seq1 < seq2)
-	{
-		new_cle->cand1 = seq1;
-		new_cle->cand2 = seq2;
-		new_cle->loc1 = loc1;
-		new_cle->loc2 = loc2;
-	}
-	else
-	{
-		new_cle->cand2 = seq1;
-		new_cle->cand1 = seq2;
-		new_cle->loc2 = loc1;
-		new_cle->loc1 = loc2;
+		for ( ;	curr_row < end_row; curr_row++ )
+		{
+			add_to_batch(f, curr_row);
+		}
 	}
-	new_cle->dir = dir;
-	new_cle->next = 0;
-	new_cle->count = 1;
 
-	return new_cle;
+	load_batch(f);
 }
 
-int should_compare_cands(int c1, int c2)
+static int should_compare_cands(struct sequence_filter *f, int c1, int c2)
 {
 	// If the two rectangles are equal, then we are intended to compare
 	// two from the same rectangle, so return 1.
-	if (same_rect) { return 1; }
+	if (f->same_rect) { return 1; }
 
 	// Otherwise, return false if they are in the same rectangle,
 	// true otherwise.
-	if (in_range(c1, start_x, end_x) && in_range(c2, start_x, end_x)) {  return 0; }
-	if (in_range(c1, start_y, end_y) && in_range(c2, start_y, end_y)) { return 0; }
+	if (in_range(c1, f->start_x, f->end_x) && in_range(c2, f->start_x, f->end_x)) {  return 0; }
+	if (in_range(c1, f->start_y, f->end_y) && in_range(c2, f->start_y, f->end_y)) { return 0; }
 
 	return 1;
 }
 
-void add_candidate(int seq, int cand, char dir, mer_t min, short loc1, short loc2)
+/*
+A candidate is keyed by its pair of sequences, the lower first,
+and by its direction.
+*/
+
+static UINT64_T cand_key_of( int cand1, int cand2, char dir )
+{
+	return ((UINT64_T) cand1 << 32) ^ ((UINT64_T) cand2 << 1) ^ (dir > 0);
+}
+
+static UINT64_T cand_key( struct filter_part *p, int entry )
+{
+	return cand_key_of(p->candidates[entry].cand1, p->candidates[entry].cand2, p->candidates[entry].dir);
+}
+
+static void add_candidate(struct filter_part *p, int seq, int cand, char dir, mer_t min, short loc1, short loc2)
 {
 	// Unless this is a diagonal, ones from the same block have already been compared.
 	// If I don't do this step, then ones from the same block on the same axis
 	// could get compared, because we don't really distinguish them.
 
-	if (!should_compare_cands(seq, cand)) return;
+	if (!should_compare_cands(p->f, seq, cand)) return;
 
-	int index = (seq*cand*499);
-	if (index < 0) { index *= -1; }
-	index = index % CAND_TABLE_BUCKETS;
+	int cand1 = MIN(seq, cand);
+	int cand2 = MAX(seq, cand);
+	UINT64_T key = cand_key_of(cand1, cand2, dir);
+	unsigned slot = slot_hash(key, p->cand_slots.size);
 
-	cand_list_element * cle = candidates[index];
-	// There are no candidate pairs in this bucket
-	if (!cle)
+	// If we already have this candidate pair, just leave
+	// because we've already printed it out.
+	while (p->cand_slots.slots[slot] >= 0)
 	{
-		candidates[index] = create_new_cle(seq, cand, dir, loc1, loc2);
-
-		total_cand++;
-		return;
+		cand_list_element * cle = &p->candidates[p->cand_slots.slots[slot]];
+		if ((cle->cand1 == cand1) && (cle->cand2 == cand2) && (cle->dir == dir)) return;
+		slot = (slot + 1) & (p->cand_slots.size - 1);
 	}
 
-	// This bucket has candidate pairs, if ours is one of them just leave
-	// because we've already printed it out.
-	while (cle)
+	// If we made it this far, we did not find this candidate pair, so add it.
+	slot_table_grow(&p->cand_slots, p, cand_key);
+	p->candidates = array_grow(p->candidates, &p->candidates_max, p->cand_slots.count + 1, sizeof(*p->candidates));
+
+	cand_list_element * new_cle = &p->candidates[p->cand_slots.count];
+	new_cle->cand1 = cand1;
+	new_cle->cand2 = cand2;
+	new_cle->dir = dir;
+	if (seq < cand)
 	{
-		if ((cle->cand1 == seq) && (cle->cand2 == cand) && (cle->dir == dir))
-		{
-			cle->count++;
-			return;
-		}
-		else if ((cle->cand2 == seq) && (cle->cand1 == cand) && (cle->dir == dir))
-		{
-			cle->count++;
-			return;
-		}
-		cle = cle->next;
+		new_cle->loc1 = loc1;
+		new_cle->loc2 = loc2;
 	}
+	else
+	{
+		new_cle->loc2 = loc1;
+		new_cle->loc1 = loc2;
+	}
+	p->cand_slots.slots[slot_table_free_slot(&p->cand_slots, key)] = p->cand_slots.count++;
 
-	// If we made it this far, we did not find this candidate pair, so add it.
-	cand_list_element * new_cle = create_new_cle(seq, cand, dir, loc1, loc2);
-	new_cle->next = candidates[index];
-	candidates[index] = new_cle;
-	total_cand++;
 	return;
 
 }
 
-void free_cand_table()
+void free_cand_table(struct sequence_filter *f)
 {
 	int i;
 
-	for (i = 0; i < CAND_TABLE_BUCKETS; i++)
+	for (i = 0; i < f->threads; i++)
 	{
-		free_cand_list_element(candidates[i]);
-		candidates[i] = 0;
+		slot_table_clear(&f->parts[i].cand_slots);
 	}
 }
-
-void free_cand_list_element(cand_list_element * cle)
-{
-	if (!cle) return;
-
-	cand_list_element * n = cle->next;
-	free(cle);
-	free_cand_list_element(n);
-}
-
@@ -38,29 +38,33 @@ struct minimizer_s
 };
 typedef struct minimizer_s minimizer;
 
-void load_mer_table();
-void load_mer_table_subset(int start_x, int end_x, int start_y, int end_y, int is_same_rect);
-void generate_candidates();
-candidate_t * retrieve_candidates(int * total_cand);
-int output_candidate_list(FILE * file, candidate_t * list, int total_output );
-void free_mer_table();
-void free_cand_table();
-void init_cand_table( int buckets );
-void init_mer_table(int buckets );
-int init_repeat_mer_table(FILE * repeats, unsigned long buckets, int max_mer_repeat);
-int load_seqs(FILE * input );
-int load_seqs_two_files(FILE * f1, int * end1, FILE * f2, int * end2);
-void rearrange_seqs_for_dist_framework();
-void test_mers();
-void print_mer_table(FILE * file);
-void set_k(int new_k);
-void set_window_size(int new_size);
-int get_next_minimizer(int seq_num, minimizer * next_minimizer);
-void print_kmer(FILE * file, mer_t mer);
+/*
+A sequence_filter holds a body of sequences, and finds the candidate
+pairs among them, one rectangle of sequences at a time.  Each rectangle
+is divided among the given number of threads, and the candidates are
+the same for any number of threads.
+*/
+
+struct sequence_filter;
+
+struct sequence_filter * sequence_filter_create( int k, int window_size, int threads );
+void sequence_filter_delete( struct sequence_filter *f );
+
+void load_mer_table_subset(struct sequence_filter *f, int start_x, int end_x, int start_y, int end_y, int is_same_rect);
+void generate_candidates(struct sequence_filter *f);
+candidate_t * retrieve_candidates(struct sequence_filter *f, int * total_cand);
+int output_candidate_list(struct sequence_filter *f, FILE * file, candidate_t * list, int total_output );
+void free_mer_table(struct sequence_filter *f);
+void free_cand_table(struct sequence_filter *f);
+void init_cand_table(struct sequence_filter *f, int buckets );
+void init_mer_table(struct sequence_filter *f, int buckets );
+int init_repeat_mer_table(struct sequence_filter *f, FILE * repeats, unsigned long buckets, int max_mer_repeat);
+int load_seqs(struct sequence_filter *f, FILE * input );
+int load_seqs_two_files(struct sequence_filter *f, FILE * f1, int * end1, FILE * f2, int * end2);
+void print_mer_table(struct sequence_filter *f, FILE * file);
 void translate_kmer(mer_t mer, char * str, int length);
 
 extern int rectangle_size;
 extern int curr_rect_x;
 extern int curr_rect_y;
-extern unsigned long total_cand;
 
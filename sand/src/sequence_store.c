@@ -0,0 +1,342 @@
+/*
+Copyright (C) 2013- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "sequence_store.h"
+
+#include "debug.h"
+#include "full_io.h"
+#include "macros.h"
+
+#define SEQUENCE_STORE_MAGIC "SANDIDX1"
+
+/*
+The index file is this header, then count+1 offsets of the sequences
+in the cfa file, the last being the end of the last sequence, and then
+a table of slots for the names, each the number of a sequence or -1,
+probed linearly from the hash of the name.  The size and modification
+time of the cfa file tell whether the index still describes it.
+*/
+
+struct sequence_store_header {
+	char magic[8];
+	UINT64_T file_size;
+	UINT64_T file_mtime;
+	UINT64_T count;
+	UINT64_T slots;
+};
+
+struct sequence_store {
+	char *filename;
+	int fd;
+	char *data;
+	size_t size;
+
+	void *index;
+	size_t index_size;
+	int index_mapped;
+
+	int count;
+	UINT64_T slots;
+	UINT64_T *offsets;
+	INT32_T *names;
+};
+
+static unsigned name_hash( const char *name, int length )
+{
+	unsigned h = 2166136261u;
+	int i;
+	for(i=0;i<length;i++) h = (h ^ (unsigned char) name[i]) * 16777619u;
+	return h;
+}
+
+// The name of a sequence runs from after the '>' up to the first space.
+static const char * sequence_name( struct sequence_store *s, int i, int *length )
+{
+	const char *name = s->data + s->offsets[i] + 1;
+	const char *end = s->data + s->offsets[i+1];
+	const char *p = name;
+
+	while(p<end && *p!=' ' && *p!='\n') p++;
+
+	*length = p - name;
+	return name;
+}
+
+/*
+Copy the header line of the sequence at offset into line,
+and return the offset just after it.
+*/
+
+static size_t header_line( struct sequence_store *s, size_t offset, char *line )
+{
+	size_t end = offset;
+
+	while(end<s->size && s->data[end]!='\n') {
+		end++;
+		if(end-offset >= SEQUENCE_FILE_LINE_MAX) fatal("sequence file %s is corrupted: header too long at byte %llu",s->filename,(unsigned long long)offset);
+	}
+
+	memcpy(line,&s->data[offset],end-offset);
+	line[end-offset] = 0;
+
+	return end + 1;
+}
+
+static int index_allocate( struct sequence_store *s, UINT64_T count, UINT64_T slots )
+{
+	s->index_size = sizeof(struct sequence_store_header) + (count+1)*sizeof(UINT64_T) + slots*sizeof(INT32_T);
+	s->index = malloc(s->index_size);
+	if(!s->index) return 0;
+
+	struct sequence_store_header *h = s->index;
+	memset(h,0,sizeof(*h));
+	memcpy(h->magic,SEQUENCE_STORE_MAGIC,sizeof(h->magic));
+	h->count = count;
+	h->slots = slots;
+
+	s->offsets = (UINT64_T *) (h+1);
+	s->names = (INT32_T *) (s->offsets+count+1);
+	s->count = count;
+	s->slots = slots;
+
+	return 1;
+}
+
+/*
+Build the index by reading the header of every sequence.  A list
+separator (>>) ends the sequences, as it does for cseq_read.
+*/
+
+static int index_build( struct sequence_store *s )
+{
+	char line[SEQUENCE_FILE_LINE_MAX];
+	char name[SEQUENCE_FILE_LINE_MAX];
+	size_t offset = 0;
+	UINT64_T count = 0;
+	UINT64_T i, slots;
+	int nbases, nbytes;
+
+	while(offset<s->size && !(s->data[offset]=='>' && offset+1<s->size && s->data[offset+1]=='>')) {
+		size_t data_offset = header_line(s,offset,line);
+		if(sscanf(line,">%s %d %d",name,&nbases,&nbytes)!=3) fatal("syntax error near %s\n",line);
+		offset = data_offset + nbytes + 1;
+		if(offset>s->size+1) fatal("sequence file %s is corrupted.",s->filename);
+		count++;
+	}
+
+	slots = 1;
+	while(slots < 2*count) slots *= 2;
+
+	if(!index_allocate(s,count,slots)) return 0;
+
+	offset = 0;
+	for(i=0;i<count;i++) {
+		size_t data_offset = header_line(s,offset,line);
+		sscanf(line,">%s %d %d",name,&nbases,&nbytes);
+		s->offsets[i] = offset;
+		offset = data_offset + nbytes + 1;
+	}
+	s->offsets[count] = MIN(offset,s->size);
+
+	memset(s->names,-1,slots*sizeof(INT32_T));
+
+	// When names repeat, the first sequence of that name is the one found.
+	for(i=0;i<count;i++) {
+		int length;
+		const char *name = sequence_name(s,i,&length);
+		UINT64_T slot = name_hash(name,length) & (slots-1);
+		while(s->names[slot]>=0) {
+			int other_length;
+			const char *other = sequence_name(s,s->names[slot],&other_length);
+			if(other_length==length && !memcmp(other,name,length)) break;
+			slot = (slot+1) & (slots-1);
+		}
+		if(s->names[slot]<0) s->names[slot] = i;
+	}
+
+	return 1;
+}
+
+static void index_save( struct sequence_store *s, const char *indexname, struct stat *info )
+{
+	char tmpname[strlen(indexname)+32];
+	struct sequence_store_header *h = s->index;
+
+	h->file_size = info->st_size;
+	h->file_mtime = info->st_mtime;
+
+	sprintf(tmpname,"%s.%d",indexname,(int)getpid());
+
+	int fd = open(tmpname,O_WRONLY|O_CREAT|O_TRUNC,0666);
+	if(fd<0) {
+		debug(D_DEBUG,"couldn't create %s, keeping the index in memory: %s",tmpname,strerror(errno));
+		return;
+	}
+
+	int result = full_write(fd,s->index,s->index_size);
+	close(fd);
+
+	if(result!=(int)s->index_size || rename(tmpname,indexname)!=0) {
+		debug(D_DEBUG,"couldn't write %s, keeping the index in memory: %s",indexname,strerror(errno));
+		unlink(tmpname);
+	}
+}
+
+static int index_load( struct sequence_store *s, const char *indexname, struct stat *info )
+{
+	struct stat index_info;
+
+	int fd = open(indexname,O_RDONLY);
+	if(fd<0) return 0;
+
+	if(fstat(fd,&index_info)<0 || index_info.st_size<(off_t)sizeof(struct sequence_store_header)) {
+		close(fd);
+		return 0;
+	}
+
+	void *index = mmap(0,index_info.st_size,PROT_READ,MAP_SHARED,fd,0);
+	close(fd);
+	if(index==MAP_FAILED) return 0;
+
+	struct sequence_store_header *h = index;
+	size_t expected = sizeof(*h) + (h->count+1)*sizeof(UINT64_T) + h->slots*sizeof(INT32_T);
+
+	if(memcmp(h->magic,SEQUENCE_STORE_MAGIC,sizeof(h->magic)) || h->file_size!=(UINT64_T)info->st_size || h->file_mtime!=(UINT64_T)info->st_mtime || (size_t)index_info.st_size!=expected) {
+		debug(D_DEBUG,"%s does not describe the current %s, rebuilding it",indexname,s->filename);
+		munmap(index,index_info.st_size);
+		return 0;
+	}
+
+	s->index = index;
+	s->index_size = index_info.st_size;
+	s->index_mapped = 1;
+	s->count = h->count;
+	s->slots = h->slots;
+	s->offsets = (UINT64_T *) (h+1);
+	s->names = (INT32_T *) (s->offsets+s->count+1);
+
+	return 1;
+}
+
+struct sequence_store * sequence_store_open( const char *filename )
+{
+	struct stat info;
+	char indexname[strlen(filename)+8];
+
+	struct sequence_store *s = calloc(1,sizeof(*s));
+	if(!s) return 0;
+
+	s->filename = strdup(filename);
+	s->fd = open(filename,O_RDONLY);
+	if(s->fd<0 || fstat(s->fd,&info)<0) {
+		sequence_store_close(s);
+		return 0;
+	}
+
+	s->size = info.st_size;
+	if(s->size>0) {
+		s->data = mmap(0,s->size,PROT_READ,MAP_SHARED,s->fd,0);
+		if(s->data==MAP_FAILED) {
+			s->data = 0;
+			sequence_store_close(s);
+			return 0;
+		}
+	}
+
+	sprintf(indexname,"%s.index",filename);
+
+	if(!index_load(s,indexname,&info)) {
+		if(!index_build(s)) {
+			sequence_store_close(s);
+			return 0;
+		}
+		index_save(s,indexname,&info);
+	}
+
+	debug(D_DEBUG,"%s has %d sequences",filename,s->count);
+
+	return s;
+}
+
+void sequence_store_close( struct sequence_store *s )
+{
+	if(!s) return;
+
+	if(s->index) {
+		if(s->index_mapped) {
+			munmap(s->index,s->index_size);
+		} else {
+			free(s->index);
+		}
+	}
+	if(s->data) munmap(s->data,s->size);
+	if(s->fd>=0) close(s->fd);
+	free(s->filename);
+	free(s);
+}
+
+int sequence_store_count( struct sequence_store *s )
+{
+	return s->count;
+}
+
+INT64_T sequence_store_offset( struct sequence_store *s, int i )
+{
+	return s->offsets[i];
+}
+
+int sequence_store_lookup( struct sequence_store *s, const char *name )
+{
+	int length = strlen(name);
+
+	if(s->count==0) return -1;
+
+	UINT64_T slot = name_hash(name,length) & (s->slots-1);
+
+	while(s->names[slot]>=0) {
+		int other_length;
+		const char *other = sequence_name(s,s->names[slot],&other_length);
+		if(other_length==length && !memcmp(other,name,length)) return s->names[slot];
+		slot = (slot+1) & (s->slots-1);
+	}
+
+	return -1;
+}
+
+struct cseq * sequence_store_read( struct sequence_store *s, int i )
+{
+	char line[SEQUENCE_FILE_LINE_MAX];
+	char metadata[SEQUENCE_FILE_LINE_MAX];
+	char name[SEQUENCE_FILE_LINE_MAX];
+	int nbases, nbytes;
+
+	size_t data_offset = header_line(s,s->offsets[i],line);
+
+	metadata[0] = 0;
+	if(sscanf(line,">%s %d %d %[^\n]",name,&nbases,&nbytes,metadata)<3) fatal("syntax error near %s\n",line);
+
+	// Round up to whole shorts, as cseq_read does.
+	int malloc_bytes = (nbases+3)/4;
+	malloc_bytes += malloc_bytes % sizeof(short);
+
+	short *data = calloc(malloc_bytes,1);
+	memcpy(data,&s->data[data_offset],MIN(nbytes,malloc_bytes));
+
+	struct cseq *c = cseq_create(name,nbases,data,metadata);
+
+	free(data);
+
+	return c;
+}
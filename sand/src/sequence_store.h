@@ -0,0 +1,33 @@
+/*
+Copyright (C) 2013- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#ifndef SEQUENCE_STORE_H
+#define SEQUENCE_STORE_H
+
+#include "int_sizes.h"
+#include "compressed_sequence.h"
+
+/*
+A sequence store gives access to the sequences of a compressed (cfa) file
+without reading them into memory.  The file is mapped, and is described
+by an index kept beside it, in filename.index: the byte offset of every
+sequence, and a hash table of their names.  The index is built the first
+time that a file is opened, and afterwards opening the file only maps the
+index.  If the index cannot be written, it is kept in memory instead.
+
+Because the sequences are stored one after another, sequences first
+through last-1 are the bytes from sequence_store_offset(s,first) up to
+sequence_store_offset(s,last), which may be sent as a piece of the file.
+*/
+
+struct sequence_store * sequence_store_open( const char *filename );
+void                    sequence_store_close( struct sequence_store *s );
+int                     sequence_store_count( struct sequence_store *s );
+INT64_T                 sequence_store_offset( struct sequence_store *s, int i );
+int                     sequence_store_lookup( struct sequence_store *s, const char *name );
+struct cseq *           sequence_store_read( struct sequence_store *s, int i );
+
+#endif
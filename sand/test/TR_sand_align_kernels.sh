@@ -0,0 +1,21 @@
+#!/bin/sh
+
+. ../../dttools/src/test_runner.common.sh
+
+prepare()
+{
+    cd ../src/; make
+    exit 0
+}
+
+run()
+{
+    cd ../src; exec ./sand_align_test
+}
+
+clean()
+{
+    exit 0
+}
+
+dispatch $@
@@ -0,0 +1,46 @@
+#!/bin/sh
+
+. ../../dttools/src/test_runner.common.sh
+
+PATH=../src:$PATH
+
+prepare()
+{
+    cd ../src/; make
+    exit 0
+}
+
+# Align the first few sequences against all of those that follow them,
+# in the input format that sand_align_master gives to each task.
+
+run()
+{
+    : > threads.input
+    for first in 1 2 3 4 5
+    do
+        awk -v first=$first '/^>/ { n++; if(n>first) $0 = $0 " 1 0 0" } n>=first' test_20.fa > threads.fa
+        sand_compress_reads < threads.fa >> threads.input || exit 1
+        echo ">>" >> threads.input
+    done
+
+    for type in sw ps banded
+    do
+        sand_align_kernel -a $type threads.input > threads.1.ovl || exit 1
+        sand_align_kernel -a $type -t 4 threads.input > threads.4.ovl || exit 1
+        cmp threads.1.ovl threads.4.ovl || exit 1
+
+        sand_align_kernel -a $type -o align threads.input > threads.1.align || exit 1
+        sand_align_kernel -a $type -o align -t 3 threads.input > threads.3.align || exit 1
+        cmp threads.1.align threads.3.align || exit 1
+    done
+
+    exit 0
+}
+
+clean()
+{
+    rm -f threads.input threads.fa threads.1.ovl threads.4.ovl threads.1.align threads.3.align
+    exit 0
+}
+
+dispatch $@
@@ -0,0 +1,41 @@
+#!/bin/sh
+
+. ../../dttools/src/test_runner.common.sh
+
+PATH=../src:$PATH
+
+prepare()
+{
+    cd ../src/; make
+    exit 0
+}
+
+# Filter the sequences in several small rectangles, and between two
+# files, with one thread and with several.
+
+run()
+{
+    sand_compress_reads < test_20.fa > filter_threads.cfa || exit 1
+    awk '/^>/ { n++ } n<=8' test_20.fa | sand_compress_reads > filter_threads.1.cfa || exit 1
+    awk '/^>/ { n++ } n>8' test_20.fa | sand_compress_reads > filter_threads.2.cfa || exit 1
+
+    sand_filter_kernel -s 7 filter_threads.cfa > filter_threads.1.cand || exit 1
+    sand_filter_kernel -s 7 -t 4 filter_threads.cfa > filter_threads.4.cand || exit 1
+    test -s filter_threads.1.cand || exit 1
+    cmp filter_threads.1.cand filter_threads.4.cand || exit 1
+
+    sand_filter_kernel -s 5 filter_threads.1.cfa filter_threads.2.cfa > filter_threads.1.cand || exit 1
+    sand_filter_kernel -s 5 -t 3 filter_threads.1.cfa filter_threads.2.cfa > filter_threads.3.cand || exit 1
+    test -s filter_threads.1.cand || exit 1
+    cmp filter_threads.1.cand filter_threads.3.cand || exit 1
+
+    exit 0
+}
+
+clean()
+{
+    rm -f filter_threads.cfa filter_threads.1.cfa filter_threads.2.cfa filter_threads.1.cand filter_threads.3.cand filter_threads.4.cand
+    exit 0
+}
+
+dispatch $@
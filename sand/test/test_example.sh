@@ -8,7 +8,7 @@ export PATH
 error_state=0;
 
 echo "Cleaning up old data"
-rm -f test_20.cfa test_20.cand test_20.sw.ovl test_20.banded.ovl
+rm -f test_20.cfa test_20.cfa.index test_20.cand test_20.sw.ovl test_20.banded.ovl
 
 echo "Compressing reads"
 sand_compress_reads < test_20.fa > test_20.cfa
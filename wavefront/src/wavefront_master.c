@@ -14,19 +14,34 @@ See the file COPYING for details.
 #include <string.h>
 #include <time.h>
 #include <signal.h>
+#include <fcntl.h>
+#include <sys/wait.h>
 
 #include "cctools.h"
 #include "debug.h"
 #include "work_queue.h"
 #include "xxmalloc.h"
 #include "text_array.h"
+#include "bitmap.h"
+#include "buffer.h"
+#include "copy_stream.h"
+#include "envtools.h"
+#include "full_io.h"
+#include "stringtools.h"
+#include "timestamp.h"
 #include "macros.h"
 #include "getopt_aux.h"
 
 #define WAVEFRONT_LINE_MAX 1024
 
+#define WAVEFRONT_TASK_STATE_COMPLETE   MAKE_RGBA(0,0,255,0)
+#define WAVEFRONT_TASK_STATE_READY      MAKE_RGBA(255,255,0,0)
+#define WAVEFRONT_TASK_STATE_NOTREADY   MAKE_RGBA(255,0,0,0)
+
 static const char *function = 0;
+static char tile_program[WAVEFRONT_LINE_MAX];
 static struct text_array *array = 0;
+static struct bitmap *state = 0;
 static struct work_queue *queue = 0;
 static int xsize = 0;
 static int ysize = 0;
@@ -37,62 +52,351 @@ static const char *outfile;
 static FILE *logfile;
 static int cells_total = 0;
 static int cells_complete = 0;
+static int cells_recovered = 0;
 static int tasks_done = 0;
 static double sequential_run_time = 7.75;
 static time_t start_time = 0;
 static time_t last_display_time = 0;
 
+static int block_size = 1;
+static int manual_block_size = 0;
+static time_t last_block_time = 0;
+static timestamp_t total_dispatch_time = 0;
+static timestamp_t total_execute_time = 0;
+static int total_cells_executed = 0;
+
 static const time_t long_wait = 60;
 static const time_t short_wait = 5; 
 
-static int task_consider( int x, int y )
+/*
+Each task computes a tile of up to block_size by block_size cells,
+by running wavefront_master -W on the worker.  It is given only the
+row of values below the tile and the column of values to its left,
+and returns the values of all of the cells of the tile.  Tiles are
+formed as in wavefront: a tile starts at a cell whose left and bottom
+neighbors are complete, and extends as far as those are complete.
+*/
+
+static void task_consider( int x, int y )
 {
 	char command[WAVEFRONT_LINE_MAX];
 	char tag[WAVEFRONT_LINE_MAX];
-	
+	int i, j;
+
 	struct work_queue_task* t;
 
-	if(x>=xsize) return 1;
-	if(y>=ysize) return 1;
+	if(x>=xsize) return;
+	if(y>=ysize) return;
+
+	if(bitmap_get(state,x,y)!=WAVEFRONT_TASK_STATE_NOTREADY) return;
 
-	if(text_array_get(array,x,y)) return 0;
+	for(i=0;i<block_size && x+i<xsize;i++) {
+		if(bitmap_get(state,x+i,y-1)!=WAVEFRONT_TASK_STATE_COMPLETE) break;
+		if(bitmap_get(state,x+i,y)!=WAVEFRONT_TASK_STATE_NOTREADY) break;
+	}
 
-	const char *left   = text_array_get(array,x-1,y);
-	const char *bottom = text_array_get(array,x,y-1);
-	const char *diag   = text_array_get(array,x-1,y-1);
+	for(j=0;j<block_size && y+j<ysize;j++) {
+		if(bitmap_get(state,x-1,y+j)!=WAVEFRONT_TASK_STATE_COMPLETE) break;
+		if(bitmap_get(state,x,y+j)!=WAVEFRONT_TASK_STATE_NOTREADY) break;
+	}
 
-	if(!left || !bottom || !diag) return 1;
+	if(i==0 || j==0) return;
+
+	/* the boundary, numbered from the cell diagonal to the tile */
+	buffer_t *boundary = buffer_create();
+	int a, b;
+	for(a=0;a<=i;a++) {
+		buffer_printf(boundary,"%d %d %s\n",a,0,text_array_get(array,x+a-1,y-1));
+	}
+	for(b=1;b<=j;b++) {
+		buffer_printf(boundary,"%d %d %s\n",0,b,text_array_get(array,x-1,y+b-1));
+	}
+
+	size_t length;
+	const char *data = buffer_tostring(boundary,&length);
+
+	sprintf(command,"./%s -W %s %d %d %d %d boundary",string_basename(tile_program),function,x,y,i,j);
+	sprintf(tag,"%d %d %d %d",x,y,i,j);
 
-	sprintf(command,"./%s %d %d xfile yfile dfile",function,x,y);
-	sprintf(tag,"%d %d",x,y);
-	
 	t = work_queue_task_create(command);
 	work_queue_task_specify_tag(t,tag);
+	work_queue_task_specify_file(t, tile_program, string_basename(tile_program), WORK_QUEUE_INPUT, WORK_QUEUE_CACHE);
 	work_queue_task_specify_input_file(t, function, function);
-	work_queue_task_specify_input_buf(t, left, strlen(left), "xfile");
-	work_queue_task_specify_input_buf(t, bottom, strlen(bottom), "yfile");
-	work_queue_task_specify_input_buf(t, diag, strlen(diag), "dfile");
+	work_queue_task_specify_input_buf(t, data, length, "boundary");
 	work_queue_submit(queue,t);
 
-	return 1;
+	buffer_delete(boundary);
+
+	for(a=0;a<i;a++) {
+		for(b=0;b<j;b++) {
+			bitmap_set(state,x+a,y+b,WAVEFRONT_TASK_STATE_READY);
+		}
+	}
 }
 
-static void task_complete( int x, int y )
+/*
+Record the values of a completed tile, and then consider the cells
+just to its right and just above it, which may now be ready.  The time
+spent in the function is measured apart from the rest of the task, which
+counts as the time to dispatch the task.
+*/
+
+static void task_complete( struct work_queue_task *t, int x, int y, int width, int height )
 {
-	cells_complete++;
-	task_consider(x+1,y);
-	task_consider(x,y+1);
+	char *output = t->output ? t->output : "";
+	char *line;
+	int i, j, n;
+	unsigned long long execute_time = t->cmd_execution_time;
+
+	while((line = strsep(&output,"\n"))) {
+		if(sscanf(line,"# %llu",&execute_time)==1) continue;
+		if(sscanf(line,"%d %d %n",&i,&j,&n)<2) continue;
+		if(!text_array_get(array,i,j)) cells_complete++;
+		text_array_set(array,i,j,line+n);
+		fprintf(logfile,"%d %d %s\n",i,j,line+n);
+	}
+	fflush(logfile);
+
+	for(i=0;i<width;i++) {
+		for(j=0;j<height;j++) {
+			bitmap_set(state,x+i,y+j,WAVEFRONT_TASK_STATE_COMPLETE);
+		}
+	}
+
+	total_dispatch_time += (t->time_receive_output_finish - t->time_send_input_start) - MIN(execute_time,t->cmd_execution_time);
+	total_execute_time += execute_time;
+	total_cells_executed += width*height;
+
+	for(j=0;j<height;j++) task_consider(x+width,y+j);
+	for(i=0;i<width;i++) task_consider(x+i,y+height);
 }
 
 static void task_prime()
 {
 	int i,j;
+
 	for(j=0;j<ysize;j++) {
 		for(i=0;i<xsize;i++) {
-			if(task_consider(i,j)) break;
-			if(i!=0 && j!=0) cells_complete++;
+			if(text_array_get(array,i,j)) {
+				bitmap_set(state,i,j,WAVEFRONT_TASK_STATE_COMPLETE);
+				if(i!=0 && j!=0) cells_complete++;
+			} else {
+				bitmap_set(state,i,j,WAVEFRONT_TASK_STATE_NOTREADY);
+			}
 		}
 	}
+
+	for(j=1;j<ysize;j++) {
+		for(i=1;i<xsize;i++) {
+			task_consider(i,j);
+		}
+	}
+}
+
+static double wavefront_multicore_model( int size, int cpus, double tasktime )
+{
+	int slices = 2*size-1;
+
+	double runtime=0;
+	int slicesize = 0;
+	int i;
+
+	for(i=0;i<slices;i++) {
+
+		if(i<size) {
+			slicesize = i+1;
+		} else {
+			slicesize = 2*size-i-1;
+		}
+
+		runtime += tasktime * ((slicesize+cpus-1)/cpus);
+	}
+
+	return runtime;
+}
+
+static double wavefront_distributed_model( int size, int nodes, double tasktime, int blocksize, double dispatchtime )
+{
+	double blocktime = tasktime*blocksize*blocksize;
+	double runtime = wavefront_multicore_model((size+blocksize-1)/blocksize,nodes,blocktime+dispatchtime);
+	debug(D_DEBUG,"model: runtime=%.04lf for size=%d nodes=%d tasktime=%.04lf blocksize=%d dispatchtime=%.04lf",runtime,size,nodes,tasktime,blocksize,dispatchtime);
+	return runtime;
+}
+
+static int find_best_block_size( int size, int nodes, double task_time, double dispatch_time )
+{
+	double t=0;
+	double besttime=0;
+	int b, best=1;
+
+	for(b=1;b<=MAX(size/4,1);b++) {
+		t = wavefront_distributed_model(size,nodes,task_time,b,dispatch_time);
+		if(b==1 || t<besttime) {
+			best = b;
+			besttime = t;
+		}
+	}
+
+	return best;
+}
+
+/*
+Once a second, choose the block size that the model predicts to be
+fastest for the time per cell and the dispatch time per task measured
+so far, and the number of slots of the workers now connected.
+*/
+
+static void block_size_update()
+{
+	struct work_queue_stats info;
+	time_t current = time(0);
+
+	if(manual_block_size || total_cells_executed==0 || current==last_block_time) return;
+	last_block_time = current;
+
+	work_queue_get_stats(queue,&info);
+
+	double task_time = total_execute_time / 1000000.0 / total_cells_executed;
+	double dispatch_time = total_dispatch_time / 1000000.0 / tasks_done;
+	int size = MAX(xsize,ysize)-1;
+	int nodes = MAX(info.total_worker_slots,1);
+
+	int b = find_best_block_size(size,nodes,task_time,dispatch_time);
+	if(b!=block_size) {
+		debug(D_DEBUG,"block size is now %d for %.04lfs per cell, %.04lfs per task, on %d slots",b,task_time,dispatch_time,nodes);
+		block_size = b;
+	}
+}
+
+/*
+On the worker, compute the tile of width by height cells whose lower
+left cell is x,y, given the values around it in the file boundary,
+and print the value of each cell, and then the microseconds spent
+running the function.  The value of a cell is the output of the
+function, without its trailing newline.
+*/
+
+static char * cell_run( const char *function, int x, int y )
+{
+	char xstr[16], ystr[16];
+	char *output;
+	int fds[2];
+	int status;
+
+	if(pipe(fds)<0) return 0;
+
+	sprintf(xstr,"%d",x);
+	sprintf(ystr,"%d",y);
+
+	pid_t pid = fork();
+	if(pid==0) {
+		close(fds[0]);
+		dup2(fds[1],1);
+		close(fds[1]);
+		execl(function,function,xstr,ystr,"xfile","yfile","dfile",(char*)0);
+		_exit(127);
+	} else if(pid<0) {
+		close(fds[0]);
+		close(fds[1]);
+		return 0;
+	}
+
+	close(fds[1]);
+	FILE *stream = fdopen(fds[0],"r");
+	int length = copy_stream_to_buffer(stream,&output);
+	fclose(stream);
+
+	waitpid(pid,&status,0);
+
+	if(length<0) return 0;
+
+	if(!WIFEXITED(status) || WEXITSTATUS(status)!=0) {
+		fprintf(stderr,"%s %d %d failed with status %d: %s\n",function,x,y,status,output);
+		free(output);
+		return 0;
+	}
+
+	string_chomp(output);
+	return output;
+}
+
+static int cell_input( const char *filename, const char *value )
+{
+	int fd = open(filename,O_WRONLY|O_CREAT|O_TRUNC,0666);
+	if(fd<0) return 0;
+	int result = full_write(fd,value,strlen(value));
+	close(fd);
+	return result==(int)strlen(value);
+}
+
+static int tile_run( const char *function, int x, int y, int width, int height, const char *boundary )
+{
+	char path[WAVEFRONT_LINE_MAX];
+	int i, j;
+
+	struct text_array *tile = text_array_create(width+1,height+1);
+	text_array_load(tile,boundary);
+
+	sprintf(path,"./%s",function);
+
+	timestamp_t start = timestamp_get();
+
+	for(j=1;j<=height;j++) {
+		for(i=1;i<=width;i++) {
+			const char *left = text_array_get(tile,i-1,j);
+			const char *bottom = text_array_get(tile,i,j-1);
+			const char *diag = text_array_get(tile,i-1,j-1);
+
+			if(!left || !bottom || !diag) {
+				fprintf(stderr,"%s does not hold the inputs of cell %d %d\n",boundary,x+i-1,y+j-1);
+				return 1;
+			}
+
+			if(!cell_input("xfile",left) || !cell_input("yfile",bottom) || !cell_input("dfile",diag)) {
+				fprintf(stderr,"couldn't write inputs of cell %d %d: %s\n",x+i-1,y+j-1,strerror(errno));
+				return 1;
+			}
+
+			char *value = cell_run(path,x+i-1,y+j-1);
+			if(!value) return 1;
+
+			text_array_set(tile,i,j,value);
+			printf("%d %d %s\n",x+i-1,y+j-1,value);
+			free(value);
+		}
+	}
+
+	printf("# %llu\n",(unsigned long long)(timestamp_get()-start));
+
+	text_array_delete(tile);
+
+	return 0;
+}
+
+/*
+A master that was stopped may have left the last line of the output
+incomplete.  Cut the file back to the end of its last complete line,
+so that the cell is computed again instead of recovered with a partial
+value, and the results appended do not run on from it.
+*/
+
+static int output_trim( const char *filename )
+{
+	char c;
+
+	int fd = open(filename,O_RDWR);
+	if(fd<0) return errno==ENOENT;
+
+	off_t length = lseek(fd,0,SEEK_END);
+	while(length>0) {
+		if(pread(fd,&c,1,length-1)!=1) break;
+		if(c=='\n') break;
+		length--;
+	}
+
+	int result = ftruncate(fd,length);
+	close(fd);
+	return result==0;
 }
 
 static void show_help(const char *cmd)
@@ -108,6 +412,8 @@ static void show_help(const char *cmd)
 	printf(" -v             Show version string\n");
 	printf(" -h             Show this help screen\n");
 	printf(" -Z <file>      Select port at random and write it to this file.\n");
+	printf(" -b <size>      Manually set the block size of each task. (default is automatic)\n");
+	printf(" -W             Compute one tile on a worker. (used by the tasks of the master)\n");
 
 }
 
@@ -117,7 +423,7 @@ static void display_progress( struct work_queue *q )
         time_t current = time(0);
         work_queue_get_stats(queue,&info);
         if(current==start_time) current++;
-        double speedup = (sequential_run_time*tasks_done)/(current-start_time);
+        double speedup = (sequential_run_time*(cells_complete-cells_recovered))/(current-start_time);
         printf("%2.02lf%% %6d %6ds %4d %4d %4d %4d %4d %4d %.02lf\n",100.0*cells_complete/cells_total,cells_complete,(int)(time(0)-start_time),info.workers_init,info.workers_ready,info.workers_busy,info.tasks_waiting,info.tasks_running,info.tasks_complete,speedup);
         last_display_time = current;
 }
@@ -128,12 +434,13 @@ int main( int argc, char *argv[] )
 	int work_queue_master_mode = WORK_QUEUE_MASTER_MODE_STANDALONE;
 	char *project = NULL;
 	int priority = 0;
+	int tile_mode = 0;
 
 	const char *progname = "wavefront";
 
 	debug_config(progname);
 
-	while((c=getopt(argc,argv,"ad:hN:p:P:o:v:Z:"))!=(char)-1) {
+	while((c=getopt(argc,argv,"ab:d:hN:p:P:o:v:WZ:"))!=(char)-1) {
 		switch(c) {
 	    	case 'a':
 				work_queue_master_mode = WORK_QUEUE_MASTER_MODE_CATALOG;
@@ -166,6 +473,12 @@ int main( int argc, char *argv[] )
 				port_file = optarg;
 				port = 0;
 				break;
+			case 'b':
+				manual_block_size = atoi(optarg);
+				break;
+			case 'W':
+				tile_mode = 1;
+				break;
 			default:
 				show_help(progname);
 				return 1;
@@ -174,6 +487,14 @@ int main( int argc, char *argv[] )
 
 	cctools_version_debug(D_DEBUG, argv[0]);
 
+	if(tile_mode) {
+		if( (argc-optind)!=6 ) {
+			show_help(progname);
+			exit(1);
+		}
+		return tile_run(argv[optind],atoi(argv[optind+1]),atoi(argv[optind+2]),atoi(argv[optind+3]),atoi(argv[optind+4]),argv[optind+5]);
+	}
+
 	if( (argc-optind)!=5 ) {
 		show_help(progname);
 		exit(1);
@@ -193,12 +514,25 @@ int main( int argc, char *argv[] )
 	xsize++;
 	ysize++;
 
+	if(!find_executable(argv[0],"PATH",tile_program,sizeof(tile_program))) {
+		fprintf(stderr,"%s: couldn't find the path of %s, which the tasks also run\n",progname,argv[0]);
+		return 1;
+	}
+
+	if(manual_block_size>0) block_size = manual_block_size;
+
 	array = text_array_create(xsize,ysize);
+	state = bitmap_create(xsize,ysize);
 	if(!text_array_load(array,infile)) {
 		fprintf(stderr,"couldn't load %s: %s",infile,strerror(errno));
 		return 1;
 	}
 
+	if(!output_trim(outfile)) {
+		fprintf(stderr,"couldn't trim %s: %s\n",outfile,strerror(errno));
+		return 1;
+	}
+
 	int count = text_array_load(array,outfile);
 	if(count>0) printf("recovered %d results from %s\n",count,outfile);
 	
@@ -236,6 +570,7 @@ int main( int argc, char *argv[] )
 	fprintf(stdout, "%s: listening for workers on port %d...\n",progname,work_queue_port(queue));
 
 	task_prime();
+	cells_recovered = cells_complete;
 
 	struct work_queue_task *t;
 
@@ -246,13 +581,11 @@ int main( int argc, char *argv[] )
 		if(!t) break;
 		
 		if(t->return_status==0) {
-			int x,y;
-			if(sscanf(t->tag,"%d %d",&x,&y)==2) {
-				text_array_set(array,x,y,t->output);
-				task_complete(x,y);
-				fprintf(logfile,"%d %d %s\n",x,y,t->output);
-				fflush(logfile);
+			int x,y,width,height;
+			if(sscanf(t->tag,"%d %d %d %d",&x,&y,&width,&height)==4) {
 				tasks_done++;
+				task_complete(t,x,y,width,height);
+				block_size_update();
 			} else {
 				fprintf(stderr,"unexpected output: %s\nfrom command: %s\non host: %s",t->output,t->command_line,t->host);
 			}
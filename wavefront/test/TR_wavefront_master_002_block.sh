@@ -0,0 +1,74 @@
+#!/bin/sh
+
+# Tiles of 3x3 cells, which do not divide the 9x9 cells computed.
+
+. ../../dttools/src/test_runner.common.sh
+
+TEST_INPUT=block.wmaster.input
+TEST_OUTPUT=block.wmaster.output
+TEST_TRUTH=block.wmaster.truth
+PORT_FILE=block.port
+PIDMASTER_FILE=block_master.pid
+PIDWORKER_FILE=block_worker.pid
+
+prepare()
+{
+	clean_files
+
+	awk 'BEGIN { for(i=0;i<10;i++) print i, 0, i "\n" 0, i, i }' > $TEST_INPUT
+	awk 'BEGIN {
+		for(i=0;i<10;i++) { v[i,0] = i; v[0,i] = i }
+		for(j=1;j<10;j++) for(i=1;i<10;i++) { v[i,j] = v[i-1,j] + v[i,j-1] + v[i-1,j-1]; print i, j, v[i,j] }
+	}' > $TEST_TRUTH
+
+	exit 0
+}
+
+run()
+{
+	answer=1854882
+
+	../src/wavefront_master -b 3 -Z $PORT_FILE ./sum_wfm.sh 10 10 $TEST_INPUT $TEST_OUTPUT > /dev/null &
+	master=$!
+	echo $master > $PIDMASTER_FILE
+
+	wait_for_file_creation $PORT_FILE 5
+
+	../../dttools/src/work_queue_worker -t 60 localhost `cat $PORT_FILE` &
+	echo $! > $PIDWORKER_FILE
+
+	( sleep 120; kill -9 $master ) &
+	watchdog=$!
+	wait $master
+	result=$?
+	kill $watchdog 2> /dev/null
+	[ $result -eq 0 ] || exit 1
+
+	value=`sed -n 's/^9 9 \([[:digit:]]*\)/\1/p' $TEST_OUTPUT`
+	[ "$value" = "$answer" ] || exit 1
+
+	sort -n -k2 -k1 $TEST_OUTPUT | diff $TEST_TRUTH -
+	exit $?
+}
+
+clean_files()
+{
+	rm -f $TEST_INPUT
+	rm -f $TEST_OUTPUT
+	rm -f $TEST_TRUTH
+	rm -f $PORT_FILE
+	rm -f $PIDMASTER_FILE
+	rm -f $PIDWORKER_FILE
+}
+
+clean()
+{
+	[ -f $PIDWORKER_FILE ] && kill -9 `cat $PIDWORKER_FILE` 2> /dev/null
+	[ -f $PIDMASTER_FILE ] && kill -9 `cat $PIDMASTER_FILE` 2> /dev/null
+
+	clean_files
+
+	exit 0
+}
+
+dispatch $@
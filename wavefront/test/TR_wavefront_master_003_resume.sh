@@ -0,0 +1,78 @@
+#!/bin/sh
+
+# Resume from the output of a master that was stopped in the middle of a line.
+
+. ../../dttools/src/test_runner.common.sh
+
+TEST_INPUT=resume.wmaster.input
+TEST_OUTPUT=resume.wmaster.output
+TEST_TRUTH=resume.wmaster.truth
+TEST_LOG=resume.wmaster.log
+PORT_FILE=resume.port
+PIDMASTER_FILE=resume_master.pid
+PIDWORKER_FILE=resume_worker.pid
+
+prepare()
+{
+	clean_files
+
+	awk 'BEGIN { for(i=0;i<10;i++) print i, 0, i "\n" 0, i, i }' > $TEST_INPUT
+	awk 'BEGIN {
+		for(i=0;i<10;i++) { v[i,0] = i; v[0,i] = i }
+		for(j=1;j<10;j++) for(i=1;i<10;i++) { v[i,j] = v[i-1,j] + v[i,j-1] + v[i-1,j-1]; print i, j, v[i,j] }
+	}' > $TEST_TRUTH
+
+	# 40 complete results, and the last digit of the next one missing.
+	head -40 $TEST_TRUTH > $TEST_OUTPUT
+	sed -n '41s/.$//p' $TEST_TRUTH | tr -d '\n' >> $TEST_OUTPUT
+
+	exit 0
+}
+
+run()
+{
+	../src/wavefront_master -b 2 -Z $PORT_FILE ./sum_wfm.sh 10 10 $TEST_INPUT $TEST_OUTPUT > $TEST_LOG &
+	master=$!
+	echo $master > $PIDMASTER_FILE
+
+	wait_for_file_creation $PORT_FILE 5
+
+	../../dttools/src/work_queue_worker -t 60 localhost `cat $PORT_FILE` &
+	echo $! > $PIDWORKER_FILE
+
+	( sleep 120; kill -9 $master ) &
+	watchdog=$!
+	wait $master
+	result=$?
+	kill $watchdog 2> /dev/null
+	[ $result -eq 0 ] || exit 1
+
+	grep -q "^recovered 40 results" $TEST_LOG || exit 1
+
+	# Each cell once, with the values of the full run.
+	sort -n -k2 -k1 $TEST_OUTPUT | diff $TEST_TRUTH -
+	exit $?
+}
+
+clean_files()
+{
+	rm -f $TEST_INPUT
+	rm -f $TEST_OUTPUT
+	rm -f $TEST_TRUTH
+	rm -f $TEST_LOG
+	rm -f $PORT_FILE
+	rm -f $PIDMASTER_FILE
+	rm -f $PIDWORKER_FILE
+}
+
+clean()
+{
+	[ -f $PIDWORKER_FILE ] && kill -9 `cat $PIDWORKER_FILE` 2> /dev/null
+	[ -f $PIDMASTER_FILE ] && kill -9 `cat $PIDMASTER_FILE` 2> /dev/null
+
+	clean_files
+
+	exit 0
+}
+
+dispatch $@